@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define ARENA_MMAP 1
+#endif
+
+#include "alloc.h"
+
+// size of the huge pages, the arenas mapped from them are rounded up to it
+#define HUGE_PAGE_LEN (2*1024*1024)
+
+typedef struct arena_struct {
+	char* next;
+	const char* end;
+	size_t mapped_len; // zero unless the arena was mapped rather than allocated
+} arena_s;
+
+static terab_alloc_t alloc_fn;
+static terab_free_t free_fn;
+static void* alloc_context;
+
+void client_set_allocator(terab_alloc_t alloc, terab_free_t free, void* context)
+{
+	alloc_fn = alloc;
+	free_fn = free;
+	alloc_context = context;
+}
+
+void* client_alloc(size_t len)
+{
+	if (alloc_fn == NULL)
+		return calloc(1, len);
+
+	void* ptr = alloc_fn(alloc_context, len);
+	if (ptr != NULL)
+		memset(ptr, 0, len);
+	return ptr;
+}
+
+void client_free(void* ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	if (free_fn == NULL)
+		free(ptr);
+	else
+		free_fn(alloc_context, ptr);
+}
+
+size_t arena_share(size_t len)
+{
+	return (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+#ifdef ARENA_MMAP
+/* Maps 'len' bytes, zeroed by the system, from huge pages if possible. */
+static char* map_huge_pages(size_t* len)
+{
+	size_t huge_len = (*len + HUGE_PAGE_LEN - 1) & ~(size_t)(HUGE_PAGE_LEN - 1);
+
+	void* block = mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (block == MAP_FAILED)
+	{
+		// no huge pages reserved, the transparent ones may still back the arena
+		block = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (block == MAP_FAILED)
+			return NULL;
+
+		madvise(block, huge_len, MADV_HUGEPAGE);
+	}
+
+	*len = huge_len;
+	return (char*)block;
+}
+#endif
+
+arena_s* arena_new(size_t capacity, int huge_pages)
+{
+	// the header comes first, and the block may be misaligned by the allocator
+	size_t len = arena_share(sizeof(arena_s)) + capacity + ARENA_ALIGN;
+	char* block = NULL;
+	size_t mapped_len = 0;
+
+#ifdef ARENA_MMAP
+	if (huge_pages)
+	{
+		mapped_len = len;
+		block = map_huge_pages(&mapped_len);
+		if (block == NULL)
+			return NULL;
+	}
+#else
+	(void)huge_pages;
+#endif
+
+	if (block == NULL)
+	{
+		block = (char*)client_alloc(len);
+		if (block == NULL)
+			return NULL;
+	}
+
+	arena_s* arena = (arena_s*)block;
+	arena->next = block + arena_share(sizeof(arena_s));
+	arena->end = block + (mapped_len != 0 ? mapped_len : len);
+	arena->mapped_len = mapped_len;
+	return arena;
+}
+
+void arena_free(arena_s* arena)
+{
+#ifdef ARENA_MMAP
+	if (arena->mapped_len != 0)
+	{
+		munmap(arena, arena->mapped_len);
+		return;
+	}
+#endif
+	client_free(arena);
+}
+
+void* arena_alloc(arena_s* arena, size_t len)
+{
+	char* aligned = (char*)(((uintptr_t)arena->next + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+	if (aligned > arena->end || (size_t)(arena->end - aligned) < len)
+		return NULL;
+
+	arena->next = aligned + len;
+	return aligned;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "terab.h"
+
+/* All the memory of the client library is obtained through 'client_alloc',
+   which forwards to the allocator set by 'terab_set_allocator()', or to
+   'malloc' and 'free' by default.
+
+   Connections hold their memory in an arena: a single block, obtained
+   when the connection is created and carved sequentially, which holds the
+   connection itself, its send and receive buffers and its caches. Nothing
+   is returned to the arena, the whole block being released with the
+   connection.
+*/
+
+// alignment of the allocations carved from an arena, a cache line
+#define ARENA_ALIGN 64
+
+void client_set_allocator(terab_alloc_t alloc, terab_free_t free, void* context);
+
+/* Returns 'len' zeroed bytes, NULL if the allocator fails. */
+void* client_alloc(size_t len);
+void client_free(void* ptr);
+
+typedef struct arena_struct arena_s;
+
+/* Bytes taken from an arena by an allocation of 'len' bytes. */
+size_t arena_share(size_t len);
+
+/* Creates an arena able to hold 'capacity' bytes of allocations, as
+   counted by 'arena_share'. With 'huge_pages', the arena is mapped from
+   huge pages where the system offers them (Linux only), and from regular
+   pages otherwise, bypassing the allocator in both cases. */
+arena_s* arena_new(size_t capacity, int huge_pages);
+void arena_free(arena_s* arena);
+
+/* Returns 'len' zeroed bytes aligned on ARENA_ALIGN, NULL if the arena
+   is exhausted. */
+void* arena_alloc(arena_s* arena, size_t len);
@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "block_overlay.h"
+
+#define OVERLAY_EMPTY 0
+#define OVERLAY_PRODUCED 1
+#define OVERLAY_REMOVED 2 // production undone, the slot stays in the probe chains
+
+// share of the capacity given to the table, the rest going to the scripts
+#define TABLE_SHARE 4
+
+typedef struct block_overlay_struct {
+	block_handle_t block;
+	block_overlay_entry_s* slots;
+	size_t slot_mask; // the number of slots, minus one
+	size_t slots_used; // removed slots included, as they lengthen the probes
+	uint8_t* scripts;
+	size_t scripts_len;
+	size_t scripts_used;
+} block_overlay_s;
+
+/* The largest power of two of slots which fits in the share of 'capacity'
+   given to the table, zero if too few. */
+static size_t slot_count_of(size_t capacity)
+{
+	size_t table_len = capacity / TABLE_SHARE;
+	if (table_len < 16 * sizeof(block_overlay_entry_s))
+		return 0;
+
+	size_t slot_count = 1;
+	while (slot_count * 2 * sizeof(block_overlay_entry_s) <= table_len)
+		slot_count *= 2;
+	return slot_count;
+}
+
+size_t block_overlay_arena_len(size_t capacity)
+{
+	size_t slots_len = slot_count_of(capacity) * sizeof(block_overlay_entry_s);
+	return arena_share(sizeof(block_overlay_s)) + arena_share(slots_len) + arena_share(capacity - slots_len);
+}
+
+block_overlay_s* block_overlay_new(arena_s* arena, size_t capacity)
+{
+	size_t slot_count = slot_count_of(capacity);
+	if (slot_count == 0)
+		return NULL;
+
+	block_overlay_s* overlay = (block_overlay_s*)arena_alloc(arena, sizeof(block_overlay_s));
+	if (overlay == NULL)
+		return NULL;
+
+	overlay->slots = (block_overlay_entry_s*)arena_alloc(arena, slot_count * sizeof(block_overlay_entry_s));
+	overlay->slot_mask = slot_count - 1;
+	overlay->scripts_len = capacity - slot_count * sizeof(block_overlay_entry_s);
+	overlay->scripts = (uint8_t*)arena_alloc(arena, overlay->scripts_len);
+
+	return overlay->slots != NULL && overlay->scripts != NULL ? overlay : NULL;
+}
+
+block_handle_t block_overlay_block(block_overlay_s* overlay)
+{
+	return overlay->block;
+}
+
+void block_overlay_reset(block_overlay_s* overlay, block_handle_t block)
+{
+	if (overlay->slots_used > 0)
+		memset(overlay->slots, 0, (overlay->slot_mask + 1) * sizeof(block_overlay_entry_s));
+
+	overlay->block = block;
+	overlay->slots_used = 0;
+	overlay->scripts_used = 0;
+}
+
+static size_t hash_of(const outpoint_t* outpoint)
+{
+	uint64_t hash;
+	memcpy(&hash, outpoint->txid, sizeof(hash));
+	hash ^= (uint64_t)(uint32_t)outpoint->index * 0x9E3779B97F4A7C15ull;
+	return (size_t)(hash ^ (hash >> 29));
+}
+
+/* Linear probing: returns the slot of 'outpoint', or the empty slot ending
+   its probe chain. */
+static block_overlay_entry_s* probe(block_overlay_s* overlay, const outpoint_t* outpoint)
+{
+	for (size_t i = hash_of(outpoint); ; i++)
+	{
+		block_overlay_entry_s* slot = overlay->slots + (i & overlay->slot_mask);
+		if (slot->state == OVERLAY_EMPTY || memcmp(&slot->outpoint, outpoint, sizeof(outpoint_t)) == 0)
+			return slot;
+	}
+}
+
+void block_overlay_record(block_overlay_s* overlay, const coin_t* coin, const uint8_t* script)
+{
+	block_overlay_entry_s* slot = probe(overlay, &coin->outpoint);
+
+	if (coin->production == 0)
+	{
+		// consumptions are left to the instance, see 'block_overlay.h'
+		if (slot->state != OVERLAY_PRODUCED)
+			return;
+
+		if (coin->consumption == 0)
+			slot->state = OVERLAY_REMOVED;
+		return;
+	}
+
+	// the payload of a coin never changes, rewriting it is idempotent
+	if (slot->state == OVERLAY_PRODUCED)
+		return;
+
+	// never full, the probes always end on an empty slot
+	int is_new = slot->state == OVERLAY_EMPTY;
+	if ((is_new && (overlay->slots_used + 1) * 4 > (overlay->slot_mask + 1) * 3)
+		|| (size_t)coin->script_length > overlay->scripts_len - overlay->scripts_used)
+		return;
+
+	slot->outpoint = coin->outpoint;
+	slot->satoshis = coin->satoshis;
+	slot->nLockTime = coin->nLockTime;
+	slot->flags = coin->flags;
+	slot->script_offset = (uint32_t)overlay->scripts_used;
+	slot->script_length = coin->script_length;
+	slot->state = OVERLAY_PRODUCED;
+
+	memcpy(overlay->scripts + overlay->scripts_used, script, coin->script_length);
+	overlay->scripts_used += coin->script_length;
+	if (is_new)
+		overlay->slots_used++;
+}
+
+const block_overlay_entry_s* block_overlay_find(block_overlay_s* overlay, const outpoint_t* outpoint)
+{
+	block_overlay_entry_s* slot = probe(overlay, outpoint);
+	return slot->state == OVERLAY_PRODUCED ? slot : NULL;
+}
+
+const uint8_t* block_overlay_script(block_overlay_s* overlay, const block_overlay_entry_s* entry)
+{
+	return overlay->scripts + entry->script_offset;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "terab.h"
+#include "alloc.h"
+
+/* Client-side record of the coins written to the block being connected, so
+   that reading them back does not cost a round trip.
+
+   During block connection, the outputs of a transaction are written, and
+   a moment later read again by the transactions spending them within the
+   same block. The overlay keeps the coins produced in the block, along
+   with their script; 'get_coins' against the block takes their payload
+   from here, and only asks the instance for their events. Other
+   connections may write to the same block, so whether a coin was
+   consumed is never answered locally. Coins produced in earlier blocks
+   are not recorded, their payload being unknown here.
+
+   Writes are recorded once the instance has acknowledged them. A single
+   block is tracked at a time, writing to another block starts over. When
+   the overlay is full, further coins are simply not recorded, and read
+   from the instance as usual. See the 'block_overlay' option.
+*/
+typedef struct block_overlay_struct block_overlay_s;
+
+typedef struct block_overlay_entry_struct
+{
+	outpoint_t outpoint;
+	uint64_t satoshis;
+	uint32_t nLockTime;
+	uint32_t script_offset; // within the script arena of the overlay
+	int32_t script_length;
+	uint8_t flags;
+	uint8_t state; // see 'OVERLAY_*' in 'block_overlay.c'
+} block_overlay_entry_s;
+
+/* Creates, within 'arena', an overlay holding at most 'capacity' bytes of
+   coins and scripts, released along with the arena. Returns NULL if
+   'capacity' is too small to be of any use, or if the arena is exhausted. */
+block_overlay_s* block_overlay_new(arena_s* arena, size_t capacity);
+
+/* Bytes of arena taken by an overlay of 'capacity' bytes. */
+size_t block_overlay_arena_len(size_t capacity);
+
+/* The block being tracked, zero if none. */
+block_handle_t block_overlay_block(block_overlay_s* overlay);
+
+/* Forgets all the coins, and tracks 'block' from now on. */
+void block_overlay_reset(block_overlay_s* overlay, block_handle_t block);
+
+/* Records an acknowledged write to the tracked block: 'coin' follows the
+   conventions of 'terab_utxo_set_coins()', 'script' being ignored unless
+   the coin is produced. */
+void block_overlay_record(block_overlay_s* overlay, const coin_t* coin, const uint8_t* script);
+
+/* Returns the coin of 'outpoint' if it was produced in the tracked block,
+   NULL otherwise. The entry remains valid until the next write recorded. */
+const block_overlay_entry_s* block_overlay_find(block_overlay_s* overlay, const outpoint_t* outpoint);
+const uint8_t* block_overlay_script(block_overlay_s* overlay, const block_overlay_entry_s* entry);
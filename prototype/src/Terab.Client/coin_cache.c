@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "coin_cache.h"
+
+// committed blocks remembered, the most recent ones being the most queried
+#define COMMITTED_MAX 64
+
+typedef struct coin_cache_struct {
+	coin_cache_entry_s* entries;
+	size_t set_mask; // the number of sets, minus one
+	block_handle_t committed[COMMITTED_MAX];
+	int32_t committed_next;
+} coin_cache_s;
+
+/* The largest power of two of sets which fits in 'capacity', zero if none. */
+static size_t set_count_of(size_t capacity)
+{
+	size_t set_len = COIN_CACHE_WAYS * sizeof(coin_cache_entry_s);
+	if (capacity < set_len)
+		return 0;
+
+	size_t set_count = 1;
+	while (set_count * 2 <= capacity / set_len)
+		set_count *= 2;
+	return set_count;
+}
+
+size_t coin_cache_arena_len(size_t capacity)
+{
+	return arena_share(sizeof(coin_cache_s))
+		+ arena_share(set_count_of(capacity) * COIN_CACHE_WAYS * sizeof(coin_cache_entry_s));
+}
+
+coin_cache_s* coin_cache_new(arena_s* arena, size_t capacity)
+{
+	size_t set_count = set_count_of(capacity);
+	if (set_count == 0)
+		return NULL;
+
+	coin_cache_s* cache = (coin_cache_s*)arena_alloc(arena, sizeof(coin_cache_s));
+	if (cache == NULL)
+		return NULL;
+
+	cache->entries = (coin_cache_entry_s*)arena_alloc(arena, set_count * COIN_CACHE_WAYS * sizeof(coin_cache_entry_s));
+	cache->set_mask = set_count - 1;
+
+	return cache->entries != NULL ? cache : NULL;
+}
+
+/* First entry of the set of 'outpoint'. Txids being hashes already, their
+   first bytes are spread well enough. */
+static coin_cache_entry_s* set_of(coin_cache_s* cache, const outpoint_t* outpoint)
+{
+	uint64_t hash;
+	memcpy(&hash, outpoint->txid, sizeof(hash));
+	hash ^= (uint64_t)(uint32_t)outpoint->index * 0x9E3779B97F4A7C15ull;
+	hash ^= hash >> 29;
+
+	return cache->entries + (hash & cache->set_mask) * COIN_CACHE_WAYS;
+}
+
+coin_cache_entry_s* coin_cache_find(coin_cache_s* cache, const outpoint_t* outpoint)
+{
+	coin_cache_entry_s* set = set_of(cache, outpoint);
+	for (int way = 0; way < COIN_CACHE_WAYS; way++)
+	{
+		coin_cache_entry_s* entry = set + way;
+		if (entry->in_use && memcmp(&entry->outpoint, outpoint, sizeof(outpoint_t)) == 0)
+		{
+			entry->referenced = 1;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/* Entry to overwrite within the set, the eviction follows the clock
+   algorithm: referenced entries get a second chance. */
+static coin_cache_entry_s* victim_of(coin_cache_entry_s* set)
+{
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int way = 0; way < COIN_CACHE_WAYS; way++)
+		{
+			coin_cache_entry_s* entry = set + way;
+			if (!entry->in_use || !entry->referenced)
+				return entry;
+
+			entry->referenced = 0;
+		}
+	}
+	return set; // not reached, the first pass cleared all the bits
+}
+
+/* Events read at an uncommitted block may change, they are not kept;
+   those of another committed block, if any, remain valid. */
+static void set_events(coin_cache_s* cache, coin_cache_entry_s* entry, const coin_t* coin, block_handle_t context)
+{
+	if (!coin_cache_is_committed(cache, context))
+		return;
+
+	entry->context = context;
+	entry->production = coin->production;
+	entry->consumption = coin->consumption;
+}
+
+void coin_cache_put(coin_cache_s* cache, const coin_t* coin, const char* script, block_handle_t context)
+{
+	if (coin->script_length < 0 || coin->script_length > COIN_CACHE_SCRIPT_MAX)
+		return;
+
+	coin_cache_entry_s* entry = coin_cache_find(cache, &coin->outpoint);
+	if (entry == NULL)
+	{
+		entry = victim_of(set_of(cache, &coin->outpoint));
+		entry->outpoint = coin->outpoint;
+		entry->context = 0;
+		entry->in_use = 1;
+		entry->referenced = 0;
+	}
+
+	entry->satoshis = coin->satoshis;
+	entry->nLockTime = coin->nLockTime;
+	entry->flags = coin->flags;
+	entry->script_length = (uint8_t)coin->script_length;
+	memcpy(entry->script, script, coin->script_length);
+
+	set_events(cache, entry, coin, context);
+}
+
+void coin_cache_put_events(coin_cache_s* cache, const coin_t* coin, block_handle_t context)
+{
+	coin_cache_entry_s* entry = coin_cache_find(cache, &coin->outpoint);
+	if (entry != NULL)
+		set_events(cache, entry, coin, context);
+}
+
+void coin_cache_commit(coin_cache_s* cache, block_handle_t block)
+{
+	if (block == 0 || coin_cache_is_committed(cache, block))
+		return;
+
+	cache->committed[cache->committed_next] = block;
+	cache->committed_next = (cache->committed_next + 1) % COMMITTED_MAX;
+}
+
+int coin_cache_is_committed(coin_cache_s* cache, block_handle_t block)
+{
+	if (block == 0)
+		return 0;
+
+	for (int i = 0; i < COMMITTED_MAX; i++)
+	{
+		if (cache->committed[i] == block)
+			return 1;
+	}
+	return 0;
+}
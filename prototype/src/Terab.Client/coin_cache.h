@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "terab.h"
+#include "alloc.h"
+
+/* Client-side cache of the immutable part of the coins, keyed by outpoint.
+
+   The satoshis, nLockTime and script of a coin never change once set (see
+   'terab_utxo_set_coins()'), hence a coin read once can be completed from
+   the cache: 'get_coins' then only asks the instance for its events. The
+   events themselves are cached along with the committed block they were
+   read at, since the state of the chain as seen from a committed block
+   never changes either; reading the coin again at that block is answered
+   without any round trip.
+
+   The cache is set-associative, with COIN_CACHE_WAYS entries per set, and
+   never grows beyond the capacity it is created with. Coins whose script
+   is longer than COIN_CACHE_SCRIPT_MAX are not cached, which leaves out
+   few coins besides the non-standard ones. Each connection has its own
+   cache, see the 'coin_cache' option.
+*/
+typedef struct coin_cache_struct coin_cache_s;
+
+#define COIN_CACHE_WAYS 4
+#define COIN_CACHE_SCRIPT_MAX 128
+
+typedef struct coin_cache_entry_struct
+{
+	outpoint_t outpoint;
+	uint64_t satoshis;
+	uint32_t nLockTime;
+	// events as read at the committed block 'context', which is zero when
+	// the events are unknown
+	block_handle_t context;
+	block_handle_t production;
+	block_handle_t consumption;
+	uint8_t flags;
+	uint8_t script_length;
+	uint8_t in_use;
+	uint8_t referenced; // cleared as the eviction passes by
+	uint8_t script[COIN_CACHE_SCRIPT_MAX];
+} coin_cache_entry_s;
+
+/* Creates, within 'arena', a cache holding at most 'capacity' bytes of
+   entries, released along with the arena. Returns NULL if 'capacity'
+   cannot even hold a single set, or if the arena is exhausted. */
+coin_cache_s* coin_cache_new(arena_s* arena, size_t capacity);
+
+/* Bytes of arena taken by a cache of 'capacity' bytes. */
+size_t coin_cache_arena_len(size_t capacity);
+
+/* Returns the entry of 'outpoint', or NULL if it is not cached. The entry
+   remains valid until the next call to 'coin_cache_put'. */
+coin_cache_entry_s* coin_cache_find(coin_cache_s* cache, const outpoint_t* outpoint);
+
+/* Caches the coin read at 'context', along with its script. */
+void coin_cache_put(coin_cache_s* cache, const coin_t* coin, const char* script, block_handle_t context);
+
+/* Refreshes the events of a cached coin, read at 'context'. */
+void coin_cache_put_events(coin_cache_s* cache, const coin_t* coin, block_handle_t context);
+
+/* Records that 'block' is committed, its events can then be cached. */
+void coin_cache_commit(coin_cache_s* cache, block_handle_t block);
+int coin_cache_is_committed(coin_cache_s* cache, block_handle_t block);
@@ -32,6 +32,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
@@ -42,6 +43,7 @@
 
 #ifndef _WIN32
 typedef unsigned int SOCKET;
+typedef sa_family_t ADDRESS_FAMILY;
 #define closesocket close
 #include "errno.h"
 #define WSAGetLastError() errno
@@ -57,6 +59,10 @@ typedef unsigned int SOCKET;
 #define SOCKET_ERROR -1
 #endif
 
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
 #ifdef _WIN32
 #ifndef S_IRUSR
 #define S_IRUSR 0400
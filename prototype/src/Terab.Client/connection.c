@@ -4,7 +4,62 @@
 
 #include "compat.h"
 
+#ifdef _WIN32
+#include <afunix.h>
+#else
+#include <sys/uio.h>
+#include <sys/un.h>
+#endif
+
 #include "connection.h"
+#include "alloc.h"
+#include "uring.h"
+#include "shmem.h"
+#include "stats.h"
+#include "trace.h"
+
+// maximal number of buffers sent by a single 'sendmsg'
+#define GATHER_MAX 64
+
+// external payloads shorter than this are copied into 'sendbuf' instead
+#define GATHER_MIN_LEN 128
+
+// default size of the receive buffer, see the 'recv_buffer' option
+#define RECV_BUFFER_DEFAULT (256*1024)
+#define RECV_BUFFER_MAX (64*1024*1024)
+
+// responses shorter than this are always decoded whole, see 'stream_received'
+#define STREAM_MIN_LEN (4*1024)
+
+// default capacity of each shared-memory ring, see the 'shm_ring' option
+#define SHM_RING_DEFAULT (1024*1024)
+#define SHM_RING_MAX (256*1024*1024)
+
+// bounds of the 'coin_cache' option
+#define COIN_CACHE_MIN (64*1024)
+#define COIN_CACHE_MAX (1024*1024*1024)
+
+// bounds of the 'block_overlay' option
+#define BLOCK_OVERLAY_MIN (64*1024)
+#define BLOCK_OVERLAY_MAX (1024*1024*1024)
+
+// size of the send buffer, where a whole message always fits behind a partial one
+#define SEND_BUFFER_LEN (2*MESSAGE_MAX_LEN)
+
+#ifdef _WIN32
+typedef WSABUF iovec_t;
+#define IOV_BASE(v) ((v).buf)
+#define IOV_LEN(v) ((v).len)
+#else
+typedef struct iovec iovec_t;
+#define IOV_BASE(v) ((v).iov_base)
+#define IOV_LEN(v) ((v).iov_len)
+#endif
+
+typedef struct {
+	uint32_t first_request_id;
+	int32_t request_count;
+} released_batch_s;
 
 typedef struct connection_struct {
  uint32_t msg_seq;
@@ -13,70 +68,179 @@ typedef struct connection_struct {
  char* sendbuf;
  char* sendptr;
  int in_batch;
+ // responses accumulate in 'recvbuf' as fast as the kernel delivers them;
+ // [recv_head, recv_tail) are the received bytes which are not parsed yet.
  char* recvbuf;
+ size_t recvbuf_len;
+ char* recv_head;
+ char* recv_tail;
+ // while 'stream_left' is not zero, the bytes at 'recv_head' belong to a
+ // response decoded as it arrives; 'stream' is NULL if they are skipped.
+ pending_batch_s* stream;
+ terab_ticket_t stream_ticket;
+ uint32_t stream_request_id;
+ size_t stream_left;
+ // the batch requests from 'window_base' up to 'msg_seq' are in flight,
+ // 'window_items' holding the items each of them still expects, zero
+ // once answered, or for the requests outside batches
+ int32_t window;
+ uint32_t window_base;
+ int32_t window_next_items; // set by 'connection_window_acquire'
+ int32_t window_items[WINDOW_MAX];
  int ipVersion;
  union {
 	 struct in_addr v4;
 	 struct in6_addr v6;
  } addr;
  int tcp_port;
+ const char* unix_path; // within 'conn_string', for "unix:/path" connection strings
+ const char* shm_dir; // within 'conn_string', for "shm:/path" connection strings
+ size_t shm_ring_len;
+ shmem_s* shm; // replaces the socket altogether when not NULL
  char* conn_string;
  range addr_str;
  range tcp_port_str;
 
- fd_set try_read, check_error;
+
+ terab_ticket_t ticket_seq;
+ pending_batch_s pending[MAX_PENDING_BATCHES];
+ // requests of the batches released before all their responses arrived,
+ // whose late responses are dropped; the oldest is overwritten first
+ released_batch_s released[MAX_PENDING_BATCHES];
+ int32_t released_next;
+ uint32_t awaited_id; // latest request outside of batches, see 'connection_wait_response'
+
+ int use_uring; // requested through the 'io=uring' option
+ uring_s* uring; // NULL when the blocking sockets are used
+
+ int wire_format; // requested through the 'wire' option, then negotiated
+
+ size_t coin_cache_len; // requested through the 'coin_cache' option
+ coin_cache_s* coin_cache;
+
+ size_t block_overlay_len; // requested through the 'block_overlay' option
+ block_overlay_s* block_overlay;
+
+ unsynced_writes_s unsynced; // see 'write_coins'
+
+ struct shard_struct* shard; // NULL unless the connection is the first member of a shard
+
+ terab_stats_t stats;
+ int64_t window_wait_us; // total time spent waiting for room in the window
+ uint64_t flushed_requests; // 'stats.requests_sent' at the latest flush, for tracing
+ uint64_t flushed_bytes;    // 'stats.bytes_sent' at the latest flush, for tracing
+
+ // holds the connection itself, along with its buffers, cache and overlay
+ arena_s* arena;
+ size_t arena_len; // requested through the 'arena' option, zero if sized by the others
+ int huge_pages; // requested through the 'huge_pages' option
+
+ // buffers of the next flush, only used once a request refers to memory
+ // outside of 'sendbuf'; the bytes of 'sendbuf' before 'gather_mark' are
+ // already listed.
+ iovec_t gather[GATHER_MAX];
+ int gather_count;
+ char* gather_mark;
+ size_t gathered_len; // bytes of the request being written listed in 'gather'
 } connection_s;
 
 return_status_t parse_connection_string(const char* connection_string, connection_s* result);
+return_status_t parse_connection_options(char* options, connection_s* result);
 
 connection_s* connection_new(const char* connection_string)
 {
 	if (!connection_string) return NULL;
 
 	connection_s draft = { 0 };
-	if (!parse_connection_string(connection_string, &draft))
-	{
-		return NULL;
-	}
-
-	// the only allocations in the client lib :
-	// (soon to be grouped in one allocator-callback to the miner))
-	connection_s* result = (connection_s*)calloc(1, sizeof(connection_s));
-	draft.sendbuf = calloc(2*MESSAGE_MAX_LEN, sizeof(char));
-	draft.sendptr = draft.sendbuf;
-	draft.in_batch = 0;
-	draft.recvbuf = calloc(MESSAGE_MAX_LEN, sizeof(char));
+	draft.recvbuf_len = RECV_BUFFER_DEFAULT;
+	draft.shm_ring_len = SHM_RING_DEFAULT;
+	draft.wire_format = WIRE_FIXED;
+	draft.window = WINDOW_DEFAULT;
 	size_t conn_str_len = strlen(connection_string);
-	draft.conn_string = calloc(conn_str_len + 1, sizeof(char));
+	draft.conn_string = client_alloc(conn_str_len + 1);
+	if (draft.conn_string == NULL)
+		return NULL;
 
 	strncpy(draft.conn_string, connection_string, conn_str_len);
 	draft.conn_string[conn_str_len] = '\0'; // reputs a string terminator for good measure
 
-	// rebase the "addr_str" range (which is relative to the original, uncopied, connection_string)
-	// on the saved copy, "conn_string":
-	if (!range_is_null_or_empty(draft.addr_str))
+	// options follow the address, separated by ';'. Both are parsed from
+	// the saved copy, "conn_string", so the "addr_str" and "tcp_port_str"
+	// ranges are relative to it.
+	char* options = strchr(draft.conn_string, ';');
+	if (options)
+	{
+		*options++ = '\0';
+	}
+
+	if (!parse_connection_string(draft.conn_string, &draft)
+		|| !parse_connection_options(options, &draft))
 	{
-		ptrdiff_t offset = draft.addr_str.begin - connection_string;
-		size_t len = range_len(draft.addr_str);
-		draft.addr_str = range_init(draft.conn_string + offset, len);
+		client_free(draft.conn_string);
+		return NULL;
+	}
+
+	// everything but the connection string comes from a single arena
+	size_t fixed_len = arena_share(sizeof(connection_s)) + arena_share(SEND_BUFFER_LEN)
+		+ (draft.coin_cache_len > 0 ? coin_cache_arena_len(draft.coin_cache_len) : 0)
+		+ (draft.block_overlay_len > 0 ? block_overlay_arena_len(draft.block_overlay_len) : 0);
+
+	if (draft.arena_len > 0)
+	{
+		// the room left by the other parts goes to the receive buffer
+		size_t room = draft.arena_len > fixed_len ? draft.arena_len - fixed_len : 0;
+		room &= ~(size_t)(ARENA_ALIGN - 1);
+		if (room < 2*MESSAGE_MAX_LEN || room > RECV_BUFFER_MAX)
+		{
+			client_free(draft.conn_string);
+			return NULL;
+		}
+		draft.recvbuf_len = room;
 	}
 
-	// ditto, rebase the "tcp_port_str" range:
-	if (!range_is_null_or_empty(draft.tcp_port_str))
+	arena_s* arena = arena_new(fixed_len + arena_share(draft.recvbuf_len), draft.huge_pages);
+	if (arena == NULL)
 	{
-		ptrdiff_t offset = draft.tcp_port_str.begin - connection_string;
-		size_t len = range_len(draft.tcp_port_str);
-		draft.tcp_port_str = range_init(draft.conn_string + offset, len);
+		client_free(draft.conn_string);
+		return NULL;
 	}
 
+	// the arena is sized for all these, none of them fails
+	connection_s* result = (connection_s*)arena_alloc(arena, sizeof(connection_s));
+	draft.arena = arena;
+	draft.sendbuf = (char*)arena_alloc(arena, SEND_BUFFER_LEN);
+	draft.sendptr = draft.sendbuf;
+	draft.gather_mark = draft.sendbuf;
+	draft.in_batch = 0;
+	draft.recvbuf = (char*)arena_alloc(arena, draft.recvbuf_len);
+	draft.recv_head = draft.recvbuf;
+	draft.recv_tail = draft.recvbuf;
+	draft.coin_cache = draft.coin_cache_len > 0 ? coin_cache_new(arena, draft.coin_cache_len) : NULL;
+	draft.block_overlay = draft.block_overlay_len > 0 ? block_overlay_new(arena, draft.block_overlay_len) : NULL;
+
 	*result = draft;
 	return result;
 }
 
 return_status_t connection_open(connection_s* conn)
 {
+	if (conn->shm_dir)
+	{
+		conn->shm = shmem_new(conn->shm_dir, conn->shm_ring_len);
+		if (conn->shm == NULL)
+			return KO(CONNECTIVITY);
+
+		conn->is_connected = 1;
+		conn->socket = INVALID_SOCKET;
+		return OK;
+	}
+
 	ADDRESS_FAMILY addr_family;
-	if (conn->ipVersion == 4)
+	if (conn->unix_path)
+	{
+		addr_family = AF_UNIX;
+	}
+	else if (conn->ipVersion == 4)
 	{
 		addr_family = AF_INET;
 	}
@@ -89,13 +253,16 @@ return_status_t connection_open(connection_s* conn)
 		return UNSPECIFIED;
 	}
 
-	SOCKET client = socket(addr_family, SOCK_STREAM, IPPROTO_TCP);
+	SOCKET client = socket(addr_family, SOCK_STREAM, addr_family == AF_UNIX ? 0 : IPPROTO_TCP);
 	if (client == INVALID_SOCKET)
 		return UNSPECIFIED;
 
-	int error;
+	int error = 0;
 	int tcp_nodelay_enabled = 1;
-	error = setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &tcp_nodelay_enabled, sizeof(tcp_nodelay_enabled));
+	if (addr_family != AF_UNIX) // no Nagle's algorithm on Unix domain sockets
+	{
+		error = setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &tcp_nodelay_enabled, sizeof(tcp_nodelay_enabled));
+	}
 	if (error)
 	{
 		closesocket(client);
@@ -120,6 +287,14 @@ return_status_t connection_open(connection_s* conn)
 
 		error = connect(client, (struct sockaddr*)&dest, sizeof(dest));
 	}
+	else if (addr_family == AF_UNIX)
+	{
+		struct sockaddr_un dest = { 0 };
+		dest.sun_family = AF_UNIX;
+		strcpy(dest.sun_path, conn->unix_path); // length checked when parsing
+
+		error = connect(client, (struct sockaddr*)&dest, sizeof(dest));
+	}
 	else
 	{
 		exit(1);
@@ -134,8 +309,11 @@ return_status_t connection_open(connection_s* conn)
 	conn->is_connected = 1;
 	conn->socket = client;
 
-	FD_ZERO(&conn->try_read); FD_SET(conn->socket, &conn->try_read);
-	FD_ZERO(&conn->check_error); FD_SET(conn->socket, &conn->check_error);
+	// silently falls back on the blocking sockets if io_uring is unavailable
+	if (conn->use_uring)
+	{
+		conn->uring = uring_new(client, conn->sendbuf, SEND_BUFFER_LEN, conn->recvbuf, conn->recvbuf_len);
+	}
 
 	return OK;
 
@@ -147,14 +325,68 @@ return_status_t connection_batch_begin(connection_s* conn)
 	return OK;
 }
 
-static return_status_t accept_message(connection_s* conn, const char* msgEnd, uint32_t* outRequestId)
+/* Moves the window past the requests which expect no more items. */
+static void window_advance(connection_s* conn)
+{
+	while (conn->window_base != conn->msg_seq && conn->window_items[conn->window_base % WINDOW_MAX] == 0)
+		conn->window_base++;
+}
+
+/* Accounts for 'settled' items of the request 'requestId'. */
+static void window_settle(connection_s* conn, uint32_t requestId, int32_t settled)
+{
+	// unsigned arithmetic keeps working when 'msg_seq' wraps around
+	if (requestId - conn->window_base >= conn->msg_seq - conn->window_base)
+		return;
+
+	int32_t* items = conn->window_items + requestId % WINDOW_MAX;
+	*items = *items > settled ? *items - settled : 0;
+	window_advance(conn);
+}
+
+/* Frees the places held by the requests of a batch which completes
+   without settling all their items, e.g. on errors. */
+static void window_release(connection_s* conn, pending_batch_s* batch)
+{
+	for (int32_t i = 0; i < batch->request_count; i++)
+		window_settle(conn, batch->first_request_id + i, INT32_MAX);
+}
+
+/* Identifier and kind of the message starting at 'msg', whose header is
+   that of 'write_header'. */
+static uint32_t message_request_id(const char* msg)
+{
+	range peek = range_init((char*)msg + 4, 4);
+	return read_uint32(&peek);
+}
+
+#ifdef TRACE_SUPPORTED
+static int32_t message_kind(const char* msg)
+{
+	range peek = range_init((char*)msg + 12, 4);
+	return read_int32(&peek);
+}
+#endif
+
+static return_status_t accept_message(connection_s* conn, const char* msgEnd, size_t tail_len, uint32_t* outRequestId)
 {
 	range msg_range = range_init(conn->sendptr, msgEnd - conn->sendptr);
-	size_t to_send_size = range_len(msg_range);
+	size_t to_send_size = range_len(msg_range) + conn->gathered_len + tail_len;
+	conn->gathered_len = 0;
 
 	if (to_send_size > MESSAGE_MAX_LEN)
 	{
 		if (outRequestId) *outRequestId = 0;
+		conn->window_next_items = 0;
+		return UNSPECIFIED;
+	}
+
+	// the slot of the request id is still held by an unanswered request,
+	// see 'connection_get_send_buffer'
+	if (conn->msg_seq - conn->window_base >= WINDOW_MAX)
+	{
+		if (outRequestId) *outRequestId = 0;
+		conn->window_next_items = 0;
 		return UNSPECIFIED;
 	}
 
@@ -167,10 +399,22 @@ static return_status_t accept_message(connection_s* conn, const char* msgEnd, ui
 	if (outRequestId) *outRequestId = requestId;
 	conn->sendptr = msgEnd;
 	conn->msg_seq = requestId + 1;
+
+	// outside of batches, the response is awaited right after sending
+	if (!conn->in_batch)
+		conn->awaited_id = requestId;
+
+	conn->stats.requests_sent++;
+	conn->stats.bytes_sent += to_send_size;
+	TRACE(send_request, conn, requestId, message_kind(msg_range.begin), to_send_size);
+
+	conn->window_items[requestId % WINDOW_MAX] = conn->window_next_items;
+	conn->window_next_items = 0;
+	window_advance(conn);
 	return OK;
 }
 
-static return_status_t socket_send(SOCKET socket, const char* to_send, size_t len)
+static return_status_t socket_send(SOCKET socket, const char* to_send, size_t len, uint64_t* calls)
 {
 	if (len > INT_MAX)
 	{
@@ -181,6 +425,7 @@ static return_status_t socket_send(SOCKET socket, const char* to_send, size_t le
 	while (remaining > 0)
 	{
 		int sent = send(socket, to_send, remaining, 0);
+		(*calls)++;
 		if (sent > 0)
 		{
 			if (sent > remaining)
@@ -204,24 +449,156 @@ static return_status_t socket_send(SOCKET socket, const char* to_send, size_t le
 	return OK;
 }
 
-return_status_t flush_send_buffer(connection_s* conn)
+static void gather_push(connection_s* conn, const char* base, size_t len)
+{
+	if (len == 0)
+		return;
+
+	iovec_t* last = conn->gather + conn->gather_count - 1;
+	if (conn->gather_count > 0 && (char*)IOV_BASE(*last) + IOV_LEN(*last) == base)
+	{
+		IOV_LEN(*last) += len;
+		return;
+	}
+
+	IOV_BASE(conn->gather[conn->gather_count]) = (char*)base;
+	IOV_LEN(conn->gather[conn->gather_count]) = len;
+	conn->gather_count++;
+}
+
+/* Sends all the buffers with as few system calls as possible, counted in
+   'calls'. 'parts' is consumed in the process. */
+static return_status_t socket_sendv(SOCKET socket, iovec_t* parts, int count, uint64_t* calls)
+{
+	while (count > 0)
+	{
+		(*calls)++;
+#ifdef _WIN32
+		DWORD sent = 0;
+		if (WSASend(socket, parts, count, &sent, 0, NULL, NULL) != 0 || sent == 0)
+			return UNSPECIFIED;
+#else
+		struct msghdr msg = { 0 };
+		msg.msg_iov = parts;
+		msg.msg_iovlen = count;
+		ssize_t sent = sendmsg(socket, &msg, 0);
+		if (sent <= 0)
+			return UNSPECIFIED;
+#endif
+		// skip the buffers entirely sent, and trim the partially sent one
+		size_t left = (size_t)sent;
+		while (count > 0 && left >= IOV_LEN(*parts))
+		{
+			left -= IOV_LEN(*parts);
+			parts++;
+			count--;
+		}
+		if (count > 0)
+		{
+			IOV_BASE(*parts) = (char*)IOV_BASE(*parts) + left;
+			IOV_LEN(*parts) -= left;
+		}
+	}
+	return OK;
+}
+
+/* Traces the requests handed to the transport since the previous flush. */
+static void trace_flush(connection_s* conn)
+{
+	TRACE(flush, conn, conn->stats.requests_sent - conn->flushed_requests,
+		conn->stats.bytes_sent - conn->flushed_bytes);
+	conn->flushed_requests = conn->stats.requests_sent;
+	conn->flushed_bytes = conn->stats.bytes_sent;
+}
+
+/* 'defer' allows the io_uring transport to postpone the submission until
+   the next receive, for requests whose response is awaited right away. */
+return_status_t flush_send_buffer(connection_s* conn, int defer)
 {
 	size_t len = conn->sendptr - conn->sendbuf;
 
+	trace_flush(conn);
+
+	if (conn->gather_count > 0)
+	{
+		gather_push(conn, conn->gather_mark, conn->sendptr - conn->gather_mark);
+		int count = conn->gather_count;
+		conn->gather_count = 0;
+		conn->gather_mark = conn->sendbuf;
+
+		// external buffers are not registered with io_uring, and belong to
+		// the caller once the flush returns: they go through a plain 'sendmsg',
+		// after the io_uring write in flight, if any.
+		if (conn->uring && !uring_send_wait(conn->uring))
+		{
+			return RS_FAILURE;
+		}
+		if (!socket_sendv(conn->socket, conn->gather, count, &conn->stats.send_calls))
+		{
+			return RS_FAILURE;
+		}
+	}
+	else if (conn->uring)
+	{
+		// the buffer is not reused before the write completes,
+		// see 'connection_get_send_buffer'
+		conn->stats.send_calls++;
+		if (!uring_send(conn->uring, conn->sendbuf, len, defer))
+		{
+			return RS_FAILURE;
+		}
+	}
 	// actual sending, right now:
-	if (!socket_send(conn->socket, conn->sendbuf, len))
+	else if (!socket_send(conn->socket, conn->sendbuf, len, &conn->stats.send_calls))
 	{
 		return RS_FAILURE;
 	}
-	else
+
+	// reset send buffer:
+	conn->sendptr = conn->sendbuf;
+	return OK;
+}
+
+return_status_t connection_send_request(connection_s* conn, const char* msgEnd, /* out, optional */ uint32_t* outRequestId)
+{
+	return connection_send_request_tail(conn, msgEnd, NULL, 0, outRequestId);
+}
+
+/* The message has been written straight into the request ring, see
+   'connection_get_send_buffer'. */
+static return_status_t send_shared_request(connection_s* conn, const char* msgEnd,
+	const char* tail, size_t tail_len, uint32_t* outRequestId)
+{
+	// no room could be reserved, the instance is gone
+	if (conn->sendptr == conn->sendbuf)
+	{
+		if (outRequestId) { *outRequestId = 0; }
+		return KO(CONNECTIVITY);
+	}
+
+	if (!accept_message(conn, msgEnd, tail_len, outRequestId))
 	{
-		// reset send buffer:
 		conn->sendptr = conn->sendbuf;
-		return OK;
+		return RS_FAILURE;
 	}
+
+	if (tail_len > 0)
+	{
+		memcpy(conn->sendptr, tail, tail_len);
+	}
+	shmem_commit(conn->shm, conn->sendptr + tail_len);
+	conn->sendptr = conn->sendbuf;
+
+	if (!conn->in_batch)
+	{
+		conn->stats.send_calls++;
+		shmem_publish(conn->shm);
+	}
+	return OK;
 }
 
-return_status_t connection_send_request(connection_s* conn, const char* msgEnd, /* out, optional */ uint32_t* outRequestId)
+return_status_t connection_send_request_tail(connection_s* conn, const char* msgEnd,
+	const char* tail, size_t tail_len, /* out, optional */ uint32_t* outRequestId)
 {
 	if (!conn->is_connected)
 	{
@@ -229,84 +606,669 @@ return_status_t connection_send_request(connection_s* conn, const char* msgEnd,
 		return KO(UNSPECIFIED);
 	}
 
-	if (!accept_message(conn, msgEnd, outRequestId))
+	if (conn->shm)
+	{
+		return send_shared_request(conn, msgEnd, tail, tail_len, outRequestId);
+	}
+
+	if (!accept_message(conn, msgEnd, tail_len, outRequestId))
 	{
 		return RS_FAILURE;
 	}
 
+	if (tail_len >= GATHER_MIN_LEN)
+	{
+		gather_push(conn, conn->gather_mark, conn->sendptr - conn->gather_mark);
+		gather_push(conn, tail, tail_len);
+		conn->gather_mark = conn->sendptr;
+	}
+	else if (tail_len > 0)
+	{
+		// the whole message, tail included, fits in the range
+		// returned by 'connection_get_send_buffer'
+		memcpy(conn->sendptr, tail, tail_len);
+		conn->sendptr += tail_len;
+	}
+
 	size_t len = conn->sendptr - conn->sendbuf;
-	if ( !conn->in_batch || len >= MESSAGE_MAX_LEN)
+	if ( !conn->in_batch || len >= MESSAGE_MAX_LEN || conn->gather_count > GATHER_MAX - 3)
 	{
-		return flush_send_buffer(conn);
+		// outside of batches, the response is awaited right after sending
+		return flush_send_buffer(conn, !conn->in_batch);
 	}
 
 	// defer sending:
 	return OK;
 }
 
+void connection_write_tail(connection_s* conn, range* buffer, const char* tail, size_t tail_len)
+{
+	// shared-memory requests are written in place, in the request ring;
+	// a few buffers are kept for the end of the request and its flush
+	if (conn->shm || tail_len < GATHER_MIN_LEN || conn->gather_count > GATHER_MAX - 5)
+	{
+		write_bytes(buffer, tail, tail_len);
+		return;
+	}
+
+	gather_push(conn, conn->gather_mark, buffer->begin - conn->gather_mark);
+	gather_push(conn, tail, tail_len);
+	conn->gather_mark = buffer->begin;
+	conn->gathered_len += tail_len;
+	buffer->end -= tail_len;
+}
+
+/* Sends the requests written so far within the batch. */
+static return_status_t flush_batch(connection_s* conn)
+{
+	if (conn->shm)
+	{
+		trace_flush(conn);
+		conn->stats.send_calls++;
+		shmem_publish(conn->shm);
+	}
+	else if (conn->sendbuf != conn->sendptr)
+	{
+		return flush_send_buffer(conn, 0);
+	}
+	return OK;
+}
+
 return_status_t connection_batch_end(connection_s* conn)
 {
 	conn->in_batch = 0;
-	if (conn->sendbuf != conn->sendptr)
+	flush_batch(conn);
+	return OK;
+}
+
+static int transport_recv(connection_s* conn, char* dest, int len)
+{
+	int n;
+	if (conn->shm)
+		n = shmem_recv(conn->shm, dest, len);
+	else if (conn->uring)
+		n = uring_recv(conn->uring, dest, len);
+	else
+		n = recv(conn->socket, dest, len, 0);
+
+	conn->stats.recv_calls++;
+	if (n > 0)
+		conn->stats.bytes_received += n;
+	return n;
+}
+
+/* Pops the next message from the receive buffer, if it has been entirely
+   received. The message remains valid until the next call to
+   'fill_receive_buffer'. */
+static int buffered_message(connection_s* conn, /* out */ range* reply)
+{
+	if (conn->stream_left > 0)
+		return 0;
+
+	size_t available = conn->recv_tail - conn->recv_head;
+
+	// first, we need 4 bytes to get the message size.
+	if (available < 4)
+		return 0;
+
+	range ready = range_init(conn->recv_head, 4);
+	int32_t msgsize = read_int32(&ready);
+
+	if (msgsize > MESSAGE_MAX_LEN || msgsize < 16) // not really a message, then
+		exit(1);
+
+	if (available < (size_t)msgsize)
+		return 0;
+
+	// at this point, we've got a full message:
+	reply->begin = conn->recv_head;
+	reply->end = conn->recv_head + msgsize;
+	conn->recv_head += msgsize;
+	conn->stats.responses_received++;
+
+	return 1;
+}
+
+static pending_batch_s* find_pending(connection_s* conn, uint32_t requestId);
+
+/* Receives exactly 'dest', bypassing the receive buffer. The io_uring
+   connections never get there, their reads being bound to 'recvbuf'. */
+static return_status_t receive_direct(connection_s* conn, range dest)
+{
+	while (range_len(dest) > 0)
 	{
-		flush_send_buffer(conn);
+		size_t len = range_len(dest);
+		int n = conn->shm
+			? shmem_recv(conn->shm, dest.begin, len)
+			: recv(conn->socket, dest.begin, len > INT_MAX ? INT_MAX : (int)len, 0);
+		conn->stats.recv_calls++;
+		if (n <= 0 || (size_t)n > len)
+			return UNSPECIFIED;
+
+		conn->stats.bytes_received += n;
+		dest.begin += n;
 	}
 	return OK;
 }
 
-return_status_t connection_wait_response(connection_s* conn, /* out */ range* reply)
+/* Starts streaming the message at 'recv_head' if it is partially received,
+   long enough, and belongs to a batch which supports it. */
+static void stream_begin(connection_s* conn)
+{
+	size_t available = conn->recv_tail - conn->recv_head;
+	if (conn->uring || available < 8)
+		return;
+
+	range peek = range_init(conn->recv_head, 8);
+	int32_t msgsize = read_int32(&peek);
+	uint32_t requestId = read_uint32(&peek);
+
+	// malformed lengths are left to 'buffered_message'
+	if (msgsize > MESSAGE_MAX_LEN || msgsize < STREAM_MIN_LEN || available >= (size_t)msgsize)
+		return;
+
+	pending_batch_s* batch = find_pending(conn, requestId);
+	if (batch == NULL || batch->on_stream == NULL || batch->remaining <= 0)
+		return;
+
+	conn->stream = batch;
+	conn->stream_ticket = batch->ticket;
+	conn->stream_request_id = requestId;
+	conn->stream_left = msgsize;
+}
+
+/* Hands the received bytes of the streamed response, if any, to its batch,
+   then receives the bytes the batch asks for straight into its memory. */
+static return_status_t stream_received(connection_s* conn)
+{
+	if (conn->stream_left == 0)
+		stream_begin(conn);
+
+	if (conn->stream_left == 0)
+		return OK;
+
+	// the batch may have been failed, or even released, in the meantime
+	pending_batch_s* batch = conn->stream;
+	if (batch != NULL && (batch->ticket != conn->stream_ticket || batch->remaining <= 0))
+		batch = NULL;
+
+	size_t available = conn->recv_tail - conn->recv_head;
+	int last = available >= conn->stream_left;
+	range part = range_init(conn->recv_head, last ? conn->stream_left : available);
+	range direct = range_init(NULL, 0);
+
+	int32_t remaining = batch != NULL ? batch->remaining : 0;
+	int valid = batch == NULL || batch->on_stream(batch, &part, &direct);
+	if (batch != NULL)
+		window_settle(conn, conn->stream_request_id, remaining - batch->remaining);
+
+	// the direct bytes must follow the decoded ones, within the response
+	size_t left = conn->stream_left - ((const char*)part.begin - conn->recv_head);
+	if (range_len(direct) > 0 && (range_len(part) > 0 || range_len(direct) > left))
+		valid = 0;
+
+	// the whole response must be decoded once received
+	if (last && range_len(part) > 0)
+		valid = 0;
+
+	if (batch != NULL && !valid)
+	{
+		// same as 'dispatch_pending', the rest of the response is skipped
+		if (batch->status == TERAB_SUCCESS)
+			batch->status = TERAB_ERR_INTERNAL_ERROR;
+		batch->remaining = 0;
+		window_release(conn, batch);
+		batch = NULL;
+	}
+	if (batch == NULL)
+	{
+		part.begin = (char*)part.end;
+		direct = range_init(NULL, 0);
+	}
+	conn->stream = batch;
+
+	size_t decoded = part.begin - conn->recv_head;
+	conn->recv_head += decoded;
+	conn->stream_left -= decoded;
+
+	if (range_len(direct) > 0)
+	{
+		if (!receive_direct(conn, direct))
+			return UNSPECIFIED;
+
+		conn->stream_left -= range_len(direct);
+	}
+
+	if (conn->stream_left == 0)
+	{
+		conn->stream = NULL;
+		conn->stats.responses_received++;
+	}
+
+	return OK;
+}
+
+/* Receives as many bytes as the kernel holds, up to the end of the buffer.
+   A partially received message is first moved to the beginning of the
+   buffer if the room left behind it could not fit a whole message. Large
+   responses may then be decoded as they arrive, see 'stream_received'. */
+static return_status_t fill_receive_buffer(connection_s* conn)
 {
 	if (!conn->is_connected)
 		return UNSPECIFIED;
-	
-	int n = 0;
 
-	char* dest = conn->recvbuf;
-	// first, we need 4 bytes to get the message size.
-	int needed = 4;
-	do
+	char* buffer_end = conn->recvbuf + conn->recvbuf_len;
+	if (conn->recv_head == conn->recv_tail)
 	{
-		n = recv(conn->socket, dest, needed, 0);
-		if (n > needed || n <= 0)
-		{
+		conn->recv_head = conn->recvbuf;
+		conn->recv_tail = conn->recvbuf;
+	}
+	else if (buffer_end - conn->recv_head < MESSAGE_MAX_LEN)
+	{
+		size_t partial = conn->recv_tail - conn->recv_head;
+		memmove(conn->recvbuf, conn->recv_head, partial);
+		conn->recv_head = conn->recvbuf;
+		conn->recv_tail = conn->recvbuf + partial;
+	}
+
+	size_t room = buffer_end - conn->recv_tail;
+	int n = transport_recv(conn, conn->recv_tail, room > INT_MAX ? INT_MAX : (int)room);
+	if (n <= 0 || (size_t)n > room)
+	{
+		return UNSPECIFIED;
+	}
+	conn->recv_tail += n;
+
+	return stream_received(conn);
+}
+
+static return_status_t receive_message(connection_s* conn, /* out */ range* reply)
+{
+	while (!buffered_message(conn, reply))
+	{
+		if (!fill_receive_buffer(conn))
+			return RS_FAILURE;
+	}
+	return OK;
+}
+
+static pending_batch_s* find_pending(connection_s* conn, uint32_t requestId)
+{
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		pending_batch_s* batch = conn->pending + i;
+
+		// unsigned arithmetic keeps working when 'msg_seq' wraps around
+		if (batch->ticket != 0 && requestId - batch->first_request_id < (uint32_t)batch->request_count)
+			return batch;
+	}
+	return NULL;
+}
+
+/* Whether 'requestId' belongs to a batch released before all its
+   responses arrived, see 'connection_pending_free'. */
+static int is_released(connection_s* conn, uint32_t requestId)
+{
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		released_batch_s* released = conn->released + i;
+		if (requestId - released->first_request_id < (uint32_t)released->request_count)
+			return 1;
+	}
+	return 0;
+}
+
+/* Routes the response to its pending batch, if any, or drops it if its
+   batch was released already. Returns 0 if the response does not belong
+   to a batch. */
+static int dispatch_pending(connection_s* conn, range* reply)
+{
+	uint32_t requestId = message_request_id(reply->begin);
+
+	pending_batch_s* batch = find_pending(conn, requestId);
+	if (batch == NULL)
+		return is_released(conn, requestId);
+
+	if (batch->remaining <= 0)
+	{
+		// duplicate response, the batch is already complete
+		batch->status = TERAB_ERR_INTERNAL_ERROR;
+		return 1;
+	}
+
+	int32_t remaining = batch->remaining;
+	if (!batch->on_response(batch, requestId - batch->first_request_id, reply))
+	{
+		// the items settled by the response are unknown, hence the batch
+		// cannot complete normally
+		if (batch->status == TERAB_SUCCESS)
+			batch->status = TERAB_ERR_INTERNAL_ERROR;
+		batch->remaining = 0;
+		window_release(conn, batch);
+		return 1;
+	}
+
+	window_settle(conn, requestId, remaining - batch->remaining);
+	return 1;
+}
+
+/* Dispatches all the messages already received. Afterwards, the readiness
+   of the socket reflects whether responses are waiting to be processed,
+   which 'connection_poll' and the engine rely on. */
+static return_status_t dispatch_buffered(connection_s* conn)
+{
+	range reply;
+	while (buffered_message(conn, &reply))
+	{
+		// no synchronous request can be in flight at this point
+		if (!dispatch_pending(conn, &reply))
 			return UNSPECIFIED;
+	}
+	return OK;
+}
+
+return_status_t connection_wait_response(connection_s* conn, /* out */ range* reply)
+{
+	TRACE(wait_response_begin, conn);
+	for (;;)
+	{
+		if (!receive_message(conn, reply))
+			return RS_FAILURE;
+
+		if (dispatch_pending(conn, reply))
+			continue;
+
+		if (message_request_id(reply->begin) == conn->awaited_id)
+			break;
+
+		// a late response to a request nobody waits for anymore
+	}
+
+	TRACE(wait_response_end, conn, message_request_id(reply->begin),
+		message_kind(reply->begin), range_len(*reply));
+
+	// 'reply' is left untouched, the buffer is not refilled
+	return dispatch_buffered(conn);
+}
+
+pending_batch_s* connection_pending_new(connection_s* conn, int32_t request_count, int32_t item_count,
+	batch_handler_t on_response)
+{
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		pending_batch_s* batch = conn->pending + i;
+		if (batch->ticket != 0)
+			continue;
+
+		if (++conn->ticket_seq == 0) // zero is never a valid ticket
+			conn->ticket_seq = 1;
+
+		pending_batch_s draft = { 0 };
+		draft.ticket = conn->ticket_seq;
+		draft.first_request_id = conn->msg_seq;
+		draft.request_count = request_count;
+		draft.item_count = item_count;
+		draft.remaining = item_count;
+		draft.status = TERAB_SUCCESS;
+		draft.on_response = on_response;
+		draft.stats_op = -1;
+		draft.submitted_us = stats_now_us();
+
+		*batch = draft;
+		return batch;
+	}
+	return NULL;
+}
+
+pending_batch_s* connection_pending_find(connection_s* conn, terab_ticket_t ticket)
+{
+	if (ticket == 0)
+		return NULL;
+
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		if (conn->pending[i].ticket == ticket)
+			return conn->pending + i;
+	}
+	return NULL;
+}
+
+void connection_pending_free(connection_s* conn, pending_batch_s* batch)
+{
+	if (batch->stats_op >= 0)
+	{
+		int completed = batch->remaining <= 0;
+		int32_t status = completed ? batch->status : TERAB_ERR_INTERNAL_ERROR;
+		int64_t latency_us = completed ? stats_now_us() - batch->submitted_us : -1;
+		stats_record(&conn->stats, batch->stats_op, status, batch->item_count,
+			latency_us, batch->queued_us);
+		TRACE(batch_end, conn, batch->stats_op, batch->ticket, status, latency_us);
+	}
+
+	// the responses still to come must not be taken for those of other requests
+	if (batch->remaining > 0 || batch->status != TERAB_SUCCESS)
+	{
+		released_batch_s* released = conn->released + conn->released_next;
+		released->first_request_id = batch->first_request_id;
+		// those of the requests left unsent on errors go to the next requests
+		uint32_t sent = conn->msg_seq - batch->first_request_id;
+		released->request_count = sent < (uint32_t)batch->request_count ? (int32_t)sent : batch->request_count;
+		conn->released_next = (conn->released_next + 1) % MAX_PENDING_BATCHES;
+	}
+
+	window_release(conn, batch);
+	client_free(batch->coin_map);
+	batch->coin_map = NULL;
+	batch->ticket = 0;
+}
+
+pending_batch_s* connection_pending_completed(connection_s* conn)
+{
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		pending_batch_s* batch = conn->pending + i;
+		if (batch->ticket != 0 && batch->remaining <= 0)
+			return batch;
+	}
+	return NULL;
+}
+
+int32_t connection_pending_count(connection_s* conn)
+{
+	int32_t count = 0;
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		if (conn->pending[i].ticket != 0)
+			count++;
+	}
+	return count;
+}
+
+void connection_pending_fail(connection_s* conn, int32_t status)
+{
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		pending_batch_s* batch = conn->pending + i;
+		if (batch->ticket != 0 && batch->remaining > 0)
+		{
+			batch->remaining = 0;
+			batch->status = status;
+			window_release(conn, batch);
 		}
-		dest += n;
-		needed -= n;
+	}
+}
 
-	} while (needed > 0);
+SOCKET connection_get_socket(connection_s* conn)
+{
+	return conn->socket;
+}
 
-	range ready = range_init(conn->recvbuf, 4);
-	int32_t msgsize = read_int32(&ready);
+coin_cache_s* connection_coin_cache(connection_s* conn)
+{
+	return conn->coin_cache;
+}
 
-	if (msgsize > MESSAGE_MAX_LEN || msgsize < 16) // not really a message, then
-		exit(1);
+block_overlay_s* connection_block_overlay(connection_s* conn)
+{
+	return conn->block_overlay;
+}
+
+unsynced_writes_s* connection_unsynced_writes(connection_s* conn)
+{
+	return &conn->unsynced;
+}
 
-	needed = msgsize - 4;
-	while (needed > 0)
+terab_stats_t* connection_stats(connection_s* conn)
+{
+	return &conn->stats;
+}
+
+int64_t connection_window_wait_us(connection_s* conn)
+{
+	return conn->window_wait_us;
+}
+
+struct shard_struct* connection_shard(connection_s* conn)
+{
+	return conn->shard;
+}
+
+void connection_set_shard(connection_s* conn, struct shard_struct* shard)
+{
+	conn->shard = shard;
+}
+
+int connection_wire_format(connection_s* conn)
+{
+	return conn->wire_format;
+}
+
+void connection_set_wire_format(connection_s* conn, int wire_format)
+{
+	conn->wire_format = wire_format;
+}
+
+void connection_set_window(connection_s* conn, int32_t window)
+{
+	conn->window = window < 1 ? 1 : window > WINDOW_MAX ? WINDOW_MAX : window;
+}
+
+return_status_t connection_poll(connection_s* conn)
+{
+	if (!conn->is_connected)
+		return UNSPECIFIED;
+
+	for (;;)
 	{
-		n = recv(conn->socket, dest, needed, 0);
-		if (n > needed || n <= 0)
+		if (!dispatch_buffered(conn))
+			return RS_FAILURE;
+
+		int ready;
+		if (conn->shm)
 		{
-			return UNSPECIFIED;
+			ready = shmem_readable(conn->shm);
 		}
-		dest += n;
-		needed -= n;
+		else
+		{
+			// unlike 'select', not bounded by FD_SETSIZE
+			struct pollfd readable = { 0 };
+			readable.fd = conn->socket;
+			readable.events = POLLIN;
+
+			ready = poll(&readable, 1, 0);
+		}
+		if (ready < 0)
+			return KO(CONNECTIVITY);
+		if (ready == 0)
+			return OK;
+
+		if (!fill_receive_buffer(conn))
+			return RS_FAILURE;
 	}
+}
 
-	// at this point, we've got a full message:
-	reply->begin = conn->recvbuf;
-	reply->end = conn->recvbuf + msgsize;
+/* Dispatches the responses received until fewer than 'limit' requests
+   are held in the window. */
+static return_status_t window_wait(connection_s* conn, uint32_t limit)
+{
+	int64_t wait_start = 0;
+	while (conn->msg_seq - conn->window_base >= limit)
+	{
+		if (wait_start == 0)
+			wait_start = stats_now_us();
+
+		// the requests of the window must reach the instance to be answered
+		if (!flush_batch(conn))
+			return RS_FAILURE;
 
+		range reply;
+		if (buffered_message(conn, &reply))
+		{
+			// no synchronous request can be in flight within a batch
+			if (!dispatch_pending(conn, &reply))
+				return UNSPECIFIED;
+		}
+		else if (!fill_receive_buffer(conn))
+		{
+			return RS_FAILURE;
+		}
+	}
+
+	if (wait_start != 0)
+		conn->window_wait_us += stats_now_us() - wait_start;
+	return OK;
+}
+
+return_status_t connection_window_acquire(connection_s* conn, int32_t item_count)
+{
+	return_status_t status = window_wait(conn, (uint32_t)conn->window);
+	if (status != OK)
+		return status;
+
+	conn->window_next_items = item_count;
 	return OK;
 }
 
+return_status_t connection_wait_batch(connection_s* conn, pending_batch_s* batch)
+{
+	// the batch may complete while its last response is being streamed,
+	// hence the buffer is only refilled while it holds no whole message
+	while (batch->remaining > 0)
+	{
+		range reply;
+		if (buffered_message(conn, &reply))
+		{
+			if (!dispatch_pending(conn, &reply))
+				return UNSPECIFIED;
+		}
+		else if (!fill_receive_buffer(conn))
+		{
+			return RS_FAILURE;
+		}
+	}
+	return dispatch_buffered(conn);
+}
+
 return_status_t connection_close(connection_s* conn)
 {
 	if (!conn->is_connected)
 	{
 		return UNSPECIFIED;
 	}
+	if (conn->shm)
+	{
+		shmem_free(conn->shm);
+		conn->shm = NULL;
+		conn->is_connected = 0;
+		return OK;
+	}
+	if (conn->uring)
+	{
+		uring_send_wait(conn->uring);
+		uring_free(conn->uring);
+		conn->uring = NULL;
+	}
+
 	int failed = closesocket(conn->socket);
 	if (!failed)
 	{
@@ -322,18 +1284,67 @@ return_status_t connection_close(connection_s* conn)
 
 void connection_free(connection_s* connection)
 {
-	free(connection->conn_string);
-	free(connection->sendbuf);
-	free(connection->recvbuf);
-	free(connection);
+	if (connection->uring)
+	{
+		uring_free(connection->uring);
+	}
+	if (connection->shm)
+	{
+		shmem_free(connection->shm);
+	}
+	for (int i = 0; i < MAX_PENDING_BATCHES; i++)
+	{
+		client_free(connection->pending[i].coin_map);
+	}
+	client_free(connection->conn_string);
+
+	// the connection lives in its arena, released last
+	arena_free(connection->arena);
 }
 
 return_status_t tokenize_connection_string(const char* connection_string, range* ip_str, range* tcp_port_str);
 
+// prefix of the connection strings of Unix domain sockets, as in "unix:/path/to/terab.sock"
+#define UNIX_PREFIX "unix:"
+
+// prefix of the connection strings of shared memory, as in "shm:/dev/shm/terab"
+#define SHM_PREFIX "shm:"
+
 return_status_t parse_connection_string(const char* connection_string, connection_s* result)
 {
 	range tcp_port_as_range = { 0 }, address_as_range = { 0 };
 
+	if (strncmp(connection_string, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0)
+	{
+		const char* path = connection_string + strlen(UNIX_PREFIX);
+		struct sockaddr_un unused;
+		if (*path == '\0' || strlen(path) >= sizeof(unused.sun_path))
+		{
+			return KO(USER);
+		}
+
+		result->unix_path = path;
+		return OK;
+	}
+
+	if (strncmp(connection_string, SHM_PREFIX, strlen(SHM_PREFIX)) == 0)
+	{
+		const char* directory = connection_string + strlen(SHM_PREFIX);
+		if (*directory == '\0')
+		{
+			return KO(USER);
+		}
+
+		result->shm_dir = directory;
+		return OK;
+	}
+
+	// several addresses make a shard, see 'shard_new'
+	if (strchr(connection_string, ',') != NULL)
+	{
+		return KO(USER);
+	}
+
 	if (!tokenize_connection_string(connection_string, &address_as_range, &tcp_port_as_range))
 	{
 		return UNSPECIFIED;
@@ -391,6 +1402,131 @@ return_status_t parse_connection_string(const char* connection_string, connectio
 	return OK;
 }
 
+static return_status_t parse_connection_option(const char* key, const char* value, connection_s* result)
+{
+	if (strcmp(key, "recv_buffer") == 0)
+	{
+		char* end;
+		long long len = strtoll(value, &end, 10);
+
+		// a whole message always fits behind a partial one
+		if (*end != '\0' || len < 2*MESSAGE_MAX_LEN || len > RECV_BUFFER_MAX)
+			return KO(USER);
+
+		result->recvbuf_len = (size_t)len;
+		return OK;
+	}
+
+	if (strcmp(key, "shm_ring") == 0)
+	{
+		char* end;
+		long long len = strtoll(value, &end, 10);
+
+		if (*end != '\0' || len < 4*MESSAGE_MAX_LEN || len > SHM_RING_MAX || (len & (len - 1)) != 0)
+			return KO(USER);
+
+		result->shm_ring_len = (size_t)len;
+		return OK;
+	}
+	if (strcmp(key, "coin_cache") == 0)
+	{
+		char* end;
+		long long len = strtoll(value, &end, 10);
+
+		if (*end != '\0' || len < COIN_CACHE_MIN || len > COIN_CACHE_MAX)
+			return KO(USER);
+
+		result->coin_cache_len = (size_t)len;
+		return OK;
+	}
+	if (strcmp(key, "block_overlay") == 0)
+	{
+		char* end;
+		long long len = strtoll(value, &end, 10);
+
+		if (*end != '\0' || len < BLOCK_OVERLAY_MIN || len > BLOCK_OVERLAY_MAX)
+			return KO(USER);
+
+		result->block_overlay_len = (size_t)len;
+		return OK;
+	}
+	if (strcmp(key, "arena") == 0)
+	{
+		char* end;
+		long long len = strtoll(value, &end, 10);
+
+		// checked once all the options are known, see 'connection_new'
+		if (*end != '\0' || len <= 0)
+			return KO(USER);
+
+		result->arena_len = (size_t)len;
+		return OK;
+	}
+	if (strcmp(key, "huge_pages") == 0)
+	{
+		if (strcmp(value, "1") == 0 || strcmp(value, "0") == 0)
+		{
+			result->huge_pages = value[0] == '1';
+			return OK;
+		}
+	}
+	if (strcmp(key, "io") == 0)
+	{
+		if (strcmp(value, "uring") == 0)
+		{
+			result->use_uring = 1;
+			return OK;
+		}
+		if (strcmp(value, "socket") == 0)
+		{
+			result->use_uring = 0;
+			return OK;
+		}
+	}
+	if (strcmp(key, "wire") == 0)
+	{
+		if (strcmp(value, "compact") == 0)
+		{
+			result->wire_format = WIRE_COMPACT;
+			return OK;
+		}
+		if (strcmp(value, "fixed") == 0)
+		{
+			result->wire_format = WIRE_FIXED;
+			return OK;
+		}
+	}
+	return KO(USER);
+}
+
+/* Parses the ';'-separated 'key=value' pairs which follow the address,
+   as in "127.0.0.1:8338;io=uring". The options are split in place. */
+return_status_t parse_connection_options(char* options, connection_s* result)
+{
+	while (options && *options)
+	{
+		char* next = strchr(options, ';');
+		if (next)
+		{
+			*next++ = '\0';
+		}
+
+		char* value = strchr(options, '=');
+		if (value == NULL)
+		{
+			return KO(USER);
+		}
+		*value++ = '\0';
+
+		if (!parse_connection_option(options, value, result))
+		{
+			return RS_FAILURE;
+		}
+		options = next;
+	}
+	return OK;
+}
+
 return_status_t tokenize_connection_string(const char* connection_string, range* ip_str, range* portnum_str)
 {
 	const char *ip_begin, *port_begin = NULL;
@@ -449,5 +1585,34 @@ return_status_t tokenize_connection_string(const char* connection_string, range*
 
 range connection_get_send_buffer(connection_s* conn)
 {
+	// every request id takes a slot of 'window_items', including those
+	// outside batches; the oldest must be answered before it is reused,
+	// otherwise 'accept_message' refuses the request
+	if (conn->msg_seq - conn->window_base >= WINDOW_MAX)
+	{
+		window_wait(conn, WINDOW_MAX);
+	}
+
+	// requests are written straight into the shared ring; on failure,
+	// 'sendbuf' is handed out and the next send fails
+	if (conn->shm)
+	{
+		char* reserved = NULL;
+		while (shmem_reserve(conn->shm, &reserved) && reserved == NULL)
+		{
+			// the ring is full, the instance may be blocked on responses
+			if (!connection_poll(conn))
+				break;
+		}
+		conn->sendptr = reserved ? reserved : conn->sendbuf;
+		return range_init(conn->sendptr, MESSAGE_MAX_LEN);
+	}
+
+	// with io_uring, a flushed buffer may still be in the hands of the kernel;
+	// a failure here shows up on the next send
+	if (conn->uring && conn->sendptr == conn->sendbuf)
+	{
+		uring_send_wait(conn->uring);
+	}
 	return range_init(conn->sendptr, MESSAGE_MAX_LEN);
 }
\ No newline at end of file
@@ -2,15 +2,90 @@
 
 #include <stdint.h>
 
+#include "compat.h"
+#include "terab.h"
 #include "ranges.h"
 #include "status.h"
+#include "coin_cache.h"
+#include "block_overlay.h"
 
 // you'll read in the (C#) server code that messages longer than 16k are too long to be considered
 #define MESSAGE_MAX_LEN (16*1024)
 #define DEFAULT_PORT_NUMBER 8338
 
+// maximal number of asynchronous batches in flight on a single connection
+#define MAX_PENDING_BATCHES 16
+
+// remainders of a response shorter than this are not worth receiving
+// straight into the caller memory, see 'batch_stream_t'
+#define DIRECT_RECV_MIN_LEN 512
+
+// encodings of the multi-coin messages, see 'negotiate_connection'
+#define WIRE_FIXED 1
+#define WIRE_COMPACT 2
+
+// bound of the window of requests in flight, see 'connection_window_acquire'
+#define WINDOW_MAX 256
+
+// window assumed when the instance does not advertise any
+#define WINDOW_DEFAULT 32
+
 typedef struct connection_struct connection_s;
 
+/* A batch groups the requests sent by a single 'get_coins' or 'set_coins'
+   call. As request ids are allocated sequentially, a batch covers the range
+   [first_request_id, first_request_id + request_count) and any response in
+   this range is routed to the batch, whatever the order of arrival.
+
+   A request may carry many items (coins), and its response may be split
+   into several messages: the batch completes once all its items are settled.
+*/
+typedef struct pending_batch_struct pending_batch_s;
+
+/* Decodes one response of the batch, and decrements 'remaining' by the
+   number of items it settles. 'index' is the position of the matching
+   request within the batch. */
+typedef return_status_t (*batch_handler_t)(pending_batch_s* batch, uint32_t index, range* reply);
+
+/* Optional, decodes a large response of the batch while it is still being
+   received, in place of 'batch_handler_t'. 'part' holds the bytes received
+   and not decoded yet; the handler moves 'part->begin' past the bytes it
+   decodes, leaving the rest for the next call. It may also set 'direct' to
+   the memory where the bytes following 'part' belong, in which case it must
+   have decoded all of 'part': these bytes are then received straight into
+   'direct' instead of the receive buffer. */
+typedef return_status_t (*batch_stream_t)(pending_batch_s* batch, range* part, /* out */ range* direct);
+
+struct pending_batch_struct
+{
+	terab_ticket_t ticket; // zero when the slot is free
+	uint32_t first_request_id;
+	int32_t request_count;
+	int32_t item_count;
+	int32_t remaining;     // items not settled yet
+	int32_t status;        // terab status code of the whole batch
+	batch_handler_t on_response;
+	batch_stream_t on_stream; // NULL when responses are always decoded whole
+
+	// state of the coin operations
+	coin_t* coins;
+	range storage;
+	int32_t script_offset;  // offset of 'storage.begin' in the storage of the caller
+	int32_t overflow_offset; // offset given to the next script which does not fit, past the storage
+	int32_t streamed_count; // items left in the streamed response, -1 before its header
+	block_handle_t context;
+	coin_cache_s* cache;    // NULL unless the connection caches coins
+	block_overlay_s* overlay; // NULL unless the connection keeps an overlay
+	const uint8_t* const* scripts; // scripts of 'set_coins_v', otherwise they are in 'storage'
+	int32_t* coin_map;      // item index to coin index, NULL if identical; freed with the batch
+	int32_t events_first;   // items from this one on are read without their payload
+	int scripts_in_place;   // scripts go back to the offsets already set in the coins, see 'refetch_coins'
+	// measure of the batch, recorded when it is freed
+	int stats_op;           // 'TERAB_STATS_OP_*', -1 when the batch is not measured
+	int64_t submitted_us;   // 'stats_now_us()' when the batch was created
+	int64_t queued_us;      // time spent waiting for the window while it was sent
+};
+
 connection_s* connection_new(const char* connection_string);
 void connection_free(connection_s* connection);
 
@@ -20,7 +95,91 @@ return_status_t connection_close(connection_s* connection);
 return_status_t connection_batch_begin(connection_s* conn);
 range connection_get_send_buffer(connection_s* conn);
 return_status_t connection_send_request(connection_s* conn, const char* bufEnd, /* out, optional */ uint32_t* requestId);
+
+/* Same as 'connection_send_request', the message being followed by 'tail'.
+   Long tails are sent straight from the caller memory, which must remain
+   untouched until the end of the batch, or until the function returns
+   outside of batches. */
+return_status_t connection_send_request_tail(connection_s* conn, const char* bufEnd,
+	const char* tail, size_t tail_len, /* out, optional */ uint32_t* requestId);
+
+/* Appends 'tail' to the request being written in 'buffer', whose writing
+   continues after it. Same as 'connection_send_request_tail', long tails are
+   sent straight from the caller memory; the room left in 'buffer' shrinks
+   accordingly, a request never exceeding MESSAGE_MAX_LEN. */
+void connection_write_tail(connection_s* conn, range* buffer, const char* tail, size_t tail_len);
 return_status_t connection_batch_end(connection_s* conn);
 
+/* Waits for the next response which does not belong to a pending batch.
+   Responses belonging to pending batches are dispatched along the way. */
 return_status_t connection_wait_response(connection_s* conn, /* out */ range* reply);
 
+/* Reserves a batch of 'item_count' items, sent through 'request_count'
+   requests starting at the next request id. Returns NULL if
+   MAX_PENDING_BATCHES batches are already pending. */
+pending_batch_s* connection_pending_new(connection_s* conn, int32_t request_count, int32_t item_count,
+	batch_handler_t on_response);
+pending_batch_s* connection_pending_find(connection_s* conn, terab_ticket_t ticket);
+void connection_pending_free(connection_s* conn, pending_batch_s* batch);
+
+/* Returns a pending batch which has received all its responses, if any. */
+pending_batch_s* connection_pending_completed(connection_s* conn);
+int32_t connection_pending_count(connection_s* conn);
+
+/* Completes all the pending batches with the given status, intended for
+   connections which are known to be broken. */
+void connection_pending_fail(connection_s* conn, int32_t status);
+
+SOCKET connection_get_socket(connection_s* conn);
+
+/* The cache requested through the 'coin_cache' option, NULL if none. */
+coin_cache_s* connection_coin_cache(connection_s* conn);
+
+/* The overlay requested through the 'block_overlay' option, NULL if none. */
+block_overlay_s* connection_block_overlay(connection_s* conn);
+
+/* Coins written without acknowledgement, which the instance reports upon
+   the next sync. They are numbered from zero after each sync, and all go
+   to the same block in between. */
+typedef struct
+{
+	block_handle_t block;
+	int32_t count;
+} unsynced_writes_s;
+
+unsynced_writes_s* connection_unsynced_writes(connection_s* conn);
+
+/* Counters of the connection, returned by 'terab_get_stats()'. */
+terab_stats_t* connection_stats(connection_s* conn);
+
+/* Total time spent in 'connection_window_acquire' waiting for room in the
+   window, the queue time of the batches being measured as its difference. */
+int64_t connection_window_wait_us(connection_s* conn);
+
+/* The shard the connection stands for, being its first member, NULL if
+   none. The calls of the API on the connection then go to the shard,
+   see 'shard.h'. */
+struct shard_struct* connection_shard(connection_s* conn);
+void connection_set_shard(connection_s* conn, struct shard_struct* shard);
+
+/* The format requested through the 'wire' option, until 'negotiate_connection'
+   replaces it with the one agreed upon with the instance. */
+int connection_wire_format(connection_s* conn);
+void connection_set_wire_format(connection_s* conn, int wire_format);
+
+/* Number of batch requests which may be in flight at once, as advertised
+   by the instance, bounded by WINDOW_MAX. */
+void connection_set_window(connection_s* conn, int32_t window);
+
+/* Waits until the window lets the next request of a batch be sent,
+   flushing the requests written so far and dispatching the responses
+   received meanwhile. The next request sent then holds its place in the
+   window until its 'item_count' items are settled. The requests outside
+   batches are not counted, as their response is awaited right away. */
+return_status_t connection_window_acquire(connection_s* conn, int32_t item_count);
+
+/* Dispatches the responses already received by the socket, without blocking. */
+return_status_t connection_poll(connection_s* conn);
+
+/* Blocks until all the responses of the batch have been dispatched. */
+return_status_t connection_wait_batch(connection_s* conn, pending_batch_s* batch);
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "engine.h"
+#include "alloc.h"
+#include "stats.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define ENGINE_EPOLL 1
+#endif
+
+// number of readiness events collected per system call
+#define EVENTS_PER_WAIT 64
+
+typedef struct {
+	connection_s* conn;
+	int lost; // no longer waited on, see 'on_readable'
+} engine_entry_s;
+
+typedef struct engine_struct {
+	engine_entry_s* entries;
+	int32_t conn_count;
+	int32_t conn_capacity;
+#ifdef ENGINE_EPOLL
+	int epoll_fd;
+#else
+	struct pollfd* polls; // as many as 'entries', see 'wait_readable'
+#endif
+} engine_s;
+
+engine_s* engine_new(void)
+{
+	engine_s* engine = (engine_s*)client_alloc(sizeof(engine_s));
+	if (engine == NULL)
+		return NULL;
+
+#ifdef ENGINE_EPOLL
+	engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (engine->epoll_fd < 0)
+	{
+		client_free(engine);
+		return NULL;
+	}
+#endif
+
+	return engine;
+}
+
+void engine_free(engine_s* engine)
+{
+#ifdef ENGINE_EPOLL
+	close(engine->epoll_fd);
+#else
+	client_free(engine->polls);
+#endif
+	client_free(engine->entries);
+	client_free(engine);
+}
+
+static int32_t find_connection(engine_s* engine, connection_s* conn)
+{
+	for (int32_t i = 0; i < engine->conn_count; i++)
+	{
+		if (engine->entries[i].conn == conn)
+			return i;
+	}
+	return -1;
+}
+
+return_status_t engine_add(engine_s* engine, connection_s* conn)
+{
+	if (find_connection(engine, conn) >= 0)
+		return KO(USER);
+
+	// shared-memory connections have no descriptor to wait on
+	if (connection_get_socket(conn) == INVALID_SOCKET)
+		return KO(USER);
+
+	if (engine->conn_count == engine->conn_capacity)
+	{
+		int32_t capacity = engine->conn_capacity == 0 ? 16 : 2 * engine->conn_capacity;
+		engine_entry_s* entries = (engine_entry_s*)client_alloc(capacity * sizeof(engine_entry_s));
+		if (entries == NULL)
+			return KO(RUNTIME);
+
+		memcpy(entries, engine->entries, engine->conn_count * sizeof(engine_entry_s));
+		client_free(engine->entries);
+		engine->entries = entries;
+
+#ifndef ENGINE_EPOLL
+		// filled anew by each wait, nothing to copy
+		struct pollfd* polls = (struct pollfd*)client_alloc(capacity * sizeof(struct pollfd));
+		if (polls == NULL)
+			return KO(RUNTIME);
+
+		client_free(engine->polls);
+		engine->polls = polls;
+#endif
+		engine->conn_capacity = capacity;
+	}
+
+#ifdef ENGINE_EPOLL
+	struct epoll_event event = { 0 };
+	event.events = EPOLLIN;
+	event.data.ptr = conn;
+	if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, connection_get_socket(conn), &event))
+		return KO(USER);
+#endif
+
+	engine->entries[engine->conn_count].conn = conn;
+	engine->entries[engine->conn_count].lost = 0;
+	engine->conn_count++;
+	return OK;
+}
+
+return_status_t engine_remove(engine_s* engine, connection_s* conn)
+{
+	int32_t index = find_connection(engine, conn);
+	if (index < 0)
+		return KO(USER);
+
+#ifdef ENGINE_EPOLL
+	if (!engine->entries[index].lost)
+	{
+		struct epoll_event event = { 0 }; // non-null pointer required by older kernels
+		epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, connection_get_socket(conn), &event);
+	}
+#endif
+
+	engine->entries[index] = engine->entries[--engine->conn_count];
+	return OK;
+}
+
+static void on_readable(engine_s* engine, engine_entry_s* entry)
+{
+	if (!connection_poll(entry->conn))
+	{
+		// the connection is lost, so are the responses still expected; its
+		// socket stays readable, hence is no longer waited on, but its
+		// failed batches remain to be harvested
+		connection_pending_fail(entry->conn, TERAB_ERR_CONNECTION_FAILED);
+		entry->lost = 1;
+
+#ifdef ENGINE_EPOLL
+		struct epoll_event event = { 0 };
+		epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, connection_get_socket(entry->conn), &event);
+#else
+		(void)engine;
+#endif
+	}
+}
+
+static int32_t harvest(engine_s* engine, int32_t capacity, terab_completion_t* completions)
+{
+	int32_t count = 0;
+	for (int32_t i = 0; i < engine->conn_count && count < capacity; i++)
+	{
+		connection_s* conn = engine->entries[i].conn;
+		pending_batch_s* batch;
+
+		while (count < capacity && (batch = connection_pending_completed(conn)) != NULL)
+		{
+			completions[count].conn = conn;
+			completions[count].ticket = batch->ticket;
+			completions[count].status = batch->status;
+			count++;
+
+			connection_pending_free(conn, batch);
+		}
+	}
+	return count;
+}
+
+static int any_pending(engine_s* engine)
+{
+	// nothing is to be received on the lost connections
+	for (int32_t i = 0; i < engine->conn_count; i++)
+	{
+		if (!engine->entries[i].lost && connection_pending_count(engine->entries[i].conn) > 0)
+			return 1;
+	}
+	return 0;
+}
+
+#ifdef ENGINE_EPOLL
+static return_status_t wait_readable(engine_s* engine, int32_t timeout_ms, int* timed_out)
+{
+	struct epoll_event events[EVENTS_PER_WAIT];
+
+	int n = epoll_wait(engine->epoll_fd, events, EVENTS_PER_WAIT, timeout_ms < 0 ? -1 : timeout_ms);
+	if (n < 0)
+	{
+		if (errno == EINTR)
+			return OK;
+		return KO(RUNTIME);
+	}
+
+	*timed_out = n == 0;
+	for (int i = 0; i < n; i++)
+	{
+		int32_t index = find_connection(engine, (connection_s*)events[i].data.ptr);
+		if (index >= 0)
+			on_readable(engine, &engine->entries[index]);
+	}
+	return OK;
+}
+#else
+static return_status_t wait_readable(engine_s* engine, int32_t timeout_ms, int* timed_out)
+{
+	// the descriptors are listed in the order of the entries still waited on
+	int32_t poll_count = 0;
+	for (int32_t i = 0; i < engine->conn_count; i++)
+	{
+		if (engine->entries[i].lost)
+			continue;
+
+		struct pollfd* readable = &engine->polls[poll_count++];
+		readable->fd = connection_get_socket(engine->entries[i].conn);
+		readable->events = POLLIN;
+		readable->revents = 0;
+	}
+
+	int n = poll(engine->polls, poll_count, timeout_ms < 0 ? -1 : timeout_ms);
+	if (n < 0)
+		return KO(RUNTIME);
+
+	*timed_out = n == 0;
+	int32_t k = 0;
+	for (int32_t i = 0; i < engine->conn_count && n > 0; i++)
+	{
+		if (engine->entries[i].lost)
+			continue;
+
+		if (engine->polls[k++].revents != 0)
+		{
+			on_readable(engine, &engine->entries[i]);
+			n--;
+		}
+	}
+	return OK;
+}
+#endif
+
+return_status_t engine_wait(engine_s* engine, int32_t timeout_ms,
+	int32_t capacity, terab_completion_t* completions, int32_t* count)
+{
+	*count = harvest(engine, capacity, completions);
+
+	// the responses may trickle in without completing any batch
+	int64_t deadline_us = timeout_ms < 0 ? 0 : stats_now_us() + (int64_t)timeout_ms * 1000;
+
+	while (*count == 0 && any_pending(engine))
+	{
+		int32_t remaining_ms = timeout_ms;
+		if (timeout_ms >= 0)
+		{
+			int64_t left_us = deadline_us - stats_now_us();
+			remaining_ms = left_us <= 0 ? 0 : (int32_t)((left_us + 999) / 1000);
+		}
+
+		int timed_out = 0;
+		if (!wait_readable(engine, remaining_ms, &timed_out))
+			return RS_FAILURE;
+
+		*count = harvest(engine, capacity, completions);
+
+		if (timed_out || (timeout_ms >= 0 && remaining_ms == 0))
+			break;
+	}
+
+	return OK;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "terab.h"
+#include "connection.h"
+#include "status.h"
+
+/* Drives many connections from a single thread.
+
+   The engine waits for any of its connections to become readable, and
+   dispatches the received responses to the pending batches of this
+   connection. Batches complete in the order their responses arrive,
+   regardless of the connection they belong to.
+
+   On Linux, readiness is obtained through 'epoll'. Elsewhere, the engine
+   falls back on 'poll'.
+*/
+typedef struct engine_struct engine_s;
+
+engine_s* engine_new(void);
+void engine_free(engine_s* engine);
+
+return_status_t engine_add(engine_s* engine, connection_s* conn);
+return_status_t engine_remove(engine_s* engine, connection_s* conn);
+
+/* Collects up to 'capacity' completed batches, releasing their tickets.
+   Blocks up to 'timeout_ms' (negative for no timeout) if no batch has
+   completed yet. Returns immediately if no batch is pending at all. */
+return_status_t engine_wait(engine_s* engine, int32_t timeout_ms,
+	int32_t capacity, terab_completion_t* completions, int32_t* count);
@@ -0,0 +1,441 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "compat.h"
+
+#include "hedge.h"
+#include "alloc.h"
+#include "stats.h"
+
+// latencies of the latest reads, from which the delay is taken
+#define HEDGE_SAMPLES 64
+
+// reads observed before the delay is taken from their latencies
+#define HEDGE_MIN_SAMPLES 16
+
+// delay until enough reads have been observed
+#define HEDGE_DEFAULT_DELAY_US 10000
+
+// batches left pending on a connection past which reads are not hedged,
+// so that a stalled instance keeps room for the batches of the next reads
+#define HEDGE_MAX_ORPHANS (MAX_PENDING_BATCHES / 2)
+
+// a coin is answered once it is given one of these statuses
+#define ANSWERED (TERAB_COIN_STATUS_SUCCESS | TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND)
+
+/* A batch left pending by a read which returned before it completed. The
+   batch writes to memory of the hedge, released once it completes. */
+typedef struct {
+	connection_s* conn;
+	terab_ticket_t ticket;
+	coin_t* coins;
+	char* storage;
+} hedge_orphan_s;
+
+typedef struct hedge_struct {
+	connection_s* primary;
+	connection_s* secondary;
+	int32_t delay_us;          // zero when taken from the latencies
+	block_handle_t offset;     // see 'get_block_handle_offset'
+	int offset_resolved;
+	block_handle_t unresolved; // latest context the offset could not be learned from
+	int waitable;              // both connections have a descriptor to wait on
+	int64_t latencies[HEDGE_SAMPLES]; // circular, in microseconds
+	int32_t latency_count;
+	hedge_orphan_s orphans[2 * HEDGE_MAX_ORPHANS];
+	int32_t orphan_count;
+} hedge_s;
+
+static connection_s* open_connection(const char* connection_string)
+{
+	connection_s* conn = connection_new(connection_string);
+	if (conn == NULL || !connection_open(conn) || negotiate_connection(conn) != TSE_SUCCESS)
+	{
+		if (conn != NULL)
+		{
+			connection_close(conn); // no-op unless the negotiation failed
+			connection_free(conn);
+		}
+		return NULL;
+	}
+	return conn;
+}
+
+static void close_connection(connection_s* conn)
+{
+	connection_close(conn);
+	connection_free(conn);
+}
+
+hedge_s* hedge_new(const char* primary_string, const char* secondary_string, int32_t delay_us)
+{
+	hedge_s* hedge = (hedge_s*)client_alloc(sizeof(hedge_s));
+	if (hedge == NULL)
+		return NULL;
+
+	hedge->delay_us = delay_us > 0 ? delay_us : 0;
+	hedge->primary = open_connection(primary_string);
+	hedge->secondary = hedge->primary != NULL ? open_connection(secondary_string) : NULL;
+
+	if (hedge->secondary == NULL)
+	{
+		if (hedge->primary != NULL)
+			close_connection(hedge->primary);
+		client_free(hedge);
+		return NULL;
+	}
+
+	// shared-memory connections have no descriptor, the primary would
+	// have to be spun on for the whole delay
+	hedge->waitable = connection_get_socket(hedge->primary) != INVALID_SOCKET
+		&& connection_get_socket(hedge->secondary) != INVALID_SOCKET;
+
+	return hedge;
+}
+
+static void release_orphan(hedge_s* hedge, int32_t index)
+{
+	client_free(hedge->orphans[index].coins);
+	client_free(hedge->orphans[index].storage);
+	hedge->orphans[index] = hedge->orphans[--hedge->orphan_count];
+}
+
+void hedge_free(hedge_s* hedge)
+{
+	while (hedge->orphan_count > 0)
+	{
+		hedge_orphan_s* orphan = hedge->orphans + hedge->orphan_count - 1;
+		pending_batch_s* batch = connection_pending_find(orphan->conn, orphan->ticket);
+		if (batch != NULL)
+			connection_pending_free(orphan->conn, batch);
+
+		release_orphan(hedge, hedge->orphan_count - 1);
+	}
+
+	close_connection(hedge->primary);
+	close_connection(hedge->secondary);
+	client_free(hedge);
+}
+
+connection_s* hedge_primary(hedge_s* hedge)
+{
+	return hedge->primary;
+}
+
+/* Releases the orphans whose batch has completed. */
+static void drain_orphans(hedge_s* hedge)
+{
+	for (int32_t i = hedge->orphan_count - 1; i >= 0; i--)
+	{
+		int32_t completed;
+		hedge_orphan_s* orphan = hedge->orphans + i;
+
+		// a failed poll means a broken connection, the batch completes anyway
+		poll_batch(orphan->conn, orphan->ticket, &completed);
+		if (completed || connection_pending_find(orphan->conn, orphan->ticket) == NULL)
+			release_orphan(hedge, i);
+	}
+}
+
+static int32_t count_orphans(hedge_s* hedge, connection_s* conn)
+{
+	int32_t count = 0;
+	for (int32_t i = 0; i < hedge->orphan_count; i++)
+		count += hedge->orphans[i].conn == conn;
+	return count;
+}
+
+static void record_latency(hedge_s* hedge, int64_t latency)
+{
+	hedge->latencies[hedge->latency_count++ % HEDGE_SAMPLES] = latency;
+}
+
+static int compare_latencies(const void* left, const void* right)
+{
+	int64_t l = *(const int64_t*)left, r = *(const int64_t*)right;
+	return l < r ? -1 : l > r;
+}
+
+static int64_t hedge_delay(hedge_s* hedge)
+{
+	if (hedge->delay_us > 0)
+		return hedge->delay_us;
+
+	if (hedge->latency_count < HEDGE_MIN_SAMPLES)
+		return HEDGE_DEFAULT_DELAY_US;
+
+	int32_t count = hedge->latency_count < HEDGE_SAMPLES ? hedge->latency_count : HEDGE_SAMPLES;
+	int64_t sorted[HEDGE_SAMPLES];
+	memcpy(sorted, hedge->latencies, count * sizeof(int64_t));
+	qsort(sorted, count, sizeof(int64_t), compare_latencies);
+
+	return sorted[count * 95 / 100];
+}
+
+/* Waits until 'first', or 'second' when not NULL, has received bytes,
+   at most 'timeout_us' (negative for no timeout). */
+static return_status_t wait_readable(connection_s* first, connection_s* second, int64_t timeout_us)
+{
+	SOCKET first_socket = connection_get_socket(first);
+	SOCKET second_socket = second != NULL ? connection_get_socket(second) : first_socket;
+
+	struct pollfd readable[2] = { { 0 } };
+	readable[0].fd = first_socket;
+	readable[0].events = POLLIN;
+	readable[1].fd = second_socket;
+	readable[1].events = POLLIN;
+
+	// rounded up, not to wake up before the delay of the hedge
+	int timeout_ms = -1;
+	if (timeout_us >= 0)
+		timeout_ms = timeout_us / 1000 >= INT_MAX ? INT_MAX : (int)((timeout_us + 999) / 1000);
+
+	if (poll(readable, second != NULL ? 2 : 1, timeout_ms) < 0)
+		return KO(CONNECTIVITY);
+
+	return OK;
+}
+
+/* Leaves the batch of the secondary pending, its memory being handed to
+   the orphan. */
+static void orphan_secondary(hedge_s* hedge, terab_ticket_t ticket, coin_t** coins, char** storage)
+{
+	hedge_orphan_s orphan = { 0 };
+	orphan.conn = hedge->secondary;
+	orphan.ticket = ticket;
+	orphan.coins = *coins;
+	orphan.storage = *storage;
+
+	hedge->orphans[hedge->orphan_count++] = orphan;
+	*coins = NULL;
+	*storage = NULL;
+}
+
+/* Leaves the batch of the primary pending, its remaining responses going
+   to memory of the hedge. Returns the room the batch left in the storage
+   of the caller, and the offset of the next span past its end. */
+static return_status_t orphan_primary(hedge_s* hedge, terab_ticket_t ticket, int32_t coin_length,
+	/* out */ range* room, int32_t* room_offset, int32_t* overflow_offset)
+{
+	pending_batch_s* batch = connection_pending_find(hedge->primary, ticket);
+
+	*room = batch->storage;
+	*room_offset = batch->script_offset;
+	*overflow_offset = batch->overflow_offset;
+
+	hedge_orphan_s orphan = { 0 };
+	orphan.conn = hedge->primary;
+	orphan.ticket = ticket;
+	orphan.coins = (coin_t*)client_alloc(coin_length * sizeof(coin_t));
+	orphan.storage = range_len(batch->storage) > 0 ? (char*)client_alloc(range_len(batch->storage)) : NULL;
+	if (orphan.coins == NULL || (orphan.storage == NULL && range_len(batch->storage) > 0))
+	{
+		client_free(orphan.coins);
+		client_free(orphan.storage);
+		return KO(RUNTIME);
+	}
+
+	memcpy(orphan.coins, batch->coins, coin_length * sizeof(coin_t));
+	batch->coins = orphan.coins;
+	batch->storage = range_init(orphan.storage, range_len(batch->storage));
+
+	hedge->orphans[hedge->orphan_count++] = orphan;
+	return OK;
+}
+
+static int all_answered(const coin_t* coins, const int32_t* missing, int32_t missing_count, const coin_t* hedged)
+{
+	for (int32_t j = 0; j < missing_count; j++)
+	{
+		if (!(coins[missing[j]].status & ANSWERED) && !(hedged[j].status & ANSWERED))
+			return 0;
+	}
+	return 1;
+}
+
+/* Completes the coins of the caller the primary has not answered with the
+   answers of the secondary, their scripts going to the room left by the
+   primary, as 'get_coins' would have laid them out. */
+static void merge_answers(hedge_s* hedge, coin_t* coins, const int32_t* missing, int32_t missing_count,
+	const coin_t* hedged, const char* hedged_storage, range room, int32_t room_offset, int32_t overflow_offset)
+{
+	for (int32_t j = 0; j < missing_count; j++)
+	{
+		coin_t* coin = coins + missing[j];
+		if (coin->status & ANSWERED)
+			continue;
+
+		*coin = hedged[j];
+		translate_coin_events(coin, 1, hedge->offset);
+
+		coin->status &= ANSWERED;
+		if (!(hedged[j].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT) && range_len(room) >= (size_t)coin->script_length)
+		{
+			copy_bytes(&room, hedged_storage + hedged[j].script_offset, coin->script_length);
+			coin->script_offset = room_offset;
+			room_offset += coin->script_length;
+		}
+		else
+		{
+			coin->script_offset = overflow_offset;
+			coin->status |= TERAB_COIN_STATUS_STORAGE_TOO_SHORT;
+			overflow_offset += coin->script_length;
+		}
+	}
+}
+
+/* Polls the batch of the primary, then waits for the next bytes of either
+   connection, at most 'timeout_us'. Returns 1 and the status of the batch
+   once it has completed, 0 otherwise. */
+static int primary_completed(hedge_s* hedge, terab_ticket_t ticket, connection_s* other,
+	int64_t timeout_us, terab_status_enum_t* status)
+{
+	int32_t completed;
+	*status = poll_batch(hedge->primary, ticket, &completed);
+	if (completed || *status != TSE_SUCCESS)
+		return 1;
+
+	if (!wait_readable(hedge->primary, other, timeout_us))
+	{
+		*status = wait_batch(hedge->primary, ticket);
+		return 1;
+	}
+	return 0;
+}
+
+terab_status_enum_t hedge_get_coins(
+	hedge_s* hedge,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage)
+{
+	if (coin_length < 0)
+		return TSE_INVALID_REQUEST;
+
+	if (!hedge->waitable)
+		return get_coins(hedge->primary, context, cp_full, coin_length, coins, storage);
+
+	drain_orphans(hedge);
+
+	// the coins answered are told apart by their status
+	for (int32_t i = 0; i < coin_length; i++)
+		coins[i].status = TERAB_COIN_STATUS_NONE;
+
+	// learned before the primary is relied upon, which may stall later on;
+	// the secondary may not know the blocks yet, hence the next contexts
+	if (!hedge->offset_resolved && hedge->unresolved != context)
+	{
+		hedge->offset_resolved = get_block_handle_offset(hedge->primary, context,
+			hedge->secondary, &hedge->offset) == TSE_SUCCESS;
+		hedge->unresolved = hedge->offset_resolved ? 0 : context;
+	}
+
+	int64_t start = stats_now_us();
+	terab_ticket_t ticket;
+	terab_status_enum_t status = get_coins_async(hedge->primary, context, cp_full, coin_length, coins, storage, &ticket);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int64_t deadline = start + hedge_delay(hedge);
+	for (int64_t now = start; now < deadline; now = stats_now_us())
+	{
+		if (primary_completed(hedge, ticket, NULL, deadline - now, &status))
+		{
+			record_latency(hedge, stats_now_us() - start);
+			return status;
+		}
+	}
+
+	// the secondary is not hedged upon when it does not know the blocks
+	// of the primary, or when orphans would pile up on a stalled instance
+	if (!hedge->offset_resolved
+		|| count_orphans(hedge, hedge->primary) >= HEDGE_MAX_ORPHANS
+		|| count_orphans(hedge, hedge->secondary) >= HEDGE_MAX_ORPHANS)
+	{
+		status = wait_batch(hedge->primary, ticket);
+		record_latency(hedge, stats_now_us() - start);
+		return status;
+	}
+
+	int32_t missing_count = 0;
+	int32_t* missing = (int32_t*)client_alloc(coin_length * sizeof(int32_t));
+	coin_t* hedged = (coin_t*)client_alloc(coin_length * sizeof(coin_t));
+	char* hedged_storage = range_len(*storage) > 0 ? (char*)client_alloc(range_len(*storage)) : NULL;
+	if (missing == NULL || hedged == NULL || (hedged_storage == NULL && range_len(*storage) > 0))
+	{
+		client_free(missing);
+		client_free(hedged);
+		client_free(hedged_storage);
+		return wait_batch(hedge->primary, ticket);
+	}
+
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		if (!(coins[i].status & ANSWERED))
+		{
+			hedged[missing_count].outpoint = coins[i].outpoint;
+			missing[missing_count++] = i;
+		}
+	}
+
+	range hedged_range = range_init(hedged_storage, range_len(*storage));
+	terab_ticket_t hedged_ticket;
+	if (get_coins_async(hedge->secondary, context ^ hedge->offset, cp_full, missing_count, hedged,
+		&hedged_range, &hedged_ticket) != TSE_SUCCESS)
+	{
+		hedged_ticket = 0;
+	}
+
+	for (;;)
+	{
+		if (primary_completed(hedge, ticket, hedged_ticket != 0 ? hedge->secondary : NULL, -1, &status))
+		{
+			record_latency(hedge, stats_now_us() - start);
+			break;
+		}
+
+		if (hedged_ticket == 0)
+			continue;
+
+		int32_t completed;
+		terab_status_enum_t hedged_status = poll_batch(hedge->secondary, hedged_ticket, &completed);
+		if (hedged_status != TSE_SUCCESS)
+		{
+			// the secondary has failed, the primary is waited upon alone
+			if (!completed)
+				orphan_secondary(hedge, hedged_ticket, &hedged, &hedged_storage);
+			hedged_ticket = 0;
+			continue;
+		}
+
+		if (!all_answered(coins, missing, missing_count, hedged))
+			continue;
+
+		range room;
+		int32_t room_offset, overflow_offset;
+		if (!orphan_primary(hedge, ticket, coin_length, &room, &room_offset, &overflow_offset))
+			continue;
+
+		// the latency of the primary is at least as long
+		record_latency(hedge, stats_now_us() - start);
+
+		merge_answers(hedge, coins, missing, missing_count, hedged, hedged_storage,
+			room, room_offset, overflow_offset);
+
+		status = TSE_SUCCESS;
+		if (completed)
+			hedged_ticket = 0;
+		break;
+	}
+
+	// the secondary is left to complete in the memory of the hedge
+	if (hedged_ticket != 0)
+		orphan_secondary(hedge, hedged_ticket, &hedged, &hedged_storage);
+
+	client_free(missing);
+	client_free(hedged);
+	client_free(hedged_storage);
+	return status;
+}
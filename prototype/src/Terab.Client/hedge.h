@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "terab.h"
+#include "ranges.h"
+#include "connection.h"
+#include "protocol.h"
+
+/* A pair of connections to two Terab instances fed with the same blocks,
+   a primary and a secondary. Reads go to the primary; those which take
+   longer than a delay are issued again to the secondary, for the coins not
+   answered yet, and each coin takes the first answer it gets.
+
+   The hedge bounds the wait for the responses of the primary, not within
+   them: a response partially received is received to its end, hence a
+   stall of the primary in the middle of a response is not hedged.
+
+   Reads are not hedged when either connection is over shared memory,
+   which has no descriptor to wait on: they then go to the primary alone.
+
+   Block handles are those of the primary, and translated for the secondary.
+   Like a connection, a hedge is used from a single thread at a time.
+*/
+typedef struct hedge_struct hedge_s;
+
+/* With a positive 'delay_us', reads are hedged after that many
+   microseconds. Otherwise, they are hedged past the 95th percentile of the
+   latencies of the latest reads. */
+hedge_s* hedge_new(const char* primary_string, const char* secondary_string, int32_t delay_us);
+void hedge_free(hedge_s* hedge);
+
+connection_s* hedge_primary(hedge_s* hedge);
+
+/* Same as 'get_coins' on the primary, hedged on the secondary. */
+terab_status_enum_t hedge_get_coins(
+	hedge_s* hedge,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage);
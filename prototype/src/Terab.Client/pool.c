@@ -0,0 +1,162 @@
+#include <stdlib.h>
+
+#include "compat.h"
+
+#include "pool.h"
+#include "alloc.h"
+#include "protocol.h"
+
+#if defined(_MSC_VER)
+#define CAS_INT32(ptr, expected, desired) \
+	(InterlockedCompareExchange((volatile LONG*)(ptr), (desired), (expected)) == (expected))
+#define STORE_RELEASE_INT32(ptr, value) InterlockedExchange((volatile LONG*)(ptr), (value))
+#define FETCH_ADD_INT32(ptr, value) InterlockedExchangeAdd((volatile LONG*)(ptr), (value))
+#define YIELD() SwitchToThread()
+#else
+#include <sched.h>
+#define CAS_INT32(ptr, expected, desired) \
+	__sync_bool_compare_and_swap((ptr), (expected), (desired))
+#define STORE_RELEASE_INT32(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define FETCH_ADD_INT32(ptr, value) __sync_fetch_and_add((ptr), (value))
+#define YIELD() sched_yield()
+#endif
+
+// number of full scans of the pool before yielding the thread
+#define SPIN_SCANS 64
+
+// one slot per cache line, threads checking out neighbor slots do not interfere
+#define CACHE_LINE_LEN 64
+
+typedef struct pool_slot_struct {
+	connection_s* conn; // first, no alignment hole before the padding
+	volatile int32_t busy;
+	char padding[CACHE_LINE_LEN - sizeof(connection_s*) - sizeof(int32_t)];
+} pool_slot_s;
+
+typedef char pool_slot_is_a_cache_line[sizeof(pool_slot_s) == CACHE_LINE_LEN ? 1 : -1];
+
+typedef struct pool_struct {
+	int32_t count;
+	volatile int32_t next_start; // spreads the threads without affinity yet
+	pool_slot_s* slots; // aligned on a cache line within 'slots_block'
+	void* slots_block;
+} pool_s;
+
+/* Slot of the last connection checked out by the current thread. */
+typedef struct {
+	pool_s* pool;
+	int32_t slot;
+} affinity_s;
+
+#if defined(_MSC_VER)
+__declspec(thread) static affinity_s affinity;
+#else
+static __thread affinity_s affinity;
+#endif
+
+pool_s* pool_new(const char* connection_string, int32_t connection_count)
+{
+	if (connection_count <= 0)
+		return NULL;
+
+	pool_s* pool = (pool_s*)client_alloc(sizeof(pool_s));
+	if (pool == NULL)
+		return NULL;
+
+	// the allocator only guarantees the alignment of the scalar types
+	pool->slots_block = client_alloc((connection_count + 1) * sizeof(pool_slot_s));
+	if (pool->slots_block == NULL)
+	{
+		pool_free(pool);
+		return NULL;
+	}
+
+	uintptr_t slots = ((uintptr_t)pool->slots_block + CACHE_LINE_LEN - 1) & ~(uintptr_t)(CACHE_LINE_LEN - 1);
+	pool->slots = (pool_slot_s*)slots;
+
+	for (int32_t i = 0; i < connection_count; i++)
+	{
+		connection_s* conn = connection_new(connection_string);
+		if (conn == NULL || !connection_open(conn) || negotiate_connection(conn) != TSE_SUCCESS)
+		{
+			if (conn != NULL)
+			{
+				connection_close(conn); // no-op unless the negotiation failed
+				connection_free(conn);
+			}
+			pool_free(pool);
+			return NULL;
+		}
+
+		pool->slots[i].conn = conn;
+		pool->count = i + 1;
+	}
+
+	return pool;
+}
+
+void pool_free(pool_s* pool)
+{
+	for (int32_t i = 0; i < pool->count; i++)
+	{
+		connection_close(pool->slots[i].conn);
+		connection_free(pool->slots[i].conn);
+	}
+
+	if (affinity.pool == pool)
+		affinity.pool = NULL;
+
+	client_free(pool->slots_block);
+	client_free(pool);
+}
+
+connection_s* pool_acquire(pool_s* pool)
+{
+	int32_t start = affinity.pool == pool
+		? affinity.slot
+		: (int32_t)((uint32_t)FETCH_ADD_INT32(&pool->next_start, 1) % (uint32_t)pool->count);
+
+	for (;;)
+	{
+		for (int scan = 0; scan < SPIN_SCANS; scan++)
+		{
+			for (int32_t i = 0; i < pool->count; i++)
+			{
+				int32_t index = (start + i) % pool->count;
+				pool_slot_s* slot = pool->slots + index;
+
+				// plain read first, to avoid bouncing the cache line of busy slots
+				if (slot->busy == 0 && CAS_INT32(&slot->busy, 0, 1))
+				{
+					affinity.pool = pool;
+					affinity.slot = index;
+					return slot->conn;
+				}
+			}
+		}
+
+		// more threads than connections, let the owners make progress
+		YIELD();
+	}
+}
+
+return_status_t pool_release(pool_s* pool, connection_s* conn)
+{
+	// the releasing thread is usually the one which checked out the connection
+	int32_t start = affinity.pool == pool ? affinity.slot : 0;
+
+	for (int32_t i = 0; i < pool->count; i++)
+	{
+		pool_slot_s* slot = pool->slots + (start + i) % pool->count;
+		if (slot->conn == conn)
+		{
+			if (slot->busy == 0)
+				return KO(USER); // not checked out
+
+			STORE_RELEASE_INT32(&slot->busy, 0);
+			return OK;
+		}
+	}
+
+	return KO(USER);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "connection.h"
+#include "status.h"
+
+/* A fixed set of connections to the same Terab instance, shared between
+   threads. Checking out and returning a connection is lock-free.
+
+   Each thread remembers the slot of the last connection it checked out,
+   and tries this slot first at the next checkout. Hence, under a stable
+   workload, a thread keeps reusing the same connection, with its socket and
+   buffers warm in the thread's caches.
+*/
+typedef struct pool_struct pool_s;
+
+pool_s* pool_new(const char* connection_string, int32_t connection_count);
+void pool_free(pool_s* pool);
+
+/* Blocks (spinning, then yielding) until a connection is available. */
+connection_s* pool_acquire(pool_s* pool);
+return_status_t pool_release(pool_s* pool, connection_s* conn);
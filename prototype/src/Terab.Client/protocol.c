@@ -1,6 +1,12 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "protocol.h"
 #include "connection.h"
 #include "ranges.h"
+#include "alloc.h"
+#include "stats.h"
+#include "trace.h"
 
 typedef struct {
 	uint32_t size;
@@ -14,6 +20,90 @@ header_response_s read_response_header(range* source);
 open_block_response_s read_open_block(range* source);
 commit_block_response_s read_commit_block(range* source);
 get_block_handle_response_s read_get_block_handle(range* source);
+terab_status_enum_t get_block_handle_offset(connection_s* from,
+	block_handle_t block, connection_s* to, block_handle_t* offset)
+{
+	block_info_t info;
+	for (;;)
+	{
+		terab_status_enum_t status = get_block_info(from, block, &info);
+		if (status != TSE_SUCCESS)
+			return status;
+
+		if (info.flags & TERAB_BLOCK_COMMITTED)
+			break;
+
+		block = info.parent;
+	}
+
+	block_handle_t handle;
+	terab_status_enum_t status = get_committed_block_handle(to, &info.blockid, &handle);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	*offset = handle ^ block;
+	return TSE_SUCCESS;
+}
+
+void translate_coin_events(coin_t* coins, int32_t coin_length, block_handle_t offset)
+{
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		if (coins[i].production != 0)
+			coins[i].production ^= offset;
+		if (coins[i].consumption != 0)
+			coins[i].consumption ^= offset;
+	}
+}
+
+int32_t merge_coin_storage(coin_t* coins, int32_t coin_length, range* storage,
+	int32_t part_count, const int32_t* coin_first, const size_t* storage_first)
+{
+	size_t storage_len = range_len(*storage);
+	size_t packed = 0;
+
+	for (int32_t k = 0; k < part_count; k++)
+	{
+		size_t used = 0;
+		for (int32_t i = coin_first[k]; i < coin_first[k + 1]; i++)
+		{
+			if (!(coins[i].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT)
+				&& (size_t)coins[i].script_offset + coins[i].script_length > used)
+				used = (size_t)coins[i].script_offset + coins[i].script_length;
+		}
+
+		memmove(storage->begin + packed, storage->begin + storage_first[k], used);
+
+		for (int32_t i = coin_first[k]; i < coin_first[k + 1]; i++)
+		{
+			if (!(coins[i].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT))
+				coins[i].script_offset += (int32_t)packed;
+		}
+		packed += used;
+	}
+
+	size_t overflow = storage_len;
+	int32_t refetched = 0;
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		if (!(coins[i].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT))
+			continue;
+
+		if (overflow == storage_len && packed + coins[i].script_length <= storage_len)
+		{
+			coins[i].script_offset = (int32_t)packed;
+			packed += coins[i].script_length;
+			refetched = i + 1;
+		}
+		else
+		{
+			coins[i].script_offset = (int32_t)overflow;
+			overflow += coins[i].script_length;
+		}
+	}
+	return refetched;
+}
+
 get_block_info_response_s read_get_block_info(range* source);
 
 // Header - read & write
@@ -34,8 +124,61 @@ void write_header(range* buffer, int32_t message_kind)
 	write_int32(buffer, message_kind);  // message kind
 }
 
+// Negotiate
+terab_status_enum_t negotiate_connection(connection_s* conn)
+{
+	int requested = connection_wire_format(conn);
+
+	range buffer = connection_get_send_buffer(conn);
+	write_header(&buffer, negotiate_request);
+	write_uint8(&buffer, (uint8_t)requested);
+
+	if (!connection_send_request(conn, buffer.begin, NULL))
+		return TSE_CONNECTION_FAILED;
+
+	if (!connection_wait_response(conn, &buffer))
+		return TSE_CONNECTION_FAILED;
+
+	header_response_s header = read_response_header(&buffer);
+
+	// instances predating the negotiation reject it with a protocol error,
+	// as they would reject the multi-coin requests
+	if (header.kind != negotiate_response || range_len(buffer) < 1)
+		return TSE_CONNECTION_FAILED;
+
+	// the instance may only downgrade the format
+	uint8_t format = read_uint8(&buffer);
+	if (format != WIRE_FIXED && format != requested)
+		return TSE_CONNECTION_FAILED;
+
+	// instances predating the window do not advertise any
+	int32_t window = range_len(buffer) >= 2 ? read_uint16(&buffer) : WINDOW_DEFAULT;
+
+	connection_set_wire_format(conn, format);
+	connection_set_window(conn, window);
+	return TSE_SUCCESS;
+}
+
+/* Starts the measure of a call of 'op', returning its start for 'record_call'. */
+static int64_t begin_call(connection_s* conn, int op, int32_t items)
+{
+	TRACE(call_begin, conn, op, items);
+	return stats_now_us();
+}
+
+/* Records a call of 'op' which started at 'started_us', see 'stats_record'.
+   The requests of these calls are sent outside the window, and never queued. */
+static terab_status_enum_t record_call(connection_s* conn, int op, terab_status_enum_t status,
+	int32_t items, int64_t started_us)
+{
+	int64_t latency_us = stats_now_us() - started_us;
+	stats_record(connection_stats(conn), op, status, items, latency_us, 0);
+	TRACE(call_end, conn, op, status, latency_us);
+	return status;
+}
+
 // Open Block
-terab_status_enum_t open_block(
+static terab_status_enum_t request_open_block(
 	connection_s* conn,
 	block_id_t* parent_id,
 	block_handle_t* block,
@@ -77,6 +220,18 @@ terab_status_enum_t open_block(
 	return TSE_INTERNAL_ERROR;
 }
 
+terab_status_enum_t open_block(
+	connection_s* conn,
+	block_id_t* parent_id,
+	block_handle_t* block,
+	block_ucid_t* block_ucid
+)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_OPEN_BLOCK, 0);
+	terab_status_enum_t status = request_open_block(conn, parent_id, block, block_ucid);
+	return record_call(conn, TERAB_STATS_OP_OPEN_BLOCK, status, 0, started_us);
+}
+
 open_block_response_s read_open_block(range* source)
 {
 	open_block_response_s resp;
@@ -89,9 +244,30 @@ open_block_response_s read_open_block(range* source)
 	return resp;
 }
 
+/* Lets the coin cache, if any, keep the events read at 'block'. */
+static void remember_committed(connection_s* conn, block_handle_t block)
+{
+	coin_cache_s* cache = connection_coin_cache(conn);
+	if (cache != NULL)
+		coin_cache_commit(cache, block);
+}
+
 // Commit Block
-terab_status_enum_t commit_block(connection_s* conn, block_handle_t block, block_id_t* blockid)
+static terab_status_enum_t request_commit_block(connection_s* conn, block_handle_t block, block_id_t* blockid)
 {
+	// the writes must be done before the block is frozen
+	unsynced_writes_s* unsynced = connection_unsynced_writes(conn);
+	if (unsynced->count > 0 && unsynced->block == block)
+	{
+		int32_t failure_count;
+		terab_status_enum_t status = sync_coins(conn, block, 0, NULL, &failure_count);
+		if (status != TSE_SUCCESS)
+			return status;
+
+		if (failure_count > 0)
+			return TSE_INCONSISTENT_REQUEST;
+	}
+
 	range buffer = connection_get_send_buffer(conn);
 	write_header(&buffer, commit_block_request);
 	write_uint32(&buffer, block);
@@ -113,6 +289,7 @@ terab_status_enum_t commit_block(connection_s* conn, block_handle_t block, block
 	switch (response.status)
 	{
 	case cbs_success:
+		remember_committed(conn, block);
 		return TSE_SUCCESS;
 	case cbs_block_not_found:
 		return TSE_BLOCK_UNKNOWN;
@@ -123,6 +300,13 @@ terab_status_enum_t commit_block(connection_s* conn, block_handle_t block, block
 	return TSE_INTERNAL_ERROR;
 }
 
+terab_status_enum_t commit_block(connection_s* conn, block_handle_t block, block_id_t* blockid)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_COMMIT_BLOCK, 0);
+	terab_status_enum_t status = request_commit_block(conn, block, blockid);
+	return record_call(conn, TERAB_STATS_OP_COMMIT_BLOCK, status, 0, started_us);
+}
+
 commit_block_response_s read_commit_block(range* source)
 {
 	commit_block_response_s resp;
@@ -132,7 +316,7 @@ commit_block_response_s read_commit_block(range* source)
 }
 
 // Get Committed Block Handle
-terab_status_enum_t get_committed_block_handle(connection_s* conn, block_id_t* blockid, block_handle_t* result)
+static terab_status_enum_t request_committed_block_handle(connection_s* conn, block_id_t* blockid, block_handle_t* result)
 {
 	range buffer = connection_get_send_buffer(conn);
 	write_header(&buffer, get_block_handle_request);
@@ -158,6 +342,7 @@ terab_status_enum_t get_committed_block_handle(connection_s* conn, block_id_t* b
 	{
 	case gbh_success:
 		*result = response.handle;
+		remember_committed(conn, response.handle);
 		return TSE_SUCCESS;
 	case gbh_block_not_found:
 		*result = 0;
@@ -167,8 +352,15 @@ terab_status_enum_t get_committed_block_handle(connection_s* conn, block_id_t* b
 	return TSE_INTERNAL_ERROR;
 }
 
+terab_status_enum_t get_committed_block_handle(connection_s* conn, block_id_t* blockid, block_handle_t* result)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_GET_BLOCK, 0);
+	terab_status_enum_t status = request_committed_block_handle(conn, blockid, result);
+	return record_call(conn, TERAB_STATS_OP_GET_BLOCK, status, 0, started_us);
+}
+
 // Get Uncommitted Block Handle
-terab_status_enum_t get_uncommitted_block_handle(
+static terab_status_enum_t request_uncommitted_block_handle(
 	connection_s* conn,
 	block_ucid_t* block_ucid,
 	block_handle_t* result
@@ -207,6 +399,17 @@ terab_status_enum_t get_uncommitted_block_handle(
 	return TSE_INTERNAL_ERROR;
 }
 
+terab_status_enum_t get_uncommitted_block_handle(
+	connection_s* conn,
+	block_ucid_t* block_ucid,
+	block_handle_t* result
+)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_GET_BLOCK, 0);
+	terab_status_enum_t status = request_uncommitted_block_handle(conn, block_ucid, result);
+	return record_call(conn, TERAB_STATS_OP_GET_BLOCK, status, 0, started_us);
+}
+
 get_block_handle_response_s read_get_block_handle(range* source)
 {
 	get_block_handle_response_s resp;
@@ -217,7 +420,7 @@ get_block_handle_response_s read_get_block_handle(range* source)
 }
 
 // Get Block Info
-terab_status_enum_t get_block_info(connection_s* conn, block_handle_t block, block_info_t* info)
+static terab_status_enum_t request_block_info(connection_s* conn, block_handle_t block, block_info_t* info)
 {
 	range buffer = connection_get_send_buffer(conn);
 	write_header(&buffer, get_block_info_request);
@@ -241,9 +444,19 @@ terab_status_enum_t get_block_info(connection_s* conn, block_handle_t block, blo
 	info->blockheight = response.blockheight;
 	info->blockid = response.blockid;
 
+	if (response.isCommitted == 1)
+		remember_committed(conn, block);
+
 	return TSE_SUCCESS;
 }
 
+terab_status_enum_t get_block_info(connection_s* conn, block_handle_t block, block_info_t* info)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_GET_BLOCK, 0);
+	terab_status_enum_t status = request_block_info(conn, block, info);
+	return record_call(conn, TERAB_STATS_OP_GET_BLOCK, status, 0, started_us);
+}
+
 get_block_info_response_s read_get_block_info(range* source)
 {
 	get_block_info_response_s resp;
@@ -259,213 +472,1289 @@ get_block_info_response_s read_get_block_info(range* source)
 }
 
 // Set Coins
-terab_status_enum_t set_coins(
-	connection_s* conn, 
-	block_handle_t context, 
-	int32_t coin_length, 
-	coin_t* coins, 
-	int32_t storage_length,
-	uint8_t* storage)
+
+// header of the multi-coin requests: message header, context, count and a
+// total count left to the server
+#define COINS_REQUEST_HEADER_LEN (16 + 4 + 2 + 2)
+
+// the server rejects requests of MESSAGE_MAX_LEN bytes or more
+#define COINS_REQUEST_MAX_LEN (MESSAGE_MAX_LEN - 1)
+
+// item of a 'change_coins_request': index, operation, options, outpoint
+#define CHANGE_COINS_ITEM_LEN (4 + 1 + 1 + sizeof(outpoint_t))
+
+// follows a 'cco_produce' item, the script excluded
+#define CHANGE_COINS_PRODUCTION_LEN (8 + 4 + 2)
+
+// item of a 'change_coins_response': index, status
+#define CHANGE_COINS_RESPONSE_ITEM_LEN (4 + 1)
+
+/* In the WIRE_COMPACT format, requests are followed by the varint index of
+   their first coin, the next coins being numbered consecutively. Outpoints
+   are written as a varint back-reference to their txid, followed by the
+   varint output index. A zero reference means the txid follows; otherwise,
+   it designates a txid written earlier in the request, 1 being the latest.
+   Items which are fixed-width otherwise are made of varints, and responses
+   echo no outpoint. See 'CompactCoins' on the server side for the layouts.
+
+   Requests are split as in the WIRE_FIXED format, which is never shorter:
+   the instance expands the compact requests back. */
+
+// number of latest txids looked up for back-references
+#define TXID_WINDOW 8
+
+typedef struct {
+	const uint8_t* latest[TXID_WINDOW]; // circular, the txids written literally
+	uint32_t literal_count;
+} txid_refs_s;
+
+static void write_compact_outpoint(range* buffer, txid_refs_s* refs, const outpoint_t* outpoint)
 {
-	// Send one request per coin
-	uint32_t requestId = 0;
-	coin_t* end = coins + coin_length;
+	uint32_t depth = refs->literal_count < TXID_WINDOW ? refs->literal_count : TXID_WINDOW;
 
-	connection_batch_begin(conn);
-	for (coin_t* coin = coins; coin < end; coin++)
+	// outputs of the same transaction are typically adjacent
+	for (uint32_t back = 1; back <= depth; back++)
 	{
-		range buffer = connection_get_send_buffer(conn);
+		if (memcmp(refs->latest[(refs->literal_count - back) % TXID_WINDOW], outpoint->txid, 32) == 0)
+		{
+			write_varint(buffer, back);
+			write_varint(buffer, (uint32_t)outpoint->index);
+			return;
+		}
+	}
 
-		if (coin->script_offset < 0)
-			return TERAB_ERR_INVALID_REQUEST;
+	write_varint(buffer, 0);
+	write_bytes(buffer, (const char*)outpoint->txid, 32);
+	refs->latest[refs->literal_count % TXID_WINDOW] = outpoint->txid;
+	refs->literal_count++;
 
-		// Coin production request
-		// ---------------
-		if (coin->production != 0)
-		{
-			if (coin->script_length <= 0)
-				return TERAB_ERR_INVALID_REQUEST;
+	write_varint(buffer, (uint32_t)outpoint->index);
+}
 
-			write_header(&buffer, produce_coin_request);
+/* Scripts are either located in a single 'storage' buffer, through
+   'coin_t.script_offset', or given one pointer per coin through 'scripts'. */
+static terab_status_enum_t check_set_coins(
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	const uint8_t* const* scripts)
+{
+	if (coin_length < 0 || storage_length < 0)
+		return TSE_INVALID_REQUEST;
 
-			write_bytes(&buffer, (char*)&coin->outpoint, sizeof(outpoint_t));
-			write_uint32(&buffer, context);
-			write_uint8(&buffer, coin->flags);
-			write_uint64(&buffer, coin->satoshis);
-			write_uint32(&buffer, coin->nLockTime);
-			write_bytes(&buffer, (char*)(storage + coin->script_offset), coin->script_length);
-		}
-		// Coin consumption request
-		// ----------------
-		else if (coin->consumption != 0)
-		{
-			write_header(&buffer, consume_coin_request);
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		coin_t* coin = coins + i;
+		if (coin->production == 0)
+			continue;
 
-			write_bytes(&buffer, (char*)&coin->outpoint, sizeof(outpoint_t));
-			write_uint32(&buffer, context);
-		}
-		// Coin removal request
-		// ----------------
-		else if (coin->production == 0 && coin->consumption == 0)
-		{
-			write_header(&buffer, remove_coin_request);
+		if (coin->script_length <= 0 || coin->script_length > COINS_REQUEST_MAX_LEN
+			- (COINS_REQUEST_HEADER_LEN + CHANGE_COINS_ITEM_LEN + CHANGE_COINS_PRODUCTION_LEN))
+			return TSE_INVALID_REQUEST;
 
-			write_bytes(&buffer, (char*)&coin->outpoint, sizeof(outpoint_t));
-			write_uint32(&buffer, context);
-			write_uint8(&buffer, /* Remove Production*/ 1);
-			write_uint8(&buffer, /* Remove Consumption*/ 1);
+		if (scripts)
+		{
+			if (scripts[i] == NULL)
+				return TSE_INVALID_REQUEST;
 		}
-		else
+		else if (coin->script_offset < 0
+			|| coin->script_length > storage_length - coin->script_offset)
 		{
-			return TERAB_ERR_INVALID_REQUEST;
+			return TSE_INVALID_REQUEST;
 		}
+	}
+	return TSE_SUCCESS;
+}
 
-		// Get 'requestId' of the first coin
-		if (!connection_send_request(conn, buffer.begin, (coin == coins) ? &requestId : NULL))
-			return TSE_INTERNAL_ERROR;
+static size_t change_coins_item_len(coin_t* coin)
+{
+	if (coin->production == 0)
+		return CHANGE_COINS_ITEM_LEN;
+
+	return CHANGE_COINS_ITEM_LEN + CHANGE_COINS_PRODUCTION_LEN + coin->script_length;
+}
+
+/* Returns the number of coins, starting from 'coins', which fit in a single
+   'change_coins_request'. */
+static int32_t change_coins_fit(coin_t* coins, int32_t coin_length)
+{
+	size_t len = COINS_REQUEST_HEADER_LEN;
+	int32_t count = 0;
+
+	while (count < coin_length && len + change_coins_item_len(coins + count) <= COINS_REQUEST_MAX_LEN)
+	{
+		len += change_coins_item_len(coins + count);
+		count++;
 	}
-	connection_batch_end(conn);
+	return count;
+}
 
-	// Receive one response per request (not in the same order)
-	for (int32_t i = 0; i < coin_length; i++)
+/* Records an acknowledged write in the overlay, which follows the block
+   written to last. */
+static void record_in_overlay(pending_batch_s* batch, coin_t* coin, uint32_t coin_index)
+{
+	block_overlay_s* overlay = batch->overlay;
+	if (block_overlay_block(overlay) != batch->context)
+		block_overlay_reset(overlay, batch->context);
+
+	const uint8_t* script = NULL;
+	if (coin->production != 0)
 	{
-		range buffer = connection_get_send_buffer(conn);
+		script = batch->scripts != NULL
+			? batch->scripts[coin_index]
+			: (const uint8_t*)batch->storage.begin + coin->script_offset;
+	}
+	block_overlay_record(overlay, coin, script);
+}
 
-		if (!connection_wait_response(conn, &buffer))
-			return TSE_INTERNAL_ERROR;
+/* The 'TERAB_COIN_STATUS_*' of a change, TERAB_COIN_STATUS_NONE if unknown. */
+static uint8_t change_coin_status_of(change_coin_status status)
+{
+	switch (status)
+	{
+	case ccs_success: return TERAB_COIN_STATUS_SUCCESS;
+	case ccs_outpoint_not_found: return TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND;
+	case ccs_invalid_context: return TERAB_COIN_STATUS_INVALID_CONTEXT;
+	case ccs_invalid_block_handle: return TERAB_COIN_STATUS_INVALID_BLOCK_HANDLE;
+	default: return TERAB_COIN_STATUS_NONE;
+	}
+}
 
-		header_response_s header = read_response_header(&buffer);
+static return_status_t settle_change_coin(pending_batch_s* batch, uint32_t coin_index, change_coin_status status)
+{
+	if (coin_index >= (uint32_t)batch->item_count)
+		return RS_FAILURE;
 
-		change_coin_response_s response;
-		response.status = read_uint8(&buffer);
+	coin_t* coin = batch->coins + coin_index;
 
-		switch (header.kind)
-		{
-		case produce_coin_response:
-		case consume_coin_response:
-		case remove_coin_response:
-			break;
-		default:
-			return TSE_INTERNAL_ERROR;
-		}
+	coin->status = change_coin_status_of(status);
+	if (coin->status == TERAB_COIN_STATUS_NONE)
+		return RS_FAILURE;
 
-		coin_t* coin = coins + (header.requestId - requestId);
+	if (coin->status == TERAB_COIN_STATUS_SUCCESS && batch->overlay != NULL)
+		record_in_overlay(batch, coin, coin_index);
 
-		switch (response.status)
-		{
-		case ccs_success:
-			coin->status = TERAB_COIN_STATUS_SUCCESS;
-			break;
-		case ccs_outpoint_not_found:
-			coin->status = TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND;
-			break;
-		case ccs_invalid_context:
-			coin->status = TERAB_COIN_STATUS_INVALID_CONTEXT;
-			break;
-		case ccs_invalid_block_handle:
-			coin->status = TERAB_COIN_STATUS_INVALID_BLOCK_HANDLE;
-			break;
-		default:
-			return TSE_INTERNAL_ERROR;
-		}
+	batch->remaining--;
+	return OK;
+}
+
+static return_status_t on_change_coins_response(pending_batch_s* batch, uint32_t index, range* reply)
+{
+	header_response_s header = read_response_header(reply);
+
+	if (header.kind != change_coins_response || range_len(*reply) < 4)
+		return RS_FAILURE;
+
+	uint16_t count = read_uint16(reply);
+	read_uint16(reply); // total count
+
+	if (range_len(*reply) < (size_t)count * CHANGE_COINS_RESPONSE_ITEM_LEN)
+		return RS_FAILURE;
+
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint32_t coin_index = read_uint32(reply);
+		change_coin_status status = read_uint8(reply);
+
+		if (!settle_change_coin(batch, coin_index, status))
+			return RS_FAILURE;
 	}
+	return OK;
+}
 
-	return TSE_SUCCESS;
+static return_status_t on_change_coins_compact_response(pending_batch_s* batch, uint32_t index, range* reply)
+{
+	header_response_s header = read_response_header(reply);
+
+	if (header.kind != change_coins_response || range_len(*reply) < 4)
+		return RS_FAILURE;
+
+	uint16_t count = read_uint16(reply);
+	read_uint16(reply); // total count
+
+	for (uint16_t i = 0; i < count; i++)
+	{
+		uint64_t coin_index;
+		if (!read_varint(reply, &coin_index) || coin_index > UINT32_MAX || range_len(*reply) < 1)
+			return RS_FAILURE;
+
+		change_coin_status status = read_uint8(reply);
+
+		if (!settle_change_coin(batch, (uint32_t)coin_index, status))
+			return RS_FAILURE;
+	}
+	return OK;
 }
 
-// Get Coins
-terab_status_enum_t get_coins(
+/* Sends the coins, as many per request as possible, numbered from
+   'first_index'. The requests of 'batch' hold their place in the window;
+   without batch, the coins are written without acknowledgement. */
+static return_status_t send_change_coins(
 	connection_s* conn,
+	pending_batch_s* batch,
 	block_handle_t context,
 	int32_t coin_length,
 	coin_t* coins,
-	range* storage
-)
+	uint8_t* storage,
+	const uint8_t* const* scripts,
+	int32_t first_index)
 {
-	// Send one request per outpoint
-	uint32_t requestId = 0;
-	coin_t* end = coins + coin_length;
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
 
-	connection_batch_begin(conn);
-	for (coin_t* coin = coins; coin < end; coin++)
+	for (int32_t first = 0; first < coin_length; )
 	{
-		range buffer = connection_get_send_buffer(conn);
+		int32_t count = change_coins_fit(coins + first, coin_length - first);
 
-		write_header(&buffer, get_coin_request);
+		if (batch != NULL && !connection_window_acquire(conn, count))
+			return RS_FAILURE;
 
-		write_bytes(&buffer, (char*)&coin->outpoint, sizeof(outpoint_t));
+		range buffer = connection_get_send_buffer(conn);
+		write_header(&buffer, batch != NULL ? change_coins_request : write_coins_request);
 		write_uint32(&buffer, context);
+		write_uint16(&buffer, (uint16_t)count);
+		write_uint16(&buffer, 0); // total count, set by the server
 
-		// Get 'requestId' of the first outpoint
-		if (!connection_send_request(conn, buffer.begin, (coin == coins) ? &requestId : NULL))
-			return TSE_INTERNAL_ERROR;
-	}
-	connection_batch_end(conn);
+		txid_refs_s refs = { 0 };
+		if (compact)
+			write_varint(&buffer, (uint32_t)(first_index + first));
 
-	// Receive one response per outpoint (not in the same order)
-	int32_t script_offset = 0;
-	for (int32_t i = 0; i < coin_length; i++)
-	{
-		range buffer = connection_get_send_buffer(conn);
+		for (int32_t i = first; i < first + count; i++)
+		{
+			coin_t* coin = coins + i;
+			if (!compact)
+				write_uint32(&buffer, (uint32_t)(first_index + i));
+
+			uint8_t operation, options;
+			if (coin->production != 0)
+			{
+				operation = cco_produce;
+				options = coin->flags;
+			}
+			else if (coin->consumption != 0)
+			{
+				operation = cco_consume;
+				options = 0;
+			}
+			else
+			{
+				operation = cco_remove;
+				options = CCO_REMOVE_PRODUCTION | CCO_REMOVE_CONSUMPTION;
+			}
+
+			write_uint8(&buffer, operation);
+			write_uint8(&buffer, options);
+
+			if (compact)
+				write_compact_outpoint(&buffer, &refs, &coin->outpoint);
+			else
+				write_bytes(&buffer, (char*)&coin->outpoint, sizeof(outpoint_t));
+
+			if (operation != cco_produce)
+				continue;
+
+			if (compact)
+			{
+				write_varint(&buffer, coin->satoshis);
+				write_varint(&buffer, coin->nLockTime);
+				write_varint(&buffer, (uint32_t)coin->script_length);
+			}
+			else
+			{
+				write_uint64(&buffer, coin->satoshis);
+				write_uint32(&buffer, coin->nLockTime);
+				write_uint16(&buffer, (uint16_t)coin->script_length);
+			}
+
+			// the script is appended by the connection, without intermediate copy
+			const uint8_t* script = scripts ? scripts[i] : storage + coin->script_offset;
+			connection_write_tail(conn, &buffer, (const char*)script, coin->script_length);
+		}
 
-		if (!connection_wait_response(conn, &buffer))
-			return TSE_INTERNAL_ERROR;
+		if (!connection_send_request(conn, buffer.begin, NULL))
+			return RS_FAILURE;
 
-		char* response_origin = buffer.begin;
+		first += count;
+	}
+	return OK;
+}
 
-		header_response_s header = read_response_header(&buffer);
+static terab_status_enum_t submit_set_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	const uint8_t* const* scripts,
+	terab_ticket_t* ticket)
+{
+	*ticket = 0;
 
-		if(header.kind != get_coin_response)
-			return TSE_INTERNAL_ERROR;
+	// Validate upfront, as a batch cannot be recalled once partially sent
+	terab_status_enum_t status = check_set_coins(coin_length, coins, storage_length, scripts);
+	if (status != TSE_SUCCESS)
+		return status;
 
-		get_coin_response_s response;
-		response.status = read_uint8(&buffer);
-		read_bytes(&buffer, (char*)(&response.outpoint), sizeof(outpoint_t));
-		response.flags = read_uint8(&buffer);
-		response.context = read_uint32(&buffer);
-		response.production = read_uint32(&buffer);
-		response.consumption = read_uint32(&buffer);
-		response.satoshis = read_uint64(&buffer);
-		response.nLockTime = read_uint32(&buffer);
-
-		int32_t script_length = header.size - (uint32_t)(buffer.begin - response_origin);
-
-		coin_t* coin = coins + (header.requestId - requestId);
-
-		coin->outpoint = response.outpoint;
-		coin->production = response.production;
-		coin->consumption = response.consumption;
-		coin->satoshis = response.satoshis;
-		coin->nLockTime = response.nLockTime;
-		coin->flags = response.flags;
-		
-		coin->script_offset = script_offset;
-		coin->script_length = script_length;	
-
-		switch (response.status)
-		{
-		case gcs_success:
-			coin->status = TERAB_COIN_STATUS_SUCCESS;
-			break;
-		case gcs_outpoint_not_found:
-			coin->status = TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND;
-			break;
-		default:
-			return TSE_INTERNAL_ERROR;
-		}
+	// As many coins as possible per request, the split being replayed below
+	int32_t request_count = 0;
+	for (int32_t first = 0; first < coin_length; request_count++)
+		first += change_coins_fit(coins + first, coin_length - first);
 
-		// Copy the script if storage capacity allows
-		if (range_len(*storage) >= script_length)
-		{
-			copy_range(storage, buffer, script_length);
-		}
-		else
-		{
-			coin->status |= TERAB_COIN_STATUS_STORAGE_TOO_SHORT;
-		}
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
 
-		script_offset += script_length;
+	pending_batch_s* batch = connection_pending_new(conn, request_count, coin_length,
+		compact ? on_change_coins_compact_response : on_change_coins_response);
+	if (batch == NULL)
+		return TSE_TOO_MANY_REQUESTS;
+
+	batch->coins = coins;
+	batch->context = context;
+	batch->overlay = connection_block_overlay(conn);
+	batch->storage = range_init((char*)storage, storage_length);
+	batch->scripts = scripts;
+	batch->stats_op = TERAB_STATS_OP_SET_COINS;
+
+	int64_t waited_us = connection_window_wait_us(conn);
+	connection_batch_begin(conn);
+	if (!send_change_coins(conn, batch, context, coin_length, coins, storage, scripts, 0))
+	{
+		// the connection is broken, the batch will never complete
+		connection_batch_end(conn);
+		connection_pending_free(conn, batch);
+		return TSE_INTERNAL_ERROR;
 	}
+	connection_batch_end(conn);
+	batch->queued_us = connection_window_wait_us(conn) - waited_us;
+	TRACE(batch_submit, conn, batch->stats_op, batch->ticket, batch->item_count,
+		batch->first_request_id, batch->request_count);
 
+	*ticket = batch->ticket;
 	return TSE_SUCCESS;
 }
+
+terab_status_enum_t set_coins_async(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	terab_ticket_t* ticket)
+{
+	return submit_set_coins(conn, context, coin_length, coins, storage_length, storage, NULL, ticket);
+}
+
+terab_status_enum_t set_coins(
+	connection_s* conn, 
+	block_handle_t context, 
+	int32_t coin_length, 
+	coin_t* coins, 
+	int32_t storage_length,
+	uint8_t* storage)
+{
+	terab_ticket_t ticket;
+	terab_status_enum_t status = set_coins_async(
+		conn, context, coin_length, coins, storage_length, storage, &ticket);
+
+	if (status != TSE_SUCCESS)
+		return status;
+
+	return wait_batch(conn, ticket);
+}
+
+terab_status_enum_t set_coins_v(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	const uint8_t* const* scripts)
+{
+	if (scripts == NULL)
+		return TSE_INVALID_REQUEST;
+
+	terab_ticket_t ticket;
+	terab_status_enum_t status = submit_set_coins(
+		conn, context, coin_length, coins, 0, NULL, scripts, &ticket);
+
+	if (status != TSE_SUCCESS)
+		return status;
+
+	return wait_batch(conn, ticket);
+}
+
+// Write Coins
+
+static terab_status_enum_t send_write_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage)
+{
+	unsynced_writes_s* unsynced = connection_unsynced_writes(conn);
+	if (unsynced->count > 0 && unsynced->block != context)
+		return TSE_INVALID_REQUEST;
+
+	terab_status_enum_t status = check_set_coins(coin_length, coins, storage_length, NULL);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	if (coin_length > INT32_MAX - unsynced->count)
+		return TSE_INVALID_REQUEST;
+
+	// the overlay only follows acknowledged writes, which these may contradict
+	block_overlay_s* overlay = connection_block_overlay(conn);
+	if (overlay != NULL && block_overlay_block(overlay) == context)
+		block_overlay_reset(overlay, context);
+
+	connection_batch_begin(conn);
+	if (!send_change_coins(conn, NULL, context, coin_length, coins, storage, NULL, unsynced->count))
+	{
+		connection_batch_end(conn);
+		return TSE_INTERNAL_ERROR;
+	}
+	connection_batch_end(conn);
+
+	unsynced->block = context;
+	unsynced->count += coin_length;
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t write_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_WRITE_COINS, coin_length);
+	terab_status_enum_t status = send_write_coins(conn, context, coin_length, coins, storage_length, storage);
+	return record_call(conn, TERAB_STATS_OP_WRITE_COINS, status, coin_length, started_us);
+}
+
+/* Reads an item of a 'sync_coins_response', laid out as those of a
+   'change_coins_response' in the negotiated format. */
+static return_status_t read_sync_item(range* reply, int compact, uint32_t* index, change_coin_status* status)
+{
+	if (compact)
+	{
+		uint64_t value;
+		if (!read_varint(reply, &value) || value > UINT32_MAX)
+			return RS_FAILURE;
+
+		*index = (uint32_t)value;
+	}
+	else
+	{
+		if (range_len(*reply) < CHANGE_COINS_RESPONSE_ITEM_LEN)
+			return RS_FAILURE;
+
+		*index = read_uint32(reply);
+	}
+
+	if (range_len(*reply) < 1)
+		return RS_FAILURE;
+
+	*status = read_uint8(reply);
+	return OK;
+}
+
+static terab_status_enum_t request_sync_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t failure_capacity,
+	write_failure_t* failures,
+	int32_t* failure_count)
+{
+	*failure_count = 0;
+
+	if (failure_capacity < 0)
+		return TSE_INVALID_REQUEST;
+
+	unsynced_writes_s* unsynced = connection_unsynced_writes(conn);
+	if (unsynced->count == 0)
+		return TSE_SUCCESS;
+
+	if (unsynced->block != context)
+		return TSE_INVALID_REQUEST;
+
+	range buffer = connection_get_send_buffer(conn);
+	write_header(&buffer, sync_coins_request);
+	write_uint32(&buffer, context);
+
+	if (!connection_send_request(conn, buffer.begin, NULL))
+		return TSE_INTERNAL_ERROR;
+
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
+
+	// the failures may not fit in a single response
+	int32_t received = 0;
+	int32_t total = -1;
+	while (received != total)
+	{
+		if (!connection_wait_response(conn, &buffer))
+			return TSE_INTERNAL_ERROR;
+
+		header_response_s header = read_response_header(&buffer);
+		if (header.kind != sync_coins_response || range_len(buffer) < 4)
+			return TSE_INTERNAL_ERROR;
+
+		uint16_t count = read_uint16(&buffer);
+		total = read_uint16(&buffer);
+
+		if (count > total - received || (count == 0 && total > 0))
+			return TSE_INTERNAL_ERROR;
+
+		for (uint16_t i = 0; i < count; i++, received++)
+		{
+			uint32_t index;
+			change_coin_status status;
+			if (!read_sync_item(&buffer, compact, &index, &status))
+				return TSE_INTERNAL_ERROR;
+
+			if (received < failure_capacity)
+			{
+				failures[received].index = (int32_t)index;
+				failures[received].status = change_coin_status_of(status);
+			}
+		}
+	}
+
+	unsynced->count = 0;
+	*failure_count = total;
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t sync_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t failure_capacity,
+	write_failure_t* failures,
+	int32_t* failure_count)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_SYNC, 0);
+	terab_status_enum_t status = request_sync_coins(conn, context, failure_capacity, failures, failure_count);
+	return record_call(conn, TERAB_STATS_OP_SYNC, status, 0, started_us);
+}
+
+// Get Coins
+
+// item of a 'get_coins_request': index, outpoint
+#define GET_COINS_ITEM_LEN (4 + sizeof(outpoint_t))
+
+// item of a 'get_coins_response', the script excluded
+#define GET_COINS_RESPONSE_ITEM_LEN (4 + 1 + 1 + 4 + 4 + 8 + 4 + 2)
+
+// header of a 'get_coins_request': the multi-coin header, then the projection
+#define GET_COINS_REQUEST_HEADER_LEN (COINS_REQUEST_HEADER_LEN + 1)
+
+#define GET_COINS_PER_REQUEST ((int32_t)((COINS_REQUEST_MAX_LEN - GET_COINS_REQUEST_HEADER_LEN) / GET_COINS_ITEM_LEN))
+
+/* Items are numbered in the order they are sent, which differs from the
+   order of the coins when some of them come from the cache. */
+static coin_t* coin_of_item(pending_batch_s* batch, int32_t item)
+{
+	return batch->coins + (batch->coin_map != NULL ? batch->coin_map[item] : item);
+}
+
+/* The storage where the script of 'coin' may go: the rest of the storage
+   when scripts are laid out in the order of arrival, or the span already
+   reserved to the coin when it is fetched again. */
+static range script_room(pending_batch_s* batch, coin_t* coin)
+{
+	if (!batch->scripts_in_place)
+		return batch->storage;
+
+	size_t storage_len = range_len(batch->storage);
+	if (coin->script_offset < 0 || (size_t)coin->script_offset + coin->script_length > storage_len)
+		return range_init(NULL, 0);
+
+	return range_init(batch->storage.begin + coin->script_offset, coin->script_length);
+}
+
+/* Settles the coin of 'item', whose script is at the beginning of 'reply'.
+   When 'direct' is not NULL, the script may be partially received: it is
+   then set to the storage left for the rest of the script.
+
+   The scripts which fit are packed at the beginning of the storage. Those
+   which do not are given spans past its end, one after the other, so that
+   growing the storage to the end of the last span is enough for
+   'refetch_coins' to put them all in place. */
+static return_status_t settle_get_coin(pending_batch_s* batch, get_coins_item_s* item, range* reply, range* direct)
+{
+	size_t received = range_len(*reply) < item->script_length ? range_len(*reply) : item->script_length;
+
+	if (item->index >= (uint32_t)batch->item_count || (received < item->script_length && direct == NULL))
+		return RS_FAILURE;
+
+	coin_t* coin = coin_of_item(batch, (int32_t)item->index);
+	range room = script_room(batch, coin);
+
+	uint8_t status;
+	switch (item->status)
+	{
+	case gcs_success:
+	case gcs_unspent:
+		status = TERAB_COIN_STATUS_SUCCESS;
+		break;
+	case gcs_outpoint_not_found:
+		status = TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND;
+		break;
+	case gcs_spent:
+		status = TERAB_COIN_STATUS_SPENT;
+		break;
+	default:
+		return RS_FAILURE;
+	}
+
+	coin->production = item->production;
+	coin->consumption = item->consumption;
+
+	if ((int32_t)item->index >= batch->events_first)
+	{
+		// the payload was taken from the cache when the batch was submitted
+		if (item->script_length != 0)
+			return RS_FAILURE;
+
+		if (status != TERAB_COIN_STATUS_SUCCESS)
+		{
+			// cleared as on a fetch, the cached payload is no longer current
+			coin->satoshis = item->satoshis;
+			coin->nLockTime = item->nLockTime;
+			coin->flags = item->flags;
+			coin->script_length = 0;
+			coin->status = status;
+		}
+		else
+		{
+			coin->status = status | (coin->status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT);
+			if (batch->cache != NULL)
+				coin_cache_put_events(batch->cache, coin, batch->context);
+		}
+
+		batch->remaining--;
+		return OK;
+	}
+
+	coin->satoshis = item->satoshis;
+	coin->nLockTime = item->nLockTime;
+	coin->flags = item->flags;
+
+	coin->script_length = item->script_length;
+	coin->status = status;
+
+	// short scripts are always received whole, longer ones are not cached anyway
+	if (batch->cache != NULL && status == TERAB_COIN_STATUS_SUCCESS && received == item->script_length)
+		coin_cache_put(batch->cache, coin, reply->begin, batch->context);
+
+	// Copy the script if storage capacity allows
+	if (range_len(room) >= item->script_length)
+	{
+		if (!batch->scripts_in_place)
+			coin->script_offset = batch->script_offset;
+
+		copy_range(&room, *reply, received);
+		if (received < item->script_length)
+		{
+			*direct = range_init(room.begin, item->script_length - received);
+			room.begin += item->script_length - received;
+		}
+	}
+	else if (received < item->script_length)
+	{
+		// the rest of the script would have nowhere to go
+		return RS_FAILURE;
+	}
+	else
+	{
+		if (!batch->scripts_in_place)
+		{
+			coin->script_offset = batch->overflow_offset;
+			batch->overflow_offset += item->script_length;
+		}
+		coin->status |= TERAB_COIN_STATUS_STORAGE_TOO_SHORT;
+	}
+
+	if (!batch->scripts_in_place)
+	{
+		batch->script_offset += (int32_t)(room.begin - batch->storage.begin);
+		batch->storage = room;
+	}
+
+	skip_bytes(reply, received);
+	batch->remaining--;
+	return OK;
+}
+
+/* Reads an item of a 'get_coins_response', up to its script. Returns 0 if
+   'reply' is too short, in which case it is left untouched. */
+typedef int (*read_get_coins_item_t)(range* reply, get_coins_item_s* item);
+
+static int read_get_coins_item(range* reply, get_coins_item_s* item)
+{
+	if (range_len(*reply) < GET_COINS_RESPONSE_ITEM_LEN)
+		return 0;
+
+	item->index = read_uint32(reply);
+	item->status = read_uint8(reply);
+	item->flags = read_uint8(reply);
+	item->production = read_uint32(reply);
+	item->consumption = read_uint32(reply);
+	item->satoshis = read_uint64(reply);
+	item->nLockTime = read_uint32(reply);
+	item->script_length = read_uint16(reply);
+	return 1;
+}
+
+static int read_get_coins_compact_item(range* reply, get_coins_item_s* item)
+{
+	range draft = *reply;
+	uint64_t coin_index, nLockTime, script_length;
+
+	*item = (get_coins_item_s){ 0 };
+
+	if (!read_varint(&draft, &coin_index) || coin_index > UINT32_MAX || range_len(draft) < 1)
+		return 0;
+
+	item->index = (uint32_t)coin_index;
+	item->status = read_uint8(&draft);
+
+	// missing coins come without details
+	if (item->status == gcs_success)
+	{
+		if (range_len(draft) < 1 + 4 + 4)
+			return 0;
+
+		item->flags = read_uint8(&draft);
+		item->production = read_uint32(&draft);
+		item->consumption = read_uint32(&draft);
+
+		if (!read_varint(&draft, &item->satoshis)
+			|| !read_varint(&draft, &nLockTime) || nLockTime > UINT32_MAX
+			|| !read_varint(&draft, &script_length) || script_length > UINT16_MAX)
+			return 0;
+
+		item->nLockTime = (uint32_t)nLockTime;
+		item->script_length = (uint16_t)script_length;
+	}
+
+	*reply = draft;
+	return 1;
+}
+
+/* Reads the header of a 'get_coins_response', returns the number of items,
+   or -1 if the response is malformed. */
+static int32_t read_get_coins_header(range* reply)
+{
+	header_response_s header = read_response_header(reply);
+
+	if (header.kind != get_coins_response || range_len(*reply) < 4)
+		return -1;
+
+	uint16_t count = read_uint16(reply);
+	read_uint16(reply); // total count
+	return count;
+}
+
+static return_status_t decode_get_coins(pending_batch_s* batch, range* reply, read_get_coins_item_t read_item)
+{
+	int32_t count = read_get_coins_header(reply);
+	if (count < 0)
+		return RS_FAILURE;
+
+	for (int32_t i = 0; i < count; i++)
+	{
+		get_coins_item_s item;
+		if (!read_item(reply, &item) || !settle_get_coin(batch, &item, reply, NULL))
+			return RS_FAILURE;
+	}
+	return OK;
+}
+
+/* Decodes the items of a response which are already received, see
+   'batch_stream_t'. An item whose script is partially received is only
+   settled if the rest of its script is long enough to be worth receiving
+   straight into the storage; otherwise, decoding resumes once the whole
+   item is there. */
+static return_status_t stream_get_coins(pending_batch_s* batch, range* part, range* direct,
+	read_get_coins_item_t read_item)
+{
+	if (batch->streamed_count < 0)
+	{
+		if (range_len(*part) < 16 + 4) // header, count, total count
+			return OK;
+
+		batch->streamed_count = read_get_coins_header(part);
+		if (batch->streamed_count < 0)
+			return RS_FAILURE;
+	}
+
+	while (batch->streamed_count > 0)
+	{
+		range next = *part;
+		get_coins_item_s item;
+		if (!read_item(&next, &item))
+			break;
+
+		size_t missing = item.script_length > range_len(next) ? item.script_length - range_len(next) : 0;
+		if (missing > 0 && (missing < DIRECT_RECV_MIN_LEN || item.index >= (uint32_t)batch->item_count
+			|| range_len(script_room(batch, coin_of_item(batch, (int32_t)item.index))) < item.script_length))
+			break;
+
+		if (!settle_get_coin(batch, &item, &next, direct))
+			return RS_FAILURE;
+
+		*part = next;
+		batch->streamed_count--;
+
+		if (missing > 0)
+			break;
+	}
+
+	if (batch->streamed_count == 0)
+		batch->streamed_count = -1; // ready for the next response
+	return OK;
+}
+
+static return_status_t on_get_coins_response(pending_batch_s* batch, uint32_t index, range* reply)
+{
+	return decode_get_coins(batch, reply, read_get_coins_item);
+}
+
+static return_status_t on_get_coins_compact_response(pending_batch_s* batch, uint32_t index, range* reply)
+{
+	return decode_get_coins(batch, reply, read_get_coins_compact_item);
+}
+
+static return_status_t on_get_coins_stream(pending_batch_s* batch, range* part, range* direct)
+{
+	return stream_get_coins(batch, part, direct, read_get_coins_item);
+}
+
+static return_status_t on_get_coins_compact_stream(pending_batch_s* batch, range* part, range* direct)
+{
+	return stream_get_coins(batch, part, direct, read_get_coins_compact_item);
+}
+
+/* Fills the payload of a coin answered locally, its script going to the
+   storage like the scripts received, see 'settle_get_coin'. Only the parts
+   of the payload requested through 'projection' are filled. */
+static void complete_payload(coin_t* coin, coin_projection projection, uint64_t satoshis,
+	uint32_t nLockTime, uint8_t flags, const uint8_t* script, int32_t script_length,
+	range* storage, int32_t* script_offset, int32_t* overflow_offset)
+{
+	if (projection == cp_existence)
+		satoshis = nLockTime = flags = 0;
+	if (projection != cp_full)
+		script_length = 0;
+
+	coin->satoshis = satoshis;
+	coin->nLockTime = nLockTime;
+	coin->flags = flags;
+	coin->script_length = script_length;
+	coin->status = TERAB_COIN_STATUS_NONE;
+
+	if (range_len(*storage) >= (size_t)script_length)
+	{
+		coin->script_offset = *script_offset;
+		copy_bytes(storage, (const char*)script, script_length);
+		*script_offset += script_length;
+	}
+	else
+	{
+		coin->script_offset = *overflow_offset;
+		coin->status = TERAB_COIN_STATUS_STORAGE_TOO_SHORT;
+		*overflow_offset += script_length;
+	}
+}
+
+/* Fills the events of a coin answered locally. With 'cp_existence', only
+   whether the coin is unspent is told, as the instance would. */
+static void complete_events(coin_t* coin, coin_projection projection,
+	block_handle_t production, block_handle_t consumption)
+{
+	if (projection == cp_existence)
+	{
+		coin->production = 0;
+		coin->consumption = 0;
+		coin->status |= consumption == 0 ? TERAB_COIN_STATUS_SUCCESS : TERAB_COIN_STATUS_SPENT;
+		return;
+	}
+
+	coin->production = production;
+	coin->consumption = consumption;
+	coin->status |= TERAB_COIN_STATUS_SUCCESS;
+}
+
+/* Completes the payload of the coins written to 'context' through the
+   overlay, and of the ones found in the cache, along with their events if
+   known at 'context'. Either 'cache' or 'overlay' may be NULL. Lists in 'coin_map'
+   the coins left to the instance: the missing ones first, up to
+   'events_first', then those which only need their events. Returns the
+   number of coins listed. */
+static int32_t complete_locally(coin_cache_s* cache, block_overlay_s* overlay, block_handle_t context,
+	coin_projection projection, int32_t coin_length, coin_t* coins, range* storage, int32_t* script_offset,
+	int32_t* overflow_offset, int32_t* coin_map, int32_t* events_first)
+{
+	int committed = cache != NULL && coin_cache_is_committed(cache, context);
+	int32_t missing = 0, events = 0;
+
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		coin_t* coin = coins + i;
+
+		const block_overlay_entry_s* written = overlay != NULL ? block_overlay_find(overlay, &coin->outpoint) : NULL;
+		if (written != NULL)
+		{
+			complete_payload(coin, projection, written->satoshis, written->nLockTime, written->flags,
+				block_overlay_script(overlay, written), written->script_length, storage, script_offset, overflow_offset);
+
+			// other connections may have spent it since, the instance tells
+			coin_map[coin_length - 1 - events++] = i;
+			continue;
+		}
+
+		coin_cache_entry_s* entry = cache != NULL ? coin_cache_find(cache, &coin->outpoint) : NULL;
+		if (entry == NULL)
+		{
+			coin_map[missing++] = i;
+			continue;
+		}
+
+		complete_payload(coin, projection, entry->satoshis, entry->nLockTime, entry->flags,
+			entry->script, entry->script_length, storage, script_offset, overflow_offset);
+
+		if (committed && entry->context == context)
+		{
+			complete_events(coin, projection, entry->production, entry->consumption);
+		}
+		else
+		{
+			coin_map[coin_length - 1 - events++] = i;
+		}
+	}
+
+	// the coins which need their events are moved right after the missing ones
+	memmove(coin_map + missing, coin_map + coin_length - events, events * sizeof(int32_t));
+	*events_first = missing;
+	return missing + events;
+}
+
+/* Sends the items [first_item, end_item) of the batch, as many per request
+   as possible. */
+static return_status_t send_get_coins(connection_s* conn, pending_batch_s* batch,
+	int32_t first_item, int32_t end_item, coin_projection projection)
+{
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
+
+	for (int32_t first = first_item; first < end_item; first += GET_COINS_PER_REQUEST)
+	{
+		int32_t count = end_item - first < GET_COINS_PER_REQUEST ? end_item - first : GET_COINS_PER_REQUEST;
+
+		if (!connection_window_acquire(conn, count))
+			return RS_FAILURE;
+
+		range buffer = connection_get_send_buffer(conn);
+
+		write_header(&buffer, get_coins_request);
+		write_uint32(&buffer, batch->context);
+		write_uint16(&buffer, (uint16_t)count);
+		write_uint16(&buffer, 0); // total count, set by the server
+		write_uint8(&buffer, (uint8_t)projection);
+
+		if (compact)
+		{
+			txid_refs_s refs = { 0 };
+			write_varint(&buffer, (uint32_t)first);
+
+			for (int32_t i = first; i < first + count; i++)
+				write_compact_outpoint(&buffer, &refs, &coin_of_item(batch, i)->outpoint);
+		}
+		else
+		{
+			for (int32_t i = first; i < first + count; i++)
+			{
+				write_uint32(&buffer, (uint32_t)i);
+				write_bytes(&buffer, (char*)&coin_of_item(batch, i)->outpoint, sizeof(outpoint_t));
+			}
+		}
+
+		if (!connection_send_request(conn, buffer.begin, NULL))
+			return RS_FAILURE;
+	}
+	return OK;
+}
+
+terab_status_enum_t get_coins_async(
+	connection_s* conn,
+	block_handle_t context,
+	coin_projection projection,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage,
+	terab_ticket_t* ticket)
+{
+	*ticket = 0;
+
+	if (coin_length < 0)
+		return TSE_INVALID_REQUEST;
+
+	// checked upfront, as the coins answered locally are completed right away
+	if (connection_pending_count(conn) >= MAX_PENDING_BATCHES)
+		return TSE_TOO_MANY_REQUESTS;
+
+	coin_cache_s* cache = connection_coin_cache(conn);
+	block_overlay_s* overlay = connection_block_overlay(conn);
+	if (overlay != NULL && block_overlay_block(overlay) != context)
+		overlay = NULL;
+
+	// hashing the scripts is left to the instance
+	if (projection == cp_script_hash)
+	{
+		cache = NULL;
+		overlay = NULL;
+	}
+
+	range rest = *storage;
+	int32_t script_offset = 0;
+	int32_t overflow_offset = (int32_t)range_len(*storage);
+	int32_t* coin_map = NULL;
+	int32_t fetched = coin_length; // coins sent to the instance
+	int32_t events_first = coin_length;
+
+	if ((cache != NULL || overlay != NULL) && coin_length > 0)
+	{
+		coin_map = (int32_t*)client_alloc(coin_length * sizeof(int32_t));
+		if (coin_map == NULL)
+			return TSE_INTERNAL_ERROR;
+
+		fetched = complete_locally(cache, overlay, context, projection, coin_length, coins,
+			&rest, &script_offset, &overflow_offset, coin_map, &events_first);
+	}
+
+	int32_t request_count = (events_first + GET_COINS_PER_REQUEST - 1) / GET_COINS_PER_REQUEST
+		+ (fetched - events_first + GET_COINS_PER_REQUEST - 1) / GET_COINS_PER_REQUEST;
+
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
+
+	pending_batch_s* batch = connection_pending_new(conn, request_count, fetched,
+		compact ? on_get_coins_compact_response : on_get_coins_response);
+	if (batch == NULL)
+	{
+		client_free(coin_map);
+		return TSE_TOO_MANY_REQUESTS;
+	}
+
+	batch->coins = coins;
+	batch->storage = rest;
+	batch->script_offset = script_offset;
+	batch->overflow_offset = overflow_offset;
+	batch->on_stream = compact ? on_get_coins_compact_stream : on_get_coins_stream;
+	batch->streamed_count = -1;
+	batch->context = context;
+	batch->cache = projection == cp_full ? cache : NULL; // only whole coins are cached
+	batch->coin_map = coin_map;
+	batch->events_first = events_first;
+	batch->stats_op = TERAB_STATS_OP_GET_COINS;
+
+	int64_t waited_us = connection_window_wait_us(conn);
+	connection_batch_begin(conn);
+	if (!send_get_coins(conn, batch, 0, events_first, projection)
+		|| !send_get_coins(conn, batch, events_first, fetched,
+			projection == cp_existence ? cp_existence : cp_events))
+	{
+		// the socket is broken, the batch will never complete
+		connection_batch_end(conn);
+		connection_pending_free(conn, batch);
+		return TSE_INTERNAL_ERROR;
+	}
+	connection_batch_end(conn);
+	batch->queued_us = connection_window_wait_us(conn) - waited_us;
+	TRACE(batch_submit, conn, batch->stats_op, batch->ticket, batch->item_count,
+		batch->first_request_id, batch->request_count);
+
+	*ticket = batch->ticket;
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t get_coins(
+	connection_s* conn,
+	block_handle_t context,
+	coin_projection projection,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage
+)
+{
+	terab_ticket_t ticket;
+	terab_status_enum_t status = get_coins_async(conn, context, projection, coin_length, coins, storage, &ticket);
+
+	if (status != TSE_SUCCESS)
+		return status;
+
+	return wait_batch(conn, ticket);
+}
+
+terab_status_enum_t refetch_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage)
+{
+	if (coin_length < 0)
+		return TSE_INVALID_REQUEST;
+
+	int32_t fetched = 0;
+	for (int32_t i = 0; i < coin_length; i++)
+	{
+		if (coins[i].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT)
+			fetched++;
+	}
+
+	if (fetched == 0)
+		return TSE_SUCCESS;
+
+	int32_t* coin_map = (int32_t*)client_alloc(fetched * sizeof(int32_t));
+	if (coin_map == NULL)
+		return TSE_INTERNAL_ERROR;
+
+	for (int32_t i = 0, item = 0; i < coin_length; i++)
+	{
+		if (coins[i].status & TERAB_COIN_STATUS_STORAGE_TOO_SHORT)
+			coin_map[item++] = i;
+	}
+
+	int32_t request_count = (fetched + GET_COINS_PER_REQUEST - 1) / GET_COINS_PER_REQUEST;
+	int compact = connection_wire_format(conn) == WIRE_COMPACT;
+
+	pending_batch_s* batch = connection_pending_new(conn, request_count, fetched,
+		compact ? on_get_coins_compact_response : on_get_coins_response);
+	if (batch == NULL)
+	{
+		client_free(coin_map);
+		return TSE_TOO_MANY_REQUESTS;
+	}
+
+	batch->coins = coins;
+	batch->storage = *storage;
+	batch->on_stream = compact ? on_get_coins_compact_stream : on_get_coins_stream;
+	batch->streamed_count = -1;
+	batch->context = context;
+	batch->coin_map = coin_map;
+	batch->events_first = fetched;
+	batch->scripts_in_place = 1;
+	batch->stats_op = TERAB_STATS_OP_GET_COINS;
+
+	int64_t waited_us = connection_window_wait_us(conn);
+	connection_batch_begin(conn);
+	if (!send_get_coins(conn, batch, 0, fetched, cp_full))
+	{
+		connection_batch_end(conn);
+		connection_pending_free(conn, batch);
+		return TSE_INTERNAL_ERROR;
+	}
+	connection_batch_end(conn);
+	batch->queued_us = connection_window_wait_us(conn) - waited_us;
+	TRACE(batch_submit, conn, batch->stats_op, batch->ticket, batch->item_count,
+		batch->first_request_id, batch->request_count);
+
+	return wait_batch(conn, batch->ticket);
+}
+
+// Prefetch Coins
+
+/* The hint is always sent in the fixed format, which the instance reads
+   whatever the wire format, and outside the window, as it is never
+   answered. */
+static terab_status_enum_t send_prefetch_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t outpoint_length,
+	const outpoint_t* outpoints)
+{
+	if (outpoint_length < 0)
+		return TSE_INVALID_REQUEST;
+
+	connection_batch_begin(conn);
+	for (int32_t first = 0; first < outpoint_length; first += GET_COINS_PER_REQUEST)
+	{
+		int32_t count = outpoint_length - first < GET_COINS_PER_REQUEST ? outpoint_length - first : GET_COINS_PER_REQUEST;
+
+		range buffer = connection_get_send_buffer(conn);
+
+		write_header(&buffer, prefetch_coins_request);
+		write_uint32(&buffer, context);
+		write_uint16(&buffer, (uint16_t)count);
+		write_uint16(&buffer, 0); // total count, set by the server
+		write_uint8(&buffer, (uint8_t)cp_full);
+
+		for (int32_t i = first; i < first + count; i++)
+		{
+			write_uint32(&buffer, (uint32_t)i);
+			write_bytes(&buffer, (const char*)(outpoints + i), sizeof(outpoint_t));
+		}
+
+		if (!connection_send_request(conn, buffer.begin, NULL))
+		{
+			connection_batch_end(conn);
+			return TSE_INTERNAL_ERROR;
+		}
+	}
+	connection_batch_end(conn);
+
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t prefetch_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t outpoint_length,
+	const outpoint_t* outpoints)
+{
+	int64_t started_us = begin_call(conn, TERAB_STATS_OP_PREFETCH, outpoint_length);
+	terab_status_enum_t status = send_prefetch_coins(conn, context, outpoint_length, outpoints);
+	return record_call(conn, TERAB_STATS_OP_PREFETCH, status, outpoint_length, started_us);
+}
+
+// Batch completion
+terab_status_enum_t poll_batch(connection_s* conn, terab_ticket_t ticket, int32_t* completed)
+{
+	*completed = 0;
+
+	pending_batch_s* batch = connection_pending_find(conn, ticket);
+	if (batch == NULL)
+		return TSE_INVALID_REQUEST;
+
+	if (batch->remaining > 0 && !connection_poll(conn))
+		return TSE_INTERNAL_ERROR;
+
+	if (batch->remaining > 0)
+		return TSE_SUCCESS;
+
+	terab_status_enum_t status = batch->status;
+	connection_pending_free(conn, batch);
+
+	*completed = 1;
+	return status;
+}
+
+terab_status_enum_t wait_batch(connection_s* conn, terab_ticket_t ticket)
+{
+	pending_batch_s* batch = connection_pending_find(conn, ticket);
+	if (batch == NULL)
+		return TSE_INVALID_REQUEST;
+
+	if (!connection_wait_batch(conn, batch))
+	{
+		connection_pending_free(conn, batch);
+		return TSE_INTERNAL_ERROR;
+	}
+
+	terab_status_enum_t status = batch->status;
+	connection_pending_free(conn, batch);
+
+	return status;
+}
@@ -42,6 +42,19 @@ typedef enum
 #undef TSE_
 } terab_status_enum_t;
 
+// Get Coins, parts of the coins returned
+typedef enum {
+	cp_full = 0,
+	cp_events = 1, // no satoshis, nLockTime nor script
+	cp_metadata = 2, // no script
+	cp_script_hash = 3, // the SHA-256 hash of the script in place of the script
+	cp_existence = 4, // status only, 'gcs_unspent', 'gcs_spent' or 'gcs_outpoint_not_found'
+} coin_projection;
+
+/* Agrees with the instance on the format of the multi-coin messages, and
+   learns the number of requests which may be in flight. Intended to be
+   called right after 'connection_open', before any other request. */
+terab_status_enum_t negotiate_connection(connection_s* conn);
 
 terab_status_enum_t open_block(connection_s* conn, 
 	block_id_t* parent_id, block_handle_t* block, block_ucid_t* block_ucid);
@@ -58,6 +71,30 @@ terab_status_enum_t get_uncommitted_block_handle(connection_s* conn,
 terab_status_enum_t get_block_info(connection_s* conn, 
 	block_handle_t block, block_info_t* info);
 
+/* The instance XORs the handles of a connection with a mask of its own,
+   over an alias made of the height of the block and of its rank among the
+   blocks of that height. Hence, the handles of a block on two connections
+   differ by a constant, which holds for all the blocks, and even across
+   instances fed with the same blocks in the same order. Sets 'offset' to
+   that constant, learned from the first committed ancestor of 'block', the
+   only blocks which can be looked up on 'to'. */
+terab_status_enum_t get_block_handle_offset(connection_s* from,
+	block_handle_t block, connection_s* to, block_handle_t* offset);
+
+/* Brings the events of coins read on another connection back to the
+   handles of the first one, 'offset' being that of 'get_block_handle_offset'. */
+void translate_coin_events(coin_t* coins, int32_t coin_length, block_handle_t offset);
+
+/* Merges the parts of a 'get_coins' split over several batches, part 'k'
+   having read the coins from 'coin_first[k]' to the storage starting at
+   'storage_first[k]'. Packs the scripts of the parts one after the other
+   at the beginning of the storage, then lays out the spans of the scripts
+   which did not fit in the order of the coins, as 'get_coins' would have.
+   Returns the number of leading coins to fetch again, those whose span
+   now fits. */
+int32_t merge_coin_storage(coin_t* coins, int32_t coin_length, range* storage,
+	int32_t part_count, const int32_t* coin_first, const size_t* storage_first);
+
 terab_status_enum_t set_coins(
 	connection_s* conn,
 	block_handle_t context,
@@ -66,17 +103,89 @@ terab_status_enum_t set_coins(
 	int32_t storage_length,
 	uint8_t* storage);
 
+terab_status_enum_t set_coins_v(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	const uint8_t* const* scripts);
+
 terab_status_enum_t get_coins(
 	connection_s* conn, 
 	block_handle_t context, 
+	coin_projection projection,
 	int32_t coin_length, 
 	coin_t* coins, 
 	range* storage);
 
+/* Fetches again the coins flagged 'TERAB_COIN_STATUS_STORAGE_TOO_SHORT' by a
+   previous 'get_coins' over the same 'coins', writing their scripts to the
+   offsets this call had reserved in 'storage'. */
+terab_status_enum_t refetch_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage);
+
+/* Same as 'set_coins', without waiting for the outcome of the coins: the
+   instance reports the coins which failed upon 'sync_coins'. */
+terab_status_enum_t write_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage);
+
+/* Waits until the coins of 'write_coins' have been written to 'context',
+   listing up to 'failure_capacity' of those which failed in 'failures'.
+   'failure_count' is set to the number of failures, possibly larger. */
+terab_status_enum_t sync_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t failure_capacity,
+	write_failure_t* failures,
+	int32_t* failure_count);
+
+/* Hints the instance that the coins of 'outpoints' are about to be read
+   in 'context'. Sent in the layout of 'get_coins_request', never answered. */
+terab_status_enum_t prefetch_coins(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t outpoint_length,
+	const outpoint_t* outpoints);
+
+terab_status_enum_t set_coins_async(
+	connection_s* conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	terab_ticket_t* ticket);
+
+terab_status_enum_t get_coins_async(
+	connection_s* conn,
+	block_handle_t context,
+	coin_projection projection,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage,
+	terab_ticket_t* ticket);
+
+terab_status_enum_t poll_batch(connection_s* conn, 
+	terab_ticket_t ticket, int32_t* completed);
+
+terab_status_enum_t wait_batch(connection_s* conn, 
+	terab_ticket_t ticket);
+
 typedef enum {
 	/* Connection controller */
 	authenticate_request = 2,
 	close_connection_request = 4,
+	negotiate_request = 6,
+	sync_coins_request = 8,
 
 	/* Chain controller */
 	open_block_request = 16,
@@ -89,10 +198,18 @@ typedef enum {
 	produce_coin_request = 66,
 	consume_coin_request = 68,
 	remove_coin_request = 70,
+	get_coins_request = 72,
+	change_coins_request = 74,
+	prefetch_coins_request = 76,
+	write_coins_request = 78,
 } request_kind;
 
 
 typedef enum {
+	/* Connection controller */
+	negotiate_response = 7,
+	sync_coins_response = 9,
+
 	/* Chain controller */
 	open_block_response = 17,
 	commit_block_response = 19,
@@ -104,6 +221,8 @@ typedef enum {
 	produce_coin_response = 67,
 	consume_coin_response = 69,
 	remove_coin_response = 71,
+	get_coins_response = 73,
+	change_coins_response = 75,
 
 } response_kind;
 
@@ -170,10 +289,23 @@ typedef struct
 	change_coin_status status;
 } change_coin_response_s;
 
+// Change Coins, item operations
+typedef enum {
+	cco_produce = 0,
+	cco_consume = 1,
+	cco_remove = 2,
+} change_coins_operation;
+
+// options of a 'cco_remove' item
+#define CCO_REMOVE_PRODUCTION 1
+#define CCO_REMOVE_CONSUMPTION 2
+
 // Get Coin
 typedef enum {
 	gcs_success = 0,
 	gcs_outpoint_not_found = 1,
+	gcs_unspent = 2, // answers 'cp_existence', without details
+	gcs_spent = 3,   // answers 'cp_existence', without details
 } get_coin_status;
 
 typedef struct
@@ -188,3 +320,16 @@ typedef struct
 	uint32_t nLockTime;
 } get_coin_response_s;
 
+// Get Coins, each item being followed by its script
+typedef struct
+{
+	uint32_t index;
+	get_coin_status status;
+	uint8_t flags;
+	block_handle_t production;
+	block_handle_t consumption;
+	uint64_t satoshis;
+	uint32_t nLockTime;
+	uint16_t script_length;
+} get_coins_item_s;
+
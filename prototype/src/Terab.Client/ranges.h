@@ -2,54 +2,139 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 
 /* The 'range' struct offers simple stream-like behaviors.
   This structure is intended to facilitate parsing and writing
   binary messages.
+
+  The primitives below are inlined, as encoding and decoding the messages
+  is the hottest code of the client after the system calls. Integers are
+  loaded and stored with fixed-width 'memcpy', which compilers turn into
+  single (unaligned) moves, and fixed-size copies such as the 32-byte ids
+  into a couple of vector moves. Bounds are checked in release builds as
+  well: overflowing a range is a bug of the client, and ends the process
+  through 'range_overflow' rather than corrupting memory.
 */
 
 typedef struct range_s {
-	char* begin; 
+	char* begin;
 	const char* end;
 } range;
 
-range range_init(char* begin, size_t len);
-size_t range_len(range r);
-int range_is_null_or_empty(range r);
-
-int64_t read_int64(range* r);
-void skip_int64(range* r);
-void write_int64(range* r, int64_t value);
-void clear_int64(range* r);
-
-uint64_t read_uint64(range* r);
-void skip_uint64(range* r);
-void write_uint64(range* r, uint64_t value);
-void clear_uint64(range* r);
-
-uint32_t read_uint32(range* r);
-void skip_uint32(range* r);
-void write_uint32(range* r, uint32_t value);
-void clear_uint32(range* r);
-
-int32_t read_int32(range* r);
-void skip_int32(range* r);
-void write_int32(range* r, int32_t value);
-void clear_int32(range* r);
-
-int8_t read_int8(range* r);
-void skip_int8(range* r);
-void write_int8(range* r, int8_t value);
-void clear_int8(range* r);
-
-uint8_t read_uint8(range* r);
-void skip_uint8(range* r);
-void write_uint8(range* r, uint8_t value);
-void clear_uint8(range* r);
-
-void copy_bytes(range* to, const char* src, size_t n);
-void copy_range(range* to, range from, size_t n);
-void write_bytes(range* dst, const char* src, size_t n);
-void clear_bytes(range* to, size_t n);
-void read_bytes(range* from, char* dst, size_t n);
-void skip_bytes(range* from, size_t n);
+#if defined(__GNUC__)
+#define RANGE_INLINE static inline __attribute__((always_inline))
+#define RANGE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define RANGE_NORETURN __attribute__((noreturn, cold))
+#elif defined(_MSC_VER)
+#define RANGE_INLINE static __forceinline
+#define RANGE_UNLIKELY(x) (x)
+#define RANGE_NORETURN __declspec(noreturn)
+#else
+#define RANGE_INLINE static inline
+#define RANGE_UNLIKELY(x) (x)
+#define RANGE_NORETURN
+#endif
+
+/* Reports a read or a write past the end of a range, never returns. */
+RANGE_NORETURN void range_overflow(void);
+
+RANGE_INLINE range range_init(char* begin, size_t len)
+{
+	range result;
+	result.begin = begin;
+	result.end = begin != NULL ? begin + len : NULL;
+	return result;
+}
+
+RANGE_INLINE size_t range_len(range r)
+{
+	return r.begin != NULL ? r.end - r.begin : 0;
+}
+
+RANGE_INLINE int range_is_null_or_empty(range r)
+{
+	return range_len(r) == 0;
+}
+
+// a null range holds no bytes, so that the check rejects it as well
+RANGE_INLINE void range_check(const range* r, size_t n)
+{
+	if (RANGE_UNLIKELY((size_t)(r->end - r->begin) < n))
+		range_overflow();
+}
+
+RANGE_INLINE void write_bytes(range* to, const char* src, size_t n)
+{
+	range_check(to, n);
+	memcpy(to->begin, src, n);
+	to->begin += n;
+}
+
+RANGE_INLINE void copy_bytes(range* to, const char* src, size_t n)
+{
+	write_bytes(to, src, n);
+}
+
+RANGE_INLINE void copy_range(range* to, range from, size_t n)
+{
+	range_check(&from, n);
+	write_bytes(to, from.begin, n);
+}
+
+RANGE_INLINE void clear_bytes(range* to, size_t n)
+{
+	range_check(to, n);
+	memset(to->begin, 0, n);
+	to->begin += n;
+}
+
+RANGE_INLINE void read_bytes(range* from, char* dst, size_t n)
+{
+	range_check(from, n);
+	memcpy(dst, from->begin, n);
+	from->begin += n;
+}
+
+RANGE_INLINE void skip_bytes(range* from, size_t n)
+{
+	range_check(from, n);
+	from->begin += n;
+}
+
+/* Defines 'read_', 'skip_', 'write_' and 'clear_' for a fixed-width integer,
+   stored in the byte order of the host (little-endian, as the server). */
+#define RANGE_FIXED_WIDTH(suffix, type) \
+	RANGE_INLINE type read_##suffix(range* r) \
+	{ \
+		type value; \
+		read_bytes(r, (char*)&value, sizeof(type)); \
+		return value; \
+	} \
+	RANGE_INLINE void skip_##suffix(range* r) \
+	{ \
+		skip_bytes(r, sizeof(type)); \
+	} \
+	RANGE_INLINE void write_##suffix(range* r, type value) \
+	{ \
+		write_bytes(r, (const char*)&value, sizeof(type)); \
+	} \
+	RANGE_INLINE void clear_##suffix(range* r) \
+	{ \
+		clear_bytes(r, sizeof(type)); \
+	}
+
+RANGE_FIXED_WIDTH(int64, int64_t)
+RANGE_FIXED_WIDTH(uint64, uint64_t)
+RANGE_FIXED_WIDTH(int32, int32_t)
+RANGE_FIXED_WIDTH(uint32, uint32_t)
+RANGE_FIXED_WIDTH(uint16, uint16_t)
+RANGE_FIXED_WIDTH(int8, int8_t)
+RANGE_FIXED_WIDTH(uint8, uint8_t)
+
+#undef RANGE_FIXED_WIDTH
+
+/* Unsigned LEB128: 7 bits per byte, least significant first. Reading
+   returns 0 if the integer is truncated or longer than 64 bits. */
+int read_varint(range* r, uint64_t* value);
+void write_varint(range* r, uint64_t value);
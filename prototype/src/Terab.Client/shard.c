@@ -0,0 +1,564 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "shard.h"
+#include "alloc.h"
+#include "stats.h"
+
+typedef struct shard_struct {
+	int32_t count;
+	connection_s** conns;
+	block_handle_t* offsets;  // per member, see 'get_block_handle_offset'
+	int offsets_resolved;
+	// set once a block was opened or committed on some members only
+	int diverged;
+	terab_ticket_t* tickets;  // zero for the members left out of a call
+	int32_t* first;           // first coin of each member in a call, 'count + 1' entries
+	size_t* storage_first;    // first byte of the storage of each member in a call
+} shard_s;
+
+int is_shard_string(const char* connection_string)
+{
+	const char* options = strchr(connection_string, ';');
+	const char* comma = strchr(connection_string, ',');
+	return comma != NULL && (options == NULL || comma < options);
+}
+
+static connection_s* open_member(const char* address, size_t address_len, const char* options)
+{
+	size_t options_len = options != NULL ? strlen(options) : 0;
+	char* member_string = (char*)client_alloc(address_len + options_len + 1);
+	if (member_string == NULL)
+		return NULL;
+
+	memcpy(member_string, address, address_len);
+	if (options_len > 0)
+		memcpy(member_string + address_len, options, options_len);
+
+	connection_s* conn = connection_new(member_string);
+	client_free(member_string);
+
+	if (conn == NULL || !connection_open(conn) || negotiate_connection(conn) != TSE_SUCCESS)
+	{
+		if (conn != NULL)
+		{
+			connection_close(conn); // no-op unless the negotiation failed
+			connection_free(conn);
+		}
+		return NULL;
+	}
+	return conn;
+}
+
+shard_s* shard_new(const char* connection_string)
+{
+	// the addresses are separated by ',' and followed by the options,
+	// which are appended to each of them
+	const char* options = strchr(connection_string, ';');
+	const char* end = options != NULL ? options : connection_string + strlen(connection_string);
+
+	int32_t count = 1;
+	for (const char* c = connection_string; c < end; c++)
+		count += *c == ',';
+
+	shard_s* shard = (shard_s*)client_alloc(sizeof(shard_s));
+	if (shard == NULL)
+		return NULL;
+
+	shard->conns = (connection_s**)client_alloc(count * sizeof(connection_s*));
+	shard->offsets = (block_handle_t*)client_alloc(count * sizeof(block_handle_t));
+	shard->tickets = (terab_ticket_t*)client_alloc(count * sizeof(terab_ticket_t));
+	shard->first = (int32_t*)client_alloc((count + 1) * sizeof(int32_t));
+	shard->storage_first = (size_t*)client_alloc((count + 1) * sizeof(size_t));
+	if (shard->conns == NULL || shard->offsets == NULL || shard->tickets == NULL
+		|| shard->first == NULL || shard->storage_first == NULL)
+	{
+		shard_free(shard);
+		return NULL;
+	}
+
+	const char* address = connection_string;
+	for (int32_t k = 0; k < count; k++)
+	{
+		const char* comma = address;
+		while (comma < end && *comma != ',')
+			comma++;
+
+		connection_s* conn = open_member(address, (size_t)(comma - address), options);
+		if (conn == NULL)
+		{
+			shard_free(shard);
+			return NULL;
+		}
+
+		shard->conns[k] = conn;
+		shard->count = k + 1;
+		address = comma + 1;
+	}
+
+	connection_set_shard(shard->conns[0], shard);
+	return shard;
+}
+
+void shard_free(shard_s* shard)
+{
+	for (int32_t k = 0; k < shard->count; k++)
+	{
+		connection_close(shard->conns[k]);
+		connection_free(shard->conns[k]);
+	}
+
+	client_free(shard->conns);
+	client_free(shard->offsets);
+	client_free(shard->tickets);
+	client_free(shard->first);
+	client_free(shard->storage_first);
+	client_free(shard);
+}
+
+connection_s* shard_front(shard_s* shard)
+{
+	return shard->conns[0];
+}
+
+void shard_get_stats(shard_s* shard, terab_stats_t* stats)
+{
+	memset(stats, 0, sizeof(terab_stats_t));
+	for (int32_t m = 0; m < shard->count; m++)
+		stats_add(stats, connection_stats(shard->conns[m]));
+}
+
+/* Member holding the coins of 'outpoint'. The outputs of a transaction
+   stay together, and the txid being a hash already, its leading bytes are
+   spread evenly. They are read in a fixed order, for all the clients to
+   agree on the member whatever their platform. */
+static int32_t member_of(shard_s* shard, const outpoint_t* outpoint)
+{
+	uint64_t hash = 0;
+	for (int i = 7; i >= 0; i--)
+		hash = (hash << 8) | outpoint->txid[i];
+
+	return (int32_t)(hash % (uint64_t)shard->count);
+}
+
+/* Learned from the blocks opened through the shard, or else once from 'context'. */
+static terab_status_enum_t resolve_offsets(shard_s* shard, block_handle_t context)
+{
+	if (shard->offsets_resolved)
+		return TSE_SUCCESS;
+
+	for (int32_t k = 1; k < shard->count; k++)
+	{
+		terab_status_enum_t status = get_block_handle_offset(shard->conns[0], context,
+			shard->conns[k], shard->offsets + k);
+		if (status != TSE_SUCCESS)
+			return status;
+	}
+
+	shard->offsets_resolved = 1;
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t shard_open_block(shard_s* shard,
+	block_id_t* parent_id, block_handle_t* block, block_ucid_t* block_ucid)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	terab_status_enum_t status = open_block(shard->conns[0], parent_id, block, block_ucid);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	for (int32_t k = 1; k < shard->count; k++)
+	{
+		block_handle_t handle;
+		block_ucid_t unused;
+		status = open_block(shard->conns[k], parent_id, &handle, &unused);
+
+		// a member which did not open the same blocks as the others
+		// cannot be given the handles of the first one anymore
+		if (status == TSE_SUCCESS && !shard->offsets_resolved)
+			shard->offsets[k] = handle ^ *block;
+		else if (status == TSE_SUCCESS && handle != (*block ^ shard->offsets[k]))
+			status = TSE_INTERNAL_ERROR;
+
+		if (status != TSE_SUCCESS)
+		{
+			shard->diverged = 1;
+			return TSE_STORAGE_CORRUPTED;
+		}
+	}
+
+	shard->offsets_resolved = 1;
+	return TSE_SUCCESS;
+}
+
+terab_status_enum_t shard_commit_block(shard_s* shard,
+	block_handle_t block, block_id_t* blockid)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	terab_status_enum_t status = resolve_offsets(shard, block);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	for (int32_t k = 0; k < shard->count; k++)
+	{
+		status = commit_block(shard->conns[k], block ^ shard->offsets[k], blockid);
+		if (status != TSE_SUCCESS && k == 0)
+			return status;
+
+		// the members before have committed the block already
+		if (status != TSE_SUCCESS)
+		{
+			shard->diverged = 1;
+			return TSE_STORAGE_CORRUPTED;
+		}
+	}
+	return TSE_SUCCESS;
+}
+
+/* Orders 'length' items by member, each item starting with its outpoint,
+   as coins do. Sets 'shard->first' and returns the index of the item at
+   each position, NULL if out of memory. The items of a member keep their
+   order, so that the outputs of a transaction remain adjacent. */
+static int32_t* order_by_member(shard_s* shard, const void* items, size_t item_len, int32_t length)
+{
+	// followed by the next position of each member
+	int32_t* order = (int32_t*)client_alloc((length + shard->count) * sizeof(int32_t));
+	if (order == NULL)
+		return NULL;
+
+	int32_t* next = order + length;
+	memset(shard->first, 0, (shard->count + 1) * sizeof(int32_t));
+
+	for (int32_t i = 0; i < length; i++)
+		shard->first[member_of(shard, (const outpoint_t*)((const char*)items + i * item_len)) + 1]++;
+
+	for (int32_t k = 0; k < shard->count; k++)
+	{
+		shard->first[k + 1] += shard->first[k];
+		next[k] = shard->first[k];
+	}
+
+	for (int32_t i = 0; i < length; i++)
+		order[next[member_of(shard, (const outpoint_t*)((const char*)items + i * item_len))]++] = i;
+
+	return order;
+}
+
+/* Copies the coins of the caller grouped by member, see 'order_by_member'. */
+static coin_t* group_coins(shard_s* shard, coin_t* coins, int32_t coin_length, int32_t** order)
+{
+	*order = order_by_member(shard, coins, sizeof(coin_t), coin_length);
+	coin_t* grouped = *order != NULL ? (coin_t*)client_alloc(coin_length * sizeof(coin_t)) : NULL;
+	if (grouped == NULL)
+	{
+		client_free(*order);
+		*order = NULL;
+		return NULL;
+	}
+
+	for (int32_t i = 0; i < coin_length; i++)
+		grouped[i] = coins[(*order)[i]];
+
+	return grouped;
+}
+
+/* Waits for the batches of the first 'submitted' members, and returns the
+   first failure in the order of the members, if any. */
+static terab_status_enum_t collect_members(shard_s* shard, int32_t submitted)
+{
+	terab_status_enum_t status = TSE_SUCCESS;
+	for (int32_t k = 0; k < submitted; k++)
+	{
+		if (shard->tickets[k] == 0)
+			continue;
+
+		terab_status_enum_t member_status = wait_batch(shard->conns[k], shard->tickets[k]);
+		if (status == TSE_SUCCESS)
+			status = member_status;
+	}
+	return status;
+}
+
+terab_status_enum_t shard_set_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	if (coin_length <= 0)
+		return set_coins(shard->conns[0], context, coin_length, coins, storage_length, storage);
+
+	terab_status_enum_t status = resolve_offsets(shard, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* order;
+	coin_t* grouped = group_coins(shard, coins, coin_length, &order);
+	if (grouped == NULL)
+		return TSE_INTERNAL_ERROR;
+
+	// the script offsets of the coins are kept, each member being given
+	// the whole storage; only whether the events are set matters, which
+	// the XOR of the handles preserves
+	int32_t submitted = 0;
+	for (; submitted < shard->count; submitted++)
+	{
+		int32_t k = submitted;
+		shard->tickets[k] = 0;
+		if (shard->first[k + 1] == shard->first[k])
+			continue;
+
+		status = set_coins_async(shard->conns[k], context ^ shard->offsets[k],
+			shard->first[k + 1] - shard->first[k], grouped + shard->first[k],
+			storage_length, storage, shard->tickets + k);
+		if (status != TSE_SUCCESS)
+			break;
+	}
+
+	terab_status_enum_t collected = collect_members(shard, submitted);
+	if (status == TSE_SUCCESS)
+		status = collected;
+
+	for (int32_t i = 0; i < coin_length; i++)
+		coins[order[i]].status = grouped[i].status;
+
+	client_free(grouped);
+	client_free(order);
+	return status;
+}
+
+terab_status_enum_t shard_set_coins_v(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	const uint8_t* const* scripts)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	if (coin_length <= 0)
+		return set_coins_v(shard->conns[0], context, coin_length, coins, scripts);
+
+	terab_status_enum_t status = resolve_offsets(shard, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* order;
+	coin_t* grouped = group_coins(shard, coins, coin_length, &order);
+	const uint8_t** grouped_scripts = grouped != NULL
+		? (const uint8_t**)client_alloc(coin_length * sizeof(const uint8_t*)) : NULL;
+	if (grouped_scripts == NULL)
+	{
+		client_free(grouped);
+		client_free(order);
+		return TSE_INTERNAL_ERROR;
+	}
+
+	for (int32_t i = 0; i < coin_length; i++)
+		grouped_scripts[i] = scripts[order[i]];
+
+	// without asynchronous counterpart, the members are written one after
+	// the other
+	for (int32_t k = 0; k < shard->count && status == TSE_SUCCESS; k++)
+	{
+		if (shard->first[k + 1] == shard->first[k])
+			continue;
+
+		status = set_coins_v(shard->conns[k], context ^ shard->offsets[k],
+			shard->first[k + 1] - shard->first[k], grouped + shard->first[k],
+			grouped_scripts + shard->first[k]);
+	}
+
+	for (int32_t i = 0; i < coin_length; i++)
+		coins[order[i]].status = grouped[i].status;
+
+	client_free(grouped_scripts);
+	client_free(grouped);
+	client_free(order);
+	return status;
+}
+
+/* Fetches again the flagged coins among the first 'limit' of 'grouped',
+   in place as 'refetch_coins' does. The events are left in the handles of
+   each member. */
+static terab_status_enum_t refetch_members(shard_s* shard, block_handle_t context,
+	coin_t* grouped, int32_t limit, range* storage)
+{
+	terab_status_enum_t status = TSE_SUCCESS;
+	for (int32_t k = 0; k < shard->count && status == TSE_SUCCESS; k++)
+	{
+		int32_t last = shard->first[k + 1] < limit ? shard->first[k + 1] : limit;
+		if (last > shard->first[k])
+		{
+			status = refetch_coins(shard->conns[k], context ^ shard->offsets[k],
+				last - shard->first[k], grouped + shard->first[k], storage);
+		}
+	}
+	return status;
+}
+
+static void translate_members(shard_s* shard, coin_t* grouped)
+{
+	for (int32_t k = 1; k < shard->count; k++)
+	{
+		translate_coin_events(grouped + shard->first[k],
+			shard->first[k + 1] - shard->first[k], shard->offsets[k]);
+	}
+}
+
+terab_status_enum_t shard_get_coins(
+	shard_s* shard,
+	block_handle_t context,
+	coin_projection projection,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	if (coin_length <= 0)
+		return get_coins(shard->conns[0], context, projection, coin_length, coins, storage);
+
+	terab_status_enum_t status = resolve_offsets(shard, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* order;
+	coin_t* grouped = group_coins(shard, coins, coin_length, &order);
+	if (grouped == NULL)
+		return TSE_INTERNAL_ERROR;
+
+	// the storage is split in proportion to the coins of each member
+	size_t storage_len = range_len(*storage);
+	for (int32_t k = 0; k <= shard->count; k++)
+		shard->storage_first[k] = (size_t)((uint64_t)storage_len * shard->first[k] / coin_length);
+
+	int32_t submitted = 0;
+	for (; submitted < shard->count; submitted++)
+	{
+		int32_t k = submitted;
+		shard->tickets[k] = 0;
+		if (shard->first[k + 1] == shard->first[k])
+			continue;
+
+		range part = range_init(storage->begin + shard->storage_first[k],
+			shard->storage_first[k + 1] - shard->storage_first[k]);
+
+		status = get_coins_async(shard->conns[k], context ^ shard->offsets[k], projection,
+			shard->first[k + 1] - shard->first[k], grouped + shard->first[k], &part, shard->tickets + k);
+		if (status != TSE_SUCCESS)
+			break;
+	}
+
+	// the members already sent write to the grouped coins until they complete
+	terab_status_enum_t collected = collect_members(shard, submitted);
+	if (status == TSE_SUCCESS)
+		status = collected;
+
+	if (status == TSE_SUCCESS)
+	{
+		int32_t refetched = merge_coin_storage(grouped, coin_length, storage,
+			shard->count, shard->first, shard->storage_first);
+		if (refetched > 0 && projection == cp_full)
+			status = refetch_members(shard, context, grouped, refetched, storage);
+	}
+
+	translate_members(shard, grouped);
+	for (int32_t i = 0; i < coin_length; i++)
+		coins[order[i]] = grouped[i];
+
+	client_free(grouped);
+	client_free(order);
+	return status;
+}
+
+terab_status_enum_t shard_refetch_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	if (coin_length <= 0)
+		return refetch_coins(shard->conns[0], context, coin_length, coins, storage);
+
+	terab_status_enum_t status = resolve_offsets(shard, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* order;
+	coin_t* grouped = group_coins(shard, coins, coin_length, &order);
+	if (grouped == NULL)
+		return TSE_INTERNAL_ERROR;
+
+	// to the handles of each member and back, as only the flagged coins
+	// are fetched again
+	translate_members(shard, grouped);
+	status = refetch_members(shard, context, grouped, coin_length, storage);
+
+	translate_members(shard, grouped);
+	for (int32_t i = 0; i < coin_length; i++)
+		coins[order[i]] = grouped[i];
+
+	client_free(grouped);
+	client_free(order);
+	return status;
+}
+
+terab_status_enum_t shard_prefetch_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t outpoint_length,
+	const outpoint_t* outpoints)
+{
+	if (shard->diverged)
+		return TSE_STORAGE_CORRUPTED;
+
+	if (outpoint_length <= 0)
+		return prefetch_coins(shard->conns[0], context, outpoint_length, outpoints);
+
+	terab_status_enum_t status = resolve_offsets(shard, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* order = order_by_member(shard, outpoints, sizeof(outpoint_t), outpoint_length);
+	outpoint_t* grouped = order != NULL
+		? (outpoint_t*)client_alloc(outpoint_length * sizeof(outpoint_t)) : NULL;
+	if (grouped == NULL)
+	{
+		client_free(order);
+		return TSE_INTERNAL_ERROR;
+	}
+
+	for (int32_t i = 0; i < outpoint_length; i++)
+		grouped[i] = outpoints[order[i]];
+
+	for (int32_t k = 0; k < shard->count && status == TSE_SUCCESS; k++)
+	{
+		if (shard->first[k + 1] == shard->first[k])
+			continue;
+
+		status = prefetch_coins(shard->conns[k], context ^ shard->offsets[k],
+			shard->first[k + 1] - shard->first[k], grouped + shard->first[k]);
+	}
+
+	client_free(grouped);
+	client_free(order);
+	return status;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "terab.h"
+#include "ranges.h"
+#include "connection.h"
+#include "protocol.h"
+
+/* A set of Terab instances over which the coins are partitioned, each
+   coin going to the member picked by the txid of its outpoint. The coins
+   of a call are split per member, sent to all of them at once, and merged
+   back in the order of the caller. Blocks are opened and committed on all
+   the members alike, which hence hold the same blocks.
+
+   The first member is the one the caller sees: block handles are those of
+   the first member, and translated for the others.
+   The lookups of blocks only go to the first member.
+   A block opened or committed on some of the members only leaves them out
+   of step: every later call on the shard returns 'TSE_STORAGE_CORRUPTED'.
+   Like a connection, a shard is used from a single thread at a time.
+*/
+typedef struct shard_struct shard_s;
+
+/* Whether 'connection_string' lists several instances, as in
+   "10.0.0.1:8338,10.0.0.2:8338;wire=compact", the options applying to
+   all of them. */
+int is_shard_string(const char* connection_string);
+
+shard_s* shard_new(const char* connection_string);
+void shard_free(shard_s* shard);
+
+/* The first member, which carries the shard, see 'connection_shard'. */
+connection_s* shard_front(shard_s* shard);
+
+/* Sum of the counters of the members, see 'terab_get_stats()'. */
+void shard_get_stats(shard_s* shard, terab_stats_t* stats);
+
+/* Same as 'open_block' on all the members, returning the handle and the
+   identifier of the block on the first one. */
+terab_status_enum_t shard_open_block(shard_s* shard,
+	block_id_t* parent_id, block_handle_t* block, block_ucid_t* block_ucid);
+
+terab_status_enum_t shard_commit_block(shard_s* shard,
+	block_handle_t block, block_id_t* blockid);
+
+terab_status_enum_t shard_set_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage);
+
+terab_status_enum_t shard_set_coins_v(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	const uint8_t* const* scripts);
+
+/* Same as 'get_coins', the storage being shared by the members in
+   proportion of their coins. With 'cp_full', the scripts which did not
+   fit in the share of their member are fetched again once the scripts of
+   all the members are packed, as the storage holds them whole; with the
+   other projections, they remain flagged. */
+terab_status_enum_t shard_get_coins(
+	shard_s* shard,
+	block_handle_t context,
+	coin_projection projection,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage);
+
+terab_status_enum_t shard_refetch_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage);
+
+terab_status_enum_t shard_prefetch_coins(
+	shard_s* shard,
+	block_handle_t context,
+	int32_t outpoint_length,
+	const outpoint_t* outpoints);
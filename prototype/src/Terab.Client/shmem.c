@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "connection.h"
+#include "shmem.h"
+#include "alloc.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHMEM_MAGIC 0x53425254 // "TRBS"
+#define SHMEM_VERSION 1
+
+// busy polls of a ring before sleeping on its doorbell
+#define SPIN_COUNT 4096
+
+// sleeps are bounded, to notice a peer which died without closing
+#define DOORBELL_TIMEOUT_MS 100
+
+// waits for room in the request ring are short, see 'shmem_reserve'
+#define ROOM_TIMEOUT_MS 1
+
+#define ATTACH_TIMEOUT_MS 5000
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+typedef struct
+{
+	uint64_t tail;
+	char pad0[56];
+	uint64_t head;
+	char pad1[56];
+	uint32_t consumer_waiting;
+	uint32_t producer_waiting;
+	char pad2[56];
+} ring_control_s;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t state;
+	int32_t client_pid;
+	int32_t server_pid;
+	char pad0[40];
+	ring_control_s requests;
+	ring_control_s responses;
+	char pad1[64];
+} segment_header_s;
+
+typedef char segment_header_is_512_bytes[sizeof(segment_header_s) == 512 ? 1 : -1];
+
+typedef struct shmem_struct {
+	char* path;
+	segment_header_s* header;
+	size_t mapped_len;
+	uint64_t capacity;
+	char* requests;
+	char* responses;
+
+	// requests committed but not published yet are before this position
+	uint64_t request_tail;
+} shmem_s;
+
+static uint32_t segment_seq;
+
+static void futex_wait(uint32_t* word, uint32_t expected, int timeout_ms)
+{
+	struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t* word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wakes the other side if it sleeps on the doorbell. */
+static void ring_doorbell(uint32_t* waiting)
+{
+	if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) != 0)
+		futex_wake(waiting);
+}
+
+static int server_alive(shmem_s* shm)
+{
+	int32_t pid = __atomic_load_n(&shm->header->server_pid, __ATOMIC_ACQUIRE);
+	return pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* Blocks while '*position', written by the server, keeps the value 'observed'.
+   A positive 'timeout_ms' bounds the wait, which may then end without change. */
+static return_status_t wait_change(shmem_s* shm, uint32_t* waiting, uint64_t* position, uint64_t observed, int timeout_ms)
+{
+	for (int spin = 0; spin < SPIN_COUNT; spin++)
+	{
+		if (__atomic_load_n(position, __ATOMIC_ACQUIRE) != observed)
+			return OK;
+	}
+
+	for (;;)
+	{
+		if (__atomic_load_n(&shm->header->state, __ATOMIC_ACQUIRE) != SHMEM_STATE_ATTACHED)
+			return KO(CONNECTIVITY);
+
+		// the server checks the doorbell after moving the position, hence
+		// the position is checked again once the doorbell is set
+		__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(position, __ATOMIC_SEQ_CST) != observed)
+		{
+			__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+			return OK;
+		}
+
+		futex_wait(waiting, 1, timeout_ms > 0 ? timeout_ms : DOORBELL_TIMEOUT_MS);
+
+		if (timeout_ms > 0 || __atomic_load_n(position, __ATOMIC_ACQUIRE) != observed)
+			return OK;
+
+		if (!server_alive(shm))
+			return KO(CONNECTIVITY);
+	}
+}
+
+static void unmap(shmem_s* shm)
+{
+	if (shm->header)
+		munmap(shm->header, shm->mapped_len);
+	client_free(shm->path);
+	client_free(shm);
+}
+
+shmem_s* shmem_new(const char* directory, size_t ring_capacity)
+{
+	if (ring_capacity < 4 * MESSAGE_MAX_LEN || (ring_capacity & (ring_capacity - 1)) != 0)
+		return NULL;
+
+	shmem_s* shm = (shmem_s*)client_alloc(sizeof(shmem_s));
+	if (shm == NULL)
+		return NULL;
+
+	size_t path_len = strlen(directory) + 64;
+	shm->path = (char*)client_alloc(path_len);
+	if (shm->path == NULL)
+	{
+		unmap(shm);
+		return NULL;
+	}
+
+	snprintf(shm->path, path_len, "%s/terab-%d-%u.shm", directory, (int)getpid(),
+		__atomic_fetch_add(&segment_seq, 1, __ATOMIC_RELAXED));
+
+	int fd = open(shm->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0)
+	{
+		unmap(shm);
+		return NULL;
+	}
+
+	shm->mapped_len = sizeof(segment_header_s) + 2 * ring_capacity;
+	void* mapped = MAP_FAILED;
+	if (ftruncate(fd, shm->mapped_len) == 0)
+	{
+		mapped = mmap(NULL, shm->mapped_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (mapped == MAP_FAILED)
+	{
+		unlink(shm->path);
+		unmap(shm);
+		return NULL;
+	}
+
+	shm->header = (segment_header_s*)mapped;
+	shm->capacity = ring_capacity;
+	shm->requests = (char*)mapped + sizeof(segment_header_s);
+	shm->responses = shm->requests + ring_capacity;
+
+	segment_header_s* header = shm->header;
+	header->magic = SHMEM_MAGIC;
+	header->version = SHMEM_VERSION;
+	header->capacity = (uint32_t)ring_capacity;
+	header->client_pid = (int32_t)getpid();
+	__atomic_store_n(&header->state, SHMEM_STATE_READY, __ATOMIC_RELEASE);
+
+	// the server unlinks the file once claimed
+	for (int waited = 0; waited < ATTACH_TIMEOUT_MS; waited += DOORBELL_TIMEOUT_MS)
+	{
+		if (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == SHMEM_STATE_ATTACHED)
+			return shm;
+
+		futex_wait(&header->state, SHMEM_STATE_READY, DOORBELL_TIMEOUT_MS);
+	}
+
+	// the server claims the segment the same way, hence it either attached
+	// before the timeout, or never will
+	uint32_t ready = SHMEM_STATE_READY;
+	if (!__atomic_compare_exchange_n(&header->state, &ready, SHMEM_STATE_CLOSED,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return shm;
+
+	unlink(shm->path);
+	unmap(shm);
+	return NULL;
+}
+
+void shmem_free(shmem_s* shm)
+{
+	segment_header_s* header = shm->header;
+	__atomic_store_n(&header->state, SHMEM_STATE_CLOSED, __ATOMIC_SEQ_CST);
+
+	// whatever the server waits on, it has to notice the closing
+	futex_wake(&header->state);
+	ring_doorbell(&header->requests.consumer_waiting);
+	ring_doorbell(&header->responses.producer_waiting);
+
+	unmap(shm);
+}
+
+return_status_t shmem_reserve(shmem_s* shm, char** reserved)
+{
+	ring_control_s* ring = &shm->header->requests;
+	uint64_t mask = shm->capacity - 1;
+
+	for (;;)
+	{
+		uint64_t tail = shm->request_tail;
+		uint64_t offset = tail & mask;
+
+		// a message never wraps around, the end of the ring is skipped instead
+		uint64_t skip = shm->capacity - offset < MESSAGE_MAX_LEN ? shm->capacity - offset : 0;
+
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail + skip + MESSAGE_MAX_LEN - head <= shm->capacity)
+		{
+			if (skip)
+			{
+				memset(shm->requests + offset, 0, sizeof(int32_t));
+				shm->request_tail += skip;
+			}
+			*reserved = shm->requests + (shm->request_tail & mask);
+			return OK;
+		}
+
+		// the server frees room only from the requests it can see
+		shmem_publish(shm);
+
+		// the server may itself wait for room in the response ring,
+		// the caller is given a chance to receive responses first
+		*reserved = NULL;
+		return wait_change(shm, &ring->producer_waiting, &ring->head, head, ROOM_TIMEOUT_MS);
+	}
+}
+
+void shmem_commit(shmem_s* shm, const char* end)
+{
+	const char* begin = shm->requests + (shm->request_tail & (shm->capacity - 1));
+	shm->request_tail += ALIGN8((uint64_t)(end - begin));
+
+	// mirrors the flushing of the send buffer of sockets
+	ring_control_s* ring = &shm->header->requests;
+	if (shm->request_tail - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) >= MESSAGE_MAX_LEN)
+	{
+		shmem_publish(shm);
+	}
+}
+
+void shmem_publish(shmem_s* shm)
+{
+	ring_control_s* ring = &shm->header->requests;
+	if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == shm->request_tail)
+		return;
+
+	__atomic_store_n(&ring->tail, shm->request_tail, __ATOMIC_SEQ_CST);
+	ring_doorbell(&ring->consumer_waiting);
+}
+
+int shmem_recv(shmem_s* shm, char* dest, size_t len)
+{
+	ring_control_s* ring = &shm->header->responses;
+
+	uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (tail == head)
+	{
+		if (!wait_change(shm, &ring->consumer_waiting, &ring->tail, head, 0))
+			return -1;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	}
+
+	size_t available = (size_t)(tail - head);
+	size_t n = available < len ? available : len;
+	if (n > INT_MAX)
+		n = INT_MAX;
+
+	// the bytes may wrap around the end of the ring
+	size_t offset = (size_t)(head & (shm->capacity - 1));
+	size_t first = shm->capacity - offset < n ? shm->capacity - offset : n;
+	memcpy(dest, shm->responses + offset, first);
+	memcpy(dest + first, shm->responses, n - first);
+
+	__atomic_store_n(&ring->head, head + n, __ATOMIC_SEQ_CST);
+	ring_doorbell(&ring->producer_waiting);
+
+	return (int)n;
+}
+
+int shmem_readable(shmem_s* shm)
+{
+	ring_control_s* ring = &shm->header->responses;
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+#else
+
+shmem_s* shmem_new(const char* directory, size_t ring_capacity)
+{
+	return NULL;
+}
+
+void shmem_free(shmem_s* shm)
+{
+}
+
+return_status_t shmem_reserve(shmem_s* shm, char** reserved)
+{
+	*reserved = NULL;
+	return UNSPECIFIED;
+}
+
+void shmem_commit(shmem_s* shm, const char* end)
+{
+}
+
+void shmem_publish(shmem_s* shm)
+{
+}
+
+int shmem_recv(shmem_s* shm, char* dest, size_t len)
+{
+	return -1;
+}
+
+int shmem_readable(shmem_s* shm)
+{
+	return 0;
+}
+
+#endif
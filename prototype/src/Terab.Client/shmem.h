@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "status.h"
+
+/* Shared-memory transport, for clients running on the same host as the
+   Terab instance.
+
+   The client creates a segment file in the directory watched by the
+   instance (see 'sharedMemoryPath' in the server configuration), and
+   waits for the instance to claim it. The segment holds two single
+   producer, single consumer rings: requests (client to server) and
+   responses (server to client). Messages keep their usual framing.
+
+   Requests are written straight into the request ring: a message never
+   wraps around the end of the ring, and starts on an 8-byte boundary. A
+   null length marks the end of the usable part of the ring, the next
+   message being at its beginning. The response ring is a plain stream of
+   bytes.
+
+   Both sides spin briefly when the ring they wait on is empty (or full),
+   then sleep on a futex doorbell which the other side only rings when a
+   sleeper is registered. The kernel is thus out of the way as long as
+   both sides are busy.
+
+   Segment layout (little-endian, mirrored by 'SharedMemorySocket' on the
+   server side):
+
+     0   uint32  magic "TRBS"
+     4   uint32  version
+     8   uint32  ring capacity in bytes (power of two, each ring)
+     12  uint32  state (see 'SHMEM_STATE_*')
+     16  int32   client pid
+     20  int32   server pid
+     64  request ring control
+     256 response ring control
+     512 request ring data, followed by the response ring data
+
+   Ring control:
+
+     0   uint64  tail, written by the producer
+     64  uint64  head, written by the consumer
+     128 uint32  consumer doorbell, non-zero while the consumer sleeps
+     132 uint32  producer doorbell, non-zero while the producer sleeps
+
+   Only available on Linux; elsewhere 'shmem_new' always returns NULL.
+*/
+typedef struct shmem_struct shmem_s;
+
+#define SHMEM_STATE_READY 1    // created by the client, not claimed yet
+#define SHMEM_STATE_ATTACHED 2 // claimed by the server
+#define SHMEM_STATE_CLOSED 3   // closed by either side
+
+/* Creates a segment in 'directory' and waits for the instance to claim it.
+   'ring_capacity' must be a power of two. Returns NULL on failure. */
+shmem_s* shmem_new(const char* directory, size_t ring_capacity);
+
+/* Closes the segment, the server is notified. */
+void shmem_free(shmem_s* shm);
+
+/* Returns in 'reserved' where the next request can be written in the
+   request ring, with at least MESSAGE_MAX_LEN contiguous bytes of room.
+   If the ring is full, waits briefly for room, and may return with a NULL
+   'reserved': the caller should then receive the pending responses before
+   trying again, as the server may be waiting for room in the response ring.
+   Fails if the instance is gone. */
+return_status_t shmem_reserve(shmem_s* shm, char** reserved);
+
+/* Appends the request written from the last reservation up to 'end'. The
+   request is not visible to the server until published. */
+void shmem_commit(shmem_s* shm, const char* end);
+
+/* Makes the committed requests visible to the server. */
+void shmem_publish(shmem_s* shm);
+
+/* Copies up to 'len' response bytes to 'dest', blocking until at least one
+   byte is available. Returns the number of bytes, or -1 if the instance
+   is gone. */
+int shmem_recv(shmem_s* shm, char* dest, size_t len);
+
+/* Returns non-zero if response bytes are waiting to be received. */
+int shmem_readable(shmem_s* shm);
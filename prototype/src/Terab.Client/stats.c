@@ -0,0 +1,138 @@
+#include "compat.h"
+
+#include "stats.h"
+
+#if !defined(_MSC_VER)
+#include <time.h>
+#endif
+
+// each power of two is split in 1 << HISTOGRAM_SUB_BITS buckets
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+
+int64_t stats_now_us(void)
+{
+#if defined(_MSC_VER)
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (int64_t)(counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* The values below HISTOGRAM_SUB_COUNT have a bucket each; above, the
+   bucket is given by the highest bit of the value, and by the bits which
+   follow it. */
+static int32_t bucket_of(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_COUNT)
+		return (int32_t)value;
+
+	int32_t high = HISTOGRAM_SUB_BITS;
+	while (high < 63 && (value >> (high + 1)) != 0)
+		high++;
+
+	int32_t bucket = (high - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT
+		+ (int32_t)((value >> (high - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_COUNT - 1));
+
+	return bucket < TERAB_HISTOGRAM_BUCKETS ? bucket : TERAB_HISTOGRAM_BUCKETS - 1;
+}
+
+/* Smallest value of the bucket, the inverse of 'bucket_of'. */
+static uint64_t bucket_floor(int32_t bucket)
+{
+	if (bucket < HISTOGRAM_SUB_COUNT)
+		return (uint64_t)bucket;
+
+	int32_t high = bucket / HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_BITS - 1;
+	uint64_t sub = (uint64_t)(bucket % HISTOGRAM_SUB_COUNT);
+	return (HISTOGRAM_SUB_COUNT + sub) << (high - HISTOGRAM_SUB_BITS);
+}
+
+void stats_record(terab_stats_t* stats, int op, int32_t status, int64_t items,
+	int64_t latency_us, int64_t queue_us)
+{
+	terab_op_stats_t* measured = stats->ops + op;
+	measured->calls++;
+	measured->items += (uint64_t)items;
+	if (status != TERAB_SUCCESS)
+		measured->failures++;
+
+	if (latency_us < 0)
+		return;
+
+	measured->queue_us += (uint64_t)queue_us;
+	measured->wire_us += (uint64_t)(latency_us - queue_us);
+
+	terab_histogram_t* latency = &measured->latency;
+	latency->count++;
+	latency->total_us += (uint64_t)latency_us;
+	if ((uint64_t)latency_us > latency->max_us)
+		latency->max_us = (uint64_t)latency_us;
+	latency->buckets[bucket_of((uint64_t)latency_us)]++;
+}
+
+static void histogram_add(terab_histogram_t* into, const terab_histogram_t* from)
+{
+	into->count += from->count;
+	into->total_us += from->total_us;
+	if (from->max_us > into->max_us)
+		into->max_us = from->max_us;
+
+	for (int32_t b = 0; b < TERAB_HISTOGRAM_BUCKETS; b++)
+		into->buckets[b] += from->buckets[b];
+}
+
+void stats_add(terab_stats_t* into, const terab_stats_t* from)
+{
+	into->requests_sent += from->requests_sent;
+	into->responses_received += from->responses_received;
+	into->bytes_sent += from->bytes_sent;
+	into->bytes_received += from->bytes_received;
+	into->send_calls += from->send_calls;
+	into->recv_calls += from->recv_calls;
+
+	for (int op = 0; op < TERAB_STATS_OP_COUNT; op++)
+	{
+		terab_op_stats_t* measured = into->ops + op;
+		measured->calls += from->ops[op].calls;
+		measured->failures += from->ops[op].failures;
+		measured->items += from->ops[op].items;
+		measured->queue_us += from->ops[op].queue_us;
+		measured->wire_us += from->ops[op].wire_us;
+		histogram_add(&measured->latency, &from->ops[op].latency);
+	}
+}
+
+uint64_t stats_percentile(const terab_histogram_t* histogram, double percentile)
+{
+	// the counts of the buckets are those which matter, the histogram
+	// may be the difference of two copies
+	uint64_t count = 0;
+	for (int32_t b = 0; b < TERAB_HISTOGRAM_BUCKETS; b++)
+		count += histogram->buckets[b];
+
+	if (count == 0)
+		return 0;
+
+	// rank of the value, from 1 to 'count'
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count);
+	if ((double)rank < percentile / 100.0 * (double)count)
+		rank++;
+	if (rank == 0)
+		rank = 1;
+
+	uint64_t seen = 0;
+	int32_t b = 0;
+	for (; b < TERAB_HISTOGRAM_BUCKETS - 1; b++)
+	{
+		seen += histogram->buckets[b];
+		if (seen >= rank)
+			break;
+	}
+	return bucket_floor(b + 1) - 1;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "terab.h"
+
+/* Measures of the activity of a connection, see 'terab_get_stats()'.
+
+   Each connection keeps its own 'terab_stats_t', updated as requests are
+   sent and responses received, and as the calls and batches complete.
+   Like the connection, it is only touched from a single thread at a time.
+*/
+
+/* Monotonic clock, in microseconds. */
+int64_t stats_now_us(void);
+
+/* Counts a call or batch of 'op', and measures its latency unless it did
+   not complete, 'latency_us' being negative. 'queue_us' is the part of
+   the latency spent waiting for the window. */
+void stats_record(terab_stats_t* stats, int op, int32_t status, int64_t items,
+	int64_t latency_us, int64_t queue_us);
+
+/* Adds up the counters of 'from' to those of 'into'. */
+void stats_add(terab_stats_t* into, const terab_stats_t* from);
+
+/* Largest value of the bucket holding 'percentile' of the latencies. */
+uint64_t stats_percentile(const terab_histogram_t* histogram, double percentile);
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "stripe.h"
+#include "alloc.h"
+#include "engine.h"
+
+// batches smaller than this per connection cost more in round-trips than they save
+#define STRIPE_MIN_COINS 256
+
+typedef struct stripe_struct {
+	int32_t count;
+	connection_s** conns;
+	block_handle_t* offsets; // per connection, see 'get_block_handle_offset'
+	int offsets_resolved;
+	terab_ticket_t* tickets;
+	engine_s* engine; // NULL unless all the connections are sockets
+} stripe_s;
+
+stripe_s* stripe_new(const char* connection_string, int32_t stripe_count)
+{
+	if (stripe_count <= 0)
+		return NULL;
+
+	stripe_s* stripe = (stripe_s*)client_alloc(sizeof(stripe_s));
+	if (stripe == NULL)
+		return NULL;
+
+	stripe->conns = (connection_s**)client_alloc(stripe_count * sizeof(connection_s*));
+	stripe->offsets = (block_handle_t*)client_alloc(stripe_count * sizeof(block_handle_t));
+	stripe->tickets = (terab_ticket_t*)client_alloc(stripe_count * sizeof(terab_ticket_t));
+	if (stripe->conns == NULL || stripe->offsets == NULL || stripe->tickets == NULL)
+	{
+		stripe_free(stripe);
+		return NULL;
+	}
+
+	for (int32_t i = 0; i < stripe_count; i++)
+	{
+		connection_s* conn = connection_new(connection_string);
+		if (conn == NULL || !connection_open(conn) || negotiate_connection(conn) != TSE_SUCCESS)
+		{
+			if (conn != NULL)
+			{
+				connection_close(conn); // no-op unless the negotiation failed
+				connection_free(conn);
+			}
+			stripe_free(stripe);
+			return NULL;
+		}
+
+		stripe->conns[i] = conn;
+		stripe->count = i + 1;
+	}
+
+	// shared-memory connections cannot be waited upon together, their
+	// batches are then collected one after the other
+	stripe->engine = stripe_count > 1 ? engine_new() : NULL;
+	for (int32_t i = 0; stripe->engine != NULL && i < stripe_count; i++)
+	{
+		if (!engine_add(stripe->engine, stripe->conns[i]))
+		{
+			engine_free(stripe->engine);
+			stripe->engine = NULL;
+		}
+	}
+
+	return stripe;
+}
+
+void stripe_free(stripe_s* stripe)
+{
+	if (stripe->engine != NULL)
+		engine_free(stripe->engine);
+
+	for (int32_t i = 0; i < stripe->count; i++)
+	{
+		connection_close(stripe->conns[i]);
+		connection_free(stripe->conns[i]);
+	}
+
+	client_free(stripe->conns);
+	client_free(stripe->offsets);
+	client_free(stripe->tickets);
+	client_free(stripe);
+}
+
+connection_s* stripe_lead(stripe_s* stripe)
+{
+	return stripe->conns[0];
+}
+
+/* Learned once, from 'context'. */
+static terab_status_enum_t resolve_offsets(stripe_s* stripe, block_handle_t context)
+{
+	if (stripe->offsets_resolved)
+		return TSE_SUCCESS;
+
+	for (int32_t i = 1; i < stripe->count; i++)
+	{
+		terab_status_enum_t status = get_block_handle_offset(stripe->conns[0], context,
+			stripe->conns[i], stripe->offsets + i);
+		if (status != TSE_SUCCESS)
+			return status;
+	}
+
+	stripe->offsets_resolved = 1;
+	return TSE_SUCCESS;
+}
+
+/* Waits for the batches of the first 'submitted' connections, and returns
+   the first failure in the order of the connections, if any. */
+static terab_status_enum_t collect_stripes(stripe_s* stripe, int32_t submitted)
+{
+	terab_status_enum_t status = TSE_SUCCESS;
+
+	if (stripe->engine == NULL)
+	{
+		for (int32_t i = 0; i < submitted; i++)
+		{
+			terab_status_enum_t stripe_status = wait_batch(stripe->conns[i], stripe->tickets[i]);
+			if (status == TSE_SUCCESS)
+				status = stripe_status;
+		}
+		return status;
+	}
+
+	int32_t first_failed = submitted;
+	for (int32_t left = submitted; left > 0;)
+	{
+		terab_completion_t completions[8];
+		int32_t count;
+		if (!engine_wait(stripe->engine, -1, 8, completions, &count) || count == 0)
+		{
+			// the batches still pending write to the caller memory, they are
+			// waited on one by one before returning
+			for (int32_t i = 0; i < submitted; i++)
+			{
+				if (connection_pending_find(stripe->conns[i], stripe->tickets[i]) != NULL)
+					wait_batch(stripe->conns[i], stripe->tickets[i]);
+			}
+			return TSE_INTERNAL_ERROR;
+		}
+
+		for (int32_t c = 0; c < count; c++)
+		{
+			int32_t i = 0;
+			while (stripe->conns[i] != (connection_s*)completions[c].conn)
+				i++;
+
+			if (completions[c].status != TSE_SUCCESS && i < first_failed)
+			{
+				first_failed = i;
+				status = (terab_status_enum_t)completions[c].status;
+			}
+			left--;
+		}
+	}
+	return status;
+}
+
+terab_status_enum_t stripe_get_coins(
+	stripe_s* stripe,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage)
+{
+	if (coin_length < 0)
+		return TSE_INVALID_REQUEST;
+
+	int32_t part_count = coin_length / STRIPE_MIN_COINS < stripe->count
+		? coin_length / STRIPE_MIN_COINS : stripe->count;
+
+	if (part_count <= 1)
+		return get_coins(stripe->conns[0], context, cp_full, coin_length, coins, storage);
+
+	// the batches of the stripe are collected from any connection
+	for (int32_t k = 0; k < stripe->count; k++)
+	{
+		if (connection_pending_count(stripe->conns[k]) > 0)
+			return TSE_TOO_MANY_REQUESTS;
+	}
+
+	terab_status_enum_t status = resolve_offsets(stripe, context);
+	if (status != TSE_SUCCESS)
+		return status;
+
+	int32_t* coin_first = (int32_t*)client_alloc((part_count + 1) * sizeof(int32_t));
+	size_t* storage_first = (size_t*)client_alloc((part_count + 1) * sizeof(size_t));
+	if (coin_first == NULL || storage_first == NULL)
+	{
+		client_free(coin_first);
+		client_free(storage_first);
+		return TSE_INTERNAL_ERROR;
+	}
+
+	// the storage is split in proportion to the coins of each part
+	size_t storage_len = range_len(*storage);
+	for (int32_t k = 0; k <= part_count; k++)
+	{
+		coin_first[k] = (int32_t)((int64_t)coin_length * k / part_count);
+		storage_first[k] = (size_t)((uint64_t)storage_len * coin_first[k] / coin_length);
+	}
+
+	int32_t submitted = 0;
+	for (; submitted < part_count; submitted++)
+	{
+		int32_t k = submitted;
+		range part = range_init(storage->begin + storage_first[k], storage_first[k + 1] - storage_first[k]);
+
+		status = get_coins_async(stripe->conns[k], context ^ stripe->offsets[k], cp_full,
+			coin_first[k + 1] - coin_first[k], coins + coin_first[k], &part, stripe->tickets + k);
+		if (status != TSE_SUCCESS)
+			break;
+	}
+
+	// the parts already sent write to the caller memory until they complete
+	terab_status_enum_t collected = collect_stripes(stripe, submitted);
+	if (status == TSE_SUCCESS)
+		status = collected;
+
+	if (status == TSE_SUCCESS)
+	{
+		for (int32_t k = 1; k < part_count; k++)
+			translate_coin_events(coins + coin_first[k], coin_first[k + 1] - coin_first[k], stripe->offsets[k]);
+
+		int32_t refetched = merge_coin_storage(coins, coin_length, storage, part_count, coin_first, storage_first);
+		if (refetched > 0)
+			status = refetch_coins(stripe->conns[0], context, refetched, coins, storage);
+	}
+
+	client_free(coin_first);
+	client_free(storage_first);
+	return status;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "terab.h"
+#include "ranges.h"
+#include "connection.h"
+#include "protocol.h"
+
+/* A fixed set of connections to the same Terab instance, over which a
+   single batch of coins is split, so that the instance reads its parts on
+   as many connection controllers at once.
+
+   The first connection, the lead, is the one the caller sees: block
+   handles are those of the lead, and translated for the other connections.
+   Like a connection, a stripe is used from a single thread at a time.
+*/
+typedef struct stripe_struct stripe_s;
+
+stripe_s* stripe_new(const char* connection_string, int32_t stripe_count);
+void stripe_free(stripe_s* stripe);
+
+connection_s* stripe_lead(stripe_s* stripe);
+
+/* Same as 'get_coins' on the lead, the coins being read in parallel
+   over the connections of the stripe. */
+terab_status_enum_t stripe_get_coins(
+	stripe_s* stripe,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	range* storage);
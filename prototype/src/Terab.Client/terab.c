@@ -3,10 +3,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "terab.h"
+#include "alloc.h"
 #include "connection.h"
 #include "protocol.h"
+#include "pool.h"
+#include "engine.h"
+#include "stripe.h"
+#include "hedge.h"
+#include "shard.h"
+#include "stats.h"
 
 #ifdef _WIN32
 #include <WinSock2.h>
@@ -34,9 +42,32 @@ int32_t terab_shutdown()
 	return TERAB_SUCCESS;
 }
 
+int32_t terab_set_allocator(terab_alloc_t alloc, terab_free_t free, void* context)
+{
+	if ((alloc == NULL) != (free == NULL))
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+
+	client_set_allocator(alloc, free, context);
+	return TERAB_SUCCESS;
+}
+
 
 int32_t terab_connect( const char* connection_string, connection_t* conn )
 {
+	if (is_shard_string(connection_string))
+	{
+		shard_s* shard = shard_new(connection_string);
+		if (shard == NULL)
+		{
+			return TERAB_ERR_CONNECTION_FAILED;
+		}
+
+		*conn = shard_front(shard);
+		return TERAB_SUCCESS;
+	}
+
 	connection_s* result = connection_new(connection_string);
 
 	if (result == NULL)
@@ -50,6 +81,13 @@ int32_t terab_connect( const char* connection_string, connection_t* conn )
 		return TERAB_ERR_CONNECTION_FAILED;
 	}
 
+	if (negotiate_connection(result) != TSE_SUCCESS)
+	{
+		connection_close(result);
+		connection_free(result);
+		return TERAB_ERR_CONNECTION_FAILED;
+	}
+
 	*conn = result;
 	return TERAB_SUCCESS;
 }
@@ -59,6 +97,12 @@ int32_t terab_disconnect(connection_t connection, const char* reason)
 {
 	connection_s* cnx = (connection_s*) connection;
 
+	if (connection_shard(cnx) != NULL)
+	{
+		shard_free(connection_shard(cnx));
+		return TERAB_SUCCESS;
+	}
+
 	if (!connection_close(cnx))
 	{
 		return TERAB_ERR_INTERNAL_ERROR;
@@ -69,6 +113,104 @@ int32_t terab_disconnect(connection_t connection, const char* reason)
 }
 
 
+int32_t terab_pool_create(const char* connection_string, int32_t connection_count, terab_pool_t* pool)
+{
+	if (connection_count <= 0)
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+
+	pool_s* result = pool_new(connection_string, connection_count);
+
+	if (result == NULL)
+	{
+		return TERAB_ERR_CONNECTION_FAILED;
+	}
+
+	*pool = result;
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_pool_destroy(terab_pool_t pool)
+{
+	pool_free((pool_s*)pool);
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_pool_acquire(terab_pool_t pool, connection_t* conn)
+{
+	*conn = pool_acquire((pool_s*)pool);
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_pool_release(terab_pool_t pool, connection_t conn)
+{
+	if (!pool_release((pool_s*)pool, (connection_s*)conn))
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+	return TERAB_SUCCESS;
+}
+
+
+int32_t terab_stripe_create(const char* connection_string, int32_t stripe_count, terab_stripe_t* stripe)
+{
+	if (stripe_count <= 0)
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+
+	stripe_s* result = stripe_new(connection_string, stripe_count);
+
+	if (result == NULL)
+	{
+		return TERAB_ERR_CONNECTION_FAILED;
+	}
+
+	*stripe = result;
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_stripe_destroy(terab_stripe_t stripe)
+{
+	stripe_free((stripe_s*)stripe);
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_stripe_connection(terab_stripe_t stripe, connection_t* conn)
+{
+	*conn = stripe_lead((stripe_s*)stripe);
+	return TERAB_SUCCESS;
+}
+
+
+int32_t terab_hedge_create(const char* primary_string, const char* secondary_string,
+	int32_t delay_us, terab_hedge_t* hedge)
+{
+	hedge_s* result = hedge_new(primary_string, secondary_string, delay_us);
+
+	if (result == NULL)
+	{
+		return TERAB_ERR_CONNECTION_FAILED;
+	}
+
+	*hedge = result;
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_hedge_destroy(terab_hedge_t hedge)
+{
+	hedge_free((hedge_s*)hedge);
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_hedge_connection(terab_hedge_t hedge, connection_t* conn)
+{
+	*conn = hedge_primary((hedge_s*)hedge);
+	return TERAB_SUCCESS;
+}
+
+
 int32_t terab_utxo_open_block(
 	connection_t conn,
 	block_id_t* parentid,
@@ -77,6 +219,9 @@ int32_t terab_utxo_open_block(
 )
 {
 	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return shard_open_block(connection_shard(cnx), parentid, block, block_ucid);
+
 	return open_block(cnx, parentid, block, block_ucid);
 }
 
@@ -87,6 +232,9 @@ int32_t terab_utxo_commit_block(
 )
 {
 	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return shard_commit_block(connection_shard(cnx), block, blockid);
+
 	return commit_block(cnx, block, blockid);
 }
 
@@ -130,9 +278,58 @@ int32_t terab_utxo_set_coins(
 )
 {
 	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return shard_set_coins(connection_shard(cnx), context, coin_length, coins, storage_length, storage);
+
 	return set_coins(cnx, context, coin_length, coins, storage_length, storage);
 }
 
+int32_t terab_utxo_set_coins_v(
+	connection_t conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	const uint8_t* const* scripts
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return shard_set_coins_v(connection_shard(cnx), context, coin_length, coins, scripts);
+
+	return set_coins_v(cnx, context, coin_length, coins, scripts);
+}
+
+int32_t terab_utxo_set_coins_unacked(
+	connection_t conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	return write_coins(cnx, context, coin_length, coins, storage_length, storage);
+}
+
+int32_t terab_utxo_sync(
+	connection_t conn,
+	block_handle_t context,
+	int32_t failure_capacity,
+	write_failure_t* failures,
+	int32_t* failure_count
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	return sync_coins(cnx, context, failure_capacity, failures, failure_count);
+}
+
 int32_t terab_utxo_get_coins(
 	connection_t conn,
 	block_handle_t context,
@@ -147,6 +344,288 @@ int32_t terab_utxo_get_coins(
 	range storage_range = { 0 };
 	storage_range.begin = (char*) storage;
 	storage_range.end = storage_range.begin + storage_length;
+
+	if (connection_shard(cnx) != NULL)
+		return shard_get_coins(connection_shard(cnx), context, cp_full, coin_length, coins, &storage_range);
 	
-	return get_coins(cnx, context, coin_length, coins, &storage_range);
+	return get_coins(cnx, context, cp_full, coin_length, coins, &storage_range);
+}
+
+/* Wire projection of each 'TERAB_PROJECTION_*', -1 if invalid. */
+static int wire_projection(int32_t projection)
+{
+	switch (projection)
+	{
+	case TERAB_PROJECTION_FULL: return cp_full;
+	case TERAB_PROJECTION_METADATA: return cp_metadata;
+	case TERAB_PROJECTION_SCRIPT_HASH: return cp_script_hash;
+	case TERAB_PROJECTION_EXISTENCE: return cp_existence;
+	default: return -1;
+	}
+}
+
+int32_t terab_utxo_get_coins_projected(
+	connection_t conn,
+	block_handle_t context,
+	int32_t projection,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+
+	int wire = wire_projection(projection);
+	if (wire < 0)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	if (connection_shard(cnx) != NULL)
+		return shard_get_coins(connection_shard(cnx), context, (coin_projection)wire, coin_length, coins, &storage_range);
+
+	return get_coins(cnx, context, (coin_projection)wire, coin_length, coins, &storage_range);
+}
+
+int32_t terab_utxo_refetch_coins(
+	connection_t conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	if (connection_shard(cnx) != NULL)
+		return shard_refetch_coins(connection_shard(cnx), context, coin_length, coins, &storage_range);
+
+	return refetch_coins(cnx, context, coin_length, coins, &storage_range);
+}
+
+int32_t terab_utxo_get_coins_striped(
+	terab_stripe_t stripe,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage
+)
+{
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	return stripe_get_coins((stripe_s*)stripe, context, coin_length, coins, &storage_range);
+}
+
+int32_t terab_utxo_get_coins_hedged(
+	terab_hedge_t hedge,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage
+)
+{
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	return hedge_get_coins((hedge_s*)hedge, context, coin_length, coins, &storage_range);
+}
+
+int32_t terab_utxo_prefetch(
+	connection_t conn,
+	block_handle_t context,
+	const outpoint_t* outpoints,
+	int32_t outpoint_length
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return shard_prefetch_coins(connection_shard(cnx), context, outpoint_length, outpoints);
+
+	return prefetch_coins(cnx, context, outpoint_length, outpoints);
+}
+
+int32_t terab_utxo_get_coins_async(
+	connection_t conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	terab_ticket_t* ticket
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	return get_coins_async(cnx, context, cp_full, coin_length, coins, &storage_range, ticket);
+}
+
+int32_t terab_utxo_get_coins_projected_async(
+	connection_t conn,
+	block_handle_t context,
+	int32_t projection,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	terab_ticket_t* ticket
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+
+	*ticket = 0;
+
+	int wire = wire_projection(projection);
+	if (wire < 0 || connection_shard(cnx) != NULL)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	range storage_range = { 0 };
+	storage_range.begin = (char*) storage;
+	storage_range.end = storage_range.begin + storage_length;
+
+	return get_coins_async(cnx, context, (coin_projection)wire, coin_length, coins, &storage_range, ticket);
+}
+
+int32_t terab_utxo_set_coins_async(
+	connection_t conn,
+	block_handle_t context,
+	int32_t coin_length,
+	coin_t* coins,
+	int32_t storage_length,
+	uint8_t* storage,
+	terab_ticket_t* ticket
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+		return TERAB_ERR_INVALID_REQUEST;
+
+	return set_coins_async(cnx, context, coin_length, coins, storage_length, storage, ticket);
+}
+
+int32_t terab_poll(
+	connection_t conn,
+	terab_ticket_t ticket,
+	int32_t* completed
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	return poll_batch(cnx, ticket, completed);
+}
+
+int32_t terab_wait(
+	connection_t conn,
+	terab_ticket_t ticket
+)
+{
+	connection_s* cnx = (connection_s*)conn;
+	return wait_batch(cnx, ticket);
+}
+
+int32_t terab_engine_create(terab_engine_t* engine)
+{
+	engine_s* result = engine_new();
+
+	if (result == NULL)
+	{
+		return TERAB_ERR_INTERNAL_ERROR;
+	}
+
+	*engine = result;
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_engine_destroy(terab_engine_t engine)
+{
+	engine_free((engine_s*)engine);
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_engine_add(terab_engine_t engine, connection_t conn)
+{
+	if (connection_shard((connection_s*)conn) != NULL || !engine_add((engine_s*)engine, (connection_s*)conn))
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_engine_remove(terab_engine_t engine, connection_t conn)
+{
+	if (!engine_remove((engine_s*)engine, (connection_s*)conn))
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_engine_wait(
+	terab_engine_t engine,
+	int32_t timeout_ms,
+	int32_t completion_capacity,
+	terab_completion_t* completions,
+	int32_t* completion_count
+)
+{
+	*completion_count = 0;
+
+	if (completion_capacity <= 0)
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+
+	if (!engine_wait((engine_s*)engine, timeout_ms, completion_capacity, completions, completion_count))
+	{
+		return TERAB_ERR_INTERNAL_ERROR;
+	}
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_get_stats(connection_t conn, terab_stats_t* stats)
+{
+	connection_s* cnx = (connection_s*)conn;
+	if (connection_shard(cnx) != NULL)
+	{
+		shard_get_stats(connection_shard(cnx), stats);
+		return TERAB_SUCCESS;
+	}
+
+	memcpy(stats, connection_stats(cnx), sizeof(terab_stats_t));
+	return TERAB_SUCCESS;
+}
+
+int32_t terab_histogram_percentile(
+	const terab_histogram_t* histogram,
+	double percentile,
+	uint64_t* value_us
+)
+{
+	*value_us = 0;
+
+	// also rejects NaN
+	if (!(percentile >= 0 && percentile <= 100))
+	{
+		return TERAB_ERR_INVALID_REQUEST;
+	}
+
+	*value_us = stats_percentile(histogram, percentile);
+	return TERAB_SUCCESS;
 }
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,14 @@ extern "C" {
  */
 typedef void* connection_t;
 
+/* Opaque handle to a pool of connections shared between threads.
+
+   A connection checked out of the pool through 'terab_pool_acquire()'
+   is owned by the calling thread until 'terab_pool_release()'. In between,
+   the connection is used like any other connection.
+ */
+typedef void* terab_pool_t;
+
 /* Opaque handle to a block present on a Terab server.
    
    A shorter way to reference a block instead of using its 32-byte
@@ -49,6 +58,133 @@ typedef void* connection_t;
  */
 typedef uint32_t block_handle_t;
 
+/* Handle to an asynchronous batch of coin operations.
+
+   Tickets are returned by 'terab_utxo_get_coins_async()' and
+   'terab_utxo_set_coins_async()'. Like block handles, tickets are 
+   specific to a connection. A ticket remains valid until the completion 
+   of its batch has been observed through 'terab_poll()' or 'terab_wait()'.
+   Zero is never a valid ticket.
+ */
+typedef uint32_t terab_ticket_t;
+
+/* Maximal number of asynchronous batches that can be pending on
+   a single connection. */
+#define TERAB_MAX_PENDING_BATCHES 16
+
+/* Opaque handle to an I/O engine driving many connections from a single
+   thread (see 'terab_engine_wait()').
+ */
+typedef void* terab_engine_t;
+
+/* Opaque handle to a set of connections over which a single batch of
+   coins is split (see 'terab_utxo_get_coins_striped()').
+ */
+typedef void* terab_stripe_t;
+
+/* Opaque handle to a pair of connections to redundant Terab instances
+   (see 'terab_utxo_get_coins_hedged()').
+ */
+typedef void* terab_hedge_t;
+
+/* Outcome of an asynchronous batch, as collected by 'terab_engine_wait()'. */
+typedef struct terab_completion terab_completion_t;
+
+struct terab_completion
+{
+  connection_t conn;
+  terab_ticket_t ticket;
+  int32_t status;
+};
+
+/* Operations measured by 'terab_get_stats()', indices of 'terab_stats_t.ops'. */
+
+  /* 'terab_utxo_open_block()'. */
+#define TERAB_STATS_OP_OPEN_BLOCK                   0
+
+  /* 'terab_utxo_commit_block()'. */
+#define TERAB_STATS_OP_COMMIT_BLOCK                 1
+
+  /* Lookups of blocks: 'terab_utxo_get_committed_block()',
+     'terab_utxo_get_uncommitted_block()' and 'terab_utxo_get_blockinfo()'. */
+#define TERAB_STATS_OP_GET_BLOCK                    2
+
+  /* Batches of coins read, whatever the call which submitted them. */
+#define TERAB_STATS_OP_GET_COINS                    3
+
+  /* Batches of coins written with acknowledgement. */
+#define TERAB_STATS_OP_SET_COINS                    4
+
+  /* 'terab_utxo_set_coins_unacked()', measured until its requests are sent. */
+#define TERAB_STATS_OP_WRITE_COINS                  5
+
+  /* 'terab_utxo_sync()'. */
+#define TERAB_STATS_OP_SYNC                         6
+
+  /* 'terab_utxo_prefetch()', measured until its requests are sent. */
+#define TERAB_STATS_OP_PREFETCH                     7
+
+#define TERAB_STATS_OP_COUNT                        8
+
+/* Number of buckets of 'terab_histogram_t'. */
+#define TERAB_HISTOGRAM_BUCKETS                     240
+
+/* Latencies in microseconds, in buckets of logarithmic width: one per
+   value below 8, then 8 per power of two. The last bucket also counts the
+   values of 2^32 and above. See 'terab_histogram_percentile()'.
+*/
+typedef struct terab_histogram terab_histogram_t;
+
+struct terab_histogram
+{
+  uint64_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+  uint64_t buckets[TERAB_HISTOGRAM_BUCKETS];
+};
+
+/* Measures of an operation (within 'terab_stats_t').
+
+   calls: calls, or batches for the coin operations.
+   failures: calls which did not succeed.
+   items: coins or outpoints sent to the instance.
+   queue_us: total time waiting for room in the request window.
+   wire_us: total time from the requests being sent to the last response.
+   latency: from the call to its last response, or to its last request
+          for the calls not answered.
+*/
+typedef struct terab_op_stats terab_op_stats_t;
+
+struct terab_op_stats
+{
+  uint64_t calls;
+  uint64_t failures;
+  uint64_t items;
+  uint64_t queue_us;
+  uint64_t wire_us;
+  terab_histogram_t latency;
+};
+
+/* Counters of a connection since it was opened, see 'terab_get_stats()'.
+
+   requests_sent, responses_received: messages exchanged with the instance.
+   bytes_sent, bytes_received: their bytes, headers included.
+   send_calls, recv_calls: calls to the transport.
+   ops: measures of each 'TERAB_STATS_OP_*'.
+*/
+typedef struct terab_stats terab_stats_t;
+
+struct terab_stats
+{
+  uint64_t requests_sent;
+  uint64_t responses_received;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t send_calls;
+  uint64_t recv_calls;
+  terab_op_stats_t ops[TERAB_STATS_OP_COUNT];
+};
+
 /* Persistent identifier of a committed block.
 */
 typedef struct block_id { uint8_t value[32]; } block_id_t;
@@ -135,6 +271,27 @@ struct outpoint
   /* Get coin partially failed because the script could not be written to the storage. */
 #define TERAB_COIN_STATUS_STORAGE_TOO_SHORT         16
 
+  /* The coin exists but is consumed at the context (existence projection only). */
+#define TERAB_COIN_STATUS_SPENT                     32
+
+/* Parts of the coins returned by 'terab_utxo_get_coins_projected()'. */
+
+  /* Everything, script included, as 'terab_utxo_get_coins()'. */
+#define TERAB_PROJECTION_FULL                       0
+
+  /* Everything but the script, 'script_length' being zero. */
+#define TERAB_PROJECTION_METADATA                   1
+
+  /* Everything, the script being replaced by its SHA-256 hash: the 32 bytes
+     of the hash are written to the storage in place of the script. */
+#define TERAB_PROJECTION_SCRIPT_HASH                2
+
+  /* Whether the coin is unspent at the context only: the status is
+     'TERAB_COIN_STATUS_SUCCESS' if unspent, 'TERAB_COIN_STATUS_SPENT' if
+     consumed, 'TERAB_COIN_STATUS_OUTPOINT_NOT_FOUND' if missing, the other
+     fields being zero. */
+#define TERAB_PROJECTION_EXISTENCE                  3
+
 /* A coin, identified by its outpoint, and asssociated to two blocks which 
   represent the events in its lifecycle, namely its production and consumption.
 
@@ -160,8 +317,9 @@ struct outpoint
 		associated to the script of the coin. When the coin is found, the
 		'script_length' is returned. However, if 'TERAB_COIN_STATUS_STORAGE_TOO_SHORT'
 		then, no corresponding script can be loaded from 'storage'. The script
-		length is returned however, to facilitate choosing an adequate size for
-		the storage during a later 'get_coins' attempt.
+		offset and length are returned however: the span, past the end of
+		'storage', is reserved to the script, so that 'terab_utxo_refetch_coins()'
+		can load it once the storage has been grown.
 
   flags: misc flags intended for persistence within the UTXO set.
 
@@ -189,6 +347,23 @@ struct coin
   uint8_t status;
 };
 
+/* A coin written through 'terab_utxo_set_coins_unacked()' which failed,
+   as reported by 'terab_utxo_sync()'.
+
+   index: rank of the coin among all the coins written since the previous
+          sync, the first coin of the first call being zero.
+
+   status: one of 'TERAB_COIN_STATUS_*', as 'coin_t.status' would have
+          been set by 'terab_utxo_set_coins()'.
+*/
+typedef struct write_failure write_failure_t;
+
+struct write_failure
+{
+  int32_t index;
+  int32_t status;
+};
+
 /* Perform initializations needed for good working order of the Terab client,
    along with environment check.
 
@@ -201,11 +376,53 @@ int32_t terab_initialize();
 */
 int32_t terab_shutdown();
 
+/* Memory requested by the Terab client, 'context' being passed back
+   as is. Aligned as by 'malloc', NULL on failure.
+*/
+typedef void* (*terab_alloc_t)(void* context, size_t size);
+typedef void (*terab_free_t)(void* context, void* ptr);
+
+/* Routes all the allocations of the Terab client through 'alloc' and
+   'free'. Passing NULL for both restores 'malloc' and 'free'. Not
+   thread-safe: call it while no connection, pool or engine exists.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if only one of 'alloc' and 'free' is NULL.
+*/
+int32_t terab_set_allocator(terab_alloc_t alloc, terab_free_t free, void* context);
+
 /* Get a connection handle intended for all Terab-related operations.
 
    connection_string: details to connect to the Terab instance.
    conn: returned as an opaque connection handle.
 
+   The connection string is an address, optionally followed by a port
+   and by ';'-separated options, e.g. "127.0.0.1:8338;io=uring". Local
+   instances are also reached with "unix:/path/to/terab.sock", or through
+   shared memory with "shm:/path/to/dir", the directory watched by the
+   instance.
+
+   Several ','-separated addresses make a sharded connection, the coins
+   being partitioned over the instances by txid. All the clients must list
+   the instances in the same order, fed with the same blocks. Once a block
+   is opened or committed on some instances only, every call returns
+   TERAB_ERR_STORAGE_CORRUPTED. The asynchronous and unacknowledged calls
+   return TERAB_ERR_INVALID_REQUEST on sharded connections.
+
+   Options:
+
+   - io=socket (default) or io=uring (Linux only, falls back on sockets).
+   - recv_buffer=<bytes>: receive buffer, 262144 by default, 32768 at least.
+   - shm_ring=<bytes>: ring capacity of shared-memory connections, a power
+     of two, 1048576 by default.
+   - wire=fixed (default) or wire=compact: encoding of the coins.
+   - coin_cache=<bytes>: cache of the coins read, 65536 at least.
+   - block_overlay=<bytes>: coins written to the open block, whose
+     payload is read back without asking the instance, 65536 at least.
+   - arena=<bytes>: single block holding the memory of the connection.
+   - huge_pages=1: maps the arena from huge pages (Linux only).
+
    Errors: 
 
    - TERAB_ERR_CONNECTION_FAILED if instance is unreachable, did not respond,
@@ -227,6 +444,94 @@ int32_t terab_connect(
 
 int32_t terab_disconnect(connection_t conn, const char* reason);
 
+/* Open a pool of connections to a Terab instance.
+
+   connection_string: details to connect to the Terab instance.
+   connection_count: number of connections opened by the pool.
+   pool: returned as an opaque pool handle.
+
+   Errors: same as 'terab_connect()', and TERAB_ERR_INVALID_REQUEST if
+   'connection_count' is not positive.
+*/
+int32_t terab_pool_create(
+  const char* connection_string,
+  int32_t connection_count,
+  terab_pool_t* pool
+);
+
+/* Close all the connections of the pool. No connection should be
+   checked out when the pool is destroyed.
+*/
+int32_t terab_pool_destroy(terab_pool_t pool);
+
+/* Check out a connection from the pool, preferably the one the thread
+   checked out last. Thread-safe; blocks until a connection is available.
+*/
+int32_t terab_pool_acquire(terab_pool_t pool, connection_t* conn);
+
+/* Return to the pool a connection checked out with 'terab_pool_acquire()'.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if 'conn' is not a checked out connection
+     of the pool.
+*/
+int32_t terab_pool_release(terab_pool_t pool, connection_t conn);
+
+/* Open a stripe of connections to a Terab instance.
+
+   connection_string: details to connect to the Terab instance.
+   stripe_count: number of connections opened by the stripe.
+   stripe: returned as an opaque stripe handle.
+
+   Like a connection, a stripe is used from a single thread at a time.
+
+   Errors: same as 'terab_pool_create()'.
+*/
+int32_t terab_stripe_create(
+  const char* connection_string,
+  int32_t stripe_count,
+  terab_stripe_t* stripe
+);
+
+/* Close all the connections of the stripe, its connection included. */
+int32_t terab_stripe_destroy(terab_stripe_t stripe);
+
+/* The connection of the stripe, to which the block handles passed to
+   'terab_utxo_get_coins_striped()' belong. Closed with the stripe.
+*/
+int32_t terab_stripe_connection(terab_stripe_t stripe, connection_t* conn);
+
+/* Open a hedge over two Terab instances fed with the same blocks, in the
+   same order.
+
+   primary_string: details to connect to the instance read first.
+   secondary_string: details to connect to the instance read when the
+       primary is late.
+   delay_us: delay before a read goes to the secondary, in microseconds,
+       zero or negative for the 95th percentile of the latest reads.
+   hedge: returned as an opaque hedge handle.
+
+   Like a connection, a hedge is used from a single thread at a time.
+   Reads are not hedged over shared-memory connections.
+
+   Errors: same as 'terab_connect()', on either instance.
+*/
+int32_t terab_hedge_create(
+  const char* primary_string,
+  const char* secondary_string,
+  int32_t delay_us,
+  terab_hedge_t* hedge
+);
+
+/* Close both connections of the hedge. */
+int32_t terab_hedge_destroy(terab_hedge_t hedge);
+
+/* The connection to the primary, to which the block handles passed to
+   'terab_utxo_get_coins_hedged()' belong. Closed with the hedge.
+*/
+int32_t terab_hedge_connection(terab_hedge_t hedge, connection_t* conn);
+
 /* Starts the write sequence for a new block.
 
    conn: opaque connection handle.
@@ -280,6 +585,11 @@ int32_t terab_utxo_open_block(
    - TERAB_ERR_BLOCK_COMMITTED if there exists another block with
 	 the provided `blockid`.
 
+   - TERAB_ERR_INCONSISTENT_REQUEST if coins written to the block through
+	 `terab_utxo_set_coins_unacked` failed. The block is synced first,
+	 see `terab_utxo_sync`, and left uncommitted in that case: sync
+	 explicitly beforehand to learn which coins failed.
+
    This method is IDEMPOTENT: attempting to commit a block that
    is already committed simply succeeds.
 */
@@ -372,8 +682,11 @@ int32_t terab_utxo_get_blockinfo(
    Upon return, the `coins[].script_offset` offsets point to spans inside the
    `storage` buffer. If the storage is too short then some coins  have a 
    `coins[].status flaggged with `TERAB_COIN_STATUS_STORAGE_TOO_SHORT`.
-   However `coins[].script_length` will be set as a hint to the amount of 
-   memory required. 
+   However `coins[].script_offset` and `coins[].script_length` are set
+   nonetheless, to spans past the end of `storage`: the storage needed is
+   the end of the last such span.
+   See 'terab_utxo_refetch_coins()' to complete these coins without 
+   querying the others again.
 
    Errors: 
 
@@ -395,6 +708,108 @@ int32_t terab_utxo_get_coins(
   uint8_t* storage
 );
 
+/* Same as 'terab_utxo_get_coins()', returning only the parts of the coins
+   selected by 'projection', one of 'TERAB_PROJECTION_*'.
+
+   Errors: same as 'terab_utxo_get_coins()', and
+
+   - TERAB_ERR_INVALID_REQUEST if 'projection' is unknown.
+*/
+int32_t terab_utxo_get_coins_projected(
+  connection_t conn,
+  block_handle_t context,
+  int32_t projection,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage
+);
+
+/* Complete the coins whose scripts did not fit in the storage given to
+   'terab_utxo_get_coins()'.
+
+   conn, context, coin_length, coins: same as the 'terab_utxo_get_coins()'
+       call, whose results are left in 'coins'.
+   storage_length: the number of bytes in 'storage'.
+   storage: the storage of that call, grown with its content preserved
+       (through 'realloc', typically).
+
+   Only the coins flagged with `TERAB_COIN_STATUS_STORAGE_TOO_SHORT` are
+   requested again, their scripts going to the spans reserved by
+   'terab_utxo_get_coins()'. Coins whose span is still out of 'storage'
+   remain flagged.
+
+   Errors: same as 'terab_utxo_get_coins()'.
+
+   The method is PURE.
+*/
+int32_t terab_utxo_refetch_coins(
+  connection_t conn,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage
+);
+
+/* Same as 'terab_utxo_get_coins()' on the connection of the stripe, the
+   coins being split into parts read at once over the connections of the
+   stripe. 'coins' and 'storage' are laid out as by 'terab_utxo_get_coins()'.
+
+   Errors: same as 'terab_utxo_get_coins()', and
+
+   - TERAB_ERR_TOO_MANY_REQUESTS if asynchronous batches are pending on
+     the connection of the stripe.
+*/
+int32_t terab_utxo_get_coins_striped(
+  terab_stripe_t stripe,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage
+);
+
+/* Same as 'terab_utxo_get_coins()' on the primary of the hedge, the coins
+   not answered past the delay of the hedge being read again from the
+   secondary. Each coin takes the first answer it gets. 'coins' and
+   'storage' are laid out as by 'terab_utxo_get_coins()'.
+
+   Errors: same as 'terab_utxo_get_coins()' on the primary.
+*/
+int32_t terab_utxo_get_coins_hedged(
+  terab_hedge_t hedge,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage
+);
+
+/* Hint the Terab instance that the coins of 'outpoints' are about to be
+   read in 'context'.
+
+   conn: opaque connection handle.
+   context: the block the coins will be read in.
+   outpoint_length: the number of outpoints.
+   outpoints: the outpoints of the coins.
+
+   Returns as soon as the hint is sent. The hint is never answered, and
+   may be dropped by the instance.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if 'outpoint_length' is negative.
+
+   The method is PURE.
+*/
+int32_t terab_utxo_prefetch(
+  connection_t conn,
+  block_handle_t context,
+  const outpoint_t* outpoints,
+  int32_t outpoint_length
+);
+
 /* Write new outputs and their scripts to a new block.
   
    conn: opaque connection handle.
@@ -460,6 +875,236 @@ int32_t terab_utxo_set_coins(
   uint8_t* storage
 );
 
+/* Same as 'terab_utxo_set_coins()', but returns as soon as the coins are
+   sent: 'coin_t.status' is left untouched, and the coins which failed are
+   reported by 'terab_utxo_sync()'. The connection writes to a single
+   block until the next sync.
+
+   Errors: same as 'terab_utxo_set_coins()' for the checks made before
+   sending the coins, and
+
+   - TERAB_ERR_INVALID_REQUEST if coins written to another block through
+     this function have not been synced yet.
+*/
+int32_t terab_utxo_set_coins_unacked(
+  connection_t conn,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage
+);
+
+/* Waits until the coins written through 'terab_utxo_set_coins_unacked()'
+   since the previous sync have been processed by the Terab instance.
+
+   conn: opaque connection handle.
+   context: the block the coins have been written to.
+   failure_capacity: the number of items in 'failures'.
+   failures: where the coins which failed are listed, up to 'failure_capacity'.
+   failure_count: set to the number of coins which failed, possibly
+       larger than 'failure_capacity'.
+
+   The coins are numbered afresh after each sync. Committing the block
+   syncs as well, see 'terab_utxo_commit_block()'.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if the coins have been written to another
+     block, or if 'failure_capacity' is negative.
+*/
+int32_t terab_utxo_sync(
+  connection_t conn,
+  block_handle_t context,
+  int32_t failure_capacity,
+  write_failure_t* failures,
+  int32_t* failure_count
+);
+
+/* Variant of 'terab_utxo_set_coins()' where the scripts are not packed
+   in a single storage buffer.
+
+   scripts: one pointer per coin, to a script of 'coin_t.script_length'
+     bytes. 'coin_t.script_offset' is ignored. Pointers of coins which are
+     not produced are ignored, and may be NULL.
+
+   Errors: same as 'terab_utxo_set_coins()'.
+*/
+int32_t terab_utxo_set_coins_v(
+  connection_t conn,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  const uint8_t* const* scripts
+);
+
+/* Asynchronous counterpart of 'terab_utxo_get_coins()'.
+
+   The batch is sent, and the function returns without waiting for the 
+   responses. 'coins' and 'storage' are written to as responses arrive,
+   hence, both buffers must remain valid and untouched until the completion
+   of the batch has been observed through 'terab_poll()' or 'terab_wait()'.
+
+   ticket: returned as the handle to the pending batch.
+
+   Synchronous calls remain allowed while batches are pending.
+
+   Errors: 
+
+   - TERAB_ERR_TOO_MANY_REQUESTS if TERAB_MAX_PENDING_BATCHES batches are
+     already pending on the connection.
+
+   Other errors, which pertain to the batch itself, are returned upon 
+   completion.
+*/
+int32_t terab_utxo_get_coins_async(
+  connection_t conn,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage,
+  terab_ticket_t* ticket
+);
+
+/* Asynchronous counterpart of 'terab_utxo_get_coins_projected()', same
+   contract as 'terab_utxo_get_coins_async()'. */
+int32_t terab_utxo_get_coins_projected_async(
+  connection_t conn,
+  block_handle_t context,
+  int32_t projection,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage,
+  terab_ticket_t* ticket
+);
+
+/* Asynchronous counterpart of 'terab_utxo_set_coins()'.
+
+   Same contract as 'terab_utxo_get_coins_async()'. The coins are validated
+   before anything is sent, TERAB_ERR_INVALID_REQUEST being returned 
+   immediately if any coin is malformed.
+*/
+int32_t terab_utxo_set_coins_async(
+  connection_t conn,
+  block_handle_t context,
+  int32_t coin_length,
+  coin_t* coins,
+  int32_t storage_length,
+  uint8_t* storage,
+  terab_ticket_t* ticket
+);
+
+/* Check, without blocking, if a pending batch has completed.
+
+   conn: opaque connection handle.
+   ticket: identifies the pending batch.
+   completed: set to 1 if the batch has completed, 0 otherwise.
+
+   Responses already received for any pending batch of the connection
+   are processed along the way.
+
+   If the batch has completed, the ticket is released and the outcome of
+   the batch is returned, as 'terab_utxo_get_coins()' (or 'set_coins')
+   would have. Otherwise, TERAB_SUCCESS is returned.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if 'ticket' does not identify a pending batch.
+*/
+int32_t terab_poll(
+  connection_t conn,
+  terab_ticket_t ticket,
+  int32_t* completed
+);
+
+/* Block until a pending batch completes, release the ticket and return
+   the outcome of the batch.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if 'ticket' does not identify a pending batch.
+*/
+int32_t terab_wait(
+  connection_t conn,
+  terab_ticket_t ticket
+);
+
+/* Create an I/O engine, which collects the completed batches of many
+   connections from a single thread.
+*/
+int32_t terab_engine_create(terab_engine_t* engine);
+
+/* Destroy the engine. The connections are left open. */
+int32_t terab_engine_destroy(terab_engine_t engine);
+
+/* Attach a connection to the engine.
+
+   The batches of the connection are then collected through
+   'terab_engine_wait()'. Shared-memory connections cannot be attached.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if the connection is already attached.
+*/
+int32_t terab_engine_add(terab_engine_t engine, connection_t conn);
+
+/* Detach a connection from the engine. */
+int32_t terab_engine_remove(terab_engine_t engine, connection_t conn);
+
+/* Collect completed batches across all the connections of the engine.
+
+   engine: opaque engine handle.
+   timeout_ms: maximal wait in milliseconds if no batch has completed yet,
+               negative to wait without limit.
+   completion_capacity: the number of items in 'completions'.
+   completions: overwritten with the completed batches.
+   completion_count: returned as the number of completed batches.
+
+   Tickets reported as completed are released. Returns immediately, with
+   zero completions, if no batch is pending on any connection.
+
+   If a connection fails, all its pending batches complete with
+   TERAB_ERR_CONNECTION_FAILED.
+*/
+int32_t terab_engine_wait(
+  terab_engine_t engine,
+  int32_t timeout_ms,
+  int32_t completion_capacity,
+  terab_completion_t* completions,
+  int32_t* completion_count
+);
+
+/* Copy the counters and latency histograms of a connection.
+
+   conn: opaque connection handle.
+   stats: overwritten with the counters since the connection was opened.
+
+   The counters only grow: the activity over a period is the difference
+   of two copies. A sharded connection reports the sum of its instances.
+   Not thread-safe, like the other calls on the connection.
+*/
+int32_t terab_get_stats(connection_t conn, terab_stats_t* stats);
+
+/* Value under which a percentage of the latencies of a histogram fall.
+
+   histogram: a histogram of 'terab_stats_t', or a difference of two.
+   percentile: between 0 and 100, e.g. 99 for the 99th percentile.
+   value_us: returned as the largest value of the bucket holding that
+          percentile, zero if the histogram is empty. 'count', 'total_us'
+          and 'max_us' are not used.
+
+   Errors:
+
+   - TERAB_ERR_INVALID_REQUEST if 'percentile' is out of bounds.
+*/
+int32_t terab_histogram_percentile(
+  const terab_histogram_t* histogram,
+  double percentile,
+  uint64_t* value_us
+);
+
 /* Successful call. */
 #define TERAB_SUCCESS                     0 
 
@@ -0,0 +1,45 @@
+#pragma once
+
+/* Static tracepoints (USDT) of the client, under the 'terab' provider,
+   for perf, bpftrace or SystemTap to attach to a running process, e.g.
+
+     bpftrace -e 'usdt:/path/to/libterabclient.so:terab:call_end { @us[arg1] = hist(arg3); }'
+
+   A tracepoint compiles to a single 'nop', patched by the tracer which
+   attaches to it, and a note in the library giving the location of its
+   arguments. Not traced, it only costs the evaluation of its arguments,
+   which are kept to values already at hand. The tracepoints are compiled
+   out where <sys/sdt.h> is missing (it comes with systemtap-sdt-dev or
+   systemtap-sdt-devel), and with -DTERAB_NO_TRACE.
+
+   Connection level, see 'connection.c':
+   - send_request(conn, request_id, kind, bytes): a request is accepted,
+     'kind' being the message kind of 'MessageKind' on the server side.
+   - flush(conn, requests, bytes): the requests accepted since the
+     previous flush are handed to the transport.
+   - wait_response_begin(conn), wait_response_end(conn, request_id, kind, bytes):
+     a call waits for the response to its request, the batch responses
+     received meanwhile being dispatched; the end is only traced when
+     the response is received.
+
+   Protocol level, see 'protocol.c', 'op' being one of 'TERAB_STATS_OP_*':
+   - call_begin(conn, op, items), call_end(conn, op, status, latency_us):
+     a call which is not a batch, as measured by 'terab_get_stats()'.
+   - batch_submit(conn, op, ticket, items, first_request_id, request_count):
+     the requests of a batch are sent, numbered from 'first_request_id'.
+   - batch_end(conn, op, ticket, status, latency_us): the batch is
+     released, 'latency_us' being -1 if it did not complete.
+*/
+
+#if defined(__linux__) && defined(__has_include) && !defined(TERAB_NO_TRACE)
+#if __has_include(<sys/sdt.h>)
+#define TRACE_SUPPORTED 1
+#endif
+#endif
+
+#ifdef TRACE_SUPPORTED
+#include <sys/sdt.h>
+#define TRACE(probe, ...) STAP_PROBEV(terab, probe, __VA_ARGS__)
+#else
+#define TRACE(probe, ...) ((void)0)
+#endif
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "uring.h"
+#include "alloc.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define URING_SUPPORTED 1
+#endif
+#endif
+
+#ifdef URING_SUPPORTED
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// at most one write and one read are in flight at any time
+#define URING_ENTRIES 4
+
+#define TAG_WRITE 1
+#define TAG_READ 2
+
+#define SENDBUF_INDEX 0
+#define RECVBUF_INDEX 1
+
+typedef struct uring_struct {
+	int ring_fd;
+	SOCKET socket;
+
+	// submission queue, shared with the kernel
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned* sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned to_submit;
+
+	// completion queue, shared with the kernel
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned* cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ring;
+	size_t sq_ring_len;
+	void* cq_ring;
+	size_t cq_ring_len;
+	size_t sqes_len;
+
+	// outstanding write, possibly resubmitted after a short write
+	const char* write_ptr;
+	size_t write_left;
+	int write_inflight;
+	int write_failed;
+
+	int read_done;
+	int read_result;
+} uring_s;
+
+static void push_sqe(uring_s* uring, uint8_t opcode, uint16_t buf_index, const char* addr, size_t len, uint64_t tag)
+{
+	unsigned tail = *uring->sq_tail;
+	unsigned index = tail & *uring->sq_mask;
+
+	struct io_uring_sqe* sqe = uring->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = (int)uring->socket;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = (uint32_t)len;
+	sqe->buf_index = buf_index;
+	sqe->user_data = tag;
+
+	uring->sq_array[index] = index;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->to_submit++;
+}
+
+static return_status_t enter(uring_s* uring, unsigned min_complete)
+{
+	unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	long submitted = syscall(__NR_io_uring_enter, uring->ring_fd, uring->to_submit, min_complete, flags, NULL, 0);
+	if (submitted < 0)
+	{
+		// interrupted waits are simply retried by the caller
+		return errno == EINTR ? OK : KO(CONNECTIVITY);
+	}
+	uring->to_submit -= (unsigned)submitted;
+	return OK;
+}
+
+static void on_write(uring_s* uring, int res)
+{
+	if (res <= 0)
+	{
+		uring->write_failed = 1;
+		uring->write_inflight = 0;
+		return;
+	}
+
+	uring->write_ptr += res;
+	uring->write_left -= res;
+	if (uring->write_left > 0)
+	{
+		// short write, the remainder goes with the next submission
+		push_sqe(uring, IORING_OP_WRITE_FIXED, SENDBUF_INDEX, uring->write_ptr, uring->write_left, TAG_WRITE);
+	}
+	else
+	{
+		uring->write_inflight = 0;
+	}
+}
+
+static void reap(uring_s* uring)
+{
+	unsigned head = *uring->cq_head;
+	unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++)
+	{
+		struct io_uring_cqe* cqe = uring->cqes + (head & *uring->cq_mask);
+		if (cqe->user_data == TAG_WRITE)
+		{
+			on_write(uring, cqe->res);
+		}
+		else
+		{
+			uring->read_result = cqe->res;
+			uring->read_done = 1;
+		}
+	}
+
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+uring_s* uring_new(SOCKET socket, char* sendbuf, size_t sendbuf_len, char* recvbuf, size_t recvbuf_len)
+{
+	struct io_uring_params params = { 0 };
+	int ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (ring_fd < 0)
+		return NULL;
+
+	uring_s* uring = (uring_s*)client_alloc(sizeof(uring_s));
+	if (uring == NULL)
+	{
+		close(ring_fd);
+		return NULL;
+	}
+
+	uring->ring_fd = ring_fd;
+	uring->socket = socket;
+
+	uring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (uring->cq_ring_len > uring->sq_ring_len)
+			uring->sq_ring_len = uring->cq_ring_len;
+		uring->cq_ring_len = 0;
+	}
+
+	uring->sq_ring = mmap(NULL, uring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (uring->sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (uring->cq_ring_len == 0)
+	{
+		uring->cq_ring = uring->sq_ring;
+	}
+	else
+	{
+		uring->cq_ring = mmap(NULL, uring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (uring->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	uring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED)
+		goto fail;
+
+	char* sq = (char*)uring->sq_ring;
+	uring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	uring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	uring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	uring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	char* cq = (char*)uring->cq_ring;
+	uring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	uring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	uring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	struct iovec buffers[2];
+	buffers[SENDBUF_INDEX].iov_base = sendbuf;
+	buffers[SENDBUF_INDEX].iov_len = sendbuf_len;
+	buffers[RECVBUF_INDEX].iov_base = recvbuf;
+	buffers[RECVBUF_INDEX].iov_len = recvbuf_len;
+
+	// fails when the locked memory limit is too low, the caller then falls back on sockets
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, buffers, 2) < 0)
+		goto fail;
+
+	return uring;
+
+fail:
+	uring_free(uring);
+	return NULL;
+}
+
+void uring_free(uring_s* uring)
+{
+	if (uring->sqes && uring->sqes != MAP_FAILED)
+		munmap(uring->sqes, uring->sqes_len);
+	if (uring->cq_ring && uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring)
+		munmap(uring->cq_ring, uring->cq_ring_len);
+	if (uring->sq_ring && uring->sq_ring != MAP_FAILED)
+		munmap(uring->sq_ring, uring->sq_ring_len);
+
+	// also unregisters the buffers
+	close(uring->ring_fd);
+	client_free(uring);
+}
+
+return_status_t uring_send(uring_s* uring, const char* data, size_t len, int defer)
+{
+	if (!uring_send_wait(uring))
+		return RS_FAILURE;
+
+	uring->write_ptr = data;
+	uring->write_left = len;
+	uring->write_inflight = 1;
+	push_sqe(uring, IORING_OP_WRITE_FIXED, SENDBUF_INDEX, data, len, TAG_WRITE);
+
+	if (defer)
+		return OK;
+
+	return enter(uring, 0);
+}
+
+return_status_t uring_send_wait(uring_s* uring)
+{
+	reap(uring);
+	while (uring->write_inflight)
+	{
+		if (!enter(uring, 1))
+			return RS_FAILURE;
+		reap(uring);
+	}
+
+	return uring->write_failed ? KO(CONNECTIVITY) : OK;
+}
+
+int uring_recv(uring_s* uring, char* dest, size_t len)
+{
+	if (uring->write_failed)
+		return -1;
+
+	// a deferred send, if any, is submitted by the same system call
+	uring->read_done = 0;
+	push_sqe(uring, IORING_OP_READ_FIXED, RECVBUF_INDEX, dest, len, TAG_READ);
+
+	do
+	{
+		if (!enter(uring, 1))
+			return -1;
+		reap(uring);
+	} while (!uring->read_done);
+
+	return uring->write_failed ? -1 : uring->read_result;
+}
+
+#else
+
+uring_s* uring_new(SOCKET socket, char* sendbuf, size_t sendbuf_len, char* recvbuf, size_t recvbuf_len)
+{
+	return NULL;
+}
+
+void uring_free(uring_s* uring)
+{
+}
+
+return_status_t uring_send(uring_s* uring, const char* data, size_t len, int defer)
+{
+	return UNSPECIFIED;
+}
+
+return_status_t uring_send_wait(uring_s* uring)
+{
+	return UNSPECIFIED;
+}
+
+int uring_recv(uring_s* uring, char* dest, size_t len)
+{
+	return -1;
+}
+
+#endif
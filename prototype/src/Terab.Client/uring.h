@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "compat.h"
+#include "status.h"
+
+/* Optional io_uring transport of a connection.
+
+   The send and receive buffers of the connection are registered once with
+   the kernel, so that transfers use fixed buffers and skip the per-call
+   page pinning of 'send' and 'recv'. A send may be deferred, in which case
+   it is submitted along with the next receive, and a request/response
+   round trip costs a single system call.
+
+   Only available on Linux; elsewhere 'uring_new' always returns NULL and
+   the connection sticks to blocking sockets.
+*/
+typedef struct uring_struct uring_s;
+
+/* Returns NULL if io_uring is not supported by the platform or the kernel. */
+uring_s* uring_new(SOCKET socket, char* sendbuf, size_t sendbuf_len, char* recvbuf, size_t recvbuf_len);
+void uring_free(uring_s* uring);
+
+/* Sends 'len' bytes located within the registered send buffer. If 'defer'
+   is set, the submission is postponed until the next 'uring_recv'. The
+   data must be left untouched until 'uring_send_wait' returns. */
+return_status_t uring_send(uring_s* uring, const char* data, size_t len, int defer);
+
+/* Blocks until the last send has been entirely written to the socket. */
+return_status_t uring_send_wait(uring_s* uring);
+
+/* Receives up to 'len' bytes into 'dest', located within the registered
+   receive buffer. Returns the number of bytes received, or a negative
+   or null value if the connection failed or was closed. */
+int uring_recv(uring_s* uring, char* dest, size_t len);
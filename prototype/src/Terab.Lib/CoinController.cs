@@ -1,5 +1,6 @@
 ﻿// Copyright Lokad 2018 under MIT BCH.
 using System;
+using System.Security.Cryptography;
 using System.Threading;
 using Terab.Lib.Chains;
 using Terab.Lib.Coins;
@@ -36,6 +37,11 @@ public class CoinController
 
         private readonly ManualResetEvent _mre;
 
+        /// <summary> Answers <see cref="CoinProjection.ScriptHash"/>. </summary>
+        private readonly SHA256 _scriptHasher;
+
+        private readonly byte[] _scriptHash;
+
         /// <summary>
         /// Called by the thread blocking on 'Look' whenever a request is handled.
         /// </summary>
@@ -53,6 +59,8 @@ public class CoinController
 
             _pool = new SpanPool<byte>(PoolSizeInBytes);
             _mre = new ManualResetEvent(false);
+            _scriptHasher = SHA256.Create();
+            _scriptHash = new byte[32];
         }
 
         /// <remarks>
@@ -322,17 +330,181 @@ public bool HandleRequest()
                         break;
                     } // end of 'MessageKind.RemoveCoin' 
 
+                    case MessageKind.GetCoins:
+                    {
+                        var request = new GetCoinsRequest(next, mask);
+                        var context = request.Context;
+                        var projection = request.Projection;
+                        var withPayload = projection != CoinProjection.Events;
+
+                        var coinsResponse = new GetCoinsResponse(
+                            _pool.GetSpan(Constants.MaxResponseSize), requestId, clientId, request.TotalCount);
+
+                        var items = request.Items;
+                        for (var i = 0; i < items.Length; i++)
+                        {
+                            ref var item = ref items[i];
+                            var hash = _hash.Hash(ref item.Outpoint);
+
+                            var found = _store.TryGet(hash, ref item.Outpoint, context, _lineage,
+                                out Coin coin,
+                                out var production, out var consumption);
+
+                            var script = Span<byte>.Empty;
+                            if (found && projection == CoinProjection.Full)
+                            {
+                                script = coin.Payload.Script;
+                            }
+                            else if (found && projection == CoinProjection.ScriptHash)
+                            {
+                                _scriptHasher.TryComputeHash(coin.Payload.Script, _scriptHash, out _);
+                                script = _scriptHash;
+                            }
+
+                            // The response is split when the scripts do not fit in a single message.
+                            for (var attempt = 0; ; attempt++)
+                            {
+                                bool appended;
+                                if (found && projection == CoinProjection.Existence)
+                                {
+                                    appended = coinsResponse.TryAppend(
+                                        item.Index,
+                                        consumption.IsUndefined ? GetCoinStatus.Unspent : GetCoinStatus.Spent,
+                                        OutpointFlags.None,
+                                        BlockAlias.Undefined.ConvertToBlockHandle(mask),
+                                        BlockAlias.Undefined.ConvertToBlockHandle(mask),
+                                        satoshis: 0,
+                                        nLockTime: 0,
+                                        script: Span<byte>.Empty);
+                                }
+                                else if (found)
+                                {
+                                    appended = coinsResponse.TryAppend(
+                                        item.Index,
+                                        GetCoinStatus.Success,
+                                        coin.Flags.ToClientFlags(),
+                                        production.ConvertToBlockHandle(mask),
+                                        consumption.ConvertToBlockHandle(mask),
+                                        withPayload ? coin.Payload.Satoshis : 0,
+                                        withPayload ? coin.Payload.NLockTime : 0,
+                                        script);
+                                }
+                                else
+                                {
+                                    appended = coinsResponse.TryAppend(
+                                        item.Index,
+                                        GetCoinStatus.OutpointNotFound,
+                                        OutpointFlags.None,
+                                        BlockAlias.Undefined.ConvertToBlockHandle(mask),
+                                        BlockAlias.Undefined.ConvertToBlockHandle(mask),
+                                        satoshis: 0,
+                                        nLockTime: 0,
+                                        script: Span<byte>.Empty);
+                                }
+
+                                if (appended)
+                                    break;
+
+                                if (attempt > 0)
+                                    throw new InvalidOperationException("Coin too large for a response.");
+
+                                Reply(coinsResponse.Span, kind);
+                                coinsResponse.Clear();
+                            }
+                        }
+
+                        response = coinsResponse.Span;
+                        break;
+                    } // end of 'MessageKind.GetCoins'
+
+                    case MessageKind.ChangeCoins:
+                    case MessageKind.WriteCoins:
+                    {
+                        var request = new ChangeCoinsRequest(next, mask);
+                        var context = request.Context;
+                        var isUncommitted = _lineage.IsUncommitted(context);
+
+                        var coinsResponse = new ChangeCoinsResponse(
+                            requestId, clientId, request.Count, request.TotalCount, _pool);
+                        var responseItems = coinsResponse.Items;
+
+                        // Collected by the connection controller, see 'MessageKind.SyncCoins'.
+                        if (kind == MessageKind.WriteCoins)
+                            coinsResponse.MessageHeader.MessageKind = MessageKind.WriteCoinsResponse;
+
+                        var offset = 0;
+                        for (var i = 0; i < request.Count; i++)
+                        {
+                            ref var item = ref request.ItemAt(offset);
+                            var hash = _hash.Hash(ref item.Outpoint);
+
+                            CoinChangeStatus status;
+                            if (!isUncommitted)
+                            {
+                                status = CoinChangeStatus.InvalidContext;
+                            }
+                            else switch (item.Operation)
+                            {
+                                case CoinOperation.Produce:
+                                {
+                                    ref var production = ref request.ProductionAt(offset);
+                                    status = _store.AddProduction(
+                                        hash,
+                                        ref item.Outpoint,
+                                        (OutpointFlags) item.Options == OutpointFlags.IsCoinbase,
+                                        new Payload(production.Satoshis, production.NLockTime,
+                                            request.ScriptAt(offset), _pool),
+                                        context,
+                                        _lineage);
+                                    break;
+                                }
+
+                                case CoinOperation.Consume:
+                                    status = _store.AddConsumption(hash, ref item.Outpoint, context, _lineage);
+                                    break;
+
+                                case CoinOperation.Remove:
+                                {
+                                    var removal = (CoinRemoval) item.Options;
+                                    var option = CoinRemoveOption.None;
+                                    if ((removal & CoinRemoval.Production) != 0) option |= CoinRemoveOption.RemoveProduction;
+                                    if ((removal & CoinRemoval.Consumption) != 0) option |= CoinRemoveOption.RemoveConsumption;
+
+                                    status = _store.Remove(hash, ref item.Outpoint, context, option, _lineage);
+                                    break;
+                                }
+
+                                default:
+                                    throw new NotSupportedException();
+                            }
+
+                            responseItems[i].Index = item.Index;
+                            responseItems[i].Status = ToChangeCoinStatus(status);
+
+                            offset += request.ItemSizeAt(offset);
+                        }
+
+                        response = coinsResponse.Span;
+                        break;
+                    } // end of 'MessageKind.ChangeCoins' and 'MessageKind.WriteCoins'
+
+                    case MessageKind.PrefetchCoins:
+                    {
+                        var request = new GetCoinsRequest(next, mask);
+
+                        var items = request.Items;
+                        for (var i = 0; i < items.Length; i++)
+                            _store.Prefetch(_hash.Hash(ref items[i].Outpoint));
+
+                        // A hint, never answered.
+                        return true;
+                    } // end of 'MessageKind.PrefetchCoins'
+
                     default:
                         throw new NotSupportedException();
                 }
 
-
-                while (!_outbox.TryWrite(response))
-                {
-                    _log?.Log(LogSeverity.Warning, $"CoinController can't write the response to {kind}.");
-                    // Pathological situation, we don't want to overflow the logger.
-                    Thread.Sleep(1000);
-                }
+                Reply(response, kind);
             }
             finally
             {
@@ -342,5 +514,36 @@ public bool HandleRequest()
 
             return true;
         }
+
+        private void Reply(Span<byte> response, MessageKind kind)
+        {
+            while (!_outbox.TryWrite(response))
+            {
+                _log?.Log(LogSeverity.Warning, $"CoinController can't write the response to {kind}.");
+                // Pathological situation, we don't want to overflow the logger.
+                Thread.Sleep(1000);
+            }
+        }
+
+        private static ChangeCoinStatus ToChangeCoinStatus(CoinChangeStatus status)
+        {
+            switch (status)
+            {
+                case CoinChangeStatus.Success:
+                    return ChangeCoinStatus.Success;
+
+                case CoinChangeStatus.InvalidContext:
+                    return ChangeCoinStatus.InvalidContext;
+
+                case CoinChangeStatus.InvalidBlockHandle:
+                    return ChangeCoinStatus.InvalidBlockHandle;
+
+                case CoinChangeStatus.OutpointNotFound:
+                    return ChangeCoinStatus.OutpointNotFound;
+
+                default:
+                    throw new NotSupportedException();
+            }
+        }
     }
 }
\ No newline at end of file
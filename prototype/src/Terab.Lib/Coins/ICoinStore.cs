@@ -49,6 +49,12 @@ public interface ICoinStore
         bool TryGet(ulong outpointHash, ref Outpoint outpoint, BlockAlias context, ILineage lineage,
             out Coin coin, out BlockAlias production, out BlockAlias consumption);
 
+        /// <summary>
+        /// Hints that the outpoint is about to be read, so that the storage
+        /// behind it gets loaded in the background. Does not block.
+        /// </summary>
+        void Prefetch(ulong outpointHash);
+
         CoinChangeStatus AddProduction(ulong outpointHash, 
             ref Outpoint outpoint, 
             bool isCoinBase,
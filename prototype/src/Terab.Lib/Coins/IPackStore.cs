@@ -25,6 +25,12 @@ public interface IPackStore : IDisposable
 
         CoinPack Read(int layerIndex, uint sectorIndex);
 
+        /// <summary>
+        /// Hints that the sector is about to be read, without blocking. Layers
+        /// which are not memory mapped may ignore it.
+        /// </summary>
+        void Prefetch(int layerIndex, uint sectorIndex);
+
         /// <summary> Journalized write. </summary>
         void Write(ShortCoinPackCollection coll);
     }
@@ -145,6 +145,15 @@ private Span<byte> GetSpan(int layerIndex, uint sectorIndex)
                 .GetSpan(sectorIndex * _sectorSizeInBytes[layerIndex], _sectorSizeInBytes[layerIndex]);
         }
 
+        /// <summary> The bottom layer, a key-value store, is left alone. </summary>
+        public void Prefetch(int layerIndex, uint sectorIndex)
+        {
+            if (layerIndex >= _layerMmf.Length)
+                return;
+
+            _layerMmf[layerIndex].Prefetch(sectorIndex * _sectorSizeInBytes[layerIndex], _sectorSizeInBytes[layerIndex]);
+        }
+
         public CoinPack Read(int layerIndex, uint sectorIndex)
         {
             var span = GetSpan(layerIndex, sectorIndex);
@@ -70,6 +70,19 @@ public SozuTable(IPackStore store, IOutpointHash hash)
             // Not found, it was a false positive on the probabilistic filter.
             return false;
         }
+
+        /// <summary>
+        /// The deeper layers are prefetched as well: whether they are read
+        /// depends on the first one, which is not read here.
+        /// </summary>
+        public void Prefetch(ulong outpointHash)
+        {
+            var sectorIndex = (uint)(outpointHash % (uint) _store.SectorCount);
+
+            for (var layerIndex = 0; layerIndex < _store.LayerCount; layerIndex++)
+                _store.Prefetch(layerIndex, sectorIndex);
+        }
+
         public CoinChangeStatus AddProduction(
             ulong outpointHash, 
             ref Outpoint outpoint, 
@@ -1,6 +1,8 @@
 ﻿// Copyright Lokad 2018 under MIT BCH.
 using System;
+using System.Collections.Generic;
 using System.Net.Sockets;
+using System.Runtime.InteropServices;
 using System.Threading;
 using Terab.Lib.Messaging;
 using Terab.Lib.Messaging.Protocol;
@@ -54,12 +56,94 @@ public class ConnectionController
         /// <summary> Counts request in-progress associated to this connection. </summary>
         private volatile int _requestsInProgress;
 
+        /// <summary> Set whenever a request completes, see 'WaitForWindow'. </summary>
+        private readonly ManualResetEventSlim _windowOpen;
+
         /// <summary> Intended to avoid TCP packet fragmentation. </summary>
         private readonly SpanPool<byte> _responsePool;
 
         /// <summary> Counts the number of responses buffered in '_responsePool'. </summary>
         private int _responseCountInPool;
 
+        /// <summary>
+        /// Multi-coin responses being merged, by request ID. The parts
+        /// come from the coin controllers the request has been split across.
+        /// </summary>
+        private readonly Dictionary<uint, MergedResponse> _merged;
+
+        /// <summary> Recycles the buffers of '_merged'. </summary>
+        private readonly Stack<MergedResponse> _mergedPool;
+
+        /// <summary>
+        /// Format of the multi-coin messages exchanged with the client. The
+        /// controllers only deal with <see cref="WireFormat.Fixed"/>.
+        /// </summary>
+        private volatile WireFormat _wireFormat;
+
+        /// <summary> Compact requests translated for the dispatch controller. </summary>
+        private readonly byte[] _bufferExpanded;
+
+        /// <summary> Offsets of the literal txids within a compact request. </summary>
+        private readonly int[] _txidOffsets;
+
+        /// <summary> Responses translated for the client. </summary>
+        private readonly byte[] _bufferCompact;
+
+        /// <summary>
+        /// Items not processed yet of the <see cref="MessageKind.WriteCoins"/>
+        /// requests split across coin controllers, by request ID. Only
+        /// accessed by the dispatch controller, through 'Send'.
+        /// </summary>
+        private readonly Dictionary<uint, int> _writesRemaining;
+
+        /// <summary> Counts the write requests not entirely processed. </summary>
+        private volatile int _writesInProgress;
+
+        /// <summary> Set whenever a write request completes, see 'Sync'. </summary>
+        private readonly ManualResetEventSlim _writesDone;
+
+        /// <summary>
+        /// Failed items of the write requests since the last
+        /// <see cref="MessageKind.SyncCoins"/>, up to what a response can
+        /// count. Locked, as it is filled by the dispatch controller.
+        /// </summary>
+        private readonly List<ChangeCoinsResponse.Item> _writeFailures;
+
+        /// <summary> Where 'Sync' writes its responses. </summary>
+        private readonly SpanPool<byte> _syncPool;
+
+        /// <summary>
+        /// Common header of <see cref="GetCoinsResponse"/> and
+        /// <see cref="ChangeCoinsResponse"/>, the latter also laying out
+        /// the responses to <see cref="MessageKind.SyncCoins"/>.
+        /// </summary>
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct CoinsResponseHeader
+        {
+            public MessageHeader ResponseHeader;
+            public ushort Count;
+            public ushort TotalCount;
+        }
+
+        private class MergedResponse
+        {
+            public static readonly int HeaderSize = GetCoinsResponse.HeaderSizeInBytes;
+
+            public readonly byte[] Buffer = new byte[Constants.MaxResponseSize];
+
+            /// <summary> Bytes of 'Buffer' in use, header included. </summary>
+            public int Length;
+
+            /// <summary> Items in 'Buffer'. </summary>
+            public int Count;
+
+            /// <summary> Items not received yet. </summary>
+            public int Remaining;
+
+            public ref CoinsResponseHeader Header =>
+                ref MemoryMarshal.Cast<byte, CoinsResponseHeader>(new Span<byte>(Buffer))[0];
+        }
+
         public ConnectionController(BoundedInbox dispatchInbox, ISocketLike socket, ClientId clientId, ILog log = null)
         {
             _dispatchInbox = dispatchInbox ?? throw new ArgumentNullException(nameof(dispatchInbox));
@@ -71,8 +155,20 @@ public ConnectionController(BoundedInbox dispatchInbox, ISocketLike socket, Clie
             _mre = new ManualResetEvent(false);
             _tokenSource = new CancellationTokenSource();
             _requestsInProgress = 0;
+            _windowOpen = new ManualResetEventSlim(false);
             _responsePool = new SpanPool<byte>(ResponsePoolSize);
             _responseCountInPool = 0;
+            _merged = new Dictionary<uint, MergedResponse>();
+            _mergedPool = new Stack<MergedResponse>();
+            _wireFormat = WireFormat.Fixed;
+            _bufferExpanded = new byte[Constants.MaxRequestSize];
+            _txidOffsets = new int[Constants.MaxRequestSize / GetCoinsRequest.Item.SizeInBytes];
+            _bufferCompact = new byte[Constants.MaxResponseSize];
+            _writesRemaining = new Dictionary<uint, int>();
+            _writesInProgress = 0;
+            _writesDone = new ManualResetEventSlim(false);
+            _writeFailures = new List<ChangeCoinsResponse.Item>();
+            _syncPool = new SpanPool<byte>(Constants.MaxResponseSize);
         }
 
         public void Start()
@@ -118,6 +214,8 @@ public void LoopIn()
             {
                 while (!_tokenSource.Token.IsCancellationRequested && _socket.Connected)
                 {
+                    WaitForWindow();
+
                     // Blocking call.
                     if (HandleRequest())
                         // Notify the dispatch controller.
@@ -132,6 +230,10 @@ public void LoopIn()
             {
                 _log?.Log(LogSeverity.Info, $"ConnectionController({ClientId}) closed in LoopIn(): {ex}.");
             }
+            catch (OperationCanceledException)
+            {
+                // Stopped while waiting for the window.
+            }
             finally
             {
                 Stop();
@@ -146,11 +248,36 @@ public void LoopIn()
             }
         }
 
+        /// <summary>
+        /// Blocks until fewer than <see cref="Constants.ConnectionWindow"/>
+        /// requests are in progress. Clients honoring the window advertised
+        /// by <see cref="Negotiate"/> never wait; the others are held off
+        /// through the transport rather than overflowing the outbox.
+        /// </summary>
+        private void WaitForWindow()
+        {
+            while (true)
+            {
+                _windowOpen.Reset();
+                if (_requestsInProgress < Constants.ConnectionWindow)
+                    return;
+
+                _windowOpen.Wait(_tokenSource.Token);
+            }
+        }
+
         /// <summary>
         /// Thread-safe. Signals the thread blocked on 'LoopOut' to wake up.
         /// </summary>
         public void Send(Span<byte> response)
         {
+            // Not for the client, see 'AcknowledgeWrites'.
+            if (new Message(response).Header.MessageKind == MessageKind.WriteCoinsResponse)
+            {
+                AcknowledgeWrites(response);
+                return;
+            }
+
             if (!_outbox.TryWrite(response))
             {
                 if (!_tokenSource.IsCancellationRequested)
@@ -196,11 +323,53 @@ public void LoopOut()
 
         public bool HandleRequest()
         {
+            // Requests already framed in memory are consumed in place.
+            if (_socket is IMessageRing ring)
+                return HandleRingRequest(ring);
+
             // Blocking until header is received.
             _socket.Receive(new Span<byte>(_bufferIn, 0, MessageHeader.SizeInBytes));
 
             var message = new Message(_bufferIn);
 
+            if (!IsValidRequest(message, _bufferIn.Length))
+                return false;
+
+            // Blocking until the rest of the message is received.
+            _socket.Receive(new Span<byte>(_bufferIn, 
+                MessageHeader.SizeInBytes,
+                message.SizeInBytes - MessageHeader.SizeInBytes));
+
+            return ForwardRequest(message);
+        }
+
+        private bool HandleRingRequest(IMessageRing ring)
+        {
+            // Blocking until a request is available.
+            var request = ring.PeekMessage();
+
+            try
+            {
+                var message = new Message(request);
+
+                if (!IsValidRequest(message, request.Length))
+                    return false;
+
+                return ForwardRequest(message);
+            }
+            finally
+            {
+                ring.NextMessage();
+            }
+        }
+
+        /// <summary>
+        /// Checks the header of a request, 'available' being the number of
+        /// bytes which can hold the request. Invalid requests are answered
+        /// with a protocol error.
+        /// </summary>
+        private bool IsValidRequest(Message message, int available)
+        {
             // Request too short
             if (message.SizeInBytes <= MessageHeader.SizeInBytes)
             {
@@ -217,7 +386,7 @@ public bool HandleRequest()
             
 
             // Request too long
-            if (message.SizeInBytes >= Constants.MaxRequestSize)
+            if (message.SizeInBytes >= Constants.MaxRequestSize || message.SizeInBytes > available)
             {
                 Span<byte> errorBuffer = stackalloc byte[ProtocolErrorResponse.SizeInBytes];
                 var errorMessage = new ProtocolErrorResponse(errorBuffer,
@@ -240,13 +409,46 @@ public bool HandleRequest()
                 return false;
             }
 
-            // Blocking until the rest of the message is received.
-            _socket.Receive(new Span<byte>(_bufferIn, 
-                MessageHeader.SizeInBytes,
-                message.SizeInBytes - MessageHeader.SizeInBytes));
+            return true;
+        }
+
+        private bool ForwardRequest(Message message)
+        {
+            var requestId = message.Header.RequestId;
+            var kind = message.Header.MessageKind;
 
             message.Header.ClientId = _clientId;
 
+            // Handled by the connection itself, nothing to forward.
+            if (kind == MessageKind.Negotiate)
+            {
+                Negotiate(message);
+                return false;
+            }
+
+            if (kind == MessageKind.SyncCoins)
+            {
+                Sync(message);
+                return false;
+            }
+
+            if (_wireFormat == WireFormat.Compact && (kind == MessageKind.GetCoins
+                || kind == MessageKind.ChangeCoins || kind == MessageKind.WriteCoins))
+            {
+                var length = CompactCoins.ExpandRequest(message.Span, _bufferExpanded, _txidOffsets);
+                if (length < 0)
+                {
+                    Span<byte> errorBuffer = stackalloc byte[ProtocolErrorResponse.SizeInBytes];
+                    var errorMessage = new ProtocolErrorResponse(errorBuffer,
+                        requestId, ClientId.MinClientId, ProtocolErrorStatus.RequestMalformed);
+
+                    Send(errorMessage.Span);
+                    return false;
+                }
+
+                message = new Message(new Span<byte>(_bufferExpanded, 0, length));
+            }
+
             // Client request to close the connection.
             if (message.Header.MessageKind == MessageKind.CloseConnection)
             {
@@ -256,29 +458,144 @@ public bool HandleRequest()
                 _outbox.TryWrite(closeResponse.Span);
             }
 
-            // Forwards the message to the dispatch controller.
-            if (_dispatchInbox.TryWrite(message.Span))
-            {
+            // Counted before forwarding, as the response may go out at once.
+            // Hints are never answered, hence never in progress.
+            if (kind != MessageKind.PrefetchCoins)
                 Interlocked.Increment(ref _requestsInProgress);
-                return true;
+
+            if (kind == MessageKind.WriteCoins)
+                Interlocked.Increment(ref _writesInProgress);
+
+            // Forwards the message to the dispatch controller. When its inbox
+            // is full, the request waits for room, which holds off the client
+            // through the transport, rather than failing the connection.
+            var spin = new SpinWait();
+            while (!_dispatchInbox.TryWrite(message.Span))
+            {
+                if (_tokenSource.IsCancellationRequested)
+                    return false;
+
+                OnRequestReceived?.Invoke();
+                spin.SpinOnce();
             }
 
-            //  The dispatch inbox is full.
+            return true;
+        }
+
+        /// <summary>
+        /// Collects the failures of a part of the response to a
+        /// <see cref="MessageKind.WriteCoins"/> request, in place of the
+        /// client. The request remains in progress, hence counted in the
+        /// window, until all its items have been processed.
+        /// </summary>
+        private void AcknowledgeWrites(Span<byte> part)
+        {
+            var response = new ChangeCoinsResponse(part);
+            var requestId = response.MessageHeader.RequestId.Value;
+
+            lock (_writeFailures)
             {
-                Span<byte> errorBuffer = stackalloc byte[ProtocolErrorResponse.SizeInBytes];
-                var errorMessage = new ProtocolErrorResponse(errorBuffer,
-                    requestId, ClientId.MinClientId, ProtocolErrorStatus.ServerBusy);
+                foreach (var item in response.Items)
+                {
+                    if (item.Status != ChangeCoinStatus.Success && _writeFailures.Count < ushort.MaxValue)
+                        _writeFailures.Add(item);
+                }
+            }
 
-                Send(errorMessage.Span);
+            if (!_writesRemaining.TryGetValue(requestId, out var remaining))
+                remaining = response.TotalCount;
+
+            remaining -= response.Count;
+            if (remaining > 0)
+            {
+                _writesRemaining[requestId] = remaining;
+                return;
+            }
+
+            _writesRemaining.Remove(requestId);
+
+            Interlocked.Decrement(ref _writesInProgress);
+            _writesDone.Set();
+
+            Interlocked.Decrement(ref _requestsInProgress);
+            _windowOpen.Set();
+        }
+
+        /// <summary>
+        /// Waits for the write requests received so far to be processed,
+        /// then answers with their failures, which are forgotten. The
+        /// response is split as the multi-coin responses are, and merged
+        /// back by 'LoopOut'.
+        /// </summary>
+        private void Sync(Message message)
+        {
+            while (true)
+            {
+                _writesDone.Reset();
+                if (_writesInProgress == 0)
+                    break;
+
+                _writesDone.Wait(_tokenSource.Token);
             }
 
-            return false;
+            Interlocked.Increment(ref _requestsInProgress);
+
+            var requestId = message.Header.RequestId;
+            var perPart = (Constants.MaxResponseSize - ChangeCoinsResponse.HeaderSizeInBytes)
+                          / ChangeCoinsResponse.Item.SizeInBytes;
+
+            lock (_writeFailures)
+            {
+                var total = _writeFailures.Count;
+                var first = 0;
+                do
+                {
+                    var count = Math.Min(perPart, total - first);
+                    var response = new ChangeCoinsResponse(requestId, _clientId, count, total, _syncPool);
+                    response.MessageHeader.MessageKind = MessageKind.SyncCoinsResponse;
+
+                    var items = response.Items;
+                    for (var i = 0; i < count; i++)
+                        items[i] = _writeFailures[first + i];
+
+                    Send(response.Span);
+                    _syncPool.Reset();
+
+                    first += count;
+                } while (first < total);
+
+                _writeFailures.Clear();
+            }
+        }
+
+        /// <summary>
+        /// Settles the wire format with the client. The most recent format
+        /// known to both sides is retained. The response also advertises
+        /// how many requests the client may have in progress.
+        /// </summary>
+        private void Negotiate(Message message)
+        {
+            var request = new NegotiateRequest(message.Span);
+            var format = request.Format >= WireFormat.Compact ? WireFormat.Compact : WireFormat.Fixed;
+
+            // The client waits for the response before sending anything else.
+            _wireFormat = format;
+
+            Span<byte> buffer = stackalloc byte[NegotiateResponse.SizeInBytes];
+            var response = new NegotiateResponse(buffer, message.Header.RequestId, format,
+                (ushort) Constants.ConnectionWindow);
+
+            // Counted before sending, as the response may go out at once.
+            Interlocked.Increment(ref _requestsInProgress);
+            Send(response.Span);
         }
 
         public bool HandleResponse()
         {
             if (!_outbox.CanPeek)
             {
+                // The last responses of a burst must not linger in the pool.
+                FlushResponsePool();
                 return false;
             }
 
@@ -292,25 +609,20 @@ public bool HandleResponse()
                 // Remove client ID from message
                 message.Header.ClientId = default;
 
-                if (_requestsInProgress >= ResponseBatchSize || _responseCountInPool > 0)
+                if (kind == MessageKind.GetCoinsResponse || kind == MessageKind.ChangeCoinsResponse
+                    || kind == MessageKind.SyncCoinsResponse)
                 {
-                    var nextResponse = _responsePool.GetSpan(next.Length);
-                    next.CopyTo(nextResponse);
-                    _responseCountInPool++;
-
-                    if (_responseCountInPool >= ResponseBatchSize)
-                    {
-                        _socket.Send(_responsePool.Allocated());
-                        _responsePool.Reset();
-                        _responseCountInPool = 0;
-                    }
+                    // Only the last part completes the request.
+                    if (!MergeResponse(next))
+                        return true;
                 }
                 else
                 {
-                    _socket.Send(next);
+                    SendResponse(next);
                 }
-                
+
                 Interlocked.Decrement(ref _requestsInProgress);
+                _windowOpen.Set();
 
                 // Some responses trigger the termination of the controller.
                 if (kind == MessageKind.CloseConnectionResponse
@@ -322,12 +634,7 @@ public bool HandleResponse()
                         _log?.Log(LogSeverity.Info, $"ConnectionController({ClientId}) on protocol error {protocolResponse.Status}.");
                     }
 
-                    if (_responseCountInPool > 0)
-                    {
-                        _socket.Send(_responsePool.Allocated());
-                        _responsePool.Reset();
-                        _responseCountInPool = 0;
-                    }
+                    FlushResponsePool();
 
                     _tokenSource.Cancel();
                 }
@@ -339,5 +646,114 @@ public bool HandleResponse()
 
             return true;
         }
+
+        private void SendResponse(Span<byte> response)
+        {
+            if (_requestsInProgress >= ResponseBatchSize || _responseCountInPool > 0)
+            {
+                // Merged responses are large enough to exhaust the pool.
+                if (_responsePool.Capacity - _responsePool.Offset < response.Length)
+                    FlushResponsePool();
+
+                var nextResponse = _responsePool.GetSpan(response.Length);
+                response.CopyTo(nextResponse);
+                _responseCountInPool++;
+
+                if (_responseCountInPool >= ResponseBatchSize)
+                    FlushResponsePool();
+            }
+            else
+            {
+                _socket.Send(response);
+            }
+        }
+
+        /// <summary>
+        /// Appends the items of a part of a multi-coin response to the
+        /// response of the request, which is sent whenever full. Returns
+        /// 'true' once all the items of the request have been sent.
+        /// </summary>
+        private bool MergeResponse(Span<byte> part)
+        {
+            var header = MemoryMarshal.Cast<byte, CoinsResponseHeader>(part)[0];
+
+            // Request answered in a single message, nothing to merge.
+            if (header.Count >= header.TotalCount)
+            {
+                SendCoinsResponse(part);
+                return true;
+            }
+
+            var requestId = header.ResponseHeader.RequestId.Value;
+            if (!_merged.TryGetValue(requestId, out var merged))
+            {
+                merged = _mergedPool.Count > 0 ? _mergedPool.Pop() : new MergedResponse();
+                merged.Header = header;
+                merged.Length = MergedResponse.HeaderSize;
+                merged.Count = 0;
+                merged.Remaining = header.TotalCount;
+
+                _merged.Add(requestId, merged);
+            }
+
+            var items = part.Slice(MergedResponse.HeaderSize);
+
+            if (merged.Length + items.Length > merged.Buffer.Length)
+                SendMerged(merged);
+
+            items.CopyTo(new Span<byte>(merged.Buffer, merged.Length, items.Length));
+            merged.Length += items.Length;
+            merged.Count += header.Count;
+            merged.Remaining -= header.Count;
+
+            if (merged.Remaining > 0)
+                return false;
+
+            SendMerged(merged);
+            _merged.Remove(requestId);
+            _mergedPool.Push(merged);
+            return true;
+        }
+
+        private void SendMerged(MergedResponse merged)
+        {
+            ref var header = ref merged.Header;
+            header.ResponseHeader.MessageSizeInBytes = merged.Length;
+            header.Count = (ushort) merged.Count;
+
+            SendCoinsResponse(new Span<byte>(merged.Buffer, 0, merged.Length));
+
+            merged.Length = MergedResponse.HeaderSize;
+            merged.Count = 0;
+        }
+
+        /// <summary> Sends a multi-coin response in the negotiated format. </summary>
+        private void SendCoinsResponse(Span<byte> response)
+        {
+            if (_wireFormat == WireFormat.Fixed)
+            {
+                SendResponse(response);
+                return;
+            }
+
+            // Compact items are shorter unless their amounts are huge, in
+            // which case the response is split again.
+            var offset = CompactCoins.ResponseHeaderSizeInBytes;
+            do
+            {
+                var length = CompactCoins.CompactResponse(response, ref offset, _bufferCompact);
+                SendResponse(new Span<byte>(_bufferCompact, 0, length));
+            } while (offset < response.Length);
+        }
+
+        private void FlushResponsePool()
+        {
+            if (_responseCountInPool == 0)
+                return;
+
+            _socket.Send(_responsePool.Allocated());
+            _responsePool.Reset();
+            _responseCountInPool = 0;
+        }
     }
 }
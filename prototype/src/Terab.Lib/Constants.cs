@@ -49,6 +49,13 @@ public static class Constants
         /// <summary> Size in bytes of the bounded inbox (outgoing responses) of each connection controller. </summary>
         public const int ConnectionControllerOutboxSize = 1 * _MB;
 
+        /// <summary>
+        /// Number of requests a client may have in progress on a connection,
+        /// advertised when negotiating. Half of the outbox holds the responses
+        /// of a full window, the rest being left to their split parts.
+        /// </summary>
+        public const int ConnectionWindow = ConnectionControllerOutboxSize / (2 * MaxResponseSize);
+
         /// <summary> Size in bytes of the bounded outbox of the dispatch controller. </summary>
         public const int DispatchControllerOutboxSize = 1 * _MB;
 
@@ -47,6 +47,28 @@ public class DispatchController
 
         private readonly ManualResetEvent _mre;
 
+        /// <summary> Shard of each item of the multi-coin request being split. </summary>
+        private readonly int[] _itemShards;
+
+        /// <summary> Offset of each item of the multi-coin request being split. </summary>
+        private readonly int[] _itemOffsets;
+
+        /// <summary> Number of items of the multi-coin request per shard. </summary>
+        private readonly int[] _shardCounts;
+
+        /// <summary> Where the parts of a multi-coin request are written. </summary>
+        private readonly byte[] _partBuffer;
+
+        /// <summary>
+        /// Messages waiting for room in the inbox of each coin controller,
+        /// in their order of arrival. Their amount is bounded by the windows
+        /// of the connections.
+        /// </summary>
+        private readonly Queue<byte[]>[] _parked;
+
+        /// <summary> Number of messages in '_parked'. </summary>
+        private int _parkedCount;
+
         /// <summary>
         /// Intended to call 'ConnectionController.Start()' with the
         /// possibility to intercept the call for testing purposes.
@@ -86,6 +108,17 @@ public class DispatchController
 
             OnCoinMessageDispatched = new Action[_coinControllerBoxes.Length];
 
+            // 'GetCoinsRequest' has the smallest items
+            var maxItemCount = Constants.MaxRequestSize / GetCoinsRequest.Item.SizeInBytes;
+            _itemShards = new int[maxItemCount];
+            _itemOffsets = new int[maxItemCount];
+            _shardCounts = new int[_coinControllerBoxes.Length];
+            _partBuffer = new byte[Constants.MaxRequestSize];
+
+            _parked = new Queue<byte[]>[_coinControllerBoxes.Length];
+            for (var i = 0; i < _parked.Length; i++)
+                _parked[i] = new Queue<byte[]>();
+
             _connections = new Dictionary<ClientId, ConnectionController>();
         }
 
@@ -124,7 +157,9 @@ public void Loop(CancellationToken cancel)
 
             while (!cancel.IsCancellationRequested)
             {
-                _mre.WaitOne();
+                // The coin controllers do not signal when room is made in
+                // their inbox, the parked messages are retried periodically.
+                _mre.WaitOne(_parkedCount > 0 ? 1 : Timeout.Infinite);
                 _mre.Reset();
 
                 bool workDone;
@@ -133,6 +168,9 @@ public void Loop(CancellationToken cancel)
                     // Process incoming connections
                     workDone = HandleNewConnection();
 
+                    // Process the messages waiting for the coin controllers
+                    workDone |= HandleParked();
+
                     // Process pending inbox messages
                     workDone |= HandleRequest();
                 } while (workDone);
@@ -177,6 +215,31 @@ public bool HandleNewConnection()
             return workDone;
         }
 
+        /// <summary>
+        /// Moves the parked messages to the inbox of their coin controller,
+        /// as far as room allows.
+        /// </summary>
+        public bool HandleParked()
+        {
+            var workDone = false;
+            for (var i = 0; i < _parked.Length && _parkedCount > 0; i++)
+            {
+                var parked = _parked[i];
+                var written = false;
+                while (parked.Count > 0 && _coinControllerBoxes[i].TryWrite(parked.Peek()))
+                {
+                    parked.Dequeue();
+                    _parkedCount--;
+                    written = true;
+                }
+
+                if (written) OnCoinMessageDispatched[i]();
+                workDone |= written;
+            }
+
+            return workDone;
+        }
+
         public bool HandleRequest()
         {
             if (!_inbox.CanPeek)
@@ -214,6 +277,18 @@ public bool HandleRequest()
                     return true;
                 }
 
+                if (kind == MessageKind.GetCoins || kind == MessageKind.PrefetchCoins)
+                {
+                    DispatchGetCoins(next, connection);
+                    return true;
+                }
+
+                if (kind == MessageKind.ChangeCoins || kind == MessageKind.WriteCoins)
+                {
+                    DispatchChangeCoins(next, connection);
+                    return true;
+                }
+
                 if (kind.IsForCoinController())
                 {
                     // Multiple coin controllers
@@ -240,29 +315,7 @@ public bool HandleRequest()
                             throw new NotSupportedException();
                     }
 
-                    // Sharding based on the outpoint hash
-
-                    // Beware: the factor 'BigPrime' is used to avoid accidental factor collision
-                    // between the sharding performed at the dispatch controller level, and the
-                    // sharding performed within the Sozu table.
-
-                    // PERF: hashing the outpoint is repeated in the CoinController itself
-                    const ulong BigPrime = 1_000_000_007;
-                    var controllerIndex = (int) ((_hash.Hash(ref outpoint) % BigPrime) 
-                                                 % (ulong) _coinControllerBoxes.Length);
-
-                    var written = _coinControllerBoxes[controllerIndex].TryWrite(next);
-                    if (written) OnCoinMessageDispatched[controllerIndex]();
-                    else
-                    {
-                        // Coin controller is saturated.
-                        Span<byte> buffer = stackalloc byte[ProtocolErrorResponse.SizeInBytes];
-                        var errorMessage = new ProtocolErrorResponse(
-                            buffer, requestId, clientId, ProtocolErrorStatus.ServerBusy);
-
-                        connection.Send(errorMessage.Span);
-                    }
-
+                    DispatchCoinMessage(ShardOf(ref outpoint), next);
                     return true;
                 }
 
@@ -288,5 +341,181 @@ public bool HandleRequest()
 
             return true;
         }
+
+        /// <summary> Index of the coin controller in charge of the outpoint. </summary>
+        private int ShardOf(ref Outpoint outpoint)
+        {
+            // Sharding based on the outpoint hash
+
+            // Beware: the factor 'BigPrime' is used to avoid accidental factor collision
+            // between the sharding performed at the dispatch controller level, and the
+            // sharding performed within the Sozu table.
+
+            // PERF: hashing the outpoint is repeated in the CoinController itself
+            const ulong BigPrime = 1_000_000_007;
+            return (int) ((_hash.Hash(ref outpoint) % BigPrime) % (ulong) _coinControllerBoxes.Length);
+        }
+
+        /// <summary>
+        /// When the coin controller is saturated, the message is parked
+        /// until room is made, rather than rejected: the client honors the
+        /// window of its connection, and the responses of the coin
+        /// controllers keep flowing meanwhile.
+        /// </summary>
+        private void DispatchCoinMessage(int controllerIndex, Span<byte> message)
+        {
+            var parked = _parked[controllerIndex];
+            if (parked.Count == 0 && _coinControllerBoxes[controllerIndex].TryWrite(message))
+            {
+                OnCoinMessageDispatched[controllerIndex]();
+                return;
+            }
+
+            parked.Enqueue(message.ToArray());
+            _parkedCount++;
+        }
+
+        /// <summary>
+        /// Hints are not answered: they are dropped, rather than parked,
+        /// when the coin controller is saturated.
+        /// </summary>
+        private void DispatchHint(int controllerIndex, Span<byte> message)
+        {
+            if (_coinControllerBoxes[controllerIndex].TryWrite(message))
+                OnCoinMessageDispatched[controllerIndex]();
+        }
+
+        private void RejectMalformed(Span<byte> message, ConnectionController connection)
+        {
+            var header = new Message(message).Header;
+            Span<byte> buffer = stackalloc byte[ProtocolErrorResponse.SizeInBytes];
+            var errorMessage = new ProtocolErrorResponse(
+                buffer, header.RequestId, header.ClientId, ProtocolErrorStatus.RequestMalformed);
+
+            connection.Send(errorMessage.Span);
+        }
+
+        /// <summary>
+        /// Counts the items per shard, and returns the shard of the items
+        /// if they all belong to the same one, -1 otherwise.
+        /// </summary>
+        private int CountShards(int itemCount)
+        {
+            Array.Clear(_shardCounts, 0, _shardCounts.Length);
+
+            var single = _itemShards[0];
+            for (var i = 0; i < itemCount; i++)
+            {
+                _shardCounts[_itemShards[i]]++;
+                if (_itemShards[i] != single)
+                    single = -1;
+            }
+
+            return single;
+        }
+
+        /// <summary>
+        /// Splits the request into one part per coin controller involved.
+        /// The connection controller merges the partial responses.
+        /// <see cref="MessageKind.PrefetchCoins"/> is split alike, but not
+        /// answered, even when malformed.
+        /// </summary>
+        private void DispatchGetCoins(Span<byte> next, ConnectionController connection)
+        {
+            var request = new GetCoinsRequest(next, default);
+            var isHint = request.MessageHeader.MessageKind == MessageKind.PrefetchCoins;
+            if (!request.IsWellFormed)
+            {
+                if (!isHint) RejectMalformed(next, connection);
+                return;
+            }
+
+            request.TotalCount = request.Count;
+
+            var items = request.Items;
+            for (var i = 0; i < items.Length; i++)
+                _itemShards[i] = ShardOf(ref items[i].Outpoint);
+
+            var single = CountShards(items.Length);
+            if (single >= 0)
+            {
+                if (isHint) DispatchHint(single, next);
+                else DispatchCoinMessage(single, next);
+                return;
+            }
+
+            for (var shard = 0; shard < _shardCounts.Length; shard++)
+            {
+                if (_shardCounts[shard] == 0)
+                    continue;
+
+                var part = new GetCoinsRequest(_partBuffer, request.MessageHeader.RequestId,
+                    request.MessageHeader.ClientId, request.HandleContext, _shardCounts[shard], request.TotalCount,
+                    request.Projection);
+                part.MessageHeader.MessageKind = request.MessageHeader.MessageKind;
+
+                var partItems = part.Items;
+                var count = 0;
+                for (var i = 0; i < items.Length; i++)
+                {
+                    if (_itemShards[i] == shard)
+                        partItems[count++] = items[i];
+                }
+
+                if (isHint) DispatchHint(shard, part.Span);
+                else DispatchCoinMessage(shard, part.Span);
+            }
+        }
+
+        /// <summary>
+        /// Same as <see cref="DispatchGetCoins"/>. The parts of
+        /// <see cref="MessageKind.WriteCoins"/> keep their kind, their
+        /// responses being collected by the connection controller.
+        /// </summary>
+        private void DispatchChangeCoins(Span<byte> next, ConnectionController connection)
+        {
+            var request = new ChangeCoinsRequest(next, default);
+            if (!request.IsWellFormed)
+            {
+                RejectMalformed(next, connection);
+                return;
+            }
+
+            request.TotalCount = request.Count;
+
+            var offset = 0;
+            for (var i = 0; i < request.Count; i++)
+            {
+                _itemOffsets[i] = offset;
+                _itemShards[i] = ShardOf(ref request.ItemAt(offset).Outpoint);
+                offset += request.ItemSizeAt(offset);
+            }
+
+            var single = CountShards(request.Count);
+            if (single >= 0)
+            {
+                DispatchCoinMessage(single, next);
+                return;
+            }
+
+            var items = request.Items;
+            for (var shard = 0; shard < _shardCounts.Length; shard++)
+            {
+                if (_shardCounts[shard] == 0)
+                    continue;
+
+                var part = new ChangeCoinsRequest(_partBuffer, request.MessageHeader.RequestId,
+                    request.MessageHeader.ClientId, request.HandleContext, request.TotalCount);
+                part.MessageHeader.MessageKind = request.MessageHeader.MessageKind;
+
+                for (var i = 0; i < request.Count; i++)
+                {
+                    if (_itemShards[i] == shard)
+                        part.Append(items.Slice(_itemOffsets[i], request.ItemSizeAt(_itemOffsets[i])));
+                }
+
+                DispatchCoinMessage(shard, part.Span);
+            }
+        }
     }
 }
\ No newline at end of file
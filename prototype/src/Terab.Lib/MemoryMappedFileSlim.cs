@@ -129,6 +129,43 @@ public void FlushLastSpan()
             throw new NotSupportedException($"Platform not supported: {RuntimeInformation.OSDescription}.");
         }
 
+        /// <summary>
+        /// Hints the OS that the region will be read soon, so that its pages
+        /// are brought from the disk in the background. Does not block.
+        /// </summary>
+        public void Prefetch(long offset, int length)
+        {
+            if (offset < 0 || length < 0 || offset + length > _fileLength)
+                throw new ArgumentOutOfRangeException(nameof(offset));
+
+            // The region is extended to whole pages, as required by the OS.
+            var pageSize = Environment.SystemPageSize;
+            var begin = offset - offset % pageSize;
+            var end = offset + length;
+
+            if (RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
+            {
+                MyInterop.Sys.MAdvise((IntPtr) (_originPtr + begin), (UIntPtr) (ulong) (end - begin),
+                    MyInterop.Sys.MADV_WILLNEED);
+                return;
+            }
+
+            if (RuntimeInformation.IsOSPlatform(OSPlatform.Windows))
+            {
+                var entry = new MyInterop.Kernel32.MemoryRangeEntry
+                {
+                    VirtualAddress = (IntPtr) (_originPtr + begin),
+                    NumberOfBytes = (UIntPtr) (ulong) (end - begin)
+                };
+
+                MyInterop.Kernel32.PrefetchVirtualMemory(MyInterop.Kernel32.GetCurrentProcess(),
+                    (UIntPtr) 1, &entry, 0);
+                return;
+            }
+
+            // Merely a hint, nothing to do elsewhere.
+        }
+
         private void ReleaseUnmanagedResources()
         {
             _mmva.SafeMemoryMappedViewHandle.ReleasePointer();
@@ -178,6 +215,24 @@ internal class Kernel32
                 [DllImport("kernel32.dll", SetLastError = true)]
                 [return: MarshalAs(UnmanagedType.Bool)]
                 internal extern static bool FlushFileBuffers(SafeHandle hHandle);
+
+                // See
+                // https://docs.microsoft.com/en-us/windows/desktop/api/memoryapi/nf-memoryapi-prefetchvirtualmemory
+
+                [StructLayout(LayoutKind.Sequential)]
+                internal struct MemoryRangeEntry
+                {
+                    public IntPtr VirtualAddress;
+                    public UIntPtr NumberOfBytes;
+                }
+
+                [DllImport("kernel32.dll")]
+                internal extern static IntPtr GetCurrentProcess();
+
+                [DllImport("kernel32.dll", SetLastError = true)]
+                [return: MarshalAs(UnmanagedType.Bool)]
+                internal extern static bool PrefetchVirtualMemory(IntPtr hProcess, UIntPtr numberOfEntries,
+                    MemoryRangeEntry* virtualAddresses, uint flags);
             }
 
             /// <summary> Linux </summary>
@@ -197,6 +252,12 @@ internal enum MemoryMappedSyncFlags
 
                 [DllImport("System.Native", EntryPoint = "SystemNative_MSync", SetLastError = true)]
                 internal static extern int MSync(IntPtr addr, ulong len, MemoryMappedSyncFlags flags);
+
+                // 'SystemNative_MAdvise' only supports 'MADV_DONTFORK', hence the libc.
+                internal const int MADV_WILLNEED = 3;
+
+                [DllImport("libc", EntryPoint = "madvise", SetLastError = true)]
+                internal static extern int MAdvise(IntPtr addr, UIntPtr len, int advice);
             }
         }
     }
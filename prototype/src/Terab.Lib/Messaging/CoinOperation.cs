@@ -0,0 +1,29 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+namespace Terab.Lib.Messaging
+{
+    /// <summary>
+    /// Operation carried by an item of a <see cref="Protocol.ChangeCoinsRequest"/>.
+    /// </summary>
+    public enum CoinOperation : byte
+    {
+        /// <summary> Coin production, the item is followed by the payload. </summary>
+        Produce = 0,
+
+        /// <summary> Coin consumption. </summary>
+        Consume = 1,
+
+        /// <summary> Removal of coin events, see <see cref="CoinRemoval"/>. </summary>
+        Remove = 2,
+    }
+
+    /// <summary>
+    /// Options of a <see cref="CoinOperation.Remove"/> item.
+    /// </summary>
+    [System.Flags]
+    public enum CoinRemoval : byte
+    {
+        None = 0,
+        Production = 1 << 0,
+        Consumption = 1 << 1,
+    }
+}
@@ -0,0 +1,39 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+namespace Terab.Lib.Messaging
+{
+    /// <summary>
+    /// Parts of the coins returned by a <see cref="Protocol.GetCoinsRequest"/>.
+    /// </summary>
+    public enum CoinProjection : byte
+    {
+        /// <summary> Events and payload, script included. </summary>
+        Full = 0,
+
+        /// <summary>
+        /// Status, flags and events only. The payload of a coin never
+        /// changes once set, clients which already hold it only need the
+        /// events; 'Satoshis', 'NLockTime' and the script are left empty.
+        /// </summary>
+        Events = 1,
+
+        /// <summary>
+        /// Events, 'Satoshis' and 'NLockTime', the script left empty. For
+        /// clients which keep the scripts elsewhere (signature cache).
+        /// </summary>
+        Metadata = 2,
+
+        /// <summary>
+        /// Same as <see cref="Metadata"/>, the script being replaced by its
+        /// 32-byte SHA-256 hash.
+        /// </summary>
+        ScriptHash = 3,
+
+        /// <summary>
+        /// Status only: <see cref="GetCoinStatus.Unspent"/> if the coin is
+        /// unspent at the context, <see cref="GetCoinStatus.Spent"/> if it
+        /// is already consumed, <see cref="GetCoinStatus.OutpointNotFound"/>
+        /// if it is missing.
+        /// </summary>
+        Existence = 4,
+    }
+}
@@ -33,6 +33,25 @@ public enum MessageKind : int
         /// <summary> Upon  connection closure. </summary>
         CloseConnectionResponse = 5,
 
+        /// <summary> Client request to agree on the <see cref="WireFormat"/>. </summary>
+        Negotiate = 6,
+
+        /// <summary> Result of a <see cref="Negotiate"/> request. </summary>
+        NegotiateResponse = 7,
+
+        /// <summary>
+        /// Barrier over the <see cref="WriteCoins"/> requests of the
+        /// connection, answered once they have all been processed.
+        /// </summary>
+        SyncCoins = 8,
+
+        /// <summary>
+        /// Failed items of the <see cref="WriteCoins"/> requests preceding a
+        /// <see cref="SyncCoins"/> request, laid out as a
+        /// <see cref="Protocol.ChangeCoinsResponse"/>, possibly split.
+        /// </summary>
+        SyncCoinsResponse = 9,
+
 
         // === CHAIN CONTROLLER (16 - 63) ===
         // ==================================
@@ -91,6 +110,37 @@ public enum MessageKind : int
 
         /// <summary> Result of a <see cref="RemoveCoin"/> request. </summary>
         RemoveCoinResponse = 71,
+
+        /// <summary> Request many coins to be read. </summary>
+        GetCoins = 72,
+
+        /// <summary> Result of a <see cref="GetCoins"/> request, possibly split. </summary>
+        GetCoinsResponse = 73,
+
+        /// <summary> Request many coins to be produced, consumed or removed. </summary>
+        ChangeCoins = 74,
+
+        /// <summary> Result of a <see cref="ChangeCoins"/> request, possibly split. </summary>
+        ChangeCoinsResponse = 75,
+
+        /// <summary>
+        /// Hint that many coins are about to be read, laid out as a
+        /// <see cref="GetCoins"/> request. Never answered, hence no
+        /// response kind.
+        /// </summary>
+        PrefetchCoins = 76,
+
+        /// <summary>
+        /// Same as <see cref="ChangeCoins"/>, without response to the client.
+        /// Failures are reported by <see cref="SyncCoins"/>.
+        /// </summary>
+        WriteCoins = 78,
+
+        /// <summary>
+        /// Result of a <see cref="WriteCoins"/> request, possibly split. Kept
+        /// by the connection controller, never sent to the client.
+        /// </summary>
+        WriteCoinsResponse = 79,
     }
 
     public static class MessageKindExtensions
@@ -0,0 +1,236 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+using Terab.Lib.Chains;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Produces, consumes or removes many coins against the same context in
+    /// a single message.
+    /// </summary>
+    /// <remarks>
+    /// Items are laid out back to back. A <see cref="CoinOperation.Produce"/>
+    /// item is followed by a <see cref="Production"/> and by the script.
+    ///
+    /// The dispatch controller splits the request per coin controller
+    /// shard, each part keeping the items it covers. The item index is
+    /// opaque to the server, and copied into the response.
+    /// </remarks>
+    public unsafe ref struct ChangeCoinsRequest
+    {
+        private Span<byte> _buffer;
+        private readonly BlockHandleMask _mask;
+
+        public static int HeaderSizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader RequestHeader;
+            public BlockHandle Context;
+            public ushort Count;
+
+            /// <summary> Number of items of the original request, set by the server. </summary>
+            public ushort TotalCount;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct Item
+        {
+            public static readonly int SizeInBytes = sizeof(Item);
+
+            public uint Index;
+            public CoinOperation Operation;
+
+            /// <summary>
+            /// <see cref="OutpointFlags"/> of a production, or
+            /// <see cref="CoinRemoval"/> of a removal.
+            /// </summary>
+            public byte Options;
+
+            public Outpoint Outpoint;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct Production
+        {
+            public static readonly int SizeInBytes = sizeof(Production);
+
+            public ulong Satoshis;
+            public uint NLockTime;
+            public ushort ScriptLength;
+        }
+
+        public ChangeCoinsRequest(Span<byte> buffer, BlockHandleMask mask)
+        {
+            _buffer = buffer;
+            _mask = mask;
+        }
+
+        /// <summary> Empty request, filled through 'Append'. </summary>
+        public ChangeCoinsRequest(
+            Span<byte> buffer,
+            RequestId requestId,
+            ClientId clientId,
+            BlockHandle context,
+            int totalCount)
+        {
+            _buffer = buffer;
+            _mask = clientId.Mask;
+
+            AsHeader.RequestHeader.MessageSizeInBytes = Header.SizeInBytes;
+            AsHeader.RequestHeader.RequestId = requestId;
+            AsHeader.RequestHeader.ClientId = clientId;
+            AsHeader.RequestHeader.MessageKind = MessageKind.ChangeCoins;
+
+            AsHeader.Context = context;
+            AsHeader.Count = 0;
+            AsHeader.TotalCount = (ushort) totalCount;
+        }
+
+        /// <summary>
+        /// Allocate an array. Intended for testing purposes only.
+        /// </summary>
+        internal static ChangeCoinsRequest From(
+            RequestId requestId,
+            ClientId clientId,
+            BlockAlias context,
+            BlockHandleMask mask)
+        {
+            var request = new ChangeCoinsRequest(new byte[Constants.MaxRequestSize], requestId, clientId,
+                context.ConvertToBlockHandle(mask), 0);
+
+            return request;
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.RequestHeader;
+
+        public BlockAlias Context => AsHeader.Context.ConvertToBlockAlias(_mask);
+
+        public BlockHandle HandleContext => AsHeader.Context;
+
+        public int Count => AsHeader.Count;
+
+        public int TotalCount
+        {
+            get => AsHeader.TotalCount;
+            set => AsHeader.TotalCount = (ushort) value;
+        }
+
+        /// <summary> Appends an item already encoded, typically taken from another request. </summary>
+        public void Append(Span<byte> item)
+        {
+            var offset = AsHeader.RequestHeader.MessageSizeInBytes;
+            item.CopyTo(_buffer.Slice(offset));
+
+            AsHeader.RequestHeader.MessageSizeInBytes = offset + item.Length;
+            AsHeader.Count++;
+        }
+
+        /// <summary> Intended for testing purposes. </summary>
+        internal void Append(uint index, CoinOperation operation, byte options, Outpoint outpoint)
+        {
+            Span<byte> item = stackalloc byte[Item.SizeInBytes];
+            ref var header = ref MemoryMarshal.Cast<byte, Item>(item)[0];
+            header.Index = index;
+            header.Operation = operation;
+            header.Options = options;
+            header.Outpoint = outpoint;
+
+            Append(item);
+        }
+
+        /// <summary> Intended for testing purposes. </summary>
+        internal void AppendProduction(uint index, OutpointFlags flags, Outpoint outpoint,
+            ulong satoshis, uint nLockTime, Span<byte> script)
+        {
+            Append(index, CoinOperation.Produce, (byte) flags, outpoint);
+
+            Span<byte> production = stackalloc byte[Production.SizeInBytes];
+            ref var header = ref MemoryMarshal.Cast<byte, Production>(production)[0];
+            header.Satoshis = satoshis;
+            header.NLockTime = nLockTime;
+            header.ScriptLength = (ushort) script.Length;
+
+            var offset = AsHeader.RequestHeader.MessageSizeInBytes;
+            production.CopyTo(_buffer.Slice(offset));
+            script.CopyTo(_buffer.Slice(offset + Production.SizeInBytes));
+            AsHeader.RequestHeader.MessageSizeInBytes = offset + Production.SizeInBytes + script.Length;
+        }
+
+        /// <summary> The items, laid out back to back. </summary>
+        public Span<byte> Items => _buffer.Slice(Header.SizeInBytes,
+            AsHeader.RequestHeader.MessageSizeInBytes - Header.SizeInBytes);
+
+        public ref Item ItemAt(int offset)
+        {
+            return ref MemoryMarshal.Cast<byte, Item>(Items.Slice(offset, Item.SizeInBytes))[0];
+        }
+
+        /// <summary> Valid for <see cref="CoinOperation.Produce"/> items only. </summary>
+        public ref Production ProductionAt(int offset)
+        {
+            return ref MemoryMarshal.Cast<byte, Production>(
+                Items.Slice(offset + Item.SizeInBytes, Production.SizeInBytes))[0];
+        }
+
+        /// <summary> Valid for <see cref="CoinOperation.Produce"/> items only. </summary>
+        public Span<byte> ScriptAt(int offset)
+        {
+            return Items.Slice(offset + Item.SizeInBytes + Production.SizeInBytes,
+                ProductionAt(offset).ScriptLength);
+        }
+
+        /// <summary> Length of the item at 'offset', its payload included. </summary>
+        public int ItemSizeAt(int offset)
+        {
+            if (ItemAt(offset).Operation != CoinOperation.Produce)
+                return Item.SizeInBytes;
+
+            return Item.SizeInBytes + Production.SizeInBytes + ProductionAt(offset).ScriptLength;
+        }
+
+        /// <summary> Checks that the items match the message length. </summary>
+        public bool IsWellFormed
+        {
+            get
+            {
+                if (_buffer.Length < Header.SizeInBytes || AsHeader.Count == 0)
+                    return false;
+
+                var items = Items;
+                var offset = 0;
+                for (var i = 0; i < AsHeader.Count; i++)
+                {
+                    if (items.Length - offset < Item.SizeInBytes)
+                        return false;
+
+                    var operation = ItemAt(offset).Operation;
+                    if (operation > CoinOperation.Remove)
+                        return false;
+
+                    if (operation == CoinOperation.Produce &&
+                        items.Length - offset < Item.SizeInBytes + Production.SizeInBytes)
+                        return false;
+
+                    var size = ItemSizeAt(offset);
+                    if (items.Length - offset < size)
+                        return false;
+
+                    offset += size;
+                }
+
+                return offset == items.Length;
+            }
+        }
+
+        public BlockHandleMask Mask => _mask;
+
+        public Span<byte> Span => _buffer.Slice(0, AsHeader.RequestHeader.MessageSizeInBytes);
+    }
+}
@@ -0,0 +1,77 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Outcome of the items of a <see cref="ChangeCoinsRequest"/>.
+    /// </summary>
+    /// <remarks>
+    /// When the request has been split across shards, the response may be
+    /// split too, see <see cref="GetCoinsResponse"/>.
+    /// </remarks>
+    public unsafe ref struct ChangeCoinsResponse
+    {
+        private readonly Span<byte> _buffer;
+
+        public static int HeaderSizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader ResponseHeader;
+            public ushort Count;
+            public ushort TotalCount;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct Item
+        {
+            public static readonly int SizeInBytes = sizeof(Item);
+
+            public uint Index;
+            public ChangeCoinStatus Status;
+        }
+
+        public ChangeCoinsResponse(Span<byte> buffer)
+        {
+            _buffer = buffer;
+        }
+
+        /// <summary> Response with 'count' items, left to be filled. </summary>
+        public ChangeCoinsResponse(
+            RequestId requestId,
+            ClientId clientId,
+            int count,
+            int totalCount,
+            SpanPool<byte> pool)
+        {
+            var messageSizeInBytes = Header.SizeInBytes + count * Item.SizeInBytes;
+            _buffer = pool.GetSpan(messageSizeInBytes);
+
+            AsHeader.ResponseHeader.MessageSizeInBytes = messageSizeInBytes;
+            AsHeader.ResponseHeader.RequestId = requestId;
+            AsHeader.ResponseHeader.ClientId = clientId;
+            AsHeader.ResponseHeader.MessageKind = MessageKind.ChangeCoinsResponse;
+
+            AsHeader.Count = (ushort) count;
+            AsHeader.TotalCount = (ushort) totalCount;
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.ResponseHeader;
+
+        public int Count => AsHeader.Count;
+
+        public int TotalCount => AsHeader.TotalCount;
+
+        public Span<Item> Items => MemoryMarshal.Cast<byte, Item>(
+            _buffer.Slice(Header.SizeInBytes, AsHeader.Count * Item.SizeInBytes));
+
+        public Span<byte> Span => _buffer.Slice(0, AsHeader.ResponseHeader.MessageSizeInBytes);
+    }
+}
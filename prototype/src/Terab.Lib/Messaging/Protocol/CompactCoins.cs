@@ -0,0 +1,278 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Translates the multi-coin messages between <see cref="WireFormat.Fixed"/>,
+    /// which the controllers work with, and <see cref="WireFormat.Compact"/>,
+    /// which the connections negotiating it exchange with their client.
+    /// </summary>
+    /// <remarks>
+    /// The headers are unchanged. Integers noted 'varint' are <see cref="VarInt"/>.
+    ///
+    /// Requests are followed by the varint index of their first item, the
+    /// next items being numbered consecutively. An outpoint is a varint
+    /// reference to its txid, followed by its varint output index. The
+    /// reference is zero when the txid follows, literally; otherwise it
+    /// designates a txid which already appeared literally in the message, 1
+    /// being the latest one, 2 the one before, etc.
+    ///
+    /// - <see cref="GetCoinsRequest"/> items: outpoint.
+    /// - <see cref="ChangeCoinsRequest"/> items: operation (byte), options
+    ///   (byte), outpoint; produce items are followed by the varint satoshis,
+    ///   nLockTime and script length, then by the script.
+    /// - <see cref="GetCoinsResponse"/> items: varint index, status (byte);
+    ///   found coins (<see cref="GetCoinStatus.Success"/>) are followed by
+    ///   their flags (byte), production and consumption handles (uint),
+    ///   varint satoshis, nLockTime and script length, then by the script.
+    /// - <see cref="ChangeCoinsResponse"/> items: varint index, status (byte).
+    /// </remarks>
+    public static class CompactCoins
+    {
+        /// <summary> Common to the multi-coin responses, in both formats. </summary>
+        public static int ResponseHeaderSizeInBytes => GetCoinsResponse.HeaderSizeInBytes;
+
+        /// <summary> Common part of the multi-coin request headers. </summary>
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct RequestHeader
+        {
+            public MessageHeader MessageHeader;
+            public BlockHandle Context;
+            public ushort Count;
+            public ushort TotalCount;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct ResponseHeader
+        {
+            public MessageHeader MessageHeader;
+            public ushort Count;
+            public ushort TotalCount;
+        }
+
+        /// <summary>
+        /// Decodes a compact <see cref="GetCoinsRequest"/> or
+        /// <see cref="ChangeCoinsRequest"/>, the latter possibly of kind
+        /// <see cref="MessageKind.WriteCoins"/>, into 'expanded'. Returns the
+        /// length of the expanded request, or -1 if the request is malformed
+        /// or does not fit. 'txids' holds the offsets of the literal txids,
+        /// the request is rejected if it has more items than 'txids'.
+        /// </summary>
+        public static int ExpandRequest(Span<byte> compact, Span<byte> expanded, int[] txids)
+        {
+            if (compact.Length < ChangeCoinsRequest.HeaderSizeInBytes)
+                return -1;
+
+            var header = MemoryMarshal.Read<RequestHeader>(compact);
+            if (header.Count == 0 || header.Count > txids.Length)
+                return -1;
+
+            var offset = header.MessageHeader.MessageKind == MessageKind.GetCoins
+                ? GetCoinsRequest.HeaderSizeInBytes
+                : ChangeCoinsRequest.HeaderSizeInBytes;
+            if (compact.Length < offset || !VarInt.TryRead(compact, ref offset, out var firstIndex) || firstIndex > uint.MaxValue - header.Count)
+                return -1;
+
+            var length = header.MessageHeader.MessageKind == MessageKind.GetCoins
+                ? ExpandGetCoins(compact, ref offset, header, (uint) firstIndex, expanded, txids)
+                : ExpandChangeCoins(compact, ref offset, header, (uint) firstIndex, expanded, txids);
+
+            // Trailing bytes are not tolerated either.
+            return offset == compact.Length ? length : -1;
+        }
+
+        private static int ExpandGetCoins(Span<byte> compact, ref int offset, RequestHeader header,
+            uint firstIndex, Span<byte> expanded, int[] txids)
+        {
+            if (GetCoinsRequest.HeaderSizeInBytes + header.Count * GetCoinsRequest.Item.SizeInBytes > expanded.Length)
+                return -1;
+
+            // The projection closes the header of the requests, see 'GetCoinsRequest'.
+            var projection = (CoinProjection) compact[GetCoinsRequest.HeaderSizeInBytes - 1];
+
+            var request = new GetCoinsRequest(expanded, header.MessageHeader.RequestId,
+                header.MessageHeader.ClientId, header.Context, header.Count, header.TotalCount, projection);
+
+            var items = request.Items;
+            var txidCount = 0;
+            for (var i = 0; i < items.Length; i++)
+            {
+                items[i].Index = firstIndex + (uint) i;
+                if (!TryReadOutpoint(compact, ref offset, txids, ref txidCount, out items[i].Outpoint))
+                    return -1;
+            }
+
+            return request.Span.Length;
+        }
+
+        private static int ExpandChangeCoins(Span<byte> compact, ref int offset, RequestHeader header,
+            uint firstIndex, Span<byte> expanded, int[] txids)
+        {
+            var kind = header.MessageHeader.MessageKind;
+            if (kind != MessageKind.ChangeCoins && kind != MessageKind.WriteCoins)
+                return -1;
+
+            var request = new ChangeCoinsRequest(expanded, header.MessageHeader.RequestId,
+                header.MessageHeader.ClientId, header.Context, header.TotalCount);
+            request.MessageHeader.MessageKind = kind;
+
+            var txidCount = 0;
+            for (var i = 0; i < header.Count; i++)
+            {
+                if (compact.Length - offset < 2)
+                    return -1;
+
+                var operation = (CoinOperation) compact[offset++];
+                var options = compact[offset++];
+
+                if (operation > CoinOperation.Remove ||
+                    !TryReadOutpoint(compact, ref offset, txids, ref txidCount, out var outpoint))
+                    return -1;
+
+                var room = expanded.Length - request.Span.Length;
+                if (operation != CoinOperation.Produce)
+                {
+                    if (room < ChangeCoinsRequest.Item.SizeInBytes)
+                        return -1;
+
+                    request.Append(firstIndex + (uint) i, operation, options, outpoint);
+                    continue;
+                }
+
+                if (!VarInt.TryRead(compact, ref offset, out var satoshis) ||
+                    !VarInt.TryRead(compact, ref offset, out var nLockTime) || nLockTime > uint.MaxValue ||
+                    !VarInt.TryRead(compact, ref offset, out var scriptLength) ||
+                    scriptLength > (ulong) (compact.Length - offset) ||
+                    (int) scriptLength > room - ChangeCoinsRequest.Item.SizeInBytes - ChangeCoinsRequest.Production.SizeInBytes)
+                    return -1;
+
+                request.AppendProduction(firstIndex + (uint) i, (OutpointFlags) options, outpoint,
+                    satoshis, (uint) nLockTime, compact.Slice(offset, (int) scriptLength));
+                offset += (int) scriptLength;
+            }
+
+            return request.Span.Length;
+        }
+
+        private static unsafe bool TryReadOutpoint(Span<byte> compact, ref int offset, int[] txids,
+            ref int txidCount, out Outpoint outpoint)
+        {
+            outpoint = default;
+
+            if (!VarInt.TryRead(compact, ref offset, out var reference) || reference > (ulong) txidCount)
+                return false;
+
+            int txidOffset;
+            if (reference == 0)
+            {
+                if (compact.Length - offset < 32)
+                    return false;
+
+                txidOffset = offset;
+                txids[txidCount++] = offset;
+                offset += 32;
+            }
+            else
+            {
+                txidOffset = txids[txidCount - (int) reference];
+            }
+
+            if (!VarInt.TryRead(compact, ref offset, out var txIndex) || txIndex > uint.MaxValue)
+                return false;
+
+            fixed (byte* txid = outpoint.TxId)
+                compact.Slice(txidOffset, 32).CopyTo(new Span<byte>(txid, 32));
+
+            outpoint.TxIndex = (int) (uint) txIndex;
+            return true;
+        }
+
+        /// <summary>
+        /// Encodes into 'compact' the items of the <see cref="GetCoinsResponse"/>
+        /// or <see cref="ChangeCoinsResponse"/> starting at 'offset' within the
+        /// response, as many as fit. Returns the length of the compact
+        /// message, and moves 'offset' past the items encoded: the caller
+        /// sends the message, and repeats while 'offset' is short of the
+        /// response length. 'offset' starts at <see cref="ResponseHeaderSizeInBytes"/>.
+        /// </summary>
+        public static int CompactResponse(Span<byte> response, ref int offset, Span<byte> compact)
+        {
+            var headerSize = ResponseHeaderSizeInBytes;
+            response.Slice(0, headerSize).CopyTo(compact);
+
+            var length = headerSize;
+            var count = 0;
+            var isGetCoins = MemoryMarshal.Read<ResponseHeader>(response).MessageHeader.MessageKind
+                             == MessageKind.GetCoinsResponse;
+
+            // An item takes 4 varints, 2 handles and 2 bytes at most, the script excluded.
+            Span<byte> encoded = stackalloc byte[4 * VarInt.MaxSizeInBytes + 2 * BlockHandle.SizeInBytes + 2];
+            while (offset < response.Length)
+            {
+                var itemSize = isGetCoins
+                    ? CompactGetCoinsItem(response.Slice(offset), encoded, out var encodedLength, out var script)
+                    : CompactChangeCoinsItem(response.Slice(offset), encoded, out encodedLength, out script);
+
+                if (compact.Length - length < encodedLength + script.Length)
+                    break;
+
+                encoded.Slice(0, encodedLength).CopyTo(compact.Slice(length));
+                script.CopyTo(compact.Slice(length + encodedLength));
+                length += encodedLength + script.Length;
+
+                offset += itemSize;
+                count++;
+            }
+
+            ref var header = ref MemoryMarshal.Cast<byte, ResponseHeader>(compact)[0];
+            header.MessageHeader.MessageSizeInBytes = length;
+            header.Count = (ushort) count;
+
+            return length;
+        }
+
+        private static int CompactGetCoinsItem(Span<byte> items, Span<byte> encoded,
+            out int encodedLength, out Span<byte> script)
+        {
+            var item = MemoryMarshal.Read<GetCoinsResponse.Item>(items);
+            script = items.Slice(GetCoinsResponse.Item.SizeInBytes, item.ScriptLength);
+
+            var length = VarInt.Write(encoded, item.Index);
+            encoded[length++] = (byte) item.Status;
+
+            if (item.Status == GetCoinStatus.Success)
+            {
+                encoded[length++] = (byte) item.Flags;
+                MemoryMarshal.Write(encoded.Slice(length), ref item.Production);
+                length += BlockHandle.SizeInBytes;
+                MemoryMarshal.Write(encoded.Slice(length), ref item.Consumption);
+                length += BlockHandle.SizeInBytes;
+                length += VarInt.Write(encoded.Slice(length), item.Satoshis);
+                length += VarInt.Write(encoded.Slice(length), item.NLockTime);
+                length += VarInt.Write(encoded.Slice(length), item.ScriptLength);
+            }
+            else
+            {
+                script = Span<byte>.Empty;
+            }
+
+            encodedLength = length;
+            return GetCoinsResponse.Item.SizeInBytes + item.ScriptLength;
+        }
+
+        private static int CompactChangeCoinsItem(Span<byte> items, Span<byte> encoded,
+            out int encodedLength, out Span<byte> script)
+        {
+            var item = MemoryMarshal.Read<ChangeCoinsResponse.Item>(items);
+            script = Span<byte>.Empty;
+
+            var length = VarInt.Write(encoded, item.Index);
+            encoded[length++] = (byte) item.Status;
+
+            encodedLength = length;
+            return ChangeCoinsResponse.Item.SizeInBytes;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+using Terab.Lib.Chains;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Reads many coins against the same context in a single message.
+    /// </summary>
+    /// <remarks>
+    /// The dispatch controller splits the request per coin controller
+    /// shard, each part keeping the items it covers. The item index is
+    /// opaque to the server, and copied into the response.
+    /// </remarks>
+    public unsafe ref struct GetCoinsRequest
+    {
+        private Span<byte> _buffer;
+        private readonly BlockHandleMask _mask;
+
+        public static int HeaderSizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader RequestHeader;
+            public BlockHandle Context;
+            public ushort Count;
+
+            /// <summary> Number of items of the original request, set by the server. </summary>
+            public ushort TotalCount;
+
+            public CoinProjection Projection;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct Item
+        {
+            public static readonly int SizeInBytes = sizeof(Item);
+
+            public uint Index;
+            public Outpoint Outpoint;
+        }
+
+        public GetCoinsRequest(Span<byte> buffer, BlockHandleMask mask)
+        {
+            _buffer = buffer;
+            _mask = mask;
+        }
+
+        /// <summary> Request with 'count' items, left to be filled. </summary>
+        public GetCoinsRequest(
+            Span<byte> buffer,
+            RequestId requestId,
+            ClientId clientId,
+            BlockHandle context,
+            int count,
+            int totalCount,
+            CoinProjection projection = CoinProjection.Full)
+        {
+            var messageSizeInBytes = Header.SizeInBytes + count * Item.SizeInBytes;
+            _buffer = buffer.Slice(0, messageSizeInBytes);
+            _mask = clientId.Mask;
+
+            AsHeader.RequestHeader.MessageSizeInBytes = messageSizeInBytes;
+            AsHeader.RequestHeader.RequestId = requestId;
+            AsHeader.RequestHeader.ClientId = clientId;
+            AsHeader.RequestHeader.MessageKind = MessageKind.GetCoins;
+
+            AsHeader.Context = context;
+            AsHeader.Count = (ushort) count;
+            AsHeader.TotalCount = (ushort) totalCount;
+            AsHeader.Projection = projection;
+        }
+
+        /// <summary>
+        /// Allocate an array. Intended for testing purposes only.
+        /// </summary>
+        internal static GetCoinsRequest From(
+            RequestId requestId,
+            ClientId clientId,
+            Outpoint[] outpoints,
+            BlockAlias context,
+            BlockHandleMask mask,
+            CoinProjection projection = CoinProjection.Full)
+        {
+            var buffer = new byte[Header.SizeInBytes + outpoints.Length * Item.SizeInBytes];
+            var request = new GetCoinsRequest(buffer, requestId, clientId,
+                context.ConvertToBlockHandle(mask), outpoints.Length, 0, projection);
+
+            var items = request.Items;
+            for (var i = 0; i < outpoints.Length; i++)
+            {
+                items[i].Index = (uint) i;
+                items[i].Outpoint = outpoints[i];
+            }
+
+            return request;
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.RequestHeader;
+
+        public BlockAlias Context => AsHeader.Context.ConvertToBlockAlias(_mask);
+
+        public BlockHandle HandleContext => AsHeader.Context;
+
+        public int Count => AsHeader.Count;
+
+        public int TotalCount
+        {
+            get => AsHeader.TotalCount;
+            set => AsHeader.TotalCount = (ushort) value;
+        }
+
+        /// <summary> Lets clients ask for the parts of the coins they need only. </summary>
+        public CoinProjection Projection => AsHeader.Projection;
+
+        /// <summary> Checks that the items match the message length. </summary>
+        public bool IsWellFormed => _buffer.Length >= Header.SizeInBytes
+                                    && AsHeader.Count > 0
+                                    && AsHeader.Projection <= CoinProjection.Existence
+                                    && AsHeader.RequestHeader.MessageSizeInBytes ==
+                                    Header.SizeInBytes + AsHeader.Count * Item.SizeInBytes;
+
+        public Span<Item> Items => MemoryMarshal.Cast<byte, Item>(
+            _buffer.Slice(Header.SizeInBytes, AsHeader.Count * Item.SizeInBytes));
+
+        public BlockHandleMask Mask => _mask;
+
+        public Span<byte> Span => _buffer.Slice(0, AsHeader.RequestHeader.MessageSizeInBytes);
+    }
+}
@@ -0,0 +1,132 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Coins read by a <see cref="GetCoinsRequest"/>, each item being
+    /// followed by its script.
+    /// </summary>
+    /// <remarks>
+    /// When the coins do not fit in a single message, the response is
+    /// split into several messages sharing the request ID. The client
+    /// knows the request is complete once all the items are received.
+    /// </remarks>
+    public unsafe ref struct GetCoinsResponse
+    {
+        private readonly Span<byte> _buffer;
+
+        public static int HeaderSizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader ResponseHeader;
+            public ushort Count;
+            public ushort TotalCount;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        public struct Item
+        {
+            public static readonly int SizeInBytes = sizeof(Item);
+
+            public uint Index;
+            public GetCoinStatus Status;
+            public OutpointFlags Flags;
+            public BlockHandle Production;
+            public BlockHandle Consumption;
+            public ulong Satoshis;
+            public uint NLockTime;
+            public ushort ScriptLength;
+        }
+
+        public GetCoinsResponse(Span<byte> buffer)
+        {
+            _buffer = buffer;
+        }
+
+        /// <summary> Empty response, filled through 'TryAppend'. </summary>
+        public GetCoinsResponse(Span<byte> buffer, RequestId requestId, ClientId clientId, int totalCount)
+        {
+            _buffer = buffer;
+
+            AsHeader.ResponseHeader.RequestId = requestId;
+            AsHeader.ResponseHeader.ClientId = clientId;
+            AsHeader.ResponseHeader.MessageKind = MessageKind.GetCoinsResponse;
+            AsHeader.TotalCount = (ushort) totalCount;
+
+            Clear();
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.ResponseHeader;
+
+        public int Count => AsHeader.Count;
+
+        public int TotalCount => AsHeader.TotalCount;
+
+        /// <summary> Removes all the items, intended to reuse the buffer. </summary>
+        public void Clear()
+        {
+            AsHeader.ResponseHeader.MessageSizeInBytes = Header.SizeInBytes;
+            AsHeader.Count = 0;
+        }
+
+        /// <summary> Returns 'false' if the buffer is too short for the item. </summary>
+        public bool TryAppend(
+            uint index,
+            GetCoinStatus status,
+            OutpointFlags flags,
+            BlockHandle production,
+            BlockHandle consumption,
+            ulong satoshis,
+            uint nLockTime,
+            Span<byte> script)
+        {
+            var offset = AsHeader.ResponseHeader.MessageSizeInBytes;
+            if (_buffer.Length - offset < Item.SizeInBytes + script.Length)
+                return false;
+
+            ref var item = ref MemoryMarshal.Cast<byte, Item>(_buffer.Slice(offset, Item.SizeInBytes))[0];
+            item.Index = index;
+            item.Status = status;
+            item.Flags = flags;
+            item.Production = production;
+            item.Consumption = consumption;
+            item.Satoshis = satoshis;
+            item.NLockTime = nLockTime;
+            item.ScriptLength = (ushort) script.Length;
+
+            script.CopyTo(_buffer.Slice(offset + Item.SizeInBytes));
+
+            AsHeader.ResponseHeader.MessageSizeInBytes = offset + Item.SizeInBytes + script.Length;
+            AsHeader.Count++;
+            return true;
+        }
+
+        /// <summary>
+        /// Returns the item at 'offset' within <see cref="Items"/>, and moves
+        /// 'offset' to the next item.
+        /// </summary>
+        public ref Item ReadItem(ref int offset, out Span<byte> script)
+        {
+            var items = Items;
+            ref var item = ref MemoryMarshal.Cast<byte, Item>(items.Slice(offset, Item.SizeInBytes))[0];
+            script = items.Slice(offset + Item.SizeInBytes, item.ScriptLength);
+            offset += Item.SizeInBytes + item.ScriptLength;
+
+            return ref item;
+        }
+
+        /// <summary> The items, with their scripts. </summary>
+        public Span<byte> Items => _buffer.Slice(Header.SizeInBytes,
+            AsHeader.ResponseHeader.MessageSizeInBytes - Header.SizeInBytes);
+
+        public Span<byte> Span => _buffer.Slice(0, AsHeader.ResponseHeader.MessageSizeInBytes);
+    }
+}
@@ -0,0 +1,52 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    /// <summary>
+    /// Sent by the client, if at all, before any other request: the
+    /// connection controller answers with the wire format to be used.
+    /// </summary>
+    public unsafe ref struct NegotiateRequest
+    {
+        private readonly Span<byte> _buffer;
+
+        public static int SizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader RequestHeader;
+
+            /// <summary> Most recent format supported by the client. </summary>
+            public WireFormat Format;
+        }
+
+        public NegotiateRequest(Span<byte> buffer)
+        {
+            _buffer = buffer;
+        }
+
+        public NegotiateRequest(Span<byte> buffer, RequestId requestId, WireFormat format)
+        {
+            _buffer = buffer;
+
+            AsHeader.RequestHeader.MessageSizeInBytes = Header.SizeInBytes;
+            AsHeader.RequestHeader.RequestId = requestId;
+            AsHeader.RequestHeader.MessageKind = MessageKind.Negotiate;
+
+            AsHeader.Format = format;
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.RequestHeader;
+
+        public WireFormat Format => AsHeader.Format;
+
+        public Span<byte> Span => _buffer.Slice(0, Header.SizeInBytes);
+    }
+}
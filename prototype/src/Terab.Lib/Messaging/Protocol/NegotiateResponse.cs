@@ -0,0 +1,55 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.Runtime.InteropServices;
+
+namespace Terab.Lib.Messaging.Protocol
+{
+    public unsafe ref struct NegotiateResponse
+    {
+        private readonly Span<byte> _buffer;
+
+        public static int SizeInBytes => Header.SizeInBytes;
+
+        [StructLayout(LayoutKind.Sequential, Pack = 1)]
+        private struct Header
+        {
+            public static readonly int SizeInBytes = sizeof(Header);
+
+            public MessageHeader ResponseHeader;
+
+            /// <summary> Format of the subsequent messages, both ways. </summary>
+            public WireFormat Format;
+
+            /// <summary> Requests the client may have in progress at once. </summary>
+            public ushort Window;
+        }
+
+        public NegotiateResponse(Span<byte> buffer)
+        {
+            _buffer = buffer;
+        }
+
+        public NegotiateResponse(Span<byte> buffer, RequestId requestId, WireFormat format, ushort window)
+        {
+            _buffer = buffer;
+
+            AsHeader.ResponseHeader.MessageSizeInBytes = Header.SizeInBytes;
+            AsHeader.ResponseHeader.RequestId = requestId;
+            AsHeader.ResponseHeader.ClientId = ClientId.MinClientId;
+            AsHeader.ResponseHeader.MessageKind = MessageKind.NegotiateResponse;
+
+            AsHeader.Format = format;
+            AsHeader.Window = window;
+        }
+
+        private ref Header AsHeader => ref MemoryMarshal.Cast<byte, Header>(_buffer)[0];
+
+        public ref MessageHeader MessageHeader => ref AsHeader.ResponseHeader;
+
+        public WireFormat Format => AsHeader.Format;
+
+        public ushort Window => AsHeader.Window;
+
+        public Span<byte> Span => _buffer.Slice(0, Header.SizeInBytes);
+    }
+}
@@ -24,6 +24,12 @@ public enum GetCoinStatus : byte
     {
         Success = 0,
         OutpointNotFound = 1,
+
+        /// <summary> Answers <see cref="CoinProjection.Existence"/>, no details follow. </summary>
+        Unspent = 2,
+
+        /// <summary> Answers <see cref="CoinProjection.Existence"/> for a consumed coin, no details follow. </summary>
+        Spent = 3,
     }
 
     public enum ChangeCoinStatus : byte
@@ -77,6 +83,12 @@ public enum ProtocolErrorStatus
         /// </remarks>
         RequestTooShort = 9,
 
+        /// <summary>
+        /// Indicates that the items of a multi-coin request do not match
+        /// the length of the message.
+        /// </summary>
+        RequestMalformed = 10,
+
         UnspecifiedError = int.MaxValue
     }
 }
\ No newline at end of file
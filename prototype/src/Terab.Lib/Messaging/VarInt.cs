@@ -0,0 +1,47 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+
+namespace Terab.Lib.Messaging
+{
+    /// <summary>
+    /// Unsigned LEB128 integers: 7 bits per byte, least significant first,
+    /// the high bit being set on all bytes but the last.
+    /// </summary>
+    public static class VarInt
+    {
+        public const int MaxSizeInBytes = 10;
+
+        /// <summary> Returns the number of bytes written. </summary>
+        public static int Write(Span<byte> buffer, ulong value)
+        {
+            var length = 0;
+            while (value >= 0x80)
+            {
+                buffer[length++] = (byte) (value | 0x80);
+                value >>= 7;
+            }
+
+            buffer[length++] = (byte) value;
+            return length;
+        }
+
+        /// <summary>
+        /// Reads the integer at 'offset', which is moved past it. Returns
+        /// 'false' if the integer is truncated or does not fit 64 bits.
+        /// </summary>
+        public static bool TryRead(ReadOnlySpan<byte> buffer, ref int offset, out ulong value)
+        {
+            value = 0;
+            for (var shift = 0; shift < 64 && offset < buffer.Length; shift += 7)
+            {
+                var next = buffer[offset++];
+                value |= (ulong) (next & 0x7F) << shift;
+
+                if (next < 0x80)
+                    return true;
+            }
+
+            return false;
+        }
+    }
+}
@@ -0,0 +1,16 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+namespace Terab.Lib.Messaging
+{
+    /// <summary>
+    /// Encoding of the multi-coin messages, negotiated per connection
+    /// through a <see cref="Protocol.NegotiateRequest"/>.
+    /// </summary>
+    public enum WireFormat : byte
+    {
+        /// <summary> Fixed-width items, see <see cref="Protocol.GetCoinsRequest"/>. </summary>
+        Fixed = 1,
+
+        /// <summary> Varint items, see <see cref="Protocol.CompactCoins"/>. </summary>
+        Compact = 2,
+    }
+}
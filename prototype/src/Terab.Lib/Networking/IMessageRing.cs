@@ -0,0 +1,30 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+
+namespace Terab.Lib.Networking
+{
+    /// <summary>
+    /// Implemented by transports which receive the requests already framed
+    /// in memory, like 'SharedMemorySocket'. The requests are then consumed
+    /// in place rather than copied through 'ISocketLike.Receive()'.
+    /// </summary>
+    public interface IMessageRing
+    {
+        /// <summary>
+        /// Blocking call until the next request is available. The returned
+        /// span covers the request, header included, and remains valid
+        /// until 'NextMessage()' is called.
+        /// </summary>
+        /// <remarks>
+        /// The span always covers at least a message header. It is truncated
+        /// when the header holds an invalid message size.
+        /// </remarks>
+        Span<byte> PeekMessage();
+
+        /// <summary>
+        /// Releases the request returned by 'PeekMessage()', its room is
+        /// handed back to the client.
+        /// </summary>
+        void NextMessage();
+    }
+}
@@ -1,5 +1,6 @@
 ﻿// Copyright Lokad 2018 under MIT BCH.
 using System;
+using System.IO;
 using System.Net;
 using System.Net.Sockets;
 using System.Threading;
@@ -27,6 +28,12 @@ public class Listener
 
         public int Port { get; private set; }
 
+        /// <summary> Path of the socket file, for Unix domain sockets. </summary>
+        public string UnixSocketPath { get; private set; }
+
+        /// <summary> Endpoint description, for logging purposes. </summary>
+        private string EndPointName => UnixSocketPath == null ? $"port {Port}" : UnixSocketPath;
+
         /// <remarks>
         /// A port at zero indicates to chose any available port.
         /// </remarks>
@@ -49,12 +56,38 @@ public class Listener
             _socket.Listen(Constants.SocketReceiveBufferSize);
         }
 
+        /// <summary>
+        /// Listens on a Unix domain socket, intended for clients running on
+        /// the same host, which skip the TCP/IP stack altogether.
+        /// </summary>
+        /// <remarks>
+        /// A stale socket file, left behind by a previous instance, is deleted.
+        /// </remarks>
+        public Listener(
+            BoundedInbox dispatchInbox,
+            string unixSocketPath,
+            ILog log = null)
+        {
+            _dispatchInbox = dispatchInbox;
+            _log = log;
+
+            if (File.Exists(unixSocketPath))
+                File.Delete(unixSocketPath);
+
+            _socket = new Socket(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+            _socket.Bind(new UnixDomainSocketEndPoint(unixSocketPath));
+
+            UnixSocketPath = unixSocketPath;
+
+            _socket.Listen(Constants.SocketReceiveBufferSize);
+        }
+
         public void Loop(CancellationToken cancel)
         {
             if (OnConnectionAccepted == null)
                 throw new InvalidOperationException("OnConnectionAccepted is null.");
 
-            _log?.Log(LogSeverity.Info, $"Listener started on port {Port}.");
+            _log?.Log(LogSeverity.Info, $"Listener started on {EndPointName}.");
             try
             {
                 while (!cancel.IsCancellationRequested)
@@ -88,9 +121,12 @@ public void Loop(CancellationToken cancel)
             finally
             {
                 _socket.Close();
+
+                if (UnixSocketPath != null)
+                    File.Delete(UnixSocketPath);
             }
 
-            _log?.Log(LogSeverity.Info, $"Listener on port {Port} exited.");
+            _log?.Log(LogSeverity.Info, $"Listener on {EndPointName} exited.");
         }
     }
 }
\ No newline at end of file
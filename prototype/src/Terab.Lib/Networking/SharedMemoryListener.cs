@@ -0,0 +1,86 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.IO;
+using System.Threading;
+using Terab.Lib.Messaging;
+
+namespace Terab.Lib.Networking
+{
+    /// <summary>
+    /// Watches a directory where clients running on the same host create
+    /// shared-memory segments (see 'SharedMemorySocket'), and claims them
+    /// as new client connections.
+    /// </summary>
+    /// <remarks>
+    /// The directory is polled rather than watched, as segments are only
+    /// created when clients connect.
+    /// </remarks>
+    public class SharedMemoryListener
+    {
+        private const int ScanIntervalMs = 5;
+
+        private const string SegmentPattern = "terab-*.shm";
+
+        private readonly string _directory;
+
+        private readonly BoundedInbox _dispatchInbox;
+
+        private readonly ILog _log;
+
+        /// <summary> Intended to facilitate unit testing. </summary>
+        internal Func<ClientId> GetNextClientId { get; set; } = ClientId.Next;
+
+        public Action<ConnectionController> OnConnectionAccepted { get; set; }
+
+        public string SegmentDirectory => _directory;
+
+        public SharedMemoryListener(
+            BoundedInbox dispatchInbox,
+            string directory,
+            ILog log = null)
+        {
+            _dispatchInbox = dispatchInbox;
+            _directory = directory;
+            _log = log;
+
+            Directory.CreateDirectory(directory);
+        }
+
+        public void Loop(CancellationToken cancel)
+        {
+            if (OnConnectionAccepted == null)
+                throw new InvalidOperationException("OnConnectionAccepted is null.");
+
+            _log?.Log(LogSeverity.Info, $"Shared-memory listener started on {_directory}.");
+
+            while (!cancel.IsCancellationRequested)
+            {
+                foreach (var path in Directory.EnumerateFiles(_directory, SegmentPattern))
+                {
+                    var socket = SharedMemorySocket.TryAttach(path);
+                    if (socket == null)
+                    {
+                        // Segments of crashed clients would otherwise pile up.
+                        if (SharedMemorySocket.IsStale(path))
+                            File.Delete(path);
+
+                        continue;
+                    }
+
+                    var connection = new ConnectionController(
+                        _dispatchInbox,
+                        socket,
+                        GetNextClientId(),
+                        _log);
+
+                    // Wake the dispatch controller.
+                    OnConnectionAccepted(connection);
+                }
+
+                cancel.WaitHandle.WaitOne(ScanIntervalMs);
+            }
+
+            _log?.Log(LogSeverity.Info, $"Shared-memory listener on {_directory} exited.");
+        }
+    }
+}
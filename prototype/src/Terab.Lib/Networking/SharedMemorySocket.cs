@@ -0,0 +1,401 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using System.IO;
+using System.Net.Sockets;
+using System.Runtime.InteropServices;
+using System.Threading;
+using Terab.Lib.Messaging;
+
+namespace Terab.Lib.Networking
+{
+    /// <summary>
+    /// Server side of a shared-memory segment created by a client running
+    /// on the same host. Requests and responses go through two rings of the
+    /// segment, and the kernel is only involved when one side is idle.
+    /// </summary>
+    /// <remarks>
+    /// The segment layout is defined by 'shmem.h' in the native client.
+    ///
+    /// Requests are consumed in place through 'IMessageRing'. A request
+    /// never wraps around the end of the ring, and starts on an 8-byte
+    /// boundary; a null size marks the end of the usable part of the ring.
+    /// Responses are written as a plain stream of bytes.
+    ///
+    /// Each side polls briefly, then sleeps on a futex doorbell which the
+    /// other side only rings when a sleeper is registered. Sleeps are bounded
+    /// in order to notice a client which died without closing the segment.
+    ///
+    /// Only supported on Linux.
+    /// </remarks>
+    public class SharedMemorySocket : ISocketLike, IMessageRing
+    {
+        public const uint Magic = 0x53425254; // "TRBS"
+        public const uint Version = 1;
+
+        public const int StateReady = 1;
+        public const int StateAttached = 2;
+        public const int StateClosed = 3;
+
+        private const int MagicOffset = 0;
+        private const int VersionOffset = 4;
+        private const int CapacityOffset = 8;
+        private const int StateOffset = 12;
+        private const int ClientPidOffset = 16;
+        private const int ServerPidOffset = 20;
+
+        private const int RequestRingOffset = 64;
+        private const int ResponseRingOffset = 256;
+        private const int HeaderSizeInBytes = 512;
+
+        // Offsets within a ring control block.
+        private const int TailOffset = 0;
+        private const int HeadOffset = 64;
+        private const int ConsumerWaitingOffset = 128;
+        private const int ProducerWaitingOffset = 132;
+
+        /// <summary> Smallest ring accepted, mirrors the native client. </summary>
+        private const int MinCapacity = 4 * Constants.MaxRequestSize;
+
+        /// <summary> Busy polls of a ring before sleeping on its doorbell. </summary>
+        private const int SpinCount = 4096;
+
+        private const int DoorbellTimeoutMs = 100;
+
+        private readonly MemoryMappedFileSlim _file;
+
+        private readonly int _capacity;
+
+        private readonly int _clientPid;
+
+        /// <summary> Position of the request returned by 'PeekMessage()'. </summary>
+        private long _requestHead;
+
+        /// <summary> Size of the request returned by 'PeekMessage()', zero if none. </summary>
+        private int _requestSize;
+
+        /// <summary> Bytes of the current request already copied by 'Receive()'. </summary>
+        private int _requestReceived;
+
+        private SharedMemorySocket(MemoryMappedFileSlim file, int capacity, int clientPid)
+        {
+            _file = file;
+            _capacity = capacity;
+            _clientPid = clientPid;
+        }
+
+        /// <summary>
+        /// Claims the segment at 'path' if it is ready, and deletes the file,
+        /// the mapping being kept. Returns null if the segment cannot be
+        /// claimed (not initialized yet, already claimed or invalid).
+        /// </summary>
+        public static SharedMemorySocket TryAttach(string path)
+        {
+            MemoryMappedFileSlim file;
+            try
+            {
+                file = new MemoryMappedFileSlim(path);
+            }
+            catch (Exception ex) when (ex is IOException || ex is ArgumentException
+                                       || ex is UnauthorizedAccessException)
+            {
+                // The client may still be sizing the file, or may be gone.
+                return null;
+            }
+
+            if (file.FileLength < HeaderSizeInBytes)
+            {
+                file.Dispose();
+                return null;
+            }
+
+            var header = file.GetSpan(0, HeaderSizeInBytes);
+            var capacity = MemoryMarshal.Cast<byte, int>(header.Slice(CapacityOffset))[0];
+            var clientPid = MemoryMarshal.Cast<byte, int>(header.Slice(ClientPidOffset))[0];
+
+            if (MemoryMarshal.Cast<byte, uint>(header.Slice(MagicOffset))[0] != Magic
+                || MemoryMarshal.Cast<byte, uint>(header.Slice(VersionOffset))[0] != Version
+                || capacity < MinCapacity || (capacity & (capacity - 1)) != 0
+                || file.FileLength != HeaderSizeInBytes + 2L * capacity)
+            {
+                file.Dispose();
+                return null;
+            }
+
+            var socket = new SharedMemorySocket(file, capacity, clientPid);
+
+            socket.Int32At(ServerPidOffset) = MyInterop.Sys.GetPid();
+            if (Interlocked.CompareExchange(ref socket.Int32At(StateOffset), StateAttached, StateReady) != StateReady)
+            {
+                file.Dispose();
+                return null;
+            }
+
+            // The client waits on the state for the claim.
+            socket.FutexWake(StateOffset);
+            File.Delete(path);
+
+            return socket;
+        }
+
+        /// <summary>
+        /// Indicates whether the segment at 'path' was left behind by a
+        /// client which is gone.
+        /// </summary>
+        public static bool IsStale(string path)
+        {
+            try
+            {
+                using (var stream = new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite))
+                {
+                    var header = new byte[HeaderSizeInBytes];
+                    if (stream.Read(header, 0, header.Length) < ServerPidOffset)
+                        return false;
+
+                    var clientPid = BitConverter.ToInt32(header, ClientPidOffset);
+                    return clientPid > 0 && !MyInterop.Sys.IsAlive(clientPid);
+                }
+            }
+            catch (IOException)
+            {
+                return false;
+            }
+        }
+
+        public int Available
+        {
+            get
+            {
+                // Slightly overestimated when the client skipped the end of the ring.
+                var tail = Volatile.Read(ref Int64At(RequestRingOffset + TailOffset));
+                return (int) (tail - _requestHead) - _requestReceived;
+            }
+        }
+
+        public bool Connected => Volatile.Read(ref Int32At(StateOffset)) == StateAttached;
+
+        public Span<byte> PeekMessage()
+        {
+            if (_requestSize > 0)
+                return Requests.Slice((int) (_requestHead & (_capacity - 1)), _requestSize);
+
+            for (;;)
+            {
+                WaitChange(RequestRingOffset + ConsumerWaitingOffset, RequestRingOffset + TailOffset, _requestHead);
+
+                var offset = (int) (_requestHead & (_capacity - 1));
+                var contiguous = _capacity - offset;
+                var size = MemoryMarshal.Cast<byte, int>(Requests.Slice(offset))[0];
+
+                // End of the usable part of the ring, the next request is at its beginning.
+                if (size == 0 || contiguous < MessageHeader.SizeInBytes)
+                {
+                    _requestHead += contiguous;
+                    continue;
+                }
+
+                // An invalid size is reported through the header of the request.
+                if (size < MessageHeader.SizeInBytes || size > contiguous)
+                    size = Math.Min(contiguous, Constants.MaxRequestSize);
+
+                _requestSize = size;
+                return Requests.Slice(offset, size);
+            }
+        }
+
+        public void NextMessage()
+        {
+            _requestHead += (_requestSize + 7) & ~7;
+            _requestSize = 0;
+            _requestReceived = 0;
+
+            Volatile.Write(ref Int64At(RequestRingOffset + HeadOffset), _requestHead);
+            RingDoorbell(RequestRingOffset + ProducerWaitingOffset);
+        }
+
+        public void Receive(Span<byte> bufferIn)
+        {
+            while (!bufferIn.IsEmpty)
+            {
+                var request = PeekMessage();
+
+                var count = Math.Min(bufferIn.Length, request.Length - _requestReceived);
+                request.Slice(_requestReceived, count).CopyTo(bufferIn);
+                bufferIn = bufferIn.Slice(count);
+
+                _requestReceived += count;
+                if (_requestReceived == request.Length)
+                    NextMessage();
+            }
+        }
+
+        public void Send(Span<byte> bufferOut)
+        {
+            var tailPosition = ResponseRingOffset + TailOffset;
+            var headPosition = ResponseRingOffset + HeadOffset;
+
+            var tail = Int64At(tailPosition);
+            while (!bufferOut.IsEmpty)
+            {
+                var head = Volatile.Read(ref Int64At(headPosition));
+                if (tail - head == _capacity)
+                {
+                    WaitChange(ResponseRingOffset + ProducerWaitingOffset, headPosition, head);
+                    continue;
+                }
+
+                // The bytes may wrap around the end of the ring.
+                var offset = (int) (tail & (_capacity - 1));
+                var count = (int) Math.Min(bufferOut.Length,
+                    Math.Min(_capacity - (tail - head), _capacity - offset));
+
+                bufferOut.Slice(0, count).CopyTo(Responses.Slice(offset));
+                bufferOut = bufferOut.Slice(count);
+                tail += count;
+
+                Volatile.Write(ref Int64At(tailPosition), tail);
+                RingDoorbell(ResponseRingOffset + ConsumerWaitingOffset);
+            }
+        }
+
+        /// <remarks>
+        /// The mapping itself is released once the socket is collected, as
+        /// the other thread of the connection may still be blocked on a ring.
+        /// </remarks>
+        public void Close()
+        {
+            Interlocked.Exchange(ref Int32At(StateOffset), StateClosed);
+
+            // Whatever the client waits on, it has to notice the closing.
+            FutexWake(StateOffset);
+            RingDoorbell(RequestRingOffset + ProducerWaitingOffset);
+            RingDoorbell(ResponseRingOffset + ConsumerWaitingOffset);
+
+            // Also wakes the threads of this side.
+            RingDoorbell(RequestRingOffset + ConsumerWaitingOffset);
+            RingDoorbell(ResponseRingOffset + ProducerWaitingOffset);
+        }
+
+        private Span<byte> Requests => _file.GetSpan(HeaderSizeInBytes, _capacity);
+
+        private Span<byte> Responses => _file.GetSpan(HeaderSizeInBytes + (long) _capacity, _capacity);
+
+        private ref int Int32At(int offset) =>
+            ref MemoryMarshal.Cast<byte, int>(_file.GetSpan(offset, sizeof(int)))[0];
+
+        private ref long Int64At(int offset) =>
+            ref MemoryMarshal.Cast<byte, long>(_file.GetSpan(offset, sizeof(long)))[0];
+
+        /// <summary>
+        /// Blocks while the position at 'positionOffset', written by the
+        /// client, keeps the value 'observed'.
+        /// </summary>
+        private void WaitChange(int waitingOffset, int positionOffset, long observed)
+        {
+            ref var position = ref Int64At(positionOffset);
+            for (var spin = 0; spin < SpinCount; spin++)
+            {
+                if (Volatile.Read(ref position) != observed)
+                    return;
+            }
+
+            ref var waiting = ref Int32At(waitingOffset);
+            for (;;)
+            {
+                if (!Connected)
+                    throw new SocketException((int) SocketError.ConnectionReset);
+
+                // The client checks the doorbell after moving the position,
+                // hence the position is checked again once the doorbell is set.
+                Interlocked.Exchange(ref waiting, 1);
+                if (Interlocked.Read(ref position) != observed)
+                {
+                    Volatile.Write(ref waiting, 0);
+                    return;
+                }
+
+                FutexWait(waitingOffset, 1, DoorbellTimeoutMs);
+
+                if (Volatile.Read(ref position) != observed)
+                    return;
+
+                if (!MyInterop.Sys.IsAlive(_clientPid))
+                    throw new SocketException((int) SocketError.ConnectionReset);
+            }
+        }
+
+        /// <summary> Wakes the client if it sleeps on the doorbell. </summary>
+        private void RingDoorbell(int waitingOffset)
+        {
+            if (Interlocked.Exchange(ref Int32At(waitingOffset), 0) != 0)
+                FutexWake(waitingOffset);
+        }
+
+        private unsafe void FutexWait(int offset, int expected, int timeoutMs)
+        {
+            var timeout = new MyInterop.Sys.Timespec
+            {
+                Seconds = timeoutMs / 1000,
+                Nanoseconds = (timeoutMs % 1000) * 1000000L
+            };
+
+            fixed (int* word = &Int32At(offset))
+            {
+                MyInterop.Sys.Futex(word, MyInterop.Sys.FutexWait, expected, &timeout);
+            }
+        }
+
+        private unsafe void FutexWake(int offset)
+        {
+            fixed (int* word = &Int32At(offset))
+            {
+                MyInterop.Sys.Futex(word, MyInterop.Sys.FutexWake, int.MaxValue, null);
+            }
+        }
+
+        /// <summary> Interop helper. </summary>
+        internal static class MyInterop
+        {
+            /// <summary> Linux </summary>
+            internal static unsafe class Sys
+            {
+                internal const int FutexWait = 0;
+                internal const int FutexWake = 1;
+
+                private const int ESRCH = 3;
+
+                [StructLayout(LayoutKind.Sequential)]
+                internal struct Timespec
+                {
+                    public long Seconds;
+                    public long Nanoseconds;
+                }
+
+                // See https://man7.org/linux/man-pages/man2/futex.2.html
+                [DllImport("libc", EntryPoint = "syscall", SetLastError = true)]
+                private static extern long Syscall(long number, int* address, int operation, int value,
+                    Timespec* timeout, IntPtr address2, int value3);
+
+                [DllImport("libc", EntryPoint = "getpid")]
+                internal static extern int GetPid();
+
+                [DllImport("libc", EntryPoint = "kill", SetLastError = true)]
+                private static extern int Kill(int pid, int signal);
+
+                /// <summary> Number of the 'futex' system call, which differs across architectures. </summary>
+                private static long FutexSyscall =>
+                    RuntimeInformation.ProcessArchitecture == Architecture.Arm64 ? 98 : 202;
+
+                internal static void Futex(int* word, int operation, int value, Timespec* timeout)
+                {
+                    Syscall(FutexSyscall, word, operation, value, timeout, IntPtr.Zero, 0);
+                }
+
+                /// <summary> Signal 0 only checks the existence of the process. </summary>
+                internal static bool IsAlive(int pid)
+                {
+                    return Kill(pid, 0) == 0 || Marshal.GetLastWin32Error() != ESRCH;
+                }
+            }
+        }
+    }
+}
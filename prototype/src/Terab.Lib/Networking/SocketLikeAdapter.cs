@@ -15,7 +15,9 @@ public SocketLikeAdapter(Socket s)
             _socket = s;
 
             // Socket delays can cause very large overhead for an app like Terab, bandwidth is a non-issue.
-            _socket.NoDelay = true;
+            // Unix domain sockets have no such delays, and do not support the option.
+            if (_socket.AddressFamily != AddressFamily.Unix)
+                _socket.NoDelay = true;
 
             _socket.SendTimeout = Constants.SocketSendTimeoutMs;
             _socket.SendBufferSize = Constants.SocketSendBufferSize;
@@ -17,6 +17,8 @@ namespace Terab.Lib
     ///     <layer1Path>/path/to/dir</layer1Path>
     ///     <layer2Path>/path/to/dir</layer2Path>
     ///     <layer3Path>/path/to/dir</layer3Path>
+    ///     <unixSocketPath>/path/to/terab.sock</unixSocketPath>
+    ///     <sharedMemoryPath>/dev/shm/terab</sharedMemoryPath>
     /// </TerabConfig>
     ///
     /// None of the fields is obligatory, however their order has to be as above.
@@ -45,6 +47,18 @@ public class TerabConfig
         [DataMember(Name = "layer3Path", IsRequired = false, Order = 6)]
         public string Layer3Path { get; set; } = string.Empty;
 
+        /// <summary> Can be omitted. If present, clients running on the
+        /// same host can also connect through a Unix domain socket created
+        /// at this path, in addition to TCP. </summary>
+        [DataMember(Name = "unixSocketPath", IsRequired = false, Order = 7)]
+        public string UnixSocketPath { get; set; } = string.Empty;
+
+        /// <summary> Can be omitted. If present, clients running on the
+        /// same host can also connect through shared-memory segments created
+        /// in this directory. Linux only. </summary>
+        [DataMember(Name = "sharedMemoryPath", IsRequired = false, Order = 8)]
+        public string SharedMemoryPath { get; set; } = string.Empty;
+
     }
 
     public static class TerabConfigReader
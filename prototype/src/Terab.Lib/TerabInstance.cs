@@ -22,6 +22,14 @@ public class TerabInstance
 
         public int Port { get; set; }
 
+        /// <summary> If not null, clients can also connect through a
+        /// Unix domain socket created at this path. </summary>
+        public string UnixSocketPath { get; set; }
+
+        /// <summary> If not null, clients on the same host can create
+        /// shared-memory segments in this directory. </summary>
+        public string SharedMemoryPath { get; set; }
+
         public IChainStore ChainStore { get; set; }
 
         public ICoinStore[] CoinStores { get; set; }
@@ -36,6 +44,12 @@ public class TerabInstance
 
         public Listener Listener { get; set; }
 
+        /// <summary> Null unless 'UnixSocketPath' is set. </summary>
+        public Listener UnixListener { get; set; }
+
+        /// <summary> Null unless 'SharedMemoryPath' is set. </summary>
+        public SharedMemoryListener SharedMemoryListener { get; set; }
+
         private bool _running;
 
         private CancellationTokenSource _cancelSource;
@@ -44,6 +58,8 @@ public class TerabInstance
         private Thread[] _coinThreads;
         private Thread _dispatchThread;
         private Thread _listenerThread;
+        private Thread _unixListenerThread;
+        private Thread _sharedMemoryListenerThread;
 
         /// <summary>
         /// Creates all the files with their pre-allocated sizes.
@@ -188,6 +204,12 @@ public void SetupNetwork(TerabConfig config)
         {
             IpAddress = IPAddress.Parse(config.IpAddress);
             Port = config.Port;
+
+            if (!string.IsNullOrEmpty(config.UnixSocketPath))
+                UnixSocketPath = config.UnixSocketPath;
+
+            if (!string.IsNullOrEmpty(config.SharedMemoryPath))
+                SharedMemoryPath = config.SharedMemoryPath;
         }
 
         public void SetupStores(TerabConfig config)
@@ -288,6 +310,18 @@ public void SetupControllers()
             // Zero port can be re-associated to an available port.
             Port = Listener.Port; 
 
+            if (UnixSocketPath != null)
+                UnixListener = new Listener(
+                    dispatchInbox,
+                    UnixSocketPath,
+                    _log);
+
+            if (SharedMemoryPath != null)
+                SharedMemoryListener = new SharedMemoryListener(
+                    dispatchInbox,
+                    SharedMemoryPath,
+                    _log);
+
             DispatchController = new DispatchController(
                 dispatchInbox,
                 chainInbox,
@@ -319,6 +353,10 @@ public void SetupControllers()
 
             // == Bind controllers ==
             Listener.OnConnectionAccepted = conn => { DispatchController.AddConnection(conn); };
+            if (UnixListener != null)
+                UnixListener.OnConnectionAccepted = conn => { DispatchController.AddConnection(conn); };
+            if (SharedMemoryListener != null)
+                SharedMemoryListener.OnConnectionAccepted = conn => { DispatchController.AddConnection(conn); };
 
             foreach (var cc in CoinControllers)
                 cc.OnRequestHandled = () => { DispatchController.Wake(); };
@@ -363,11 +401,21 @@ public void Start()
             _listenerThread = new Thread(() => Listener.Loop(cancel))
                 { Name = "Listener", IsBackground = true };
 
+            if (UnixListener != null)
+                _unixListenerThread = new Thread(() => UnixListener.Loop(cancel))
+                    { Name = "UnixListener", IsBackground = true };
+
+            if (SharedMemoryListener != null)
+                _sharedMemoryListenerThread = new Thread(() => SharedMemoryListener.Loop(cancel))
+                    { Name = "SharedMemoryListener", IsBackground = true };
+
             _chainThread.Start();
             foreach (var t in _coinThreads)
                 t.Start();
             _dispatchThread.Start();
             _listenerThread.Start();
+            _unixListenerThread?.Start();
+            _sharedMemoryListenerThread?.Start();
         }
 
         public void Stop()
@@ -385,6 +433,8 @@ public void Stop()
                 t.Join();
             _dispatchThread.Join();
             _listenerThread.Join();
+            _unixListenerThread?.Join();
+            _sharedMemoryListenerThread?.Join();
 
             _running = false;
         }
@@ -1,5 +1,7 @@
 ﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
 using System.Buffers.Binary;
+using System.Collections.Generic;
 using System.Runtime.InteropServices;
 using Terab.Lib.Chains;
 using Terab.Lib.Messaging;
@@ -14,6 +16,8 @@ public class ApiIntegrationTests
         private const int ShardCount = 4;
 
         private DispatchController _dispatcher;
+        private BoundedInbox _dispatchInbox;
+        private BoundedInbox[] _coinInboxes;
         private ConnectionController _clientConn;
         private ChainController _chainController;
         private IChainStore _store;
@@ -32,6 +36,8 @@ public void Setup()
             var coinInboxes = new BoundedInbox[ShardCount];
             for (var i = 0; i < coinInboxes.Length; i++)
                 coinInboxes[i] = new BoundedInbox();
+            _dispatchInbox = dispatchInbox;
+            _coinInboxes = coinInboxes;
 
             _dispatcher = new DispatchController(
                 dispatchInbox,
@@ -63,6 +69,263 @@ public void Setup()
             _c0 = new ClientId(0);
         }
 
+        /// <summary> Sets up the socket to deliver the request, header first. </summary>
+        private void ExpectRequest(byte[] request)
+        {
+            _socket.ExpectReceive(data =>
+            {
+                new Span<byte>(request, 0, MessageHeader.SizeInBytes).CopyTo(data);
+                return MessageHeader.SizeInBytes;
+            });
+
+            _socket.ExpectReceive(data =>
+            {
+                new Span<byte>(request, MessageHeader.SizeInBytes, request.Length - MessageHeader.SizeInBytes)
+                    .CopyTo(data);
+                return data.Length;
+            });
+        }
+
+        /// <summary>
+        /// A full window of requests split over the shards exceeds the
+        /// inboxes of the coin controllers: the parts wait for room rather
+        /// than failing the connection.
+        /// </summary>
+        [Fact]
+        public unsafe void terab_utxo_get_coins_full_window()
+        {
+            Setup();
+
+            // 'IdentityHash' spreads consecutive first bytes over the shards.
+            var itemCount = (Constants.MaxRequestSize - 1 - GetCoinsRequest.HeaderSizeInBytes)
+                            / GetCoinsRequest.Item.SizeInBytes;
+            var outpoints = new Outpoint[itemCount];
+            for (var i = 0; i < outpoints.Length; i++)
+                outpoints[i].TxId[0] = (byte) i;
+
+            for (var r = 0; r < Constants.ConnectionWindow; r++)
+            {
+                var request = GetCoinsRequest.From(new RequestId((uint) r + 1), _c0, outpoints,
+                    new BlockAlias(0, 0), _handleMask);
+
+                ExpectRequest(request.Span.ToArray());
+                _socket.ExpectConnected(() => true);
+
+                Assert.True(_clientConn.HandleRequest());
+                Assert.True(_dispatcher.HandleRequest());
+            }
+
+            // Nothing answered, the connection is not failed.
+            Assert.False(_clientConn.HandleResponse());
+            Assert.False(_dispatcher.HandleParked());
+
+            var received = 0;
+            do
+            {
+                foreach (var inbox in _coinInboxes)
+                {
+                    while (inbox.CanPeek)
+                    {
+                        var part = new GetCoinsRequest(inbox.Peek().Span, _handleMask);
+                        Assert.Equal(itemCount, part.TotalCount);
+                        received += part.Count;
+                        inbox.Next();
+                    }
+                }
+            } while (_dispatcher.HandleParked());
+
+            Assert.Equal(Constants.ConnectionWindow * itemCount, received);
+
+            _socket.ExpectAllDone();
+        }
+
+        /// <summary>
+        /// Sends a GetCoins request spread over all the shards, answers its
+        /// parts in place of the coin controllers with coins carrying a
+        /// script of 'scriptLength' bytes, and returns the counts of the
+        /// 'frameCount' responses the client receives.
+        /// </summary>
+        private unsafe List<int> GetCoinsMerged(int scriptLength, int frameCount)
+        {
+            Setup();
+
+            var outpoints = new Outpoint[ShardCount];
+            for (var i = 0; i < outpoints.Length; i++)
+                outpoints[i].TxId[0] = (byte) i;
+
+            var request = GetCoinsRequest.From(_r1, _c0, outpoints, new BlockAlias(0, 0), _handleMask);
+            ExpectRequest(request.Span.ToArray());
+            _socket.ExpectConnected(() => true);
+
+            Assert.True(_clientConn.HandleRequest());
+            Assert.True(_dispatcher.HandleRequest());
+
+            var script = new byte[scriptLength];
+            var buffer = new byte[Constants.MaxResponseSize];
+            foreach (var inbox in _coinInboxes)
+            {
+                while (inbox.CanPeek)
+                {
+                    var part = new GetCoinsRequest(inbox.Peek().Span, _handleMask);
+                    var response = new GetCoinsResponse(buffer, part.MessageHeader.RequestId,
+                        part.MessageHeader.ClientId, part.TotalCount);
+
+                    foreach (var item in part.Items)
+                    {
+                        Assert.True(response.TryAppend(item.Index, GetCoinStatus.Success, default,
+                            default, default, 1, 0, script));
+                    }
+
+                    Assert.True(_dispatchInbox.TryWrite(response.Span));
+                    inbox.Next();
+
+                    _socket.ExpectConnected(() => true);
+                    Assert.True(_dispatcher.HandleRequest());
+                }
+            }
+
+            var counts = new List<int>();
+            for (var f = 0; f < frameCount; f++)
+            {
+                _socket.ExpectSend(data =>
+                {
+                    var frame = new GetCoinsResponse(data);
+                    Assert.Equal(data.Length, frame.MessageHeader.MessageSizeInBytes);
+                    Assert.Equal(_r1, frame.MessageHeader.RequestId);
+                    Assert.Equal(ShardCount, frame.TotalCount);
+
+                    var offset = 0;
+                    for (var i = 0; i < frame.Count; i++)
+                        frame.ReadItem(ref offset, out _);
+                    Assert.Equal(frame.Items.Length, offset);
+
+                    counts.Add(frame.Count);
+                    return data.Length;
+                });
+            }
+
+            while (_clientConn.HandleResponse())
+            { }
+
+            _socket.ExpectAllDone();
+            return counts;
+        }
+
+        /// <summary> The parts of a response are merged into a single frame. </summary>
+        [Fact]
+        public void terab_utxo_get_coins_merged()
+        {
+            var counts = GetCoinsMerged(16, 1);
+            Assert.Equal(1, counts.Count);
+            Assert.Equal(ShardCount, counts[0]);
+        }
+
+        /// <summary>
+        /// The parts which do not fit in a frame are sent in the next one,
+        /// the client counting the items up to the total.
+        /// </summary>
+        [Fact]
+        public void terab_utxo_get_coins_merged_overflow()
+        {
+            // Two items per frame.
+            var counts = GetCoinsMerged(Constants.MaxResponseSize / 3, 2);
+            Assert.Equal(2, counts.Count);
+            Assert.Equal(2, counts[0]);
+            Assert.Equal(2, counts[1]);
+        }
+
+        /// <summary>
+        /// The failures of the WriteCoins requests are collected by the
+        /// connection, reported by the next SyncCoins, then forgotten.
+        /// </summary>
+        [Fact]
+        public unsafe void terab_utxo_write_coins_then_sync()
+        {
+            Setup();
+
+            var outpoint = new Outpoint();
+            var write = ChangeCoinsRequest.From(_r1, _c0, new BlockAlias(0, 0), _handleMask);
+            write.MessageHeader.MessageKind = MessageKind.WriteCoins;
+            for (var i = 0; i < ShardCount; i++)
+            {
+                outpoint.TxId[0] = (byte) i;
+                write.Append((uint) i, CoinOperation.Consume, 0, outpoint);
+            }
+
+            ExpectRequest(write.Span.ToArray());
+            _socket.ExpectConnected(() => true);
+
+            Assert.True(_clientConn.HandleRequest());
+            Assert.True(_dispatcher.HandleRequest());
+
+            // Answers in place of the coin controllers, the item 2 failing.
+            var pool = new SpanPool<byte>(Constants.MaxResponseSize);
+            foreach (var inbox in _coinInboxes)
+            {
+                while (inbox.CanPeek)
+                {
+                    var part = new ChangeCoinsRequest(inbox.Peek().Span, _handleMask);
+                    var response = new ChangeCoinsResponse(part.MessageHeader.RequestId,
+                        part.MessageHeader.ClientId, part.Count, part.TotalCount, pool);
+                    response.MessageHeader.MessageKind = MessageKind.WriteCoinsResponse;
+
+                    var offset = 0;
+                    for (var i = 0; i < part.Count; i++)
+                    {
+                        var index = part.ItemAt(offset).Index;
+                        response.Items[i].Index = index;
+                        response.Items[i].Status = index == 2
+                            ? ChangeCoinStatus.OutpointNotFound
+                            : ChangeCoinStatus.Success;
+                        offset += part.ItemSizeAt(offset);
+                    }
+
+                    Assert.True(_dispatchInbox.TryWrite(response.Span));
+                    pool.Reset();
+                    inbox.Next();
+
+                    _socket.ExpectConnected(() => true);
+                    Assert.True(_dispatcher.HandleRequest());
+                }
+            }
+
+            // Acknowledged by the connection, nothing for the client.
+            Assert.False(_clientConn.HandleResponse());
+
+            var failures = new[] {1, 0};
+            for (var r = 0; r < failures.Length; r++)
+            {
+                var sync = new byte[MessageHeader.SizeInBytes + sizeof(uint)];
+                var header = new MessageHeader(sync.Length, new RequestId((uint) r + 2), _c0,
+                    MessageKind.SyncCoins);
+                MemoryMarshal.Write(sync, ref header);
+
+                ExpectRequest(sync);
+
+                var expected = failures[r];
+                _socket.ExpectSend(data =>
+                {
+                    var response = new ChangeCoinsResponse(data);
+                    Assert.Equal(MessageKind.SyncCoinsResponse, response.MessageHeader.MessageKind);
+                    Assert.Equal(expected, response.Count);
+                    Assert.Equal(expected, response.TotalCount);
+                    if (expected > 0)
+                    {
+                        Assert.Equal(2u, response.Items[0].Index);
+                        Assert.Equal(ChangeCoinStatus.OutpointNotFound, response.Items[0].Status);
+                    }
+
+                    return data.Length;
+                });
+
+                // Answered by the connection itself.
+                Assert.False(_clientConn.HandleRequest());
+                Assert.True(_clientConn.HandleResponse());
+            }
+
+            _socket.ExpectAllDone();
+        }
+
         [Fact]
         public void terab_utxo_get_committed_block()
         {
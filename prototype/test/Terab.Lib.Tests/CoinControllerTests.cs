@@ -2,6 +2,7 @@
 using System;
 using System.Buffers.Binary;
 using System.Collections.Generic;
+using System.Security.Cryptography;
 using Moq;
 using Terab.Lib.Chains;
 using Terab.Lib.Coins;
@@ -106,6 +107,293 @@ public void ReadExistingCoin()
             Assert.True(coin.Payload.Script.SequenceEqual(response.Script));
         }
 
+        [Fact]
+        public void ReadCoins()
+        {
+            var sozu = new VolatileCoinStore();
+
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, sozu, _hash);
+
+            var coin = GetCoin(_rand);
+            var missing = GetCoin(_rand);
+
+            sozu.AddProduction(
+                _hash.Hash(ref coin.Outpoint),
+                ref coin.Outpoint,
+                false, coin.Payload,
+                new BlockAlias(3),
+                null);
+
+            var clientId = new ClientId();
+            var reqId = new RequestId(1);
+            var context = new BlockAlias(3);
+
+            var readCoinsRequest = GetCoinsRequest.From(reqId, clientId,
+                new[] {coin.Outpoint, missing.Outpoint}, context, clientId.Mask);
+            readCoinsRequest.TotalCount = readCoinsRequest.Count;
+
+            inbox.TryWrite(readCoinsRequest.Span);
+            controller.HandleRequest();
+
+            var raw = outbox.Peek();
+            var response = new GetCoinsResponse(raw.Span);
+            Assert.Equal(response.MessageHeader.MessageSizeInBytes, raw.Length);
+
+            Assert.Equal(reqId, response.MessageHeader.RequestId);
+            Assert.Equal(MessageKind.GetCoinsResponse, response.MessageHeader.MessageKind);
+            Assert.Equal(2, response.Count);
+            Assert.Equal(2, response.TotalCount);
+
+            var offset = 0;
+            ref var found = ref response.ReadItem(ref offset, out var script);
+            Assert.Equal(0u, found.Index);
+            Assert.Equal(GetCoinStatus.Success, found.Status);
+            Assert.Equal(context, found.Production.ConvertToBlockAlias(clientId.Mask));
+            Assert.Equal(coin.Payload.Satoshis, found.Satoshis);
+            Assert.True(coin.Payload.Script.SequenceEqual(script));
+
+            ref var notFound = ref response.ReadItem(ref offset, out script);
+            Assert.Equal(1u, notFound.Index);
+            Assert.Equal(GetCoinStatus.OutpointNotFound, notFound.Status);
+            Assert.Equal(0, script.Length);
+        }
+
+        [Fact]
+        public void ReadCoinEvents()
+        {
+            var sozu = new VolatileCoinStore();
+
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, sozu, _hash);
+
+            var coin = GetCoin(_rand);
+
+            sozu.AddProduction(
+                _hash.Hash(ref coin.Outpoint),
+                ref coin.Outpoint,
+                false, coin.Payload,
+                new BlockAlias(3),
+                null);
+
+            var clientId = new ClientId();
+            var context = new BlockAlias(3);
+
+            var request = GetCoinsRequest.From(new RequestId(1), clientId,
+                new[] {coin.Outpoint}, context, clientId.Mask, CoinProjection.Events);
+            request.TotalCount = request.Count;
+
+            inbox.TryWrite(request.Span);
+            controller.HandleRequest();
+
+            var response = new GetCoinsResponse(outbox.Peek().Span);
+            Assert.Equal(1, response.Count);
+
+            var offset = 0;
+            ref var found = ref response.ReadItem(ref offset, out var script);
+            Assert.Equal(GetCoinStatus.Success, found.Status);
+            Assert.Equal(context, found.Production.ConvertToBlockAlias(clientId.Mask));
+            Assert.Equal(0ul, found.Satoshis);
+            Assert.Equal(0, script.Length);
+        }
+
+        [Fact]
+        public void ReadCoinScriptHash()
+        {
+            var sozu = new VolatileCoinStore();
+
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, sozu, _hash);
+
+            var coin = GetCoin(_rand);
+
+            sozu.AddProduction(
+                _hash.Hash(ref coin.Outpoint),
+                ref coin.Outpoint,
+                false, coin.Payload,
+                new BlockAlias(3),
+                null);
+
+            var clientId = new ClientId();
+            var context = new BlockAlias(3);
+
+            var request = GetCoinsRequest.From(new RequestId(1), clientId,
+                new[] {coin.Outpoint}, context, clientId.Mask, CoinProjection.ScriptHash);
+            request.TotalCount = request.Count;
+            Assert.True(request.IsWellFormed);
+
+            inbox.TryWrite(request.Span);
+            controller.HandleRequest();
+
+            var response = new GetCoinsResponse(outbox.Peek().Span);
+            Assert.Equal(1, response.Count);
+
+            var offset = 0;
+            ref var found = ref response.ReadItem(ref offset, out var script);
+            Assert.Equal(GetCoinStatus.Success, found.Status);
+            Assert.Equal(coin.Payload.Satoshis, found.Satoshis);
+
+            using (var sha = SHA256.Create())
+                Assert.True(sha.ComputeHash(coin.Payload.Script.ToArray()).AsSpan().SequenceEqual(script));
+        }
+
+        [Fact]
+        public void ReadCoinExistence()
+        {
+            var sozu = new VolatileCoinStore();
+
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, sozu, _hash);
+
+            var coin = GetCoin(_rand);
+            var spent = GetCoin(_rand);
+            var missing = GetCoin(_rand);
+
+            sozu.AddProduction(
+                _hash.Hash(ref coin.Outpoint),
+                ref coin.Outpoint,
+                false, coin.Payload,
+                new BlockAlias(3),
+                null);
+
+            sozu.AddProduction(
+                _hash.Hash(ref spent.Outpoint),
+                ref spent.Outpoint,
+                false, spent.Payload,
+                new BlockAlias(3),
+                null);
+
+            sozu.AddConsumption(
+                _hash.Hash(ref spent.Outpoint),
+                ref spent.Outpoint,
+                new BlockAlias(3),
+                null);
+
+            var clientId = new ClientId();
+            var context = new BlockAlias(3);
+
+            var request = GetCoinsRequest.From(new RequestId(1), clientId,
+                new[] {coin.Outpoint, spent.Outpoint, missing.Outpoint}, context, clientId.Mask, CoinProjection.Existence);
+            request.TotalCount = request.Count;
+            Assert.True(request.IsWellFormed);
+
+            inbox.TryWrite(request.Span);
+            controller.HandleRequest();
+
+            var response = new GetCoinsResponse(outbox.Peek().Span);
+            Assert.Equal(3, response.Count);
+
+            var offset = 0;
+            ref var found = ref response.ReadItem(ref offset, out var script);
+            Assert.Equal(GetCoinStatus.Unspent, found.Status);
+            Assert.Equal(0ul, found.Satoshis);
+            Assert.Equal(0, script.Length);
+
+            ref var consumed = ref response.ReadItem(ref offset, out script);
+            Assert.Equal(GetCoinStatus.Spent, consumed.Status);
+
+            ref var notFound = ref response.ReadItem(ref offset, out script);
+            Assert.Equal(GetCoinStatus.OutpointNotFound, notFound.Status);
+        }
+
+        [Fact]
+        public void PrefetchCoinsNotAnswered()
+        {
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, new VolatileCoinStore(), _hash);
+
+            var clientId = new ClientId();
+            var request = GetCoinsRequest.From(new RequestId(1), clientId,
+                new[] {GetCoin(_rand).Outpoint}, new BlockAlias(3), clientId.Mask);
+            request.MessageHeader.MessageKind = MessageKind.PrefetchCoins;
+
+            inbox.TryWrite(request.Span);
+            Assert.True(controller.HandleRequest());
+
+            Assert.False(inbox.CanPeek);
+            Assert.False(outbox.CanPeek);
+        }
+
+        [Fact]
+        public void ChangeCoins()
+        {
+            var sozu = new VolatileCoinStore();
+
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, sozu, _hash);
+            controller.Lineage = new MockLineage();
+
+            var clientId = new ClientId();
+            var reqId = new RequestId(1);
+
+            var produced = GetCoin(_rand);
+            var consumed = GetCoin(_rand);
+
+            sozu.AddProduction(
+                _hash.Hash(ref consumed.Outpoint),
+                ref consumed.Outpoint,
+                false, consumed.Payload,
+                new BlockAlias(2),
+                null);
+
+            var changeCoinsRequest = ChangeCoinsRequest.From(reqId, clientId,
+                new BlockHandle(2).ConvertToBlockAlias(clientId.Mask), clientId.Mask);
+            changeCoinsRequest.AppendProduction(0, OutpointFlags.None, produced.Outpoint,
+                100, 50, produced.Payload.Script);
+            changeCoinsRequest.Append(1, CoinOperation.Consume, 0, consumed.Outpoint);
+            changeCoinsRequest.TotalCount = changeCoinsRequest.Count;
+            Assert.True(changeCoinsRequest.IsWellFormed);
+
+            inbox.TryWrite(changeCoinsRequest.Span);
+            controller.HandleRequest();
+
+            var raw = outbox.Peek();
+            var response = new ChangeCoinsResponse(raw.Span);
+            Assert.Equal(response.MessageHeader.MessageSizeInBytes, raw.Length);
+
+            Assert.Equal(reqId, response.MessageHeader.RequestId);
+            Assert.Equal(MessageKind.ChangeCoinsResponse, response.MessageHeader.MessageKind);
+            Assert.Equal(2, response.Count);
+            Assert.Equal(0u, response.Items[0].Index);
+            Assert.Equal(ChangeCoinStatus.Success, response.Items[0].Status);
+            Assert.Equal(1u, response.Items[1].Index);
+            Assert.Equal(ChangeCoinStatus.Success, response.Items[1].Status);
+        }
+
+        [Fact]
+        public void WriteCoinsAnsweredToConnection()
+        {
+            var inbox = new BoundedInbox();
+            var outbox = new BoundedInbox();
+            var controller = new CoinController(inbox, outbox, new VolatileCoinStore(), _hash);
+            controller.Lineage = new MockLineage();
+
+            var clientId = new ClientId();
+            var missing = GetCoin(_rand);
+
+            var request = ChangeCoinsRequest.From(new RequestId(1), clientId,
+                new BlockHandle(2).ConvertToBlockAlias(clientId.Mask), clientId.Mask);
+            request.Append(7, CoinOperation.Consume, 0, missing.Outpoint);
+            request.TotalCount = request.Count;
+            request.MessageHeader.MessageKind = MessageKind.WriteCoins;
+
+            inbox.TryWrite(request.Span);
+            controller.HandleRequest();
+
+            // Same items as for 'ChangeCoins', the connection keeping the failures.
+            var response = new ChangeCoinsResponse(outbox.Peek().Span);
+            Assert.Equal(MessageKind.WriteCoinsResponse, response.MessageHeader.MessageKind);
+            Assert.Equal(1, response.Count);
+            Assert.Equal(7u, response.Items[0].Index);
+            Assert.Equal(ChangeCoinStatus.OutpointNotFound, response.Items[0].Status);
+        }
+
         private ILineage MakeLineage()
         {
             var blockId1 = CommittedBlockId.ReadFromHex("0000000000000000000000000000000000000000000000000000000000AAA333");
@@ -2,6 +2,7 @@
 using System;
 using System.Buffers.Binary;
 using System.Linq;
+using Terab.Lib.Chains;
 using Terab.Lib.Messaging;
 using Terab.Lib.Messaging.Protocol;
 using Terab.Lib.Tests.Mock;
@@ -167,6 +168,49 @@ public void FillChainControllerInbox()
             socket2.ExpectAllDone();
         }
 
+        [Fact]
+        public unsafe void SplitGetCoinsPerShard()
+        {
+            var socket = new MockSocket();
+            var dispatcherInbox = new BoundedInbox();
+            var coinBoxes = new[] {new BoundedInbox(), new BoundedInbox()};
+            var client = new ConnectionController(dispatcherInbox, socket, ClientId.Next());
+            client.OnRequestReceived = () => { };
+
+            var dispatcher = new DispatchController(dispatcherInbox, new BoundedInbox(), coinBoxes,
+                new IdentityHash());
+            for (var i = 0; i < dispatcher.OnCoinMessageDispatched.Length; i++)
+                dispatcher.OnCoinMessageDispatched[i] = () => { };
+            dispatcher.OnConnectionAccepted = (_) => { };
+            dispatcher.AddConnection(client);
+            dispatcher.HandleNewConnection();
+
+            // 'IdentityHash' sends even and odd first bytes to distinct shards
+            var outpoints = new Outpoint[3];
+            for (var i = 0; i < outpoints.Length; i++)
+                outpoints[i].TxId[0] = (byte) i;
+
+            var request = GetCoinsRequest.From(new RequestId(1), client.ClientId, outpoints,
+                new BlockAlias(3), client.ClientId.Mask);
+
+            socket.ExpectConnected(() => true);
+            Assert.True(dispatcherInbox.TryWrite(request.Span));
+            dispatcher.HandleRequest();
+
+            var even = new GetCoinsRequest(coinBoxes[0].Peek().Span, client.ClientId.Mask);
+            Assert.Equal(MessageKind.GetCoins, even.MessageHeader.MessageKind);
+            Assert.Equal(2, even.Count);
+            Assert.Equal(3, even.TotalCount);
+            Assert.Equal(0u, even.Items[0].Index);
+            Assert.Equal(2u, even.Items[1].Index);
+
+            var odd = new GetCoinsRequest(coinBoxes[1].Peek().Span, client.ClientId.Mask);
+            Assert.Equal(1, odd.Count);
+            Assert.Equal(3, odd.TotalCount);
+            Assert.Equal(1u, odd.Items[0].Index);
+            Assert.Equal(outpoints[1], odd.Items[0].Outpoint);
+        }
+
         /// <summary>
         /// Test <see cref="ConnectionController"/> OutboundBuffer overflows
         /// and cause a connection close.
@@ -113,6 +113,22 @@ public void Read()
             
         }
 
+        [Fact]
+        public void Prefetch()
+        {
+            int position = 4096 * 12 + 100; // not aligned on a page
+
+            using (var mapping = _fixture.GetMemoryMappedFileSlim())
+            {
+                _testArray.CopyTo(mapping.GetSpan(position, _testArray.Length));
+
+                mapping.Prefetch(position, 3 * 4096);
+                Assert.True(mapping.GetSpan(position, _testArray.Length).SequenceEqual(_testArray.AsSpan()));
+
+                Assert.Throws<ArgumentOutOfRangeException>(() => mapping.Prefetch(_fixture.Length - 10, 20));
+            }
+        }
+
         /// <summary>
         /// This test asserts that the movable pointer is at correct place in
         /// and _remaining length is correct.
@@ -0,0 +1,189 @@
+﻿// Copyright Lokad 2018 under MIT BCH.
+using System;
+using Terab.Lib.Messaging;
+using Terab.Lib.Messaging.Protocol;
+using Xunit;
+
+namespace Terab.Lib.Tests.Messaging
+{
+    public unsafe class CompactCoinsTests
+    {
+        private static readonly int[] Txids = new int[Constants.MaxRequestSize / GetCoinsRequest.Item.SizeInBytes];
+
+        /// <summary> Header of a compact request, followed by the first index. </summary>
+        private static int WriteHeader(Span<byte> buffer, MessageKind kind, int count, uint firstIndex)
+        {
+            var header = new GetCoinsRequest(buffer, new RequestId(7), new ClientId(3),
+                new BlockHandle(5), count, 0);
+            header.MessageHeader.MessageKind = kind;
+
+            // Only the 'GetCoinsRequest' header ends with the projection.
+            var headerSize = kind == MessageKind.GetCoins
+                ? GetCoinsRequest.HeaderSizeInBytes
+                : ChangeCoinsRequest.HeaderSizeInBytes;
+            return headerSize + VarInt.Write(buffer.Slice(headerSize), firstIndex);
+        }
+
+        private static void SetSize(Span<byte> buffer, int length)
+        {
+            new Message(buffer).Header.MessageSizeInBytes = length;
+        }
+
+        [Fact]
+        public void VarIntRoundTrip()
+        {
+            var buffer = new byte[VarInt.MaxSizeInBytes];
+            foreach (var value in new[] {0UL, 127UL, 128UL, 300UL, uint.MaxValue, ulong.MaxValue})
+            {
+                var length = VarInt.Write(buffer, value);
+                var offset = 0;
+                Assert.True(VarInt.TryRead(buffer, ref offset, out var read));
+                Assert.Equal(value, read);
+                Assert.Equal(length, offset);
+            }
+
+            var truncated = 0;
+            Assert.False(VarInt.TryRead(new byte[] {0x80, 0x80}, ref truncated, out _));
+        }
+
+        [Fact]
+        public void ExpandGetCoinsWithTxidReferences()
+        {
+            var compact = new byte[256];
+            var length = WriteHeader(compact, MessageKind.GetCoins, 3, 1000);
+
+            // Literal txid, then twice the same txid by reference.
+            compact[length++] = 0;
+            for (var i = 0; i < 32; i++)
+                compact[length++] = (byte) i;
+            compact[length++] = 0; // output 0
+            compact[length++] = 1;
+            length += VarInt.Write(new Span<byte>(compact, length, 5), 300);
+            compact[length++] = 1;
+            compact[length++] = 2;
+            SetSize(compact, length);
+
+            var expanded = new byte[Constants.MaxRequestSize];
+            var expandedLength = CompactCoins.ExpandRequest(new Span<byte>(compact, 0, length), expanded, Txids);
+
+            var request = new GetCoinsRequest(new Span<byte>(expanded, 0, expandedLength), new ClientId(3).Mask);
+            Assert.True(request.IsWellFormed);
+            Assert.Equal(new RequestId(7), request.MessageHeader.RequestId);
+            Assert.Equal(3, request.Count);
+
+            var items = request.Items;
+            Assert.Equal(1000u, items[0].Index);
+            Assert.Equal(1002u, items[2].Index);
+            Assert.Equal(300, items[1].Outpoint.TxIndex);
+            for (var i = 0; i < 3; i++)
+                Assert.Equal(31, items[i].Outpoint.TxId[31]);
+        }
+
+        [Fact]
+        public void ExpandRejectsDanglingReference()
+        {
+            var compact = new byte[128];
+            var length = WriteHeader(compact, MessageKind.GetCoins, 1, 0);
+            compact[length++] = 1; // no txid to refer to yet
+            compact[length++] = 0;
+            SetSize(compact, length);
+
+            var expanded = new byte[Constants.MaxRequestSize];
+            Assert.Equal(-1, CompactCoins.ExpandRequest(new Span<byte>(compact, 0, length), expanded, Txids));
+        }
+
+        [Fact]
+        public void ExpandChangeCoins()
+        {
+            var compact = new byte[256];
+            var length = WriteHeader(compact, MessageKind.ChangeCoins, 2, 0);
+
+            compact[length++] = (byte) CoinOperation.Produce;
+            compact[length++] = (byte) OutpointFlags.IsCoinbase;
+            compact[length++] = 0;
+            length += 32;
+            compact[length++] = 1; // output 1
+            length += VarInt.Write(new Span<byte>(compact, length, 10), 5_000_000_000UL);
+            compact[length++] = 0; // nLockTime
+            compact[length++] = 3; // script length
+            compact[length++] = 0xAA;
+            compact[length++] = 0xBB;
+            compact[length++] = 0xCC;
+
+            compact[length++] = (byte) CoinOperation.Consume;
+            compact[length++] = 0;
+            compact[length++] = 1; // same txid
+            compact[length++] = 2; // output 2
+            SetSize(compact, length);
+
+            var expanded = new byte[Constants.MaxRequestSize];
+            var expandedLength = CompactCoins.ExpandRequest(new Span<byte>(compact, 0, length), expanded, Txids);
+
+            var request = new ChangeCoinsRequest(new Span<byte>(expanded, 0, expandedLength), new ClientId(3).Mask);
+            Assert.True(request.IsWellFormed);
+            Assert.Equal(2, request.Count);
+
+            Assert.Equal(CoinOperation.Produce, request.ItemAt(0).Operation);
+            Assert.Equal(5_000_000_000UL, request.ProductionAt(0).Satoshis);
+            Assert.Equal(0xCC, request.ScriptAt(0)[2]);
+
+            var second = request.ItemSizeAt(0);
+            Assert.Equal(1u, request.ItemAt(second).Index);
+            Assert.Equal(CoinOperation.Consume, request.ItemAt(second).Operation);
+            Assert.Equal(2, request.ItemAt(second).Outpoint.TxIndex);
+        }
+
+        [Fact]
+        public void ExpandWriteCoinsKeepsKind()
+        {
+            var compact = new byte[256];
+            var length = WriteHeader(compact, MessageKind.WriteCoins, 1, 40);
+
+            compact[length++] = (byte) CoinOperation.Consume;
+            compact[length++] = 0;
+            compact[length++] = 0;
+            length += 32;
+            compact[length++] = 3; // output 3
+            SetSize(compact, length);
+
+            var expanded = new byte[Constants.MaxRequestSize];
+            var expandedLength = CompactCoins.ExpandRequest(new Span<byte>(compact, 0, length), expanded, Txids);
+
+            var request = new ChangeCoinsRequest(new Span<byte>(expanded, 0, expandedLength), new ClientId(3).Mask);
+            Assert.True(request.IsWellFormed);
+            Assert.Equal(MessageKind.WriteCoins, request.MessageHeader.MessageKind);
+            Assert.Equal(40u, request.ItemAt(0).Index);
+        }
+
+        [Fact]
+        public void CompactGetCoinsResponseSplitsWhenFull()
+        {
+            var buffer = new byte[Constants.MaxResponseSize];
+            var response = new GetCoinsResponse(buffer, new RequestId(7), ClientId.MinClientId, 3);
+            var script = new byte[100];
+            Assert.True(response.TryAppend(0, GetCoinStatus.Success, OutpointFlags.None,
+                new BlockHandle(1), new BlockHandle(3), 1000, 0, script));
+            Assert.True(response.TryAppend(1, GetCoinStatus.OutpointNotFound, OutpointFlags.None,
+                new BlockHandle(1), new BlockHandle(1), 0, 0, Span<byte>.Empty));
+            Assert.True(response.TryAppend(2, GetCoinStatus.Success, OutpointFlags.None,
+                new BlockHandle(1), new BlockHandle(3), 1000, 0, script));
+
+            // Room for the first two items only.
+            var compact = new byte[CompactCoins.ResponseHeaderSizeInBytes + 120];
+            var offset = CompactCoins.ResponseHeaderSizeInBytes;
+
+            var length = CompactCoins.CompactResponse(response.Span, ref offset, compact);
+            var first = new GetCoinsResponse(compact);
+            Assert.Equal(2, first.Count);
+            Assert.Equal(3, first.TotalCount);
+            Assert.Equal(length, first.MessageHeader.MessageSizeInBytes);
+            // index, status, flags, two handles, satoshis, nLockTime, length, script; then index, status
+            Assert.Equal(CompactCoins.ResponseHeaderSizeInBytes + 1 + 1 + 1 + 8 + 2 + 1 + 1 + 100 + 1 + 1, length);
+            Assert.True(offset < response.Span.Length);
+
+            CompactCoins.CompactResponse(response.Span, ref offset, compact);
+            Assert.Equal(1, new GetCoinsResponse(compact).Count);
+            Assert.Equal(response.Span.Length, offset);
+        }
+    }
+}
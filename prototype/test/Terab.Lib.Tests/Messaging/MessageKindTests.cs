@@ -19,7 +19,7 @@ public void CheckIsDefined()
         [Fact]
         public void CheckIsForCoinController()
         {
-            Assert.Equal(8, _allKinds.Count(kind => kind.IsForCoinController()));
+            Assert.Equal(15, _allKinds.Count(kind => kind.IsForCoinController()));
         }
 
         [Fact]
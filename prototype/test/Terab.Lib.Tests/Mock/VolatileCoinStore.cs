@@ -57,6 +57,9 @@ public VolatileCoinStore()
             _coins = new Dictionary<Outpoint, FatCoin>(new OutpointComparer());
         }
 
+        /// <summary> Nothing done, the coins are in memory. </summary>
+        public void Prefetch(ulong outpointHash) { }
+
         public bool TryGet(ulong outpointHash, ref Outpoint outpoint, BlockAlias context, ILineage lineage, out Coin coin,
             out BlockAlias production, out BlockAlias consumption)
         {
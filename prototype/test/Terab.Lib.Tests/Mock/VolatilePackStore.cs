@@ -74,6 +74,9 @@ private Span<byte> ReadSpan(int layerIndex, uint sectorIndex)
             }
         }
 
+        /// <summary> Nothing done, the layers are in memory. </summary>
+        public void Prefetch(int layerIndex, uint sectorIndex) { }
+
         public CoinPack Read(int layerIndex, uint sectorIndex)
         {
             var span = ReadSpan(layerIndex, sectorIndex);
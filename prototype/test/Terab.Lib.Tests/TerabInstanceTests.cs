@@ -1,5 +1,6 @@
 ﻿// Copyright Lokad 2018 under MIT BCH.
 using System;
+using System.IO;
 using System.Net;
 using System.Net.Sockets;
 using System.Runtime.InteropServices;
@@ -112,6 +113,106 @@ public unsafe void OpenCommit()
             }
         }
 
+        [Fact]
+        public void OpenBlockOverUnixSocket()
+        {
+            var socketPath = Path.Combine(Path.GetTempPath(), $"terab-{Guid.NewGuid():N}.sock");
+
+            var instance = new TerabInstance(_log);
+            instance.OutpointHash = new IdentityHash();
+            instance.ChainStore = new VolatileChainStore();
+            instance.CoinStores = new ICoinStore[] {new VolatileCoinStore()};
+            instance.UnixSocketPath = socketPath;
+            instance.SetupControllers();
+            instance.Start();
+
+            var rawSocket = new Socket(AddressFamily.Unix, SocketType.Stream, ProtocolType.Unspecified);
+            rawSocket.Connect(new UnixDomainSocketEndPoint(socketPath));
+
+            var socket = new SocketLikeAdapter(rawSocket);
+
+            try
+            {
+                var openBlockRequest = OpenBlockRequest.ForGenesis(RequestId.MinRequestId);
+                socket.Send(openBlockRequest.Span);
+
+                var openBlockResponse = new OpenBlockResponse(new byte[OpenBlockResponse.SizeInBytes]);
+                socket.Receive(openBlockResponse.Span);
+
+                Assert.Equal(OpenBlockStatus.Success, openBlockResponse.Status);
+            }
+            finally
+            {
+                socket.Close();
+                instance.Stop();
+            }
+
+            Assert.False(File.Exists(socketPath));
+        }
+
+        [Fact]
+        public void OpenBlockOverSharedMemory()
+        {
+            // Futex doorbells are Linux-specific.
+            if (!RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
+                return;
+
+            var directory = Path.Combine(Path.GetTempPath(), $"terab-{Guid.NewGuid():N}");
+            var segmentPath = Path.Combine(directory, "terab-1-0.shm");
+
+            var instance = new TerabInstance(_log);
+            instance.OutpointHash = new IdentityHash();
+            instance.ChainStore = new VolatileChainStore();
+            instance.CoinStores = new ICoinStore[] {new VolatileCoinStore()};
+            instance.SharedMemoryPath = directory;
+            instance.SetupControllers();
+            instance.Start();
+
+            // Mimics the segment created by the native client, see 'shmem.h'.
+            const int capacity = 65536;
+            var segment = new MemoryMappedFileSlim(Path.Combine(directory, "pending.tmp"), 512 + 2 * capacity);
+            var span = segment.GetSpan();
+            var words = MemoryMarshal.Cast<byte, int>(span);
+
+            try
+            {
+                words[0] = (int) SharedMemorySocket.Magic;
+                words[1] = (int) SharedMemorySocket.Version;
+                words[2] = capacity;
+                words[4] = System.Diagnostics.Process.GetCurrentProcess().Id;
+                Volatile.Write(ref words[3], SharedMemorySocket.StateReady);
+                File.Move(Path.Combine(directory, "pending.tmp"), segmentPath);
+
+                for (var i = 0; i < 500 && Volatile.Read(ref words[3]) != SharedMemorySocket.StateAttached; i++)
+                    Thread.Sleep(10);
+
+                Assert.Equal(SharedMemorySocket.StateAttached, Volatile.Read(ref words[3]));
+                Assert.False(File.Exists(segmentPath));
+
+                // Request written in the request ring, then published through its tail.
+                var openBlockRequest = OpenBlockRequest.ForGenesis(RequestId.MinRequestId);
+                openBlockRequest.Span.CopyTo(span.Slice(512));
+                Volatile.Write(ref MemoryMarshal.Cast<byte, long>(span.Slice(64))[0],
+                    (openBlockRequest.Span.Length + 7) & ~7);
+
+                ref var responseTail = ref MemoryMarshal.Cast<byte, long>(span.Slice(256))[0];
+                for (var i = 0; i < 500 && Volatile.Read(ref responseTail) < OpenBlockResponse.SizeInBytes; i++)
+                    Thread.Sleep(10);
+
+                var openBlockResponse = new OpenBlockResponse(
+                    span.Slice(512 + capacity, OpenBlockResponse.SizeInBytes).ToArray());
+
+                Assert.Equal(OpenBlockStatus.Success, openBlockResponse.Status);
+            }
+            finally
+            {
+                Volatile.Write(ref words[3], SharedMemorySocket.StateClosed);
+                instance.Stop();
+                segment.Dispose();
+                Directory.Delete(directory, true);
+            }
+        }
+
         private static unsafe Coin GetCoin(Random rand, BlockAlias production)
         {
             var coin = new Coin(new byte[4096]);